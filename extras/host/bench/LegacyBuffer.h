@@ -0,0 +1,184 @@
+/*
+  LegacyBuffer.h - motore storico di ModbusBuffer (src/Buffers/Buffers.cpp del commit di baseline 36bf9a3),
+  solo per bench_buffers: una List<BufferSourceInfo> per area, scansione lineare dei tipi e
+  remove + add della voce ad ogni variazione. Il codice delle operazioni misurate e' quello originale,
+  senza le stampe di DEBUG_TEST; cambia solo il nome della classe.
+*/
+
+#ifndef LegacyBuffer_h
+#define LegacyBuffer_h
+
+#include <List.hpp>
+#include "Buffers.h"
+
+typedef struct {
+  List<BufferSourceInfo> Data; // Piu BufferSourceInfo in base al tipo
+  bool Reverse;
+  bool ReadFromPanel;
+  bool WriteToPanel;
+  bool FromPanelToField;
+  int modbusAreaToWrite;
+  char* name;
+}LegacyModbusBufferInfo;
+
+class LegacyModbusBuffer
+{
+  public:
+    LegacyModbusBuffer(unsigned int items) {
+      this->_items=items;
+      this->_buffer=new LegacyModbusBufferInfo [items];
+    }
+    ~LegacyModbusBuffer() {
+      delete [] this->_buffer;
+    }
+
+    void SetElement(int modbusArea, int modbusAreaToWrite, bool WriteToPanel, bool ReadFromPanel, bool Reverse, char* name) {
+      this->_buffer[modbusArea].WriteToPanel=WriteToPanel;
+      this->_buffer[modbusArea].name=name;
+      this->_buffer[modbusArea].ReadFromPanel=ReadFromPanel;
+      this->_buffer[modbusArea].Reverse=Reverse; //Negato
+      this->_buffer[modbusArea].modbusAreaToWrite=modbusAreaToWrite;
+    }
+
+    bool WriteElement(int modbusArea, ModbusBufferFlagType type, long value) {
+      return WriteElement(modbusArea,type,value,false);
+    }
+
+    bool WriteElement(int modbusArea, ModbusBufferFlagType type, long value, bool silent) {
+      if(modbusArea!=DUMMY_AREA) {
+        if(modbusArea>this->_items) {
+          return false;
+        }
+        else {
+          if(this->_buffer[modbusArea].Data.getSize()==0) {
+            BufferSourceInfo data;
+            data.prevValue=0; //Essendo creato da zero, il valore precedente è zero
+            data.value=value;
+            data.time=millis();
+            data.bufferType=type;
+            data.changed=(silent==true?false:true);
+
+            this->_buffer[modbusArea].Data.add(data);
+          }
+          else {
+            bool exist=false;
+            int _size=this->_buffer[modbusArea].Data.getSize()-1;
+            for (int j=_size; j!=-1; j--) {
+              BufferSourceInfo _data=this->_buffer[modbusArea].Data.get(j);
+              if (_data.bufferType==type) {
+                exist=true;
+                if( _data.value!=value) {
+                  this->_buffer[modbusArea].Data.remove(j);
+                  _data.prevValue=_data.value;
+                  _data.value=value;
+                  _data.time=millis();
+                  _data.changed=(silent==true?false:true);
+                  this->_buffer[modbusArea].Data.add(_data);
+                }
+                break;
+              }
+            }
+
+            if(!exist) {
+              BufferSourceInfo _data;
+              _data.prevValue=0;
+              _data.value=value;
+              _data.time=millis();
+              _data.bufferType=type;
+              _data.changed=(silent==true?false:true);
+
+              this->_buffer[modbusArea].Data.add(_data);
+            }
+          }
+        }
+      }
+      return true;
+    }
+
+    bool GetData(int modbusArea, ModbusBufferFlagType type, BufferSourceInfo &dataOut) {
+      if(this->_buffer[modbusArea].Data.getSize()!=0) {
+        for (int j=0; j<this->_buffer[modbusArea].Data.getSize(); j++) {
+          if(this->_buffer[modbusArea].Data.get(j).bufferType==type) {
+            dataOut= this->_buffer[modbusArea].Data.get(j);
+            return true;
+          }
+        }
+      }
+
+      //Ritorno valori fittizi
+      dataOut.value=0;
+      dataOut.prevValue=0;
+      dataOut.bufferType=type;
+      dataOut.changed=false;
+      dataOut.time=0;
+      return false;
+    }
+
+    bool HasChanged(int modbusArea, ModbusBufferFlagType type) {
+      return GetChangeFlag(modbusArea, type);
+    }
+
+    void ResetElement(int modbusArea, ModbusBufferFlagType type) {
+      SetChangeFlag(modbusArea, type, false);
+    }
+
+    int getChanged(ModbusBufferItemInfo2* items, ModbusBufferFlagType type, bool preserveChanges) {
+      int _foundR=0;
+
+      for (int i=0; i<this->_items; i++) {
+        if(this->_buffer[i].Data.getSize()!=0) {
+          for (int j = this->_buffer[i].Data.getSize() - 1; j >= 0; j--) {
+              auto data = this->_buffer[i].Data.get(j);
+              if (data.changed && data.bufferType == type) {
+                  items[_foundR].Item = data;
+                  items[_foundR].modbusArea = i;
+                  _foundR++;
+
+                  if (!preserveChanges) {
+                      this->_buffer[i].Data.remove(j);
+                      data.changed = false;
+                      this->_buffer[i].Data.add(data);
+                  }
+              }
+          }
+        }
+      }
+
+      return _foundR;
+    }
+
+  private:
+    bool GetChangeFlag(int modbusArea, ModbusBufferFlagType type) {
+      if(this->_buffer[modbusArea].Data.getSize()!=0) {
+        for (int j=0; j<this->_buffer[modbusArea].Data.getSize(); j++) {
+          if(this->_buffer[modbusArea].Data.get(j).bufferType==type) {
+            if(this->_buffer[modbusArea].Data.get(j).changed ) {
+              return true;
+            }
+            break;
+          }
+        }
+      }
+
+      return false;
+    }
+
+    void SetChangeFlag(int modbusArea, ModbusBufferFlagType type, bool value) {
+      if(this->_buffer[modbusArea].Data.getSize()!=0) {
+        for (int j=0; j<this->_buffer[modbusArea].Data.getSize(); j++) {
+          if(this->_buffer[modbusArea].Data.get(j).bufferType==type) {
+            BufferSourceInfo _data=this->_buffer[modbusArea].Data.get(j);
+            this->_buffer[modbusArea].Data.remove(j);
+            _data.changed=value;
+            this->_buffer[modbusArea].Data.add(_data);
+            break;
+          }
+        }
+      }
+    }
+
+    int _items;
+    LegacyModbusBufferInfo *_buffer;
+};
+
+#endif
@@ -0,0 +1,121 @@
+// Benchmark: allocazioni di heap per giro di DomoManager::Update a regime (HostAlloc), con 2 gateway e
+// 8 device letti e scritti dal client sincrono, dal pool di connessioni e dal client asincrono.
+// Il ciclo non deve allocare: esce con errore se un giro a regime tocca l'heap.
+//
+//   bench_alloc [--quick] [giri]
+#include "HostAlloc.h"
+#include "HostModbusServer.h"
+#include "HostPlant.h"
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+static const unsigned long CYCLE_MS = 20;
+
+// 2 gateway x 4 device da 8 DI, 4 AI e 8 DO
+static HostPlant plant(2, 4, 8, 4, 8, 20);
+
+enum ClientMode { Sync, Pool, Async };
+
+static void SomethingChanged(ModbusBuffer &) {}
+static void Route(BufferSourceInfo, int, ModbusBuffer &) {}
+static void Activity(ModbusBuffer &) {}
+
+struct Result {
+  unsigned long cycles;
+  unsigned long allocations;
+  unsigned long frees;
+  unsigned long long bytes;
+  unsigned long outputs; // uscite arrivate ai gateway durante la misura
+};
+
+static Result Run(ClientMode client, unsigned long cycles) {
+  HostNet::Reset();
+  HostClock::Simulate(1000);
+  std::vector<HostModbusServer> _gateways(plant.Gateways());
+  for (int g = 0; g < plant.Gateways(); g++) {
+    _gateways[g].Start();
+    HostNet::Route(plant.GatewayIp(g), MB_PORT, _gateways[g].Port());
+  }
+
+  DomoManager _dm(plant.Areas(), HostPlant::InitDevices, HostPlant::InitBuffer, 2, 3, 4, 5);
+  _dm.Begin(SomethingChanged, Route, Activity);
+  _dm.EnableJournal(256);
+  if (client == Pool) _dm.EnableClientPool();
+  if (client == Async) _dm.EnableAsyncClient(2, 1000);
+  EthernetClient _socket;
+  ModbusTCPClient _modbus(_socket);
+  HostNet::Listen(MB_PORT, 0);
+  EthernetServer _panels(MB_PORT);
+  _panels.begin();
+  MgsModbus _server;
+
+  // Un giro: gli ingressi cambiano ogni tanto, cosi a regime ci sono anche routing e scritture
+  unsigned long _round = 0;
+  auto _cycle = [&]() {
+    unsigned long _done = _dm.GetTimings().cycles;
+    for (int i = 0; i < 100 && _dm.GetTimings().cycles == _done; i++) {
+      _dm.Update(_panels, _server, _modbus);
+      if (client == Async)
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      HostClock::AdvanceMillis(1);
+    }
+    HostClock::AdvanceMillis(CYCLE_MS);
+    _round++;
+    if (_round % 5 == 0) {
+      int _d = (_round / 5) % plant.Devices();
+      _gateways[plant.Gateway(_d)].SetDiscrete(plant.Unit(_d), (_round / 5) % plant.Inputs(), (_round / 40) % 2);
+    }
+  };
+
+  // Riscaldamento: connessioni, piani di lettura, vettori dei tempi e prime variazioni
+  for (int i = 0; i < 50; i++)
+    _cycle();
+
+  for (auto &_gateway : _gateways) _gateway.ClearRequests();
+  HostAlloc::Counts _start = HostAlloc::Get();
+  for (unsigned long i = 0; i < cycles; i++)
+    _cycle();
+  HostAlloc::Counts _delta = HostAlloc::Since(_start);
+
+  Result _result;
+  _result.cycles = cycles;
+  _result.allocations = _delta.allocations;
+  _result.frees = _delta.frees;
+  _result.bytes = _delta.bytes;
+  _result.outputs = 0;
+  for (auto &_gateway : _gateways)
+    for (auto &_request : _gateway.Requests())
+      if (_request.fc == MB_FC_WRITE_COIL || _request.fc == MB_FC_WRITE_MULTIPLE_COILS) _result.outputs++;
+  return _result;
+}
+
+int main(int argc, char **argv) {
+  bool _quick = false;
+  unsigned long _cycles = 1000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) _quick = true;
+    else _cycles = strtoul(argv[i], nullptr, 10);
+  }
+  if (_quick) _cycles = 100;
+
+  HostSerial::Mute(true);
+  const char *_names[] = {"sincrono", "pool", "asincrono"};
+  Result _results[3];
+  for (int c = Sync; c <= Async; c++)
+    _results[c] = Run((ClientMode)c, _cycles);
+  HostSerial::Mute(false);
+
+  printf("bench_alloc: %d device su %d gateway, %lu giri a regime dopo 50 di riscaldamento\n", plant.Devices(), plant.Gateways(), _cycles);
+  printf("%-10s %12s %12s %12s %10s\n", "client", "alloc/giro", "free/giro", "byte/giro", "scritture");
+  bool _ok = true;
+  for (int c = Sync; c <= Async; c++) {
+    Result &_r = _results[c];
+    printf("%-10s %12.2f %12.2f %12.1f %10lu\n", _names[c], (double)_r.allocations / _r.cycles,
+           (double)_r.frees / _r.cycles, (double)_r.bytes / _r.cycles, _r.outputs);
+    if (_r.allocations != 0 || _r.outputs == 0) _ok = false;
+  }
+  if (!_ok)
+    fprintf(stderr, "bench_alloc: il ciclo a regime alloca (o non ha scritto uscite)\n");
+  return _ok ? 0 : 1;
+}
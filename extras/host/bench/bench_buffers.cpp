@@ -0,0 +1,147 @@
+// Benchmark: ModbusBuffer (storage piatto per tipo, dirty set a bit) contro il motore storico a
+// List<BufferSourceInfo> per area (LegacyBuffer.h, dal commit di baseline). Stesso carico su entrambi:
+// aree con Field, FromPanel e ToPanel, scritture con e senza variazione, letture, flag e la passata
+// del ciclo che raccoglie le aree Field variate e ne azzera il flag. Stampa ns/op prima e dopo.
+//
+//   bench_buffers [--quick] [aree] [iterazioni]
+#include <Arduino.h>
+#include "Buffers.h"
+#include "LegacyBuffer.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const int CHANGED_EVERY = 100; // aree variate per passata: una su CHANGED_EVERY
+
+template <typename Fn>
+static double NsPerOp(unsigned long ops, Fn fn) {
+  auto _start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - _start).count() / ops;
+}
+
+// Tutti i tipi presenti per ogni area, come le aree con WriteToPanel/ReadFromPanel
+template <typename Buffer>
+static void Fill(Buffer &buffer, int areas) {
+  for (int i = 0; i < areas; i++) {
+    buffer.SetElement(i, 0, true, true, false, (char *)"area");
+    buffer.WriteElement(i, ToPanel, 0);
+    buffer.WriteElement(i, FromPanel, 0);
+    buffer.WriteElement(i, Field, 0);
+    buffer.ResetElement(i, ToPanel);
+    buffer.ResetElement(i, FromPanel);
+    buffer.ResetElement(i, Field);
+  }
+}
+
+struct Result {
+  double writeChanged, writeSame, getData, hasChanged, cycle;
+  long checksum;
+};
+
+// Passata del ciclo sul buffer attuale: solo le aree variate, via dirty set
+static int CollectChanged(ModbusBuffer &buffer, std::vector<int> &out) {
+  out.clear();
+  for (int _area = buffer.FirstChanged(Field); _area != -1; _area = buffer.NextChanged(Field, _area)) {
+    out.push_back(_area);
+    buffer.ResetElement(_area, Field);
+  }
+  return out.size();
+}
+
+// Passata del ciclo sul motore storico: getChanged scorre tutte le aree e riaccoda le voci variate
+static int CollectChanged(LegacyModbusBuffer &buffer, std::vector<ModbusBufferItemInfo2> &items) {
+  return buffer.getChanged(items.data(), Field, false);
+}
+
+template <typename Buffer, typename Scratch>
+static Result Run(Buffer &buffer, Scratch &scratch, int areas, unsigned long iterations) {
+  Result _r;
+  unsigned long _ops = (unsigned long)areas * iterations;
+  long _sum = 0;
+
+  _r.writeChanged = NsPerOp(_ops, [&]() {
+    for (unsigned long n = 0; n < iterations; n++)
+      for (int i = 0; i < areas; i++)
+        buffer.WriteElement(i, Field, (long)(n + 1));
+  });
+  _r.writeSame = NsPerOp(_ops, [&]() {
+    for (unsigned long n = 0; n < iterations; n++)
+      for (int i = 0; i < areas; i++)
+        buffer.WriteElement(i, Field, (long)iterations);
+  });
+  _r.getData = NsPerOp(_ops, [&]() {
+    BufferSourceInfo _data;
+    for (unsigned long n = 0; n < iterations; n++)
+      for (int i = 0; i < areas; i++) {
+        buffer.GetData(i, (ModbusBufferFlagType)(i % BUFFER_FLAG_TYPES), _data);
+        _sum += _data.value;
+      }
+  });
+  _r.hasChanged = NsPerOp(_ops, [&]() {
+    for (unsigned long n = 0; n < iterations; n++)
+      for (int i = 0; i < areas; i++)
+        _sum += buffer.HasChanged(i, ToPanel);
+  });
+
+  // Passata completa: prima azzero i flag lasciati dalle scritture, poi una area su CHANGED_EVERY varia
+  CollectChanged(buffer, scratch);
+  _r.cycle = NsPerOp(iterations, [&]() {
+    for (unsigned long n = 0; n < iterations; n++) {
+      for (int i = (int)(n % CHANGED_EVERY); i < areas; i += CHANGED_EVERY)
+        buffer.WriteElement(i, Field, (long)(iterations + n + 1));
+      _sum += CollectChanged(buffer, scratch);
+    }
+  });
+  _r.checksum = _sum;
+  return _r;
+}
+
+static void Print(const char *name, double before, double after, const char *unit) {
+  printf("%-34s %10.1f %10.1f %s  %6.1fx\n", name, before, after, unit, after > 0 ? before / after : 0.0);
+}
+
+int main(int argc, char **argv) {
+  bool _quick = false;
+  int _areas = 1000;
+  unsigned long _iterations = 200;
+  int _positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) _quick = true;
+    else if (_positional++ == 0) _areas = atoi(argv[i]);
+    else _iterations = strtoul(argv[i], nullptr, 10);
+  }
+  if (_quick) _iterations = 5;
+
+  HostSerial::Mute(true);
+  HostClock::Simulate(0);
+
+  LegacyModbusBuffer _legacy(_areas);
+  Fill(_legacy, _areas);
+  std::vector<ModbusBufferItemInfo2> _legacyItems(_areas);
+  Result _before = Run(_legacy, _legacyItems, _areas, _iterations);
+
+  ModbusBuffer _buffer(_areas);
+  Fill(_buffer, _areas);
+  _buffer.Init();
+  std::vector<int> _changed;
+  _changed.reserve(_areas);
+  Result _after = Run(_buffer, _changed, _areas, _iterations);
+  HostSerial::Mute(false);
+
+  printf("bench_buffers: %d aree (Field, FromPanel, ToPanel), %lu iterazioni, 1 area su %d variata per passata\n",
+         _areas, _iterations, CHANGED_EVERY);
+  printf("%-34s %10s %10s\n", "", "List", "attuale");
+  Print("WriteElement con variazione", _before.writeChanged, _after.writeChanged, "ns/op");
+  Print("WriteElement senza variazione", _before.writeSame, _after.writeSame, "ns/op");
+  Print("GetData", _before.getData, _after.getData, "ns/op");
+  Print("HasChanged", _before.hasChanged, _after.hasChanged, "ns/op");
+  Print("passata aree Field variate", _before.cycle, _after.cycle, "ns/passata");
+
+  // Stesso carico, stessi valori: i due motori devono vedere le stesse variazioni
+  bool _ok = _before.checksum == _after.checksum;
+  if (!_ok)
+    fprintf(stderr, "bench_buffers: i due motori non coincidono (%ld != %ld)\n", _before.checksum, _after.checksum);
+  return _ok ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+// Benchmark: blocchi di 2000 coil letti (FC1) e scritti (FC15) da MgsModbus::GetBits/SetBits con il
+// server diretto sul buffer. Confronta ModbusBufferServerHandler (MbsReadBits/MbsWriteBits in un'unica
+// passata) con lo stesso handler servito un bit alla volta (implementazione di default di MbsHandler,
+// come prima dei metodi a blocchi) e con la mappa interna di MgsModbus.
+//
+//   bench_coils [--quick] [iterazioni]
+#include <Arduino.h>
+#include "Buffers.h"
+#include "Fncs.h"
+#include "MgsModbus.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+static const int BLOCK_COILS = 2000;
+static const int BLOCK_BYTES = (BLOCK_COILS + 7) / 8;
+
+// Solo i metodi per registro: GetBits/SetBits passano dal default bit per bit di MbsHandler
+class PerBitHandler : public MbsHandler
+{
+  public:
+    PerBitHandler(MbsHandler &handler) : _handler(handler) {}
+    word MbsSize(MB_SPACE space) override { return _handler.MbsSize(space); }
+    boolean MbsRead(MB_SPACE space, word address, word &value) override { return _handler.MbsRead(space, address, value); }
+    boolean MbsWrite(MB_SPACE space, word address, word value) override { return _handler.MbsWrite(space, address, value); }
+  private:
+    MbsHandler &_handler;
+};
+
+static void InitBuffer(ModbusBuffer &buffer) {
+  for (int i = 0; i < BLOCK_COILS; i++)
+    buffer.SetElement(i, 0, true, true, false, (char *)"coil");
+  buffer.Init();
+  for (int i = 0; i < BLOCK_COILS; i++)
+    buffer.WriteElement(i, ToPanel, i % 3 == 0, true);
+}
+
+template <typename Fn>
+static double NsPerOp(unsigned long iterations, Fn fn) {
+  auto _start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < iterations; i++)
+    fn(i);
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - _start).count() / iterations;
+}
+
+struct Result {
+  double read, write;
+};
+
+// Lettura del blocco e scrittura di un blocco che alterna due configurazioni: ogni iterazione cambia
+// un coil su nove, che diventa un comando FromPanel
+static Result Run(MgsModbus &server, unsigned long iterations, uint8_t *readOut) {
+  uint8_t _patterns[2][BLOCK_BYTES];
+  for (int p = 0; p < 2; p++) {
+    memset(_patterns[p], 0, BLOCK_BYTES);
+    for (int i = 0; i < BLOCK_COILS; i++)
+      if ((i % 3 == 0) != (p == 1 && i % 9 == 0)) bitSet(_patterns[p][i / 8], i % 8);
+  }
+
+  Result _result;
+  _result.read = NsPerOp(iterations, [&](unsigned long) { server.GetBits(MB_SPACE_COILS, 0, BLOCK_COILS, readOut); });
+  _result.write = NsPerOp(iterations, [&](unsigned long i) { server.SetBits(MB_SPACE_COILS, 0, BLOCK_COILS, _patterns[(i + 1) % 2]); });
+  return _result;
+}
+
+static void Print(const char *name, Result result) {
+  printf("%-28s FC1 %9.0f ns/op (%6.2f ns/coil)   FC15 %9.0f ns/op (%6.2f ns/coil)\n", name,
+         result.read, result.read / BLOCK_COILS, result.write, result.write / BLOCK_COILS);
+}
+
+int main(int argc, char **argv) {
+  bool _quick = false;
+  unsigned long _iterations = 20000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) _quick = true;
+    else _iterations = strtoul(argv[i], nullptr, 10);
+  }
+  if (_quick) _iterations = 200;
+
+  HostSerial::Mute(true);
+  uint8_t _perBitBytes[BLOCK_BYTES], _blockBytes[BLOCK_BYTES], _internalBytes[BLOCK_BYTES];
+
+  ModbusBuffer _perBitBuffer(BLOCK_COILS);
+  InitBuffer(_perBitBuffer);
+  ModbusBufferServerHandler _perBitTarget(_perBitBuffer);
+  PerBitHandler _perBit(_perBitTarget);
+  MgsModbus _perBitServer;
+  _perBitServer.MbsSetHandler(&_perBit);
+  Result _before = Run(_perBitServer, _iterations, _perBitBytes);
+
+  ModbusBuffer _blockBuffer(BLOCK_COILS);
+  InitBuffer(_blockBuffer);
+  ModbusBufferServerHandler _block(_blockBuffer);
+  MgsModbus _blockServer;
+  _blockServer.MbsSetHandler(&_block);
+  Result _after = Run(_blockServer, _iterations, _blockBytes);
+
+  MgsModbus _internalServer;
+  _internalServer.MbsBegin(BLOCK_COILS, BLOCK_COILS, BLOCK_COILS, BLOCK_COILS);
+  for (int i = 0; i < BLOCK_COILS; i++)
+    _internalServer.SetBit(MB_SPACE_COILS, i, i % 3 == 0);
+  Result _internal = Run(_internalServer, _iterations, _internalBytes);
+  HostSerial::Mute(false);
+
+  printf("bench_coils: %d coil per richiesta, %lu iterazioni\n", BLOCK_COILS, _iterations);
+  Print("handler, bit per bit", _before);
+  Print("handler, MbsReadBits/Bits", _after);
+  Print("mappa interna", _internal);
+  printf("handler a blocchi: FC1 %.1fx, FC15 %.1fx\n", _before.read / _after.read, _before.write / _after.write);
+
+  // Stesso risultato dai due percorsi dell'handler, sia in lettura sia nei comandi arrivati al buffer
+  bool _ok = memcmp(_perBitBytes, _blockBytes, BLOCK_BYTES) == 0;
+  for (int i = 0; i < BLOCK_COILS && _ok; i++) {
+    BufferSourceInfo _a, _b;
+    _perBitBuffer.GetData(i, Field, _a);
+    _blockBuffer.GetData(i, Field, _b);
+    _ok = _a.value == _b.value;
+  }
+  if (!_ok)
+    fprintf(stderr, "bench_coils: i due percorsi dell'handler non coincidono\n");
+  return _ok ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// Benchmark: una traccia sintetica (2 gateway, 8 device, ingressi che cambiano, comandi da pannello e UDP)
+// riprodotta con HostReplay attraverso il vero DomoManager::Update. Stampa le latenze per step e per
+// giro (TraceStats) e per zona (Profiler, se non disattivato con DOMO_NO_PROFILER), in tempo reale.
+//
+//   bench_replay [--quick] [cicli]
+#include "HostReplay.h"
+#include "HostPlant.h"
+#include "IOT.h"
+#include <chrono>
+#include <stdio.h>
+
+static const unsigned long CYCLE_MS = 20;
+
+// 2 gateway x 4 device da 16 DI, 8 AI e 16 DO, 16 aree comando dei pannelli
+static HostPlant plant(2, 4, 16, 8, 16, 10, 16);
+
+static void SomethingChanged(ModbusBuffer &) {}
+static void Route(BufferSourceInfo, int, ModbusBuffer &) {}
+static void Activity(ModbusBuffer &) {}
+
+static int Command(const char *name) {
+  for (int i = 0; IOT::CommandName(i).length() > 0; i++)
+    if (IOT::CommandName(i) == name) return i;
+  return -1;
+}
+
+// Tutte le letture di ogni giro, come le registra TraceRecorder sull'impianto
+static void Generate(TraceRecorder &recorder, unsigned long cycles) {
+  int _proximity = Command("updateProximity");
+  HostClock::Simulate(0);
+  recorder.Begin();
+  for (unsigned long c = 0; c < cycles; c++) {
+    for (int d = 0; d < plant.Devices(); d++) {
+      for (int i = 0; i < plant.Inputs(); i++)
+        recorder.Field(d, 0, i, GenericPrgDevice::DI, ((c + d) >> (i % 6)) & 1);
+      for (int i = 0; i < plant.Analogs(); i++)
+        recorder.Field(d, 1, i, GenericPrgDevice::AI, (c * 7 + i * 13 + d) % 1000);
+    }
+    if (c % 10 == 5)
+      recorder.Panel(plant.FirstCommand() + (c / 10) % plant.Commands(), c % 2);
+    if (c % 50 == 25)
+      recorder.Udp(_proximity, (c / 50) % 2);
+    recorder.Cycle();
+    HostClock::AdvanceMillis(CYCLE_MS);
+  }
+  recorder.End();
+}
+
+int main(int argc, char **argv) {
+  bool _quick = false;
+  unsigned long _cycles = 2000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) _quick = true;
+    else _cycles = strtoul(argv[i], nullptr, 10);
+  }
+  if (_quick) _cycles = 50;
+
+  HostSerial::Mute(true);
+  HostTraceBuffer _trace;
+  TraceRecorder _recorder(_trace);
+  Generate(_recorder, _cycles);
+
+  HostNet::Reset();
+  HostClock::Simulate(1000, true);
+  DomoManager _dm(plant.Areas(), HostPlant::InitDevices, HostPlant::InitBuffer, 2, 3, 4, 5);
+  _dm.Begin(SomethingChanged, Route, Activity);
+  _dm.EnableDirectServer(true);
+  HostNet::Listen(MB_PORT, 0);
+  EthernetServer _panels(MB_PORT);
+  _panels.begin();
+  MgsModbus _server;
+  EthernetClient _socket;
+  ModbusTCPClient _client(_socket);
+  HostNet::Listen(8888, 0);
+  EthernetUDP _iotUdp;
+  IOT _iot(_iotUdp, IPAddress(192, 168, 10, 99), 8888, 8889);
+  _iot.begin("");
+
+  HostReplay _replay(_dm.GetDevices(), _panels.hostPort(), _iotUdp.hostPort());
+  TraceStats _stats;
+  TraceReplay _reader(_trace);
+#ifdef DOMO_PROFILER
+  profiler.Reset();
+#endif
+
+  auto _start = std::chrono::steady_clock::now();
+  unsigned long _replayed = _replay.Run(_reader, _stats,
+    [&]() { _iot.Update(); _dm.Update(_panels, _server, _client); },
+    [&]() { return _dm.GetTimings().cycles; });
+  double _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+  HostSerial::Mute(false);
+
+  printf("bench_replay: %lu cicli, %d device su %d gateway, traccia %zu byte\n", _replayed, plant.Devices(), plant.Gateways(), _trace.Size());
+  printf("tempo reale %.3f s, %.1f us/giro\n", _seconds, _replayed ? _seconds * 1e6 / _replayed : 0.0);
+  _stats.PrintReport(Serial);
+#ifdef DOMO_PROFILER
+  profiler.PrintReport(Serial);
+#endif
+
+  bool _ok = _replayed == _cycles && _replay.Skipped() == 0;
+  if (!_ok)
+    fprintf(stderr, "bench_replay: %lu/%lu cicli riprodotti, %lu eventi scartati\n", _replayed, _cycles, _replay.Skipped());
+  return _ok ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+#include "HostModbusServer.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <chrono>
+
+static void PutWord(uint8_t *p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value & 0xFF;
+}
+
+static uint16_t GetWord(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+bool HostModbusServer::Start(uint16_t port) {
+  if (this->_running)
+    return true;
+
+  int _fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_fd < 0)
+    return false;
+  int _one = 1;
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &_one, sizeof(_one));
+
+  sockaddr_in _addr;
+  memset(&_addr, 0, sizeof(_addr));
+  _addr.sin_family = AF_INET;
+  _addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  _addr.sin_port = htons(port);
+  if (bind(_fd, (sockaddr *)&_addr, sizeof(_addr)) < 0 || listen(_fd, 16) < 0) {
+    close(_fd);
+    return false;
+  }
+  socklen_t _len = sizeof(_addr);
+  getsockname(_fd, (sockaddr *)&_addr, &_len);
+
+  this->_listen = _fd;
+  this->_port = ntohs(_addr.sin_port);
+  this->_running = true;
+  this->_thread = std::thread(&HostModbusServer::Run, this);
+  return true;
+}
+
+void HostModbusServer::Stop() {
+  if (!this->_running)
+    return;
+  this->_running = false;
+  this->_thread.join();
+  for (auto &_connection : this->_open)
+    close(_connection.fd);
+  this->_open.clear();
+  close(this->_listen);
+  this->_listen = -1;
+}
+
+void HostModbusServer::DropConnections() {
+  this->_drop = true;
+  while (this->_drop && this->_running)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void HostModbusServer::Run() {
+  while (this->_running) {
+    if (this->_drop) {
+      for (auto &_connection : this->_open)
+        close(_connection.fd);
+      this->_open.clear();
+      this->_drop = false;
+    }
+
+    std::vector<pollfd> _fds;
+    _fds.push_back({this->_listen, POLLIN, 0});
+    for (auto &_connection : this->_open)
+      _fds.push_back({_connection.fd, POLLIN, 0});
+
+    if (poll(_fds.data(), _fds.size(), 5) <= 0)
+      continue;
+
+    if (_fds[0].revents & POLLIN) {
+      int _fd = accept(this->_listen, nullptr, nullptr);
+      if (_fd >= 0) {
+        int _one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &_one, sizeof(_one));
+        this->_open.push_back({_fd, {}});
+        this->_accepted++;
+      }
+    }
+
+    for (size_t i = 1; i < _fds.size(); i++) {
+      if (!(_fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      Connection &_connection = this->_open[i - 1];
+      uint8_t _buffer[1024];
+      ssize_t _n = recv(_connection.fd, _buffer, sizeof(_buffer), MSG_DONTWAIT);
+      if (_n <= 0) {
+        close(_connection.fd);
+        _connection.fd = -1;
+        continue;
+      }
+      _connection.rx.insert(_connection.rx.end(), _buffer, _buffer + _n);
+      while (Process(_connection)) {}
+    }
+
+    for (size_t i = 0; i < this->_open.size(); ) {
+      if (this->_open[i].fd < 0)
+        this->_open.erase(this->_open.begin() + i);
+      else
+        i++;
+    }
+  }
+}
+
+// Un frame MBAP completo alla volta, in ordine di arrivo
+bool HostModbusServer::Process(Connection &connection) {
+  std::vector<uint8_t> &_rx = connection.rx;
+  if (_rx.size() < 7)
+    return false;
+  int _length = GetWord(&_rx[4]);
+  if (_length < 2 || _length > 254) {
+    _rx.clear();
+    return false;
+  }
+  if (_rx.size() < (size_t)(6 + _length))
+    return false;
+
+  uint8_t _response[7 + 260];
+  unsigned long _delay = 0;
+  int _pduLen = Respond(&_rx[7], _length - 1, _rx[6], _response + 7, _delay);
+
+  if (_delay > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(_delay));
+
+  if (_pduLen > 0) {
+    memcpy(_response, &_rx[0], 4);
+    PutWord(_response + 4, _pduLen + 1);
+    _response[6] = _rx[6];
+    send(connection.fd, _response, 7 + _pduLen, MSG_NOSIGNAL);
+  }
+
+  _rx.erase(_rx.begin(), _rx.begin() + 6 + _length);
+  return true;
+}
+
+// Lunghezza del PDU di risposta, 0 = nessuna risposta
+int HostModbusServer::Respond(const uint8_t *pdu, int length, uint8_t unitId, uint8_t *response, unsigned long &delay) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  Unit &_unit = this->_units[unitId];
+
+  uint8_t _fc = pdu[0];
+  uint16_t _address = length >= 3 ? GetWord(pdu + 1) : 0;
+  uint16_t _quantity = length >= 5 ? GetWord(pdu + 3) : 0;
+  this->_requests.push_back({unitId, _fc, _address, _quantity});
+
+  delay = _unit.delay;
+  if (_unit.silent)
+    return 0;
+
+  response[0] = _fc;
+  auto _exception = [&](uint8_t code) { response[0] = _fc | 0x80; response[1] = code; return 2; };
+
+  if (_unit.exception >= 0)
+    return _exception((uint8_t)_unit.exception);
+  if (length < 5)
+    return _exception(3);
+
+  int _echoAddress = _unit.badEcho ? _address + 1 : _address;
+  int _echoQuantity = _unit.badEcho ? _quantity + 1 : _quantity;
+
+  switch (_fc) {
+    case 0x01:
+    case 0x02: {
+      if (_quantity < 1 || _quantity > 2000) return _exception(3);
+      if (_address + _quantity > 65536) return _exception(2);
+      std::vector<uint8_t> &_bits = _fc == 0x01 ? _unit.coils : _unit.discrete;
+      int _bytes = (_quantity + 7) / 8;
+      response[1] = _bytes;
+      memset(response + 2, 0, _bytes);
+      for (int i = 0; i < _quantity; i++)
+        if (_bits[_address + i]) response[2 + i / 8] |= 1 << (i % 8);
+      return 2 + _bytes;
+    }
+    case 0x03:
+    case 0x04: {
+      if (_quantity < 1 || _quantity > 125) return _exception(3);
+      if (_address + _quantity > 65536) return _exception(2);
+      std::vector<uint16_t> &_registers = _fc == 0x03 ? _unit.holding : _unit.input;
+      response[1] = _quantity * 2;
+      for (int i = 0; i < _quantity; i++)
+        PutWord(response + 2 + i * 2, _registers[_address + i]);
+      return 2 + _quantity * 2;
+    }
+    case 0x05:
+      if (_quantity != 0xFF00 && _quantity != 0x0000) return _exception(3);
+      _unit.coils[_address] = _quantity == 0xFF00;
+      PutWord(response + 1, _echoAddress);
+      PutWord(response + 3, _quantity);
+      return 5;
+    case 0x06:
+      _unit.holding[_address] = _quantity;
+      PutWord(response + 1, _echoAddress);
+      PutWord(response + 3, _quantity);
+      return 5;
+    case 0x0F: {
+      int _bytes = (_quantity + 7) / 8;
+      if (_quantity < 1 || _quantity > 1968 || length < 6 + _bytes || pdu[5] != _bytes) return _exception(3);
+      if (_address + _quantity > 65536) return _exception(2);
+      for (int i = 0; i < _quantity; i++)
+        _unit.coils[_address + i] = (pdu[6 + i / 8] >> (i % 8)) & 1;
+      PutWord(response + 1, _echoAddress);
+      PutWord(response + 3, _echoQuantity);
+      return 5;
+    }
+    case 0x10: {
+      if (_quantity < 1 || _quantity > 123 || length < 6 + _quantity * 2 || pdu[5] != _quantity * 2) return _exception(3);
+      if (_address + _quantity > 65536) return _exception(2);
+      for (int i = 0; i < _quantity; i++)
+        _unit.holding[_address + i] = GetWord(pdu + 6 + i * 2);
+      PutWord(response + 1, _echoAddress);
+      PutWord(response + 3, _echoQuantity);
+      return 5;
+    }
+    default:
+      return _exception(1);
+  }
+}
+
+void HostModbusServer::SetCoil(uint8_t unit, uint16_t address, bool value) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].coils[address] = value;
+}
+
+void HostModbusServer::SetDiscrete(uint8_t unit, uint16_t address, bool value) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].discrete[address] = value;
+}
+
+void HostModbusServer::SetHolding(uint8_t unit, uint16_t address, uint16_t value) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].holding[address] = value;
+}
+
+void HostModbusServer::SetInput(uint8_t unit, uint16_t address, uint16_t value) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].input[address] = value;
+}
+
+bool HostModbusServer::GetCoil(uint8_t unit, uint16_t address) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  return this->_units[unit].coils[address];
+}
+
+uint16_t HostModbusServer::GetHolding(uint8_t unit, uint16_t address) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  return this->_units[unit].holding[address];
+}
+
+void HostModbusServer::SetException(uint8_t unit, int code) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].exception = code;
+}
+
+void HostModbusServer::SetDelay(uint8_t unit, unsigned long ms) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].delay = ms;
+}
+
+void HostModbusServer::SetSilent(uint8_t unit, bool silent) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].silent = silent;
+}
+
+void HostModbusServer::SetBadEcho(uint8_t unit, bool badEcho) {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_units[unit].badEcho = badEcho;
+}
+
+std::vector<HostModbusServer::Request> HostModbusServer::Requests() {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  return this->_requests;
+}
+
+void HostModbusServer::ClearRequests() {
+  std::lock_guard<std::mutex> _lock(this->_mutex);
+  this->_requests.clear();
+}
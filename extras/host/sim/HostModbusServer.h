@@ -0,0 +1,78 @@
+/*
+  HostModbusServer.h - server Modbus TCP su loopback per i test e i benchmark host.
+
+  Fa da gateway Modbus TCP -> RS485: una porta, piu unit (ognuna con la propria mappa di coil,
+  discrete, holding e input), piu connessioni e richieste in pipeline servite in ordine da un thread.
+  Per unit si possono iniettare eccezioni (anche con codice 0), ritardi, silenzio e risposte di
+  scrittura con eco sbagliata. Tutte le richieste ricevute finiscono nel log (Requests).
+*/
+
+#ifndef HostModbusServer_h
+#define HostModbusServer_h
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class HostModbusServer
+{
+  public:
+    struct Request { uint8_t unit; uint8_t fc; uint16_t address; uint16_t quantity; };
+
+    HostModbusServer() {}
+    ~HostModbusServer() { Stop(); }
+
+    bool Start(uint16_t port = 0); // 0 = porta effimera
+    void Stop();
+    uint16_t Port() const { return _port; }
+
+    void SetCoil(uint8_t unit, uint16_t address, bool value);
+    void SetDiscrete(uint8_t unit, uint16_t address, bool value);
+    void SetHolding(uint8_t unit, uint16_t address, uint16_t value);
+    void SetInput(uint8_t unit, uint16_t address, uint16_t value);
+    bool GetCoil(uint8_t unit, uint16_t address);
+    uint16_t GetHolding(uint8_t unit, uint16_t address);
+
+    void SetException(uint8_t unit, int code);       // risposta di eccezione con questo codice a ogni richiesta, -1 = nessuna
+    void SetDelay(uint8_t unit, unsigned long ms);   // ritardo prima della risposta (blocca il gateway come un bus seriale)
+    void SetSilent(uint8_t unit, bool silent);       // nessuna risposta: l'unit non risponde sul bus
+    void SetBadEcho(uint8_t unit, bool badEcho);     // FC5/6/15/16: eco con indirizzo+1 e quantita+1
+
+    std::vector<Request> Requests();
+    void ClearRequests();
+    unsigned long Connections() const { return _accepted; }
+    void DropConnections();                          // chiude tutte le connessioni aperte (gateway riavviato)
+
+  private:
+    struct Unit {
+      std::vector<uint8_t> coils = std::vector<uint8_t>(65536);
+      std::vector<uint8_t> discrete = std::vector<uint8_t>(65536);
+      std::vector<uint16_t> holding = std::vector<uint16_t>(65536);
+      std::vector<uint16_t> input = std::vector<uint16_t>(65536);
+      int exception = -1;
+      unsigned long delay = 0;
+      bool silent = false;
+      bool badEcho = false;
+    };
+    struct Connection { int fd; std::vector<uint8_t> rx; };
+
+    void Run();
+    bool Process(Connection &connection);
+    int Respond(const uint8_t *pdu, int length, uint8_t unitId, uint8_t *response, unsigned long &delay);
+
+    std::mutex _mutex;
+    std::map<uint8_t, Unit> _units;
+    std::vector<Request> _requests;
+    std::vector<Connection> _open;
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+    std::atomic<bool> _drop{false};
+    std::atomic<unsigned long> _accepted{0};
+    int _listen = -1;
+    uint16_t _port = 0;
+};
+
+#endif
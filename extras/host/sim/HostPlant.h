@@ -0,0 +1,95 @@
+/*
+  HostPlant.h - impianto sintetico dei benchmark host: gateways x devicesPerGateway device uguali, ognuno
+  con un canale DI (Discrete da 0), uno AI (Input da 100) e uno DO (Coil da 0). Ogni ingresso DI comanda
+  l'uscita DO con lo stesso indice; dopo le aree dei device ci sono le aree comando dei pannelli (opzionali).
+
+  I gateway sono 192.168.<subnet>.10, .11, ...; le unit dietro ogni gateway partono da 1.
+  DomoManager vuole i callback di init come puntatori a funzione: InitDevices/InitBuffer leggono l'impianto
+  costruito per ultimo, che deve vivere quanto il DomoManager (i device tengono il puntatore ai canali).
+  Include Domo.h, che e' header-only: va incluso in un solo file per eseguibile, al posto di Domo.h.
+*/
+
+#ifndef HostPlant_h
+#define HostPlant_h
+
+#include <Arduino.h>
+#include "Domo.h"
+#include <vector>
+
+class HostPlant
+{
+  public:
+    HostPlant(int gateways, int devicesPerGateway, int inputs, int analogs, int outputs, uint8_t subnet, int commands = 0)
+      : _gateways(gateways), _devicesPerGateway(devicesPerGateway), _inputs(inputs), _analogs(analogs),
+        _outputs(outputs), _subnet(subnet), _commands(commands) {
+      this->_channels[0] = {GenericPrgDevice::DI, GenericPrgDevice::Discrete, 0, inputs, 1};
+      this->_channels[1] = {GenericPrgDevice::AI, GenericPrgDevice::Input, 100, analogs, 1};
+      this->_channels[2] = {GenericPrgDevice::DO, GenericPrgDevice::Coil, 0, outputs, 1};
+      Current() = this;
+    }
+    ~HostPlant() { if (Current() == this) Current() = nullptr; }
+
+    static const int FIRST_AREA = 20;
+
+    int Gateways() const { return _gateways; }
+    int Devices() const { return _gateways * _devicesPerGateway; }
+    int Inputs() const { return _inputs; }
+    int Analogs() const { return _analogs; }
+    int Outputs() const { return _outputs; }
+    int AreasPerDevice() const { return _inputs + _analogs + _outputs; }
+    int FirstCommand() const { return FIRST_AREA + Devices() * AreasPerDevice(); }
+    int Commands() const { return _commands; }
+    int Areas() const { return FirstCommand() + _commands; } // primo argomento di DomoManager
+
+    IPAddress GatewayIp(int g) const { return IPAddress(192, 168, _subnet, 10 + g); }
+    int Gateway(int d) const { return d / _devicesPerGateway; }
+    uint8_t Unit(int d) const { return 1 + d % _devicesPerGateway; }
+    // offset nel device: prima i DI, poi gli AI, poi i DO
+    int DeviceArea(int d, int offset) const { return FIRST_AREA + d * AreasPerDevice() + offset; }
+
+    static void InitDevices(DomoManager &dm) {
+      HostPlant &_plant = *Current();
+      for (int d = 0; d < _plant.Devices(); d++) {
+        std::vector<int> _areas;
+        for (int i = 0; i < _plant.AreasPerDevice(); i++)
+          _areas.push_back(_plant.DeviceArea(d, i));
+        dm.addDevice("io", _plant.GatewayIp(_plant.Gateway(d)), _plant.Unit(d), _plant._channels, ARRAY_SIZE(_plant._channels), _areas, 3, High);
+      }
+    }
+
+    // Ogni ingresso DI comanda l'uscita DO con lo stesso indice (se esiste)
+    static void InitBuffer(DomoManager &dm) {
+      HostPlant &_plant = *Current();
+      ModbusBuffer &_buffer = dm.GetBuffer();
+      for (int d = 0; d < _plant.Devices(); d++) {
+        for (int i = 0; i < _plant._inputs; i++) {
+          int _target = i < _plant._outputs ? _plant.DeviceArea(d, _plant._inputs + _plant._analogs + i) : 0;
+          _buffer.SetElement(_plant.DeviceArea(d, i), _target, true, false, false, (char *)"di");
+        }
+        for (int i = 0; i < _plant._analogs; i++)
+          _buffer.SetElement(_plant.DeviceArea(d, _plant._inputs + i), 0, true, false, false, (char *)"ai");
+        for (int i = 0; i < _plant._outputs; i++)
+          _buffer.SetElement(_plant.DeviceArea(d, _plant._inputs + _plant._analogs + i), 0, true, false, false, (char *)"do");
+      }
+      for (int i = 0; i < _plant._commands; i++)
+        _buffer.SetElement(_plant.FirstCommand() + i, 0, true, true, false, (char *)"cmd");
+      _buffer.Init();
+    }
+
+  private:
+    static HostPlant *&Current() {
+      static HostPlant *_current = nullptr;
+      return _current;
+    }
+
+    int _gateways;
+    int _devicesPerGateway;
+    int _inputs;
+    int _analogs;
+    int _outputs;
+    uint8_t _subnet;
+    int _commands;
+    GenericPrgDevice::GenericPrgDeviceChannel _channels[3];
+};
+
+#endif
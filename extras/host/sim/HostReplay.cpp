@@ -0,0 +1,142 @@
+#include "HostReplay.h"
+#include "IOT.h"
+#include "MgsModbus.h"
+
+static const IPAddress LOOPBACK(127, 0, 0, 1);
+
+HostReplay::HostReplay(std::vector<GenericPrgDevice> &devices, uint16_t panelPort, uint16_t udpPort)
+  : _devices(devices), _panelPort(panelPort), _udpPort(udpPort) {
+  // Un gateway simulato per IP, come un convertitore Modbus TCP -> RS485 con piu unit
+  for (auto &_device : this->_devices) {
+    uint32_t _ip = _device.GetIp();
+    if (this->_gateways.count(_ip))
+      continue;
+    std::unique_ptr<HostModbusServer> _gateway(new HostModbusServer());
+    if (!_gateway->Start())
+      continue;
+    HostNet::Route(_device.GetIp(), MB_PORT, _gateway->Port());
+    this->_gateways[_ip] = std::move(_gateway);
+  }
+  if (this->_udpPort != 0)
+    this->_udp.begin(0);
+}
+
+HostReplay::~HostReplay() {
+  this->_panel.stop();
+  this->_udp.stop();
+}
+
+HostModbusServer* HostReplay::Gateway(IPAddress ip) {
+  auto _it = this->_gateways.find((uint32_t)ip);
+  return _it != this->_gateways.end() ? _it->second.get() : nullptr;
+}
+
+unsigned long HostReplay::Run(TraceReplay &trace, TraceStats &stats, StepFn step, CyclesFn cycles) {
+  unsigned long _base = millis();
+  unsigned long _replayed = 0;
+  TraceEvent _event;
+  while (trace.Next(_event)) {
+    // Il clock non torna mai indietro: se la riproduzione e' in ritardo sulla traccia resta com'e'
+    unsigned long long _at = (unsigned long long)(_base + _event.time) * 1000;
+    if (HostClock::IsSimulated() && _at > micros())
+      HostClock::Set(_at);
+
+    switch (_event.kind) {
+      case TraceField:
+        Field(_event);
+        break;
+
+      case TracePanel:
+        Panel(_event.id, _event.value);
+        break;
+
+      case TraceUdp:
+        Udp(_event.id, _event.value);
+        break;
+
+      case TraceCycle: {
+        unsigned long _done = cycles();
+        unsigned long _cycleStart = micros();
+        for (int i = 0; i < MAX_STEPS_PER_CYCLE && cycles() == _done; i++) {
+          unsigned long _start = micros();
+          step();
+          stats.Add(TraceStageUpdate, micros() - _start);
+          Drain();
+        }
+        stats.Add(TraceStageCycle, micros() - _cycleStart);
+        _replayed++;
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+  return _replayed;
+}
+
+// Il valore grezzo letto in registrazione torna nel registro da cui lo rilegge GenericPrgDevice
+void HostReplay::Field(const TraceEvent &event) {
+  if (event.id >= this->_devices.size()) {
+    this->_skipped++;
+    return;
+  }
+  GenericPrgDevice &_device = this->_devices[event.id];
+  HostModbusServer *_gateway = Gateway(_device.GetIp());
+  if (_gateway == nullptr || event.channel >= _device.GetChannelsSize()) {
+    this->_skipped++;
+    return;
+  }
+
+  GenericPrgDevice::GenericPrgDeviceChannel _channel = _device.GetChannelInfo(event.channel);
+  uint8_t _unit = _device.GetDeviceAddress();
+  uint16_t _address = _channel.startingAddr + event.index;
+  switch (_channel.hwType) {
+    case GenericPrgDevice::Coil:
+      _gateway->SetCoil(_unit, _address, event.value != 0);
+      break;
+    case GenericPrgDevice::Discrete:
+      _gateway->SetDiscrete(_unit, _address, event.value != 0);
+      break;
+    case GenericPrgDevice::Hold:
+      _gateway->SetHolding(_unit, _address, event.value);
+      break;
+    case GenericPrgDevice::Input:
+      _gateway->SetInput(_unit, _address, event.value);
+      break;
+  }
+}
+
+// FC6 senza attendere la risposta: il server la manda solo dentro Update (stesso thread)
+void HostReplay::Panel(int area, long value) {
+  if (!this->_panel.connected() && this->_panel.connect(LOOPBACK, this->_panelPort) == 0) {
+    this->_skipped++;
+    return;
+  }
+
+  uint16_t _tid = ++this->_tid;
+  uint8_t _frame[12] = {highByte(_tid), lowByte(_tid), 0, 0, 0, 6, 1, MB_FC_WRITE_REGISTER,
+                        highByte((uint16_t)area), lowByte((uint16_t)area), highByte((uint16_t)value), lowByte((uint16_t)value)};
+  this->_panel.write(_frame, sizeof(_frame));
+}
+
+void HostReplay::Udp(int command, long value) {
+  String _name = IOT::CommandName(command);
+  if (this->_udpPort == 0 || _name.length() == 0) {
+    this->_skipped++;
+    return;
+  }
+
+  // Con il terminatore: IOT::Update tratta il pacchetto come stringa C
+  String _packet = _name + "::" + String(value);
+  this->_udp.beginPacket(LOOPBACK, this->_udpPort);
+  this->_udp.write((const uint8_t *)_packet.c_str(), _packet.length() + 1);
+  this->_udp.endPacket();
+}
+
+// Risposte del server alle scritture del pannello, non servono
+void HostReplay::Drain() {
+  uint8_t _scratch[64];
+  while (this->_panel.available() > 0)
+    this->_panel.read(_scratch, sizeof(_scratch));
+}
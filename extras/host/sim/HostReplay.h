@@ -0,0 +1,84 @@
+/*
+  HostReplay.h - riproduzione di una traccia (TraceRecorder) attraverso il vero DomoManager::Update.
+
+  Ogni evento della traccia diventa traffico sugli stand-in, non una chiamata diretta agli stadi:
+  - TraceField: il valore grezzo finisce nel registro del device su un HostModbusServer (uno per IP
+    di gateway, instradato con HostNet), dove lo rilegge ManageMdbCli;
+  - TracePanel: scrittura FC6 all'indirizzo dell'area da un pannello connesso al server di Update
+    (con EnableDirectServer(true), come in registrazione, arriva subito nel Buffer);
+  - TraceUdp: pacchetto "comando::valore" alla porta di IOT (le risposte di IOT, es. Check, vanno
+    verso una destinazione senza rotta e si perdono);
+  - TraceCycle: il clock simulato viene portato al tempo dell'evento e step() (il loop dello sketch)
+    gira finche DomoManager completa un giro degli IP.
+  Le latenze di ogni step e di ogni giro finiscono in TraceStats, quelle per zona nel Profiler.
+  Usare HostClock::Simulate(start, true): il clock salta ai tempi della traccia ma le durate sono reali.
+*/
+
+#ifndef HostReplay_h
+#define HostReplay_h
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+#include "HostModbusServer.h"
+#include "PLC.h"
+#include "Trace.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Traccia in memoria: TraceRecorder ci scrive, TraceReplay la rilegge dall'inizio
+class HostTraceBuffer : public Stream
+{
+  public:
+    HostTraceBuffer() { setTimeout(0); } // a fine traccia TraceReplay non aspetta altri dati
+    size_t write(uint8_t c) override { _data.push_back(c); return 1; }
+    size_t write(const uint8_t *buffer, size_t size) override { _data.insert(_data.end(), buffer, buffer + size); return size; }
+    using Print::write;
+    int available() override { return (int)(_data.size() - _pos); }
+    int read() override { return _pos < _data.size() ? _data[_pos++] : -1; }
+    int peek() override { return _pos < _data.size() ? _data[_pos] : -1; }
+    void Rewind() { _pos = 0; }
+    size_t Size() const { return _data.size(); }
+  private:
+    std::vector<uint8_t> _data;
+    size_t _pos = 0;
+};
+
+class HostReplay
+{
+  public:
+    typedef std::function<void()> StepFn;            // un giro del loop dello sketch (IOT::Update, DomoManager::Update...)
+    typedef std::function<unsigned long()> CyclesFn; // giri completi degli IP, es. DomoManager::GetTimings().cycles
+
+    // devices: DomoManager::GetDevices(). panelPort: porta host del server dei pannelli (EthernetServer::hostPort),
+    // udpPort: porta host di IOT (EthernetUDP::hostPort), 0 = comandi UDP scartati
+    HostReplay(std::vector<GenericPrgDevice> &devices, uint16_t panelPort, uint16_t udpPort = 0);
+    ~HostReplay();
+
+    // Riproduce tutta la traccia, ritorna il numero di giri riprodotti
+    unsigned long Run(TraceReplay &trace, TraceStats &stats, StepFn step, CyclesFn cycles);
+
+    HostModbusServer* Gateway(IPAddress ip); // nullptr se nessun device usa ip
+    unsigned long Skipped() const { return _skipped; } // eventi che non corrispondono ai device
+
+    static const int MAX_STEPS_PER_CYCLE = 1000;
+
+  private:
+    void Field(const TraceEvent &event);
+    void Panel(int area, long value);
+    void Udp(int command, long value);
+    void Drain();
+
+    std::vector<GenericPrgDevice> &_devices;
+    std::map<uint32_t, std::unique_ptr<HostModbusServer>> _gateways;
+    EthernetClient _panel;
+    EthernetUDP _udp;
+    uint16_t _panelPort;
+    uint16_t _udpPort;
+    uint16_t _tid = 0;
+    unsigned long _skipped = 0;
+};
+
+#endif
@@ -0,0 +1,344 @@
+#include "Arduino.h"
+#include <stdio.h>
+#include <ctype.h>
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+
+///////////////// Clock
+static bool _simulated = false;
+static bool _running = false;
+static unsigned long long _simulatedUs = 0; // con _running: valore al momento di _anchorUs
+static unsigned long long _anchorUs = 0;
+static const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+
+static unsigned long long RealUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+static unsigned long long NowUs() {
+  if (!_simulated)
+    return RealUs();
+  return _running ? _simulatedUs + (RealUs() - _anchorUs) : _simulatedUs;
+}
+
+// Sposta il clock simulato a us (con _running riparte da li in tempo reale)
+static void SetSimulated(unsigned long long us) {
+  _simulatedUs = us;
+  _anchorUs = RealUs();
+}
+
+unsigned long millis() {
+  return (unsigned long)(NowUs() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)NowUs();
+}
+
+void delay(unsigned long ms) {
+  if (_simulated)
+    SetSimulated(NowUs() + (unsigned long long)ms * 1000);
+  else
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+  if (_simulated)
+    SetSimulated(NowUs() + us);
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {
+  std::this_thread::yield();
+}
+
+namespace HostClock {
+  void Simulate(unsigned long startMs, bool running) {
+    _simulated = true;
+    _running = running;
+    SetSimulated((unsigned long long)startMs * 1000);
+  }
+
+  void Real() {
+    _simulated = false;
+  }
+
+  bool IsSimulated() {
+    return _simulated;
+  }
+
+  void Advance(unsigned long us) {
+    SetSimulated(NowUs() + us);
+  }
+
+  void AdvanceMillis(unsigned long ms) {
+    SetSimulated(NowUs() + (unsigned long long)ms * 1000);
+  }
+
+  void Set(unsigned long long us) {
+    SetSimulated(us);
+  }
+}
+
+///////////////// Pin
+static int _pins[HostPins::COUNT];
+static unsigned long _pinWrites[HostPins::COUNT];
+
+static bool ValidPin(pin_size_t pin) {
+  return pin >= 0 && pin < HostPins::COUNT;
+}
+
+void pinMode(pin_size_t pin, int mode) {
+  (void)pin; (void)mode;
+}
+
+void digitalWrite(pin_size_t pin, int value) {
+  if (!ValidPin(pin)) return;
+  _pins[pin] = value ? HIGH : LOW;
+  _pinWrites[pin]++;
+}
+
+int digitalRead(pin_size_t pin) {
+  return ValidPin(pin) ? (_pins[pin] ? HIGH : LOW) : LOW;
+}
+
+int analogRead(pin_size_t pin) {
+  return ValidPin(pin) ? _pins[pin] : 0;
+}
+
+void analogWrite(pin_size_t pin, int value) {
+  if (!ValidPin(pin)) return;
+  _pins[pin] = value;
+  _pinWrites[pin]++;
+}
+
+namespace HostPins {
+  void Set(pin_size_t pin, int value) {
+    if (ValidPin(pin)) _pins[pin] = value;
+  }
+
+  int Get(pin_size_t pin) {
+    return ValidPin(pin) ? _pins[pin] : 0;
+  }
+
+  unsigned long Writes(pin_size_t pin) {
+    return ValidPin(pin) ? _pinWrites[pin] : 0;
+  }
+}
+
+void NVIC_SystemReset() {
+  fflush(stdout);
+  fprintf(stderr, "NVIC_SystemReset()\n");
+  exit(3);
+}
+
+///////////////// Math
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+long random(long max) {
+  return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max) {
+  return min >= max ? min : min + random(max - min);
+}
+
+void randomSeed(unsigned long seed) {
+  srand((unsigned int)seed);
+}
+
+///////////////// String
+static std::string ToBase(unsigned long value, unsigned char base) {
+  if (base < 2) base = 10;
+  char _buf[8 * sizeof(long) + 1];
+  char *_p = &_buf[sizeof(_buf) - 1];
+  *_p = 0;
+  do {
+    unsigned long _digit = value % base;
+    *--_p = _digit < 10 ? '0' + _digit : 'A' + _digit - 10;
+    value /= base;
+  } while (value);
+  return _p;
+}
+
+static std::string SignedToBase(long value, unsigned char base) {
+  if (value < 0 && base == DEC)
+    return "-" + ToBase((unsigned long)-value, base);
+  return ToBase((unsigned long)value, base);
+}
+
+static std::string FloatToString(double value, unsigned char decimalPlaces) {
+  char _buf[64];
+  snprintf(_buf, sizeof(_buf), "%.*f", decimalPlaces, value);
+  return _buf;
+}
+
+String::String(unsigned char value, unsigned char base) : std::string(ToBase(value, base)) {}
+String::String(int value, unsigned char base) : std::string(SignedToBase(value, base)) {}
+String::String(unsigned int value, unsigned char base) : std::string(ToBase(value, base)) {}
+String::String(long value, unsigned char base) : std::string(SignedToBase(value, base)) {}
+String::String(unsigned long value, unsigned char base) : std::string(ToBase(value, base)) {}
+String::String(float value, unsigned char decimalPlaces) : std::string(FloatToString(value, decimalPlaces)) {}
+String::String(double value, unsigned char decimalPlaces) : std::string(FloatToString(value, decimalPlaces)) {}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_type _pos = find(c, from);
+  return _pos == npos ? -1 : (int)_pos;
+}
+
+int String::indexOf(const String &s, unsigned int from) const {
+  size_type _pos = find(s, from);
+  return _pos == npos ? -1 : (int)_pos;
+}
+
+int String::lastIndexOf(char c) const {
+  size_type _pos = rfind(c);
+  return _pos == npos ? -1 : (int)_pos;
+}
+
+int String::lastIndexOf(const String &s) const {
+  size_type _pos = rfind(s);
+  return _pos == npos ? -1 : (int)_pos;
+}
+
+String String::substring(unsigned int beginIndex) const {
+  return beginIndex >= size() ? String() : String(substr(beginIndex));
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const {
+  if (beginIndex > endIndex) std::swap(beginIndex, endIndex);
+  if (beginIndex >= size()) return String();
+  return String(substr(beginIndex, endIndex - beginIndex));
+}
+
+bool String::startsWith(const String &prefix) const {
+  return compare(0, prefix.size(), prefix) == 0;
+}
+
+bool String::endsWith(const String &suffix) const {
+  return size() >= suffix.size() && compare(size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool String::equalsIgnoreCase(const String &s) const {
+  if (size() != s.size()) return false;
+  for (size_type i = 0; i < size(); i++)
+    if (tolower((unsigned char)(*this)[i]) != tolower((unsigned char)s[i])) return false;
+  return true;
+}
+
+void String::replace(const String &find, const String &replace) {
+  if (find.empty()) return;
+  size_type _pos = 0;
+  while ((_pos = std::string::find(find, _pos)) != npos) {
+    std::string::replace(_pos, find.size(), replace);
+    _pos += replace.size();
+  }
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+  if (index < size()) erase(index, count);
+}
+
+void String::trim() {
+  size_type _first = find_first_not_of(" \t\r\n");
+  if (_first == npos) { clear(); return; }
+  size_type _last = find_last_not_of(" \t\r\n");
+  assign(substr(_first, _last - _first + 1));
+}
+
+void String::toUpperCase() {
+  for (auto &c : *this) c = toupper((unsigned char)c);
+}
+
+void String::toLowerCase() {
+  for (auto &c : *this) c = tolower((unsigned char)c);
+}
+
+///////////////// Print / Stream
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t _n = 0;
+  while (size--) _n += write(*buffer++);
+  return _n;
+}
+
+size_t Print::print(long n, int base) {
+  return print(String(n, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long n, int base) {
+  return print(String(n, (unsigned char)base));
+}
+
+size_t Print::print(double n, int digits) {
+  return print(String(n, (unsigned char)digits));
+}
+
+// Timeout in tempo reale: con il clock simulato fermo l'attesa non finirebbe mai
+size_t Stream::readBytes(char *buffer, size_t length) {
+  size_t _count = 0;
+  unsigned long long _start = RealUs();
+  while (_count < length) {
+    int c = read();
+    if (c < 0) {
+      if (RealUs() - _start >= (unsigned long long)_timeout * 1000) break;
+      yield();
+      continue;
+    }
+    buffer[_count++] = (char)c;
+  }
+  return _count;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String _ret;
+  int c;
+  while ((c = read()) >= 0 && c != terminator)
+    _ret += (char)c;
+  return _ret;
+}
+
+///////////////// IPAddress
+namespace arduino {
+
+bool IPAddress::fromString(const char *address) {
+  unsigned int _a, _b, _c, _d;
+  if (!address || sscanf(address, "%u.%u.%u.%u", &_a, &_b, &_c, &_d) != 4 || _a > 255 || _b > 255 || _c > 255 || _d > 255)
+    return false;
+  _address[0] = _a; _address[1] = _b; _address[2] = _c; _address[3] = _d;
+  return true;
+}
+
+String IPAddress::toString() const {
+  char _buf[16];
+  snprintf(_buf, sizeof(_buf), "%u.%u.%u.%u", _address[0], _address[1], _address[2], _address[3]);
+  return String(_buf);
+}
+
+size_t IPAddress::printTo(Print &p) const {
+  return p.print(toString());
+}
+
+}
+
+///////////////// Serial
+static bool _serialMute = false;
+
+size_t HostSerial::write(uint8_t c) {
+  if (!_serialMute) fputc(c, stdout);
+  return 1;
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size) {
+  if (!_serialMute) fwrite(buffer, 1, size, stdout);
+  return size;
+}
+
+void HostSerial::Mute(bool mute) {
+  fflush(stdout);
+  _serialMute = mute;
+}
@@ -0,0 +1,262 @@
+/*
+  Arduino.h - stand-in del core Arduino per la build host (Linux) di extras/host.
+
+  Solo quello che usano i moduli della libreria e gli esempi: tipi, macro sui bit, Print/Stream/Printable,
+  String, IPAddress, pin simulati, Serial su stdout e il clock.
+  millis()/micros() leggono HostClock: di default il tempo reale dall'avvio del processo, con
+  HostClock::Simulate() un clock simulato che avanza solo con Advance/Set e con delay().
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <functional>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef bool boolean;
+typedef int pin_size_t;
+
+typedef enum { LOW = 0, HIGH = 1, CHANGE = 2, FALLING = 3, RISING = 4 } PinStatus;
+typedef enum { INPUT = 0, OUTPUT = 1, INPUT_PULLUP = 2, INPUT_PULLDOWN = 3 } PinMode;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitToggle(value, bit) ((value) ^= (1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+#define bit(b) (1UL << (b))
+#define sq(x) ((x) * (x))
+#define radians(deg) ((deg) * DEG_TO_RAD)
+#define degrees(rad) ((rad) * RAD_TO_DEG)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define F(string_literal) (string_literal)
+#define PROGMEM
+
+inline word makeWord(uint8_t h, uint8_t l) { return (h << 8) | l; }
+#define word(...) makeWord(__VA_ARGS__)
+
+// Come ArduinoCore-API: min/max tra tipi diversi
+template<class T, class L>
+auto min(const T& a, const L& b) -> decltype((b < a) ? b : a) { return (b < a) ? b : a; }
+template<class T, class L>
+auto max(const T& a, const L& b) -> decltype((b < a) ? b : a) { return (a < b) ? b : a; }
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// ---------- Tempo ----------
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+namespace HostClock {
+  // Clock simulato: fermo finche non si chiama Advance/Set/delay. Con running avanza anche in tempo reale
+  // (le durate misurate con micros restano vere) e Advance/Set lo spostano in avanti
+  void Simulate(unsigned long startMs = 0, bool running = false);
+  void Real();                              // tempo reale (default)
+  bool IsSimulated();
+  void Advance(unsigned long us);
+  void AdvanceMillis(unsigned long ms);
+  void Set(unsigned long long us);
+}
+
+// ---------- Pin ----------
+void pinMode(pin_size_t pin, int mode);
+void digitalWrite(pin_size_t pin, int value);
+int digitalRead(pin_size_t pin);
+int analogRead(pin_size_t pin);
+void analogWrite(pin_size_t pin, int value);
+
+namespace HostPins {
+  const int COUNT = 256;
+  void Set(pin_size_t pin, int value);     // livello letto da digitalRead/analogRead
+  int Get(pin_size_t pin);                 // ultimo valore scritto o impostato
+  unsigned long Writes(pin_size_t pin);    // numero di digitalWrite sul pin
+}
+
+// La scheda reale si riavvia, qui esce dal processo
+void NVIC_SystemReset();
+
+// ---------- String ----------
+class String : public std::string
+{
+  public:
+    String() {}
+    String(const char *s) : std::string(s ? s : "") {}
+    String(const std::string &s) : std::string(s) {}
+    explicit String(char c) : std::string(1, c) {}
+    explicit String(unsigned char value, unsigned char base = DEC);
+    explicit String(int value, unsigned char base = DEC);
+    explicit String(unsigned int value, unsigned char base = DEC);
+    explicit String(long value, unsigned char base = DEC);
+    explicit String(unsigned long value, unsigned char base = DEC);
+    explicit String(float value, unsigned char decimalPlaces = 2);
+    explicit String(double value, unsigned char decimalPlaces = 2);
+
+    unsigned int length() const { return (unsigned int)size(); }
+    bool isEmpty() const { return empty(); }
+    char charAt(unsigned int index) const { return index < size() ? (*this)[index] : 0; }
+    void setCharAt(unsigned int index, char c) { if (index < size()) (*this)[index] = c; }
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const String &s, unsigned int from = 0) const;
+    int lastIndexOf(char c) const;
+    int lastIndexOf(const String &s) const;
+    String substring(unsigned int beginIndex) const;
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+    bool startsWith(const String &prefix) const;
+    bool endsWith(const String &suffix) const;
+    bool equals(const String &s) const { return *this == s; }
+    bool equalsIgnoreCase(const String &s) const;
+    void replace(const String &find, const String &replace);
+    void remove(unsigned int index, unsigned int count = (unsigned int)-1);
+    void trim();
+    void toUpperCase();
+    void toLowerCase();
+    long toInt() const { return atol(c_str()); }
+    float toFloat() const { return (float)atof(c_str()); }
+    double toDouble() const { return atof(c_str()); }
+    bool concat(const String &s) { append(s); return true; }
+    bool concat(const char *s) { append(s ? s : ""); return true; }
+    bool concat(char c) { push_back(c); return true; }
+    template<class T> bool concat(T value) { append(String(value)); return true; }
+
+    String& operator+=(const String &s) { append(s); return *this; }
+    String& operator+=(const char *s) { append(s ? s : ""); return *this; }
+    String& operator+=(char c) { push_back(c); return *this; }
+    template<class T> String& operator+=(T value) { append(String(value)); return *this; }
+};
+
+inline String operator+(const String &a, const String &b) { String r(a); r.append(b); return r; }
+inline String operator+(const String &a, const char *b) { String r(a); r.append(b ? b : ""); return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r.append(b); return r; }
+inline String operator+(const String &a, char b) { String r(a); r.push_back(b); return r; }
+template<class T> String operator+(const String &a, T b) { String r(a); r.append(String(b)); return r; }
+
+// ---------- Print / Stream ----------
+class Print;
+
+class Printable
+{
+  public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str(), s.size()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long long n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned long long n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(double n, int digits = 2);
+    size_t print(const Printable &p) { return p.printTo(*this); }
+
+    size_t println() { return write("\r\n"); }
+    template<class T> size_t println(const T &value) { size_t n = print(value); return n + println(); }
+    template<class T> size_t println(const T &value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() { return _timeout; }
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+    String readStringUntil(char terminator);
+  protected:
+    unsigned long _timeout = 1000;
+};
+
+// ---------- IPAddress ----------
+namespace arduino {
+
+class IPAddress : public Printable
+{
+  public:
+    IPAddress() { memset(_address, 0, 4); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { _address[0] = a; _address[1] = b; _address[2] = c; _address[3] = d; }
+    IPAddress(uint32_t address) { memcpy(_address, &address, 4); }
+    IPAddress(const uint8_t *address) { memcpy(_address, address, 4); }
+    bool fromString(const char *address);
+    bool fromString(const String &address) { return fromString(address.c_str()); }
+    operator uint32_t() const { uint32_t a; memcpy(&a, _address, 4); return a; }
+    bool operator==(const IPAddress &addr) const { return memcmp(_address, addr._address, 4) == 0; }
+    bool operator!=(const IPAddress &addr) const { return !(*this == addr); }
+    uint8_t operator[](int index) const { return _address[index]; }
+    uint8_t& operator[](int index) { return _address[index]; }
+    String toString() const;
+    size_t printTo(Print &p) const override;
+  private:
+    uint8_t _address[4];
+};
+
+}
+using arduino::IPAddress;
+
+// ---------- Serial ----------
+// Scrive su stdout; HostSerial::Mute(true) per benchmark e replay senza log
+class HostSerial : public Stream
+{
+  public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+    explicit operator bool() { return true; }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    static void Mute(bool mute);
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,242 @@
+#include "ArduinoModbus.h"
+#include <chrono>
+
+static const char *const ERR_TIMEOUT = "Connection timed out";
+static const char *const ERR_DISCONNECTED = "Connection reset by peer";
+static const char *const ERR_INVALID = "Invalid data";
+static const char *const ERR_TOO_MANY = "Too many data";
+
+static const char *ExceptionText(uint8_t code) {
+  switch (code) {
+    case 1: return "Illegal function";
+    case 2: return "Illegal data address";
+    case 3: return "Illegal data value";
+    case 4: return "Slave device or server failure";
+    case 6: return "Slave device or server is busy";
+    case 10: return "Gateway path unavailable";
+    case 11: return "Target device failed to respond";
+    default: return "Unknown exception";
+  }
+}
+
+// Tempo reale anche con HostClock simulato: le attese sui socket non devono dipendere dal clock del test
+static unsigned long NowMs() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void PutWord(uint8_t *p, uint16_t value) {
+  p[0] = highByte(value);
+  p[1] = lowByte(value);
+}
+
+static uint16_t GetWord(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+///////////////// ModbusClient
+int ModbusClient::exchange(uint8_t id, const uint8_t *request, int requestLen, uint8_t *response, int expectedFc) {
+  this->_lastError = nullptr;
+  int _len = transact(id, request, requestLen, response, MODBUS_HOST_MAX_PDU);
+  if (_len < 0)
+    return -1;
+  if (_len >= 2 && response[0] == (expectedFc | 0x80)) {
+    setError(ExceptionText(response[1]));
+    return -1;
+  }
+  if (_len < 1 || response[0] != expectedFc) {
+    setError(ERR_INVALID);
+    return -1;
+  }
+  return _len;
+}
+
+int ModbusClient::requestFrom(int id, int type, int address, int nb) {
+  this->_available = 0;
+  this->_read = 0;
+
+  static const uint8_t _fcs[] = {0x01, 0x02, 0x03, 0x04};
+  bool _bits = type == COILS || type == DISCRETE_INPUTS;
+  if (type < COILS || type > INPUT_REGISTERS || nb <= 0 || nb > (_bits ? 2000 : 125)) {
+    setError(ERR_TOO_MANY);
+    return 0;
+  }
+
+  uint8_t _request[5] = {_fcs[type]};
+  PutWord(_request + 1, address);
+  PutWord(_request + 3, nb);
+
+  uint8_t _response[MODBUS_HOST_MAX_PDU];
+  int _len = exchange(id, _request, 5, _response, _fcs[type]);
+  if (_len < 0)
+    return 0;
+
+  int _bytes = _bits ? (nb + 7) / 8 : nb * 2;
+  if (_len < 2 || _response[1] != _bytes || _len < 2 + _bytes) {
+    setError(ERR_INVALID);
+    return 0;
+  }
+
+  for (int i = 0; i < nb; i++)
+    this->_values[i] = _bits ? (_response[2 + i / 8] >> (i % 8)) & 1 : GetWord(_response + 2 + i * 2);
+  this->_available = nb;
+  return nb;
+}
+
+int ModbusClient::available() {
+  return this->_available - this->_read;
+}
+
+long ModbusClient::read() {
+  if (this->_read >= this->_available)
+    return -1;
+  return this->_values[this->_read++];
+}
+
+int ModbusClient::coilRead(int id, int address) {
+  return requestFrom(id, COILS, address, 1) ? read() : -1;
+}
+
+int ModbusClient::discreteInputRead(int id, int address) {
+  return requestFrom(id, DISCRETE_INPUTS, address, 1) ? read() : -1;
+}
+
+long ModbusClient::holdingRegisterRead(int id, int address) {
+  return requestFrom(id, HOLDING_REGISTERS, address, 1) ? read() : -1;
+}
+
+long ModbusClient::inputRegisterRead(int id, int address) {
+  return requestFrom(id, INPUT_REGISTERS, address, 1) ? read() : -1;
+}
+
+int ModbusClient::coilWrite(int id, int address, uint8_t value) {
+  uint8_t _request[5] = {0x05};
+  PutWord(_request + 1, address);
+  PutWord(_request + 3, value ? 0xFF00 : 0x0000);
+  uint8_t _response[MODBUS_HOST_MAX_PDU];
+  return exchange(id, _request, 5, _response, 0x05) >= 0 ? 1 : 0;
+}
+
+int ModbusClient::holdingRegisterWrite(int id, int address, uint16_t value) {
+  uint8_t _request[5] = {0x06};
+  PutWord(_request + 1, address);
+  PutWord(_request + 3, value);
+  uint8_t _response[MODBUS_HOST_MAX_PDU];
+  return exchange(id, _request, 5, _response, 0x06) >= 0 ? 1 : 0;
+}
+
+int ModbusClient::beginTransmission(int id, int type, int address, int nb) {
+  if ((type != COILS && type != HOLDING_REGISTERS) || nb <= 0 || nb > (type == COILS ? 1968 : 123)) {
+    setError(ERR_TOO_MANY);
+    return 0;
+  }
+  this->_txId = id;
+  this->_txType = type;
+  this->_txAddress = address;
+  this->_txNb = nb;
+  this->_txCount = 0;
+  return 1;
+}
+
+int ModbusClient::write(unsigned int value) {
+  if (this->_txType < 0 || this->_txCount >= this->_txNb)
+    return 0;
+  this->_values[this->_txCount++] = value;
+  return 1;
+}
+
+// Come ArduinoModbus: FC15 per i coil e FC16 per gli holding, anche con un solo valore
+int ModbusClient::endTransmission() {
+  if (this->_txType < 0)
+    return 0;
+
+  bool _bits = this->_txType == COILS;
+  uint8_t _fc = _bits ? 0x0F : 0x10;
+  int _bytes = _bits ? (this->_txNb + 7) / 8 : this->_txNb * 2;
+  uint8_t _request[MODBUS_HOST_MAX_PDU] = {_fc};
+  PutWord(_request + 1, this->_txAddress);
+  PutWord(_request + 3, this->_txNb);
+  _request[5] = _bytes;
+  memset(_request + 6, 0, _bytes);
+  for (int i = 0; i < this->_txCount; i++) {
+    if (_bits) {
+      if (this->_values[i]) _request[6 + i / 8] |= 1 << (i % 8);
+    } else
+      PutWord(_request + 6 + i * 2, this->_values[i]);
+  }
+
+  uint8_t _response[MODBUS_HOST_MAX_PDU];
+  int _len = exchange(this->_txId, _request, 6 + _bytes, _response, _fc);
+  this->_txType = -1;
+  return _len >= 0 ? 1 : 0;
+}
+
+const char* ModbusClient::lastError() {
+  return this->_lastError;
+}
+
+///////////////// ModbusTCPClient
+int ModbusTCPClient::begin(IPAddress ip, uint16_t port) {
+  if (this->_client->connect(ip, port) == 0) {
+    setError(ERR_TIMEOUT);
+    return 0;
+  }
+  return 1;
+}
+
+bool ModbusTCPClient::readExact(uint8_t *buffer, int length, unsigned long deadline) {
+  int _count = 0;
+  while (_count < length) {
+    if (this->_client->available() > 0) {
+      int _n = this->_client->read(buffer + _count, length - _count);
+      if (_n > 0) _count += _n;
+      continue;
+    }
+    if (!this->_client->connected()) {
+      setError(ERR_DISCONNECTED);
+      return false;
+    }
+    long _left = (long)(deadline - NowMs());
+    if (_left <= 0) {
+      setError(ERR_TIMEOUT);
+      return false;
+    }
+    this->_client->hostWaitReadable(_left);
+  }
+  return true;
+}
+
+int ModbusTCPClient::transact(uint8_t id, const uint8_t *request, int requestLen, uint8_t *response, int responseCap) {
+  if (!this->_client->connected()) {
+    setError(ERR_DISCONNECTED);
+    return -1;
+  }
+
+  uint16_t _tid = ++this->_transactionId;
+  uint8_t _frame[7 + MODBUS_HOST_MAX_PDU];
+  PutWord(_frame, _tid);
+  PutWord(_frame + 2, 0);
+  PutWord(_frame + 4, requestLen + 1);
+  _frame[6] = id;
+  memcpy(_frame + 7, request, requestLen);
+  if (this->_client->write(_frame, 7 + requestLen) != (size_t)(7 + requestLen)) {
+    setError(ERR_DISCONNECTED);
+    return -1;
+  }
+
+  // Risposte arrivate in ritardo a richieste precedenti (transaction id diverso) vengono scartate
+  unsigned long _deadline = NowMs() + this->_timeout;
+  while (true) {
+    uint8_t _header[7];
+    if (!readExact(_header, 7, _deadline))
+      return -1;
+    int _len = GetWord(_header + 4) - 1;
+    if (_len < 1 || _len > responseCap) {
+      setError(ERR_INVALID);
+      return -1;
+    }
+    if (!readExact(response, _len, _deadline))
+      return -1;
+    if (GetWord(_header) == _tid)
+      return _len;
+  }
+}
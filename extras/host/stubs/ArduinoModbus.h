@@ -0,0 +1,31 @@
+/*
+  ArduinoModbus.h - stand-in di ArduinoModbus per la build host: solo ModbusTCPClient,
+  con framing MBAP su qualunque Client (EthernetClient su loopback, vedi Ethernet.h).
+*/
+
+#ifndef _ARDUINO_MODBUS_H_INCLUDED
+#define _ARDUINO_MODBUS_H_INCLUDED
+
+#include "ModbusClient.h"
+#include "Client.h"
+
+class ModbusTCPClient : public ModbusClient
+{
+  public:
+    ModbusTCPClient(Client &client) : _client(&client) {}
+    int begin(IPAddress ip, uint16_t port = 502);
+    int connected() { return _client->connected(); }
+    void stop() { _client->stop(); }
+    void end() override { stop(); }
+
+  protected:
+    int transact(uint8_t id, const uint8_t *request, int requestLen, uint8_t *response, int responseCap) override;
+
+  private:
+    bool readExact(uint8_t *buffer, int length, unsigned long deadline);
+
+    Client *_client;
+    uint16_t _transactionId = 0;
+};
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef ArduinoRS485_h
+#define ArduinoRS485_h
+
+// Solo per compatibilita con gli include di Fncs.h: la build host usa solo Modbus TCP
+#include "Arduino.h"
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef Client_h
+#define Client_h
+
+#include "Arduino.h"
+
+class Client : public Stream
+{
+  public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+    using Print::write;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int read(uint8_t *buffer, size_t size) = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+
+    // Solo host: attende fino a timeout ms che arrivino dati (i client bloccanti come ModbusTCPClient
+    // non girano a vuoto). Default: nessuna attesa
+    virtual bool hostWaitReadable(unsigned long timeout) { (void)timeout; return available() > 0; }
+};
+
+#endif
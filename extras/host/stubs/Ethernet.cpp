@@ -0,0 +1,303 @@
+#include "Ethernet.h"
+#include "SPI.h"
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+EthernetClass Ethernet;
+SPIClass SPI;
+
+struct HostSocket
+{
+  int fd;
+  explicit HostSocket(int fd) : fd(fd) {}
+  ~HostSocket() { if (fd >= 0) close(fd); }
+};
+
+///////////////// HostNet
+static std::mutex _netMutex;
+static std::map<uint64_t, uint16_t> _routes;
+static std::map<uint16_t, uint16_t> _listenPorts;
+static unsigned long _defaultConnectTimeout = 1000;
+
+static uint64_t RouteKey(IPAddress ip, uint16_t port) {
+  return ((uint64_t)(uint32_t)ip << 16) | port;
+}
+
+namespace HostNet {
+  void Route(IPAddress ip, uint16_t port, uint16_t hostPort) {
+    std::lock_guard<std::mutex> _lock(_netMutex);
+    _routes[RouteKey(ip, port)] = hostPort;
+  }
+
+  void Listen(uint16_t port, uint16_t hostPort) {
+    std::lock_guard<std::mutex> _lock(_netMutex);
+    _listenPorts[port] = hostPort;
+  }
+
+  void Reset() {
+    std::lock_guard<std::mutex> _lock(_netMutex);
+    _routes.clear();
+    _listenPorts.clear();
+    _defaultConnectTimeout = 1000;
+  }
+
+  uint16_t Resolve(IPAddress ip, uint16_t port) {
+    std::lock_guard<std::mutex> _lock(_netMutex);
+    auto _it = _routes.find(RouteKey(ip, port));
+    if (_it != _routes.end())
+      return _it->second;
+    return ip[0] == 127 ? port : 0;
+  }
+
+  uint16_t ListenPort(uint16_t port) {
+    std::lock_guard<std::mutex> _lock(_netMutex);
+    auto _it = _listenPorts.find(port);
+    return _it != _listenPorts.end() ? _it->second : port;
+  }
+
+  void SetConnectTimeout(unsigned long timeout) {
+    _defaultConnectTimeout = timeout;
+  }
+}
+
+static sockaddr_in Loopback(uint16_t port) {
+  sockaddr_in _addr;
+  memset(&_addr, 0, sizeof(_addr));
+  _addr.sin_family = AF_INET;
+  _addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  _addr.sin_port = htons(port);
+  return _addr;
+}
+
+static void SetNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void IgnoreSigPipe() {
+  static bool _done = false;
+  if (!_done) { signal(SIGPIPE, SIG_IGN); _done = true; }
+}
+
+///////////////// EthernetClient
+int EthernetClient::connect(IPAddress ip, uint16_t port) {
+  IgnoreSigPipe();
+  stop();
+
+  uint16_t _hostPort = HostNet::Resolve(ip, port);
+  if (_hostPort == 0)
+    return 0;
+
+  int _fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_fd < 0)
+    return 0;
+  SetNonBlocking(_fd);
+  int _one = 1;
+  setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &_one, sizeof(_one));
+
+  sockaddr_in _addr = Loopback(_hostPort);
+  if (::connect(_fd, (sockaddr *)&_addr, sizeof(_addr)) < 0) {
+    if (errno != EINPROGRESS) { close(_fd); return 0; }
+    pollfd _p = {_fd, POLLOUT, 0};
+    int _timeout = (int)(this->_connectTimeout ? this->_connectTimeout : _defaultConnectTimeout);
+    int _err = 0;
+    socklen_t _len = sizeof(_err);
+    if (poll(&_p, 1, _timeout) <= 0 || getsockopt(_fd, SOL_SOCKET, SO_ERROR, &_err, &_len) < 0 || _err != 0) {
+      close(_fd);
+      return 0;
+    }
+  }
+
+  // Riusa il socket chiuso da stop(): come il W5500, connect/stop a ogni giro non toccano l'heap
+  if (this->_spare && this->_spare.use_count() == 1) {
+    this->_spare->fd = _fd;
+    this->_socket = std::move(this->_spare);
+  } else {
+    this->_socket = std::make_shared<HostSocket>(_fd);
+  }
+  return 1;
+}
+
+int EthernetClient::connect(const char *host, uint16_t port) {
+  IPAddress _ip;
+  return _ip.fromString(host) ? connect(_ip, port) : 0;
+}
+
+size_t EthernetClient::write(const uint8_t *buffer, size_t size) {
+  if (!this->_socket)
+    return 0;
+  size_t _sent = 0;
+  while (_sent < size) {
+    ssize_t _n = send(this->_socket->fd, buffer + _sent, size - _sent, MSG_NOSIGNAL);
+    if (_n > 0) { _sent += _n; continue; }
+    if (_n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd _p = {this->_socket->fd, POLLOUT, 0};
+      if (poll(&_p, 1, 1000) > 0) continue;
+    }
+    break;
+  }
+  return _sent;
+}
+
+int EthernetClient::available() {
+  if (!this->_socket)
+    return 0;
+  int _count = 0;
+  if (ioctl(this->_socket->fd, FIONREAD, &_count) < 0)
+    return 0;
+  return _count;
+}
+
+int EthernetClient::read() {
+  uint8_t _c;
+  return read(&_c, 1) == 1 ? _c : -1;
+}
+
+int EthernetClient::read(uint8_t *buffer, size_t size) {
+  if (!this->_socket)
+    return -1;
+  ssize_t _n = recv(this->_socket->fd, buffer, size, MSG_DONTWAIT);
+  return _n > 0 ? (int)_n : -1;
+}
+
+int EthernetClient::peek() {
+  if (!this->_socket)
+    return -1;
+  uint8_t _c;
+  return recv(this->_socket->fd, &_c, 1, MSG_DONTWAIT | MSG_PEEK) == 1 ? _c : -1;
+}
+
+void EthernetClient::stop() {
+  if (this->_socket) {
+    shutdown(this->_socket->fd, SHUT_RDWR);
+    if (this->_socket.use_count() == 1) {
+      close(this->_socket->fd);
+      this->_socket->fd = -1;
+      this->_spare = std::move(this->_socket);
+    }
+    this->_socket.reset();
+  }
+}
+
+// Come la libreria Ethernet: connesso finche ci sono dati da leggere, anche se il peer ha chiuso
+uint8_t EthernetClient::connected() {
+  if (!this->_socket)
+    return 0;
+  if (available() > 0)
+    return 1;
+  uint8_t _c;
+  ssize_t _n = recv(this->_socket->fd, &_c, 1, MSG_DONTWAIT | MSG_PEEK);
+  if (_n == 0)
+    return 0;
+  if (_n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    return 0;
+  return 1;
+}
+
+bool EthernetClient::hostWaitReadable(unsigned long timeout) {
+  if (!this->_socket)
+    return false;
+  pollfd _p = {this->_socket->fd, POLLIN, 0};
+  return poll(&_p, 1, (int)timeout) > 0 && available() > 0;
+}
+
+///////////////// EthernetServer
+EthernetServer::~EthernetServer() {
+  if (this->_listen >= 0)
+    close(this->_listen);
+}
+
+void EthernetServer::begin() {
+  IgnoreSigPipe();
+  if (this->_listen >= 0)
+    return;
+
+  int _fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_fd < 0)
+    return;
+  int _one = 1;
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &_one, sizeof(_one));
+
+  sockaddr_in _addr = Loopback(HostNet::ListenPort(this->_port));
+  if (bind(_fd, (sockaddr *)&_addr, sizeof(_addr)) < 0 || listen(_fd, 16) < 0) {
+    close(_fd);
+    return;
+  }
+  SetNonBlocking(_fd);
+
+  socklen_t _len = sizeof(_addr);
+  getsockname(_fd, (sockaddr *)&_addr, &_len);
+  this->_hostPort = ntohs(_addr.sin_port);
+  this->_listen = _fd;
+}
+
+EthernetClient EthernetServer::accept() {
+  if (this->_listen < 0)
+    return EthernetClient();
+  int _fd = ::accept(this->_listen, nullptr, nullptr);
+  if (_fd < 0)
+    return EthernetClient();
+  SetNonBlocking(_fd);
+  int _one = 1;
+  setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &_one, sizeof(_one));
+  return EthernetClient(std::make_shared<HostSocket>(_fd));
+}
+
+EthernetClient EthernetServer::available() {
+  for (EthernetClient _client = accept(); _client; _client = accept())
+    this->_clients.push_back(_client);
+
+  for (size_t i = 0; i < this->_clients.size(); ) {
+    if (!this->_clients[i].connected()) {
+      this->_clients.erase(this->_clients.begin() + i);
+      continue;
+    }
+    if (this->_clients[i].available() > 0)
+      return this->_clients[i];
+    i++;
+  }
+  return EthernetClient();
+}
+
+size_t EthernetServer::write(const uint8_t *buffer, size_t size) {
+  available();
+  for (auto &_client : this->_clients)
+    _client.write(buffer, size);
+  return size;
+}
+
+///////////////// EthernetClass
+int EthernetClass::begin(uint8_t *mac, unsigned long timeout, unsigned long responseTimeout) {
+  (void)mac; (void)timeout; (void)responseTimeout;
+  return 1;
+}
+
+void EthernetClass::begin(uint8_t *mac, IPAddress ip) {
+  (void)mac;
+  this->_ip = ip;
+}
+
+void EthernetClass::begin(uint8_t *mac, IPAddress ip, IPAddress dns) {
+  (void)dns;
+  begin(mac, ip);
+}
+
+void EthernetClass::begin(uint8_t *mac, IPAddress ip, IPAddress dns, IPAddress gateway) {
+  (void)gateway;
+  begin(mac, ip, dns);
+}
+
+void EthernetClass::begin(uint8_t *mac, IPAddress ip, IPAddress dns, IPAddress gateway, IPAddress subnet) {
+  (void)subnet;
+  begin(mac, ip, dns, gateway);
+}
@@ -0,0 +1,109 @@
+/*
+  Ethernet.h - stand-in della libreria Ethernet per la build host, su socket TCP di loopback.
+
+  Gli indirizzi della rete reale (gateway Modbus, pannelli, porte locali) si mappano su porte di
+  127.0.0.1 con HostNet: Route per le destinazioni di connect/beginPacket, Listen per le porte
+  aperte da EthernetServer ed EthernetUDP (0 = porta effimera, da leggere con hostPort()).
+  Senza una rotta connect fallisce e i pacchetti UDP vengono scartati, come un host irraggiungibile.
+*/
+
+#ifndef Ethernet_h
+#define Ethernet_h
+
+#include "Arduino.h"
+#include "Client.h"
+#include <memory>
+#include <vector>
+
+namespace HostNet {
+  void Route(IPAddress ip, uint16_t port, uint16_t hostPort); // ip:port -> 127.0.0.1:hostPort
+  void Listen(uint16_t port, uint16_t hostPort);             // EthernetServer(port) / EthernetUDP::begin(port) -> hostPort
+  void Reset();
+  uint16_t Resolve(IPAddress ip, uint16_t port);             // 0 se irraggiungibile
+  uint16_t ListenPort(uint16_t port);
+  void SetConnectTimeout(unsigned long timeout);             // ms, default 1000
+}
+
+struct HostSocket;
+
+class EthernetClient : public Client
+{
+  public:
+    EthernetClient() {}
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port);
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buffer, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return _socket != nullptr; }
+    bool operator==(const EthernetClient &other) const { return _socket == other._socket; }
+    bool operator!=(const EthernetClient &other) const { return _socket != other._socket; }
+    void setConnectionTimeout(uint16_t timeout) { _connectTimeout = timeout; }
+    bool hostWaitReadable(unsigned long timeout) override;
+
+    // Solo host: socket gia connesso (EthernetServer::accept)
+    explicit EthernetClient(std::shared_ptr<HostSocket> socket) : _socket(socket) {}
+
+  private:
+    std::shared_ptr<HostSocket> _socket;
+    std::shared_ptr<HostSocket> _spare; // chiuso, riusato dalla prossima connect
+    unsigned long _connectTimeout = 0;
+};
+
+class Server : public Print
+{
+  public:
+    virtual void begin() = 0;
+};
+
+class EthernetServer : public Server
+{
+  public:
+    EthernetServer(uint16_t port) : _port(port) {}
+    ~EthernetServer();
+    void begin() override;
+    EthernetClient available(); // primo client con dati da leggere
+    EthernetClient accept();    // nuova connessione (client vuoto se nessuna)
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override; // a tutti i client
+    using Print::write;
+    explicit operator bool() { return _listen >= 0; }
+    uint16_t hostPort() const { return _hostPort; } // porta di loopback effettiva
+
+  private:
+    uint16_t _port;
+    uint16_t _hostPort = 0;
+    int _listen = -1;
+    std::vector<EthernetClient> _clients;
+};
+
+enum EthernetLinkStatus { Unknown, LinkON, LinkOFF };
+enum EthernetHardwareStatus { EthernetNoHardware, EthernetW5100, EthernetW5200, EthernetW5500 };
+
+class EthernetClass
+{
+  public:
+    int begin(uint8_t *mac, unsigned long timeout = 60000, unsigned long responseTimeout = 4000);
+    void begin(uint8_t *mac, IPAddress ip);
+    void begin(uint8_t *mac, IPAddress ip, IPAddress dns);
+    void begin(uint8_t *mac, IPAddress ip, IPAddress dns, IPAddress gateway);
+    void begin(uint8_t *mac, IPAddress ip, IPAddress dns, IPAddress gateway, IPAddress subnet);
+    int maintain() { return 0; }
+    EthernetLinkStatus linkStatus() { return LinkON; }
+    EthernetHardwareStatus hardwareStatus() { return EthernetW5500; }
+    IPAddress localIP() { return _ip; }
+    void init(uint8_t sspin = 10) { (void)sspin; }
+  private:
+    IPAddress _ip = IPAddress(127, 0, 0, 1);
+};
+
+extern EthernetClass Ethernet;
+
+#endif
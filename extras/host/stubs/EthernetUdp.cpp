@@ -0,0 +1,100 @@
+#include "EthernetUdp.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+uint8_t EthernetUDP::begin(uint16_t port) {
+  stop();
+
+  int _fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (_fd < 0)
+    return 0;
+
+  sockaddr_in _addr;
+  memset(&_addr, 0, sizeof(_addr));
+  _addr.sin_family = AF_INET;
+  _addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  _addr.sin_port = htons(HostNet::ListenPort(port));
+  if (bind(_fd, (sockaddr *)&_addr, sizeof(_addr)) < 0) {
+    close(_fd);
+    return 0;
+  }
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+
+  socklen_t _len = sizeof(_addr);
+  getsockname(_fd, (sockaddr *)&_addr, &_len);
+  this->_hostPort = ntohs(_addr.sin_port);
+  this->_fd = _fd;
+  return 1;
+}
+
+void EthernetUDP::stop() {
+  if (this->_fd >= 0) {
+    close(this->_fd);
+    this->_fd = -1;
+  }
+}
+
+int EthernetUDP::beginPacket(IPAddress ip, uint16_t port) {
+  this->_tx.clear();
+  this->_txIP = ip;
+  this->_txPort = port;
+  return 1;
+}
+
+int EthernetUDP::beginPacket(const char *host, uint16_t port) {
+  IPAddress _ip;
+  return _ip.fromString(host) ? beginPacket(_ip, port) : 0;
+}
+
+size_t EthernetUDP::write(const uint8_t *buffer, size_t size) {
+  this->_tx.insert(this->_tx.end(), buffer, buffer + size);
+  return size;
+}
+
+// Senza rotta il pacchetto si perde come su una rete reale, ma endPacket riesce comunque
+int EthernetUDP::endPacket() {
+  this->_sent++;
+  uint16_t _port = HostNet::Resolve(this->_txIP, this->_txPort);
+  if (_port == 0 || this->_fd < 0)
+    return 1;
+
+  sockaddr_in _addr;
+  memset(&_addr, 0, sizeof(_addr));
+  _addr.sin_family = AF_INET;
+  _addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  _addr.sin_port = htons(_port);
+  return sendto(this->_fd, this->_tx.data(), this->_tx.size(), 0, (sockaddr *)&_addr, sizeof(_addr)) >= 0;
+}
+
+int EthernetUDP::parsePacket() {
+  this->_rx.clear();
+  this->_rxPos = 0;
+  if (this->_fd < 0)
+    return 0;
+
+  uint8_t _buffer[1500];
+  sockaddr_in _from;
+  socklen_t _len = sizeof(_from);
+  ssize_t _n = recvfrom(this->_fd, _buffer, sizeof(_buffer), MSG_DONTWAIT, (sockaddr *)&_from, &_len);
+  if (_n <= 0)
+    return 0;
+
+  this->_rx.assign(_buffer, _buffer + _n);
+  this->_remoteIP = IPAddress(127, 0, 0, 1);
+  this->_remotePort = ntohs(_from.sin_port);
+  return (int)_n;
+}
+
+int EthernetUDP::read() {
+  return available() > 0 ? this->_rx[this->_rxPos++] : -1;
+}
+
+int EthernetUDP::read(unsigned char *buffer, size_t len) {
+  size_t _n = min((size_t)available(), len);
+  memcpy(buffer, this->_rx.data() + this->_rxPos, _n);
+  this->_rxPos += _n;
+  return (int)_n;
+}
@@ -0,0 +1,52 @@
+/*
+  EthernetUdp.h - stand-in di EthernetUDP per la build host, su socket UDP di loopback.
+  Porte e destinazioni passano da HostNet come per EthernetClient/EthernetServer (vedi Ethernet.h).
+*/
+
+#ifndef EthernetUdp_h
+#define EthernetUdp_h
+
+#include "Ethernet.h"
+#include "Udp.h"
+
+#define UDP_TX_PACKET_MAX_SIZE 24
+
+class EthernetUDP : public UDP
+{
+  public:
+    EthernetUDP() {}
+    ~EthernetUDP() { stop(); }
+    uint8_t begin(uint16_t port) override;
+    void stop() override;
+    int beginPacket(IPAddress ip, uint16_t port) override;
+    int beginPacket(const char *host, uint16_t port);
+    int endPacket() override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int parsePacket() override;
+    int available() override { return (int)(_rx.size() - _rxPos); }
+    int read() override;
+    int read(unsigned char *buffer, size_t len) override;
+    int read(char *buffer, size_t len) override { return read((unsigned char *)buffer, len); }
+    int peek() override { return available() > 0 ? _rx[_rxPos] : -1; }
+    void flush() override {}
+    IPAddress remoteIP() override { return _remoteIP; }
+    uint16_t remotePort() override { return _remotePort; }
+
+    uint16_t hostPort() const { return _hostPort; } // porta di loopback effettiva (solo host)
+    unsigned long hostSent() const { return _sent; } // pacchetti inviati (anche se scartati per mancanza di rotta)
+
+  private:
+    int _fd = -1;
+    uint16_t _hostPort = 0;
+    std::vector<uint8_t> _tx, _rx;
+    size_t _rxPos = 0;
+    IPAddress _txIP;
+    uint16_t _txPort = 0;
+    IPAddress _remoteIP;
+    uint16_t _remotePort = 0;
+    unsigned long _sent = 0;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "HostAlloc.h"
+#include <new>
+#include <stdlib.h>
+
+// Tipi banali: nessuna inizializzazione dinamica, utilizzabili anche dentro operator new
+static thread_local unsigned long _allocations = 0;
+static thread_local unsigned long _frees = 0;
+static thread_local unsigned long long _bytes = 0;
+
+namespace HostAlloc {
+  Counts Get() {
+    Counts _counts;
+    _counts.allocations = _allocations;
+    _counts.frees = _frees;
+    _counts.bytes = _bytes;
+    return _counts;
+  }
+
+  Counts Since(const Counts &start) {
+    Counts _now = Get();
+    _now.allocations -= start.allocations;
+    _now.frees -= start.frees;
+    _now.bytes -= start.bytes;
+    return _now;
+  }
+}
+
+static void* Allocate(size_t size) {
+  _allocations++;
+  _bytes += size;
+  return malloc(size ? size : 1);
+}
+
+static void* AllocateAligned(size_t size, std::align_val_t align) {
+  _allocations++;
+  _bytes += size;
+  size_t _align = (size_t)align;
+  size_t _size = (size + _align - 1) / _align * _align;
+  return aligned_alloc(_align, _size ? _size : _align);
+}
+
+static void Free(void *ptr) {
+  if (ptr == nullptr)
+    return;
+  _frees++;
+  free(ptr);
+}
+
+void* operator new(size_t size) {
+  void *_ptr = Allocate(size);
+  if (_ptr == nullptr) throw std::bad_alloc();
+  return _ptr;
+}
+
+void* operator new[](size_t size) {
+  void *_ptr = Allocate(size);
+  if (_ptr == nullptr) throw std::bad_alloc();
+  return _ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t &) noexcept { return Allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t &) noexcept { return Allocate(size); }
+
+void* operator new(size_t size, std::align_val_t align) {
+  void *_ptr = AllocateAligned(size, align);
+  if (_ptr == nullptr) throw std::bad_alloc();
+  return _ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+  void *_ptr = AllocateAligned(size, align);
+  if (_ptr == nullptr) throw std::bad_alloc();
+  return _ptr;
+}
+
+void operator delete(void *ptr) noexcept { Free(ptr); }
+void operator delete[](void *ptr) noexcept { Free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { Free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { Free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { Free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { Free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { Free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { Free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { Free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { Free(ptr); }
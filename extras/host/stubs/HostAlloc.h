@@ -0,0 +1,29 @@
+/*
+  HostAlloc.h - contatore di allocazioni di heap per i test e i benchmark host.
+
+  HostAlloc.cpp sostituisce gli operator new/delete globali: ogni thread conta le proprie allocazioni
+  (thread_local), cosi il thread del server Modbus simulato non sporca le misure del loop.
+  Le sostituzioni entrano nell'eseguibile solo se usa HostAlloc (stesso file oggetto della libreria).
+
+    HostAlloc::Counts _start = HostAlloc::Get();
+    dm.Update(...);
+    unsigned long _news = HostAlloc::Since(_start).allocations;
+*/
+
+#ifndef HostAlloc_h
+#define HostAlloc_h
+
+#include <stddef.h>
+
+namespace HostAlloc {
+  struct Counts {
+    unsigned long allocations; // chiamate a operator new / new[]
+    unsigned long frees;       // chiamate a operator delete / delete[] con puntatore non nullo
+    unsigned long long bytes;  // byte richiesti
+  };
+
+  Counts Get();                   // totali del thread corrente
+  Counts Since(const Counts &start); // differenza da un Get precedente dello stesso thread
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+  List.hpp - stand-in della libreria List per la build host.
+
+  Lista concatenata con un nodo allocato per elemento come l'originale, cosi il contatore di
+  allocazioni dei test vede lo stesso traffico di heap che si ha sulla scheda.
+*/
+
+#ifndef List_hpp
+#define List_hpp
+
+template<typename T>
+class List
+{
+  public:
+    List() {}
+    List(const List &other) { for (Node *_n = other._head; _n; _n = _n->next) add(_n->value); }
+    List& operator=(const List &other) {
+      if (this != &other) { clear(); for (Node *_n = other._head; _n; _n = _n->next) add(_n->value); }
+      return *this;
+    }
+    ~List() { clear(); }
+
+    void add(T value) {
+      Node *_node = new Node{value, nullptr};
+      if (_tail) _tail->next = _node; else _head = _node;
+      _tail = _node;
+      _size++;
+    }
+
+    void addAtIndex(int index, T value) {
+      if (index <= 0 || _head == nullptr) {
+        Node *_node = new Node{value, _head};
+        _head = _node;
+        if (!_tail) _tail = _node;
+        _size++;
+        return;
+      }
+      if (index >= _size) { add(value); return; }
+      Node *_prev = nodeAt(index - 1);
+      _prev->next = new Node{value, _prev->next};
+      _size++;
+    }
+
+    T get(int index) const { return nodeAt(index)->value; }
+    T getValue(int index) const { return get(index); }
+    T* getPointer(int index) { return &nodeAt(index)->value; }
+
+    void remove(int index) {
+      if (index < 0 || index >= _size) return;
+      Node *_node;
+      if (index == 0) {
+        _node = _head;
+        _head = _node->next;
+        if (_tail == _node) _tail = nullptr;
+      } else {
+        Node *_prev = nodeAt(index - 1);
+        _node = _prev->next;
+        _prev->next = _node->next;
+        if (_tail == _node) _tail = _prev;
+      }
+      delete _node;
+      _size--;
+    }
+
+    void clear() {
+      while (_head) { Node *_next = _head->next; delete _head; _head = _next; }
+      _tail = nullptr;
+      _size = 0;
+    }
+
+    int getSize() const { return _size; }
+    bool isEmpty() const { return _size == 0; }
+
+  private:
+    struct Node { T value; Node *next; };
+    Node* nodeAt(int index) const { Node *_n = _head; while (index-- > 0 && _n) _n = _n->next; return _n; }
+
+    Node *_head = nullptr;
+    Node *_tail = nullptr;
+    int _size = 0;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+  ModbusClient.h - stand-in del client di ArduinoModbus per la build host.
+
+  Stessa API (requestFrom/read, coilWrite, holdingRegisterWrite, beginTransmission/write/endTransmission,
+  lastError) con buffer fissi: nessuna allocazione per richiesta, cosi i contatori di allocazioni
+  dei test misurano solo la libreria. Il trasporto e' in ModbusTCPClient (ArduinoModbus.h).
+*/
+
+#ifndef _MODBUS_CLIENT_H_INCLUDED
+#define _MODBUS_CLIENT_H_INCLUDED
+
+#include "Arduino.h"
+
+#define COILS 0
+#define DISCRETE_INPUTS 1
+#define HOLDING_REGISTERS 2
+#define INPUT_REGISTERS 3
+
+const int MODBUS_HOST_MAX_PDU = 253;
+const int MODBUS_HOST_MAX_VALUES = 2000;
+
+class ModbusClient
+{
+  public:
+    virtual ~ModbusClient() {}
+
+    int coilRead(int address) { return coilRead(0x00, address); }
+    int coilRead(int id, int address);
+    int discreteInputRead(int address) { return discreteInputRead(0x00, address); }
+    int discreteInputRead(int id, int address);
+    long holdingRegisterRead(int address) { return holdingRegisterRead(0x00, address); }
+    long holdingRegisterRead(int id, int address);
+    long inputRegisterRead(int address) { return inputRegisterRead(0x00, address); }
+    long inputRegisterRead(int id, int address);
+
+    int coilWrite(int address, uint8_t value) { return coilWrite(0x00, address, value); }
+    int coilWrite(int id, int address, uint8_t value);
+    int holdingRegisterWrite(int address, uint16_t value) { return holdingRegisterWrite(0x00, address, value); }
+    int holdingRegisterWrite(int id, int address, uint16_t value);
+
+    int beginTransmission(int type, int address, int nb) { return beginTransmission(0x00, type, address, nb); }
+    int beginTransmission(int id, int type, int address, int nb);
+    int write(unsigned int value);
+    int endTransmission();
+
+    int requestFrom(int type, int address, int nb) { return requestFrom(0x00, type, address, nb); }
+    int requestFrom(int id, int type, int address, int nb);
+    int available();
+    long read();
+
+    const char* lastError();
+    virtual void end() {}
+    void setTimeout(unsigned long ms) { _timeout = ms; }
+
+  protected:
+    // PDU di richiesta -> PDU di risposta (lunghezza, -1 con _lastError impostato)
+    virtual int transact(uint8_t id, const uint8_t *request, int requestLen, uint8_t *response, int responseCap) = 0;
+    void setError(const char *error) { _lastError = error; }
+
+    unsigned long _timeout = 1000;
+
+  private:
+    int exchange(uint8_t id, const uint8_t *request, int requestLen, uint8_t *response, int expectedFc);
+
+    const char *_lastError = nullptr;
+    uint16_t _values[MODBUS_HOST_MAX_VALUES];
+    int _available = 0;
+    int _read = 0;
+
+    int _txId = 0, _txType = -1, _txAddress = 0, _txNb = 0, _txCount = 0;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SPI_h
+#define SPI_h
+
+#include "Arduino.h"
+
+class SPIClass
+{
+  public:
+    void begin() {}
+    void end() {}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,30 @@
+/*
+  HostTest.h - asserzioni minime per i test host: ogni test e' un eseguibile registrato in ctest,
+  main ritorna HostTestResult() (0 = tutto ok).
+*/
+
+#ifndef HostTest_h
+#define HostTest_h
+
+#include <stdio.h>
+
+inline int& HostTestFailures() {
+  static int _failures = 0;
+  return _failures;
+}
+
+#define CHECK(cond) \
+  do { if (!(cond)) { HostTestFailures()++; fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { long long _checkA = (long long)(a), _checkB = (long long)(b); \
+       if (_checkA != _checkB) { HostTestFailures()++; fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _checkA, _checkB); } } while (0)
+
+#define RUN_TEST(fn) \
+  do { int _before = HostTestFailures(); fn(); fprintf(stderr, "%s %s\n", HostTestFailures() == _before ? "[ OK ]" : "[FAIL]", #fn); } while (0)
+
+inline int HostTestResult() {
+  return HostTestFailures() == 0 ? 0 : 1;
+}
+
+#endif
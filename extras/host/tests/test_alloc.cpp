@@ -0,0 +1,106 @@
+// HostAlloc: conteggio per thread delle allocazioni, e letture Modbus decodificate sullo span del chiamante
+// (GenericPrgDevice::Read/ReadBlock) senza heap dopo la connessione
+#include "HostTest.h"
+#include "HostAlloc.h"
+#include "HostModbusServer.h"
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <ArduinoModbus.h>
+#include "MgsModbus.h"
+#include "PLC.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const IPAddress GATEWAY(192, 168, 1, 50);
+
+static GenericPrgDevice::GenericPrgDeviceChannel channels[] = {
+  {GenericPrgDevice::DI, GenericPrgDevice::Discrete, 0, 16, 1},
+  {GenericPrgDevice::AI, GenericPrgDevice::Input, 100, 8, 1},
+  {GenericPrgDevice::AI, GenericPrgDevice::Hold, 200, 4, 1},
+};
+
+// Passando dai puntatori volatile il compilatore non puo eliminare le coppie new/delete
+static int *volatile sink;
+
+static void TestCounts() {
+  HostAlloc::Counts _start = HostAlloc::Get();
+  sink = new int(1);
+  delete sink;
+  sink = new int[10];
+  delete[] sink;
+  std::vector<long> _vector;
+  _vector.reserve(64);
+
+  HostAlloc::Counts _delta = HostAlloc::Since(_start);
+  CHECK_EQ(_delta.allocations, 3);
+  CHECK_EQ(_delta.frees, 2);
+  CHECK(_delta.bytes >= sizeof(int) * 11 + sizeof(long) * 64);
+
+  _start = HostAlloc::Get();
+  delete (int *)nullptr;
+  CHECK_EQ(HostAlloc::Since(_start).frees, 0);
+}
+
+// Le allocazioni di un altro thread (es. il server Modbus simulato) non entrano nei conteggi del loop
+static void TestPerThread() {
+  std::atomic<bool> _go(false);
+  std::atomic<unsigned long> _workerAllocations(0);
+  std::thread _worker([&]() {
+    while (!_go) std::this_thread::yield();
+    HostAlloc::Counts _start = HostAlloc::Get();
+    for (int i = 0; i < 10; i++) {
+      sink = new int(i);
+      delete sink;
+    }
+    _workerAllocations = HostAlloc::Since(_start).allocations;
+  });
+
+  HostAlloc::Counts _start = HostAlloc::Get();
+  _go = true;
+  _worker.join();
+  CHECK_EQ(_workerAllocations, 10);
+  CHECK_EQ(HostAlloc::Since(_start).allocations, 0);
+}
+
+static void TestReadsDoNotAllocate() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, MB_PORT, _gateway.Port());
+  _gateway.SetDiscrete(1, 3, true);
+  _gateway.SetInput(1, 105, 1234);
+  _gateway.SetHolding(1, 201, 42);
+
+  GenericPrgDevice _device("io", GATEWAY, 1, channels, ARRAY_SIZE(channels), {10, 11, 12}, 3, High);
+  EthernetClient _socket;
+  ModbusTCPClient _client(_socket);
+  CHECK(_client.begin(GATEWAY, MB_PORT));
+
+  uint16_t _values[MODBUS_MAX_READ_BITS];
+  HostAlloc::Counts _start = HostAlloc::Get();
+  for (int n = 0; n < 50; n++) {
+    for (int channel = 0; channel < ARRAY_SIZE(channels); channel++)
+      _device.Read(_client, channel, _values, MODBUS_MAX_READ_BITS);
+    for (int block = 0; block < (int)_device.GetReadBlocksSize(); block++)
+      _device.ReadBlock(_client, block, _values, MODBUS_MAX_READ_BITS);
+  }
+  HostAlloc::Counts _delta = HostAlloc::Since(_start);
+  CHECK_EQ(_delta.allocations, 0);
+  CHECK_EQ(_delta.frees, 0);
+
+  GenericPrgDevice::structRead _read = _device.Read(_client, 1, _values, MODBUS_MAX_READ_BITS);
+  CHECK_EQ(_read.items, 8);
+  CHECK_EQ(_values[5], 1234);
+  _read = _device.Read(_client, 0, _values, MODBUS_MAX_READ_BITS);
+  CHECK_EQ(_read.items, 16);
+  CHECK_EQ(_values[3], 1);
+}
+
+int main() {
+  HostSerial::Mute(true);
+  RUN_TEST(TestCounts);
+  RUN_TEST(TestPerThread);
+  RUN_TEST(TestReadsDoNotAllocate);
+  return HostTestResult();
+}
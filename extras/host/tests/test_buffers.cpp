@@ -0,0 +1,136 @@
+// ModbusBuffer senza rete: diagnostica del grafo di routing (RouteTracker), DUMMY_AREA e journal per tipo
+#include "HostTest.h"
+#include <Arduino.h>
+#include "Buffers.h"
+#include <algorithm>
+
+static bool Contains(const std::vector<int> &areas, int area) {
+  return std::find(areas.begin(), areas.end(), area) != areas.end();
+}
+
+// Piu sorgenti verso la stessa area che inoltra: una sola voce in chains
+static void TestChainsAreUnique() {
+  int _targets[8] = {0, 3, 3, 4, 0, 0, 3, 0};
+  RouteTracker _tracker;
+  _tracker.build(_targets, 8, DUMMY_AREA);
+  CHECK_EQ(_tracker.getChains().size(), 1);
+  CHECK(Contains(_tracker.getChains(), 3));
+  CHECK(_tracker.getCycles().empty());
+  CHECK(_tracker.getInvalidTargets().empty());
+}
+
+// L'area 0 instrada: i percorsi che finiscono su 0 (non instradata) o su DUMMY_AREA non la rivisitano
+static void TestPathsStopAtEnd() {
+  int _targets[6] = {2, 0, 5, 4, DUMMY_AREA, 3};
+  RouteTracker _tracker;
+  _tracker.build(_targets, 6, DUMMY_AREA);
+  CHECK(_tracker.getCycles().empty());
+  CHECK(_tracker.getInvalidTargets().empty());
+  CHECK_EQ(_tracker.getChains().size(), 3); // 2, 5 e 3 ricevono e inoltrano
+  CHECK(Contains(_tracker.getChains(), 2));
+  CHECK(Contains(_tracker.getChains(), 5));
+  CHECK(Contains(_tracker.getChains(), 3));
+
+  int _cycle[5] = {0, 2, 3, 1, DUMMY_AREA};
+  _tracker.build(_cycle, 5, DUMMY_AREA);
+  CHECK_EQ(_tracker.getCycles().size(), 3);
+  CHECK(Contains(_tracker.getCycles(), 1));
+  CHECK(!Contains(_tracker.getCycles(), 4));
+}
+
+// Buffer con piu di 1000 aree: l'area 999 e' un'area come le altre, DUMMY_AREA scarta il valore
+static void TestDummyAreaOutsideBuffer() {
+  ModbusBuffer _buffer(1200);
+  _buffer.SetElement(998, 999, true, false, false, (char *)"src");
+  _buffer.SetElement(999, 1100, true, false, false, (char *)"mid");
+  _buffer.SetElement(1100, 0, true, false, false, (char *)"dst");
+  _buffer.SetElement(10, DUMMY_AREA, true, false, false, (char *)"sink");
+  _buffer.Init();
+
+  CHECK(_buffer.getRoutingInvalidTargets().empty());
+  CHECK(_buffer.getRoutingCycles().empty());
+  CHECK_EQ(_buffer.getRoutingChains().size(), 1);
+  CHECK(Contains(_buffer.getRoutingChains(), 999));
+
+  CHECK(_buffer.WriteElement(999, Field, 42));
+  BufferSourceInfo _data;
+  CHECK(_buffer.GetData(999, Field, _data));
+  CHECK_EQ(_data.value, 42);
+  CHECK(_buffer.HasChanged(999, Field));
+
+  CHECK(_buffer.WriteElement(DUMMY_AREA, Field, 7));
+  CHECK(!_buffer.WriteElement(1200, Field, 7));
+}
+
+static int Drain(ModbusBufferJournal *journal, ModbusBufferJournalCursor &cursor, ModbusBufferJournalEntry *last) {
+  int _count = 0;
+  ModbusBufferJournalEntry _entry;
+  while (journal->Read(cursor, _entry) == JournalEntry) {
+    *last = _entry;
+    _count++;
+  }
+  return _count;
+}
+
+// Journal Field di default: le scritture dei pannelli non ci finiscono, gli altri tipi si abilitano a parte
+static void TestJournalPerType() {
+  ModbusBuffer _buffer(16);
+  _buffer.SetElement(1, 0, true, true, false, (char *)"a");
+  _buffer.Init();
+  _buffer.EnableJournal(8);
+  CHECK(_buffer.GetJournal() == _buffer.GetJournal(Field));
+  CHECK(_buffer.GetJournal(FromPanel) == nullptr);
+  CHECK(_buffer.GetJournal(ToPanel) == nullptr);
+
+  ModbusBufferJournalCursor _field = _buffer.GetJournal(Field)->Subscribe();
+  _buffer.WriteElement(1, FromPanel, 5);
+  _buffer.WriteElement(1, ToPanel, 6);
+  _buffer.WriteElement(1, Field, 7);
+  ModbusBufferJournalEntry _last;
+  CHECK_EQ(Drain(_buffer.GetJournal(Field), _field, &_last), 1);
+  CHECK_EQ(_last.bufferType, Field);
+  CHECK_EQ(_last.value, 7);
+
+  _buffer.EnableJournal(8, FromPanel);
+  ModbusBufferJournalCursor _panel = _buffer.GetJournal(FromPanel)->Subscribe();
+  _buffer.WriteElement(1, FromPanel, 8);
+  _buffer.WriteElement(1, Field, 9);
+  CHECK_EQ(Drain(_buffer.GetJournal(FromPanel), _panel, &_last), 1);
+  CHECK_EQ(_last.bufferType, FromPanel);
+  CHECK_EQ(_last.value, 8);
+  CHECK_EQ(Drain(_buffer.GetJournal(Field), _field, &_last), 1);
+  CHECK_EQ(_last.value, 9);
+}
+
+// Scrittura fallita: RestoreElement rialza il flag e lo annuncia ai lettori del journal, una volta sola
+static void TestJournalRestore() {
+  ModbusBuffer _buffer(16);
+  _buffer.SetElement(3, 0, false, false, false, (char *)"out");
+  _buffer.Init();
+  _buffer.EnableJournal(8);
+  ModbusBufferJournalCursor _cursor = _buffer.GetJournal()->Subscribe();
+
+  _buffer.WriteElement(3, Field, 1);
+  _buffer.ResetElement(3, Field);
+  _buffer.RestoreElement(3, Field);
+  _buffer.RestoreElement(3, Field);
+  _buffer.RestoreElement(4, Field); // mai scritta: niente da rialzare
+  CHECK(_buffer.HasChanged(3, Field));
+  CHECK(!_buffer.HasChanged(4, Field));
+
+  ModbusBufferJournalEntry _last;
+  CHECK_EQ(Drain(_buffer.GetJournal(), _cursor, &_last), 2);
+  CHECK_EQ(_last.modbusArea, 3);
+  CHECK_EQ(_last.prevValue, 1);
+  CHECK_EQ(_last.value, 1);
+}
+
+int main() {
+  HostSerial::Mute(true);
+  RUN_TEST(TestChainsAreUnique);
+  RUN_TEST(TestPathsStopAtEnd);
+  RUN_TEST(TestDummyAreaOutsideBuffer);
+  RUN_TEST(TestJournalPerType);
+  RUN_TEST(TestJournalRestore);
+  return HostTestResult();
+}
@@ -0,0 +1,89 @@
+// DomoManager completo su loopback con clock simulato: lettura da gateway, routing e scrittura
+// sull'uscita, come su scheda (Domo.h e' header-only e va incluso in un solo file per eseguibile)
+#include "HostTest.h"
+#include "HostModbusServer.h"
+#include <Arduino.h>
+#include "Domo.h"
+
+static GenericPrgDevice::GenericPrgDeviceChannel channels[] = {
+  {GenericPrgDevice::DI, GenericPrgDevice::Discrete, 0, 2, 1},
+  {GenericPrgDevice::DO, GenericPrgDevice::Coil, 0, 2, 1},
+};
+
+static int changes = 0;
+static int routes = 0;
+static int activities = 0;
+
+static void InitDevices(DomoManager &dm) {
+  dm.addDevice("io", IPAddress(192, 168, 1, 10), 1, channels, ARRAY_SIZE(channels), {10, 11, 12, 13}, 3, High);
+}
+
+static void InitBuffer(DomoManager &dm) {
+  ModbusBuffer &_buffer = dm.GetBuffer();
+  _buffer.SetElement(10, 12, true, false, false, (char *)"in0");
+  _buffer.SetElement(11, 13, true, false, false, (char *)"in1");
+  _buffer.SetElement(12, 0, false, false, false, (char *)"out0");
+  _buffer.SetElement(13, 0, false, false, false, (char *)"out1");
+  _buffer.Init();
+}
+
+static void SomethingChanged(ModbusBuffer &) { changes++; }
+static void Route(BufferSourceInfo, int, ModbusBuffer &) { routes++; }
+static void Activity(ModbusBuffer &) { activities++; }
+
+static void TestUpdateRoutesInputsToOutputs() {
+  HostNet::Reset();
+  HostClock::Simulate(1000);
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(IPAddress(192, 168, 1, 10), 502, _gateway.Port());
+  _gateway.SetDiscrete(1, 1, true);
+
+  DomoManager _dm(20, InitDevices, InitBuffer, 2, 3, 4, 5);
+  _dm.Begin(SomethingChanged, Route, Activity);
+
+  EthernetClient _socket;
+  ModbusTCPClient _client(_socket);
+  HostNet::Listen(502, 0);
+  EthernetServer _panels(502);
+  _panels.begin();
+  MgsModbus _server;
+
+  for (int i = 0; i < 20; i++) {
+    _dm.Update(_panels, _server, _client);
+    HostClock::AdvanceMillis(50);
+  }
+
+  BufferSourceInfo _data;
+  CHECK(_dm.GetBuffer().GetData(11, Field, _data));
+  CHECK_EQ(_data.value, 1);
+  CHECK(_gateway.GetCoil(1, 1));
+  CHECK(!_gateway.GetCoil(1, 0));
+  CHECK(routes >= 1);
+  CHECK(changes >= 1);
+  CHECK(activities > 0);
+
+  _gateway.SetDiscrete(1, 1, false);
+  _gateway.SetDiscrete(1, 0, true);
+  for (int i = 0; i < 20; i++) {
+    _dm.Update(_panels, _server, _client);
+    HostClock::AdvanceMillis(50);
+  }
+  CHECK(_gateway.GetCoil(1, 0));
+  CHECK(!_gateway.GetCoil(1, 1));
+  CHECK(_dm.GetTimings().units.size() == 1);
+  CHECK(_dm.GetTimings().units[0].stats.responses > 0);
+
+  UnitTiming _unit;
+  CHECK(_dm.GetUnitTiming(IPAddress(192, 168, 1, 10), 1, _unit));
+  CHECK_EQ(_unit.unitId, 1);
+  CHECK_EQ(_unit.stats.responses, _dm.GetTimings().units[0].stats.responses);
+  CHECK(!_dm.GetUnitTiming(IPAddress(192, 168, 1, 10), 2, _unit));
+  CHECK(!_dm.GetUnitTiming(IPAddress(192, 168, 1, 11), 1, _unit));
+}
+
+int main() {
+  HostSerial::Mute(true);
+  RUN_TEST(TestUpdateRoutesInputsToOutputs);
+  return HostTestResult();
+}
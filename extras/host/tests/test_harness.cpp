@@ -0,0 +1,178 @@
+// Stand-in della build host: clock simulato, pin, TCP/UDP su loopback, ModbusTCPClient contro
+// HostModbusServer e un device di PLC letto e scritto attraverso lo stack reale
+#include "HostTest.h"
+#include "HostModbusServer.h"
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+#include <ArduinoModbus.h>
+#include "Buffers.h"
+#include "PLC.h"
+
+static void TestClock() {
+  HostClock::Simulate(1000);
+  CHECK_EQ(millis(), 1000);
+  CHECK_EQ(micros(), 1000000);
+  delay(5);
+  CHECK_EQ(millis(), 1005);
+  HostClock::Advance(250);
+  CHECK_EQ(micros(), 1005250);
+  HostClock::Real();
+  unsigned long _t0 = micros();
+  delay(2);
+  CHECK(micros() - _t0 >= 2000);
+}
+
+static void TestPins() {
+  digitalWrite(13, HIGH);
+  CHECK_EQ(digitalRead(13), HIGH);
+  digitalWrite(13, !digitalRead(13));
+  CHECK_EQ(digitalRead(13), LOW);
+  CHECK_EQ(HostPins::Writes(13), 2);
+}
+
+static void TestTcpLoopback() {
+  HostNet::Reset();
+  HostNet::Listen(502, 0);
+  EthernetServer _server(502);
+  _server.begin();
+  CHECK(_server.hostPort() != 0);
+  HostNet::Route(IPAddress(192, 168, 1, 50), 502, _server.hostPort());
+
+  EthernetClient _client;
+  CHECK_EQ(_client.connect(IPAddress(192, 168, 1, 51), 502), 0); // nessuna rotta
+  CHECK_EQ(_client.connect(IPAddress(192, 168, 1, 50), 502), 1);
+
+  EthernetClient _incoming;
+  for (int i = 0; i < 100 && !_incoming; i++) { _incoming = _server.accept(); delay(1); }
+  CHECK(_incoming);
+
+  _client.write((const uint8_t *)"ping", 4);
+  CHECK(_incoming.hostWaitReadable(1000));
+  uint8_t _buffer[8] = {0};
+  CHECK_EQ(_incoming.read(_buffer, sizeof(_buffer)), 4);
+  CHECK(memcmp(_buffer, "ping", 4) == 0);
+
+  _incoming.write((const uint8_t *)"pong", 4);
+  CHECK(_client.hostWaitReadable(1000));
+  CHECK_EQ(_client.available(), 4);
+
+  // Chiuso dal peer: resta connesso finche ci sono dati da leggere
+  _incoming.stop();
+  delay(5);
+  CHECK(_client.connected());
+  CHECK_EQ(_client.read(_buffer, sizeof(_buffer)), 4);
+  CHECK(!_client.connected());
+}
+
+static void TestUdpLoopback() {
+  HostNet::Reset();
+  HostNet::Listen(8888, 0);
+  HostNet::Listen(8889, 0);
+  EthernetUDP _a, _b;
+  CHECK(_a.begin(8888));
+  CHECK(_b.begin(8889));
+  HostNet::Route(IPAddress(192, 168, 1, 99), 9999, _b.hostPort());
+
+  _a.beginPacket(IPAddress(192, 168, 1, 99), 9999);
+  _a.print("Check|Ok");
+  CHECK(_a.endPacket());
+
+  int _size = 0;
+  for (int i = 0; i < 100 && _size == 0; i++) { _size = _b.parsePacket(); if (!_size) delay(1); }
+  CHECK_EQ(_size, 8);
+  char _buffer[UDP_TX_PACKET_MAX_SIZE] = {0};
+  _b.read(_buffer, UDP_TX_PACKET_MAX_SIZE);
+  CHECK(strcmp(_buffer, "Check|Ok") == 0);
+
+  // Senza rotta il pacchetto si perde ma viene contato
+  _a.beginPacket(IPAddress(10, 0, 0, 1), 9999);
+  _a.print("lost");
+  CHECK(_a.endPacket());
+  CHECK_EQ(_a.hostSent(), 2);
+}
+
+static void TestModbusClient() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(IPAddress(192, 168, 1, 20), 502, _gateway.Port());
+  _gateway.SetHolding(1, 100, 1234);
+  _gateway.SetHolding(1, 101, 4321);
+  _gateway.SetDiscrete(2, 7, true);
+
+  EthernetClient _socket;
+  ModbusTCPClient _mb(_socket);
+  CHECK_EQ(_mb.begin(IPAddress(192, 168, 1, 20), 502), 1);
+  CHECK(_mb.connected());
+
+  CHECK_EQ(_mb.requestFrom(1, HOLDING_REGISTERS, 100, 2), 2);
+  CHECK_EQ(_mb.read(), 1234);
+  CHECK_EQ(_mb.read(), 4321);
+  CHECK_EQ(_mb.read(), -1);
+
+  CHECK_EQ(_mb.requestFrom(2, DISCRETE_INPUTS, 0, 10), 10);
+  for (int i = 0; i < 10; i++)
+    CHECK_EQ(_mb.read(), i == 7);
+
+  CHECK_EQ(_mb.coilWrite(1, 5, 1), 1);
+  CHECK(_gateway.GetCoil(1, 5));
+  CHECK_EQ(_mb.beginTransmission(1, HOLDING_REGISTERS, 10, 3), 1);
+  _mb.write(7); _mb.write(8); _mb.write(9);
+  CHECK_EQ(_mb.endTransmission(), 1);
+  CHECK_EQ(_gateway.GetHolding(1, 11), 8);
+
+  _gateway.SetException(3, 2);
+  CHECK_EQ(_mb.requestFrom(3, INPUT_REGISTERS, 0, 1), 0);
+  CHECK(strcmp(_mb.lastError(), "Illegal data address") == 0);
+
+  _gateway.SetSilent(4, true);
+  _mb.setTimeout(50);
+  CHECK_EQ(_mb.holdingRegisterWrite(4, 0, 1), 0);
+  CHECK(strcmp(_mb.lastError(), "Connection timed out") == 0);
+
+  CHECK_EQ(_gateway.Requests().size(), 6);
+  _mb.stop();
+}
+
+// GenericPrgDevice e ModbusBuffer della libreria sopra gli stand-in
+static void TestLibraryStack() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(IPAddress(192, 168, 1, 30), 502, _gateway.Port());
+  for (int i = 0; i < 4; i++)
+    _gateway.SetHolding(5, 40 + i, 100 + i);
+
+  GenericPrgDevice::GenericPrgDeviceChannel _channels[] = {
+    {GenericPrgDevice::AI, GenericPrgDevice::Hold, 40, 4, 1},
+  };
+  GenericPrgDevice _device("plc", IPAddress(192, 168, 1, 30), 5, _channels, ARRAY_SIZE(_channels), {10, 11, 12, 13}, 3, Normal);
+
+  EthernetClient _socket;
+  ModbusTCPClient _mb(_socket);
+  CHECK(_mb.begin(IPAddress(192, 168, 1, 30), 502));
+  uint16_t _values[8];
+  GenericPrgDevice::structRead _read = _device.Read(_mb, 0, _values, 8);
+  CHECK(_read.ok);
+  CHECK_EQ(_read.items, 4);
+  CHECK_EQ(_values[3], 103);
+
+  ModbusBuffer _buffer(20);
+  _buffer.Init();
+  _buffer.WriteElement(_device.GetArea(0, 3), Field, _values[3]);
+  BufferSourceInfo _data;
+  CHECK(_buffer.GetData(13, Field, _data));
+  CHECK_EQ(_data.value, 103);
+}
+
+int main() {
+  HostSerial::Mute(true);
+  RUN_TEST(TestClock);
+  RUN_TEST(TestPins);
+  RUN_TEST(TestTcpLoopback);
+  RUN_TEST(TestUdpLoopback);
+  RUN_TEST(TestModbusClient);
+  RUN_TEST(TestLibraryStack);
+  return HostTestResult();
+}
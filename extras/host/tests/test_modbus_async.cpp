@@ -0,0 +1,170 @@
+// ModbusAsyncClient contro HostModbusServer: letture e scritture in pipeline, eccezioni (anche con
+// codice 0), eco di scrittura sbagliata e timeout
+#include "HostTest.h"
+#include "HostModbusServer.h"
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "ModbusAsync.h"
+
+static const IPAddress GATEWAY(192, 168, 1, 30);
+
+struct Collected {
+  int count = 0;
+  uint8_t status[MB_ASYNC_MAX_INFLIGHT];
+  int tag[MB_ASYNC_MAX_INFLIGHT];
+  bool hasData[MB_ASYNC_MAX_INFLIGHT];
+  uint8_t data[MB_ASYNC_MAX_INFLIGHT][8];
+};
+
+static void Collect(void *context, const ModbusAsyncResult &result) {
+  Collected *_c = (Collected *)context;
+  if (_c->count >= MB_ASYNC_MAX_INFLIGHT)
+    return;
+  int i = _c->count++;
+  _c->status[i] = result.status;
+  _c->tag[i] = result.request->tag.index;
+  _c->hasData[i] = result.data != nullptr;
+  if (result.data != nullptr)
+    memcpy(_c->data[i], result.data, min((int)result.byteCount, 8));
+}
+
+// Poll finche tutte le richieste aperte sono chiuse (risposta, eccezione o timeout)
+static void Drain(ModbusAsyncClient &client, Collected &collected) {
+  unsigned long _start = millis();
+  while (client.InFlight() > 0 && millis() - _start < 2000) {
+    client.Poll(Collect, &collected);
+    delay(1);
+  }
+}
+
+static ModbusAsyncTag Tag(int index) {
+  ModbusAsyncTag _tag;
+  _tag.id = 0;
+  _tag.index = index;
+  _tag.offset = 0;
+  return _tag;
+}
+
+static void TestReadsPipelined() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, 502, _gateway.Port());
+  _gateway.SetHolding(1, 10, 0x1234);
+  _gateway.SetDiscrete(2, 3, true);
+
+  ModbusAsyncClient _client;
+  _client.Begin(GATEWAY, 4, 500);
+  CHECK(_client.Request(1, MB_FC_READ_REGISTERS, 10, 1, nullptr, Tag(0)));
+  CHECK(_client.Request(2, MB_FC_READ_DISCRETE_INPUT, 0, 8, nullptr, Tag(1)));
+  CHECK_EQ(_client.InFlight(), 2);
+
+  Collected _c;
+  Drain(_client, _c);
+  CHECK_EQ(_c.count, 2);
+  CHECK_EQ(_c.status[0], MB_ASYNC_OK);
+  CHECK(_c.hasData[0]);
+  CHECK_EQ(_c.data[0][0], 0x12);
+  CHECK_EQ(_c.data[0][1], 0x34);
+  CHECK_EQ(_c.status[1], MB_ASYNC_OK);
+  CHECK_EQ(_c.data[1][0], 0x08);
+}
+
+static void TestExceptions() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, 502, _gateway.Port());
+
+  ModbusAsyncClient _client;
+  _client.Begin(GATEWAY, 4, 500);
+
+  // Codice di eccezione 0x00: non deve passare per MB_ASYNC_OK (data resta nullptr)
+  _gateway.SetException(1, 0);
+  _gateway.SetException(2, 2);
+  long _one = 1;
+  CHECK(_client.Request(1, MB_FC_READ_REGISTERS, 0, 2, nullptr, Tag(0)));
+  CHECK(_client.Request(1, MB_FC_WRITE_REGISTER, 0, 1, &_one, Tag(1)));
+  CHECK(_client.Request(2, MB_FC_READ_COILS, 0, 4, nullptr, Tag(2)));
+
+  Collected _c;
+  Drain(_client, _c);
+  CHECK_EQ(_c.count, 3);
+  CHECK_EQ(_c.status[0], MB_ASYNC_BAD_RESPONSE);
+  CHECK(!_c.hasData[0]);
+  CHECK_EQ(_c.status[1], MB_ASYNC_BAD_RESPONSE);
+  CHECK_EQ(_c.status[2], 2);
+  CHECK(!_c.hasData[2]);
+}
+
+static void TestWriteEcho() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, 502, _gateway.Port());
+
+  ModbusAsyncClient _client;
+  _client.Begin(GATEWAY, 8, 500);
+
+  long _values[3] = {7, 8, 9};
+  long _bits[3] = {1, 0, 1};
+  CHECK(_client.Request(1, MB_FC_WRITE_REGISTER, 20, 1, _values, Tag(0)));
+  CHECK(_client.Request(1, MB_FC_WRITE_COIL, 21, 1, _bits, Tag(1)));
+  CHECK(_client.Request(1, MB_FC_WRITE_MULTIPLE_REGISTERS, 30, 3, _values, Tag(2)));
+  CHECK(_client.Request(1, MB_FC_WRITE_MULTIPLE_COILS, 40, 3, _bits, Tag(3)));
+
+  Collected _c;
+  Drain(_client, _c);
+  CHECK_EQ(_c.count, 4);
+  for (int i = 0; i < _c.count; i++)
+    CHECK_EQ(_c.status[i], MB_ASYNC_OK);
+  CHECK_EQ(_gateway.GetHolding(1, 20), 7);
+  CHECK(_gateway.GetCoil(1, 21));
+  CHECK_EQ(_gateway.GetHolding(1, 32), 9);
+  CHECK(_gateway.GetCoil(1, 42));
+
+  // Eco con indirizzo (e quantita) sbagliati: la scrittura non e' confermata
+  _gateway.SetBadEcho(1, true);
+  CHECK(_client.Request(1, MB_FC_WRITE_REGISTER, 20, 1, _values, Tag(0)));
+  CHECK(_client.Request(1, MB_FC_WRITE_COIL, 21, 1, _bits, Tag(1)));
+  CHECK(_client.Request(1, MB_FC_WRITE_MULTIPLE_REGISTERS, 30, 3, _values, Tag(2)));
+  CHECK(_client.Request(1, MB_FC_WRITE_MULTIPLE_COILS, 40, 3, _bits, Tag(3)));
+
+  Collected _bad;
+  Drain(_client, _bad);
+  CHECK_EQ(_bad.count, 4);
+  for (int i = 0; i < _bad.count; i++)
+    CHECK_EQ(_bad.status[i], MB_ASYNC_BAD_RESPONSE);
+}
+
+static void TestTimeout() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, 502, _gateway.Port());
+  _gateway.SetSilent(3, true);
+
+  ModbusAsyncClient _client;
+  _client.Begin(GATEWAY, 2, 500);
+  CHECK(_client.Request(3, MB_FC_READ_REGISTERS, 0, 1, nullptr, Tag(0), 30));
+  CHECK(_client.Request(1, MB_FC_READ_REGISTERS, 0, 1, nullptr, Tag(1)));
+  CHECK(!_client.CanRequest());
+
+  Collected _c;
+  Drain(_client, _c);
+  CHECK_EQ(_c.count, 2);
+  CHECK_EQ(_c.tag[0], 1); // la risposta dell'unit 1 non aspetta quella dell'unit 3
+  CHECK_EQ(_c.status[0], MB_ASYNC_OK);
+  CHECK_EQ(_c.tag[1], 0);
+  CHECK_EQ(_c.status[1], MB_ASYNC_TIMEOUT);
+  CHECK_EQ(_client.GetTimeouts(), 1);
+}
+
+int main() {
+  Serial.Mute(true);
+  RUN_TEST(TestReadsPipelined);
+  RUN_TEST(TestExceptions);
+  RUN_TEST(TestWriteEcho);
+  RUN_TEST(TestTimeout);
+  return HostTestResult();
+}
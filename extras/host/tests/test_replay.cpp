@@ -0,0 +1,222 @@
+// Traccia registrata su un impianto simulato e riprodotta con HostReplay su un secondo DomoManager:
+// letture, comandi del pannello e UDP passano dal vero Update e la traccia della riproduzione
+// coincide con quella registrata
+#include "HostTest.h"
+#include "HostReplay.h"
+#include <Arduino.h>
+#include "Domo.h"
+#include "IOT.h"
+
+static const IPAddress GATEWAY(192, 168, 1, 10);
+static const int AREA_AI = 14;
+static const int AREA_CMD = 15;
+
+static GenericPrgDevice::GenericPrgDeviceChannel channels[] = {
+  {GenericPrgDevice::DI, GenericPrgDevice::Discrete, 0, 2, 1},
+  {GenericPrgDevice::DO, GenericPrgDevice::Coil, 0, 2, 1},
+  {GenericPrgDevice::AI, GenericPrgDevice::Input, 20, 1, 1},
+};
+
+static void InitDevices(DomoManager &dm) {
+  dm.addDevice("io", GATEWAY, 1, channels, ARRAY_SIZE(channels), {10, 11, 12, 13, AREA_AI}, 3, High);
+}
+
+static void InitBuffer(DomoManager &dm) {
+  ModbusBuffer &_buffer = dm.GetBuffer();
+  _buffer.SetElement(10, 12, true, false, false, (char *)"in0");
+  _buffer.SetElement(11, 13, true, false, false, (char *)"in1");
+  _buffer.SetElement(12, 0, false, false, false, (char *)"out0");
+  _buffer.SetElement(13, 0, false, false, false, (char *)"out1");
+  _buffer.SetElement(AREA_AI, 0, true, false, false, (char *)"ai");
+  _buffer.SetElement(AREA_CMD, 0, true, true, false, (char *)"cmd");
+  _buffer.Init();
+}
+
+static void SomethingChanged(ModbusBuffer &) {}
+static void Route(BufferSourceInfo, int, ModbusBuffer &) {}
+static void Activity(ModbusBuffer &) {}
+
+struct TraceCounts {
+  unsigned long field = 0, panel = 0, udp = 0, cycle = 0;
+};
+
+static TraceCounts Count(HostTraceBuffer &buffer) {
+  TraceCounts _counts;
+  buffer.Rewind();
+  TraceReplay _replay(buffer);
+  TraceEvent _event;
+  while (_replay.Next(_event)) {
+    switch (_event.kind) {
+      case TraceField: _counts.field++; break;
+      case TracePanel: _counts.panel++; break;
+      case TraceUdp: _counts.udp++; break;
+      case TraceCycle: _counts.cycle++; break;
+      default: break;
+    }
+  }
+  buffer.Rewind();
+  return _counts;
+}
+
+static long FieldValue(DomoManager &dm, int area) {
+  BufferSourceInfo _data;
+  dm.GetBuffer().GetData(area, Field, _data);
+  return _data.value;
+}
+
+static void SendPanelWrite(EthernetClient &panel, uint16_t area, uint16_t value) {
+  uint8_t _frame[12] = {0, 1, 0, 0, 0, 6, 1, MB_FC_WRITE_REGISTER, highByte(area), lowByte(area), highByte(value), lowByte(value)};
+  panel.write(_frame, sizeof(_frame));
+}
+
+static void TestRecordAndReplay() {
+  HostNet::Reset();
+  HostClock::Simulate(1000);
+  HostTraceBuffer _trace;
+  TraceRecorder _recorder(_trace);
+
+  // ---- Registrazione sull'impianto "reale" ----
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, MB_PORT, _gateway.Port());
+
+  DomoManager _live(20, InitDevices, InitBuffer, 2, 3, 4, 5);
+  _live.Begin(SomethingChanged, Route, Activity);
+  _live.EnableDirectServer(true);
+  HostNet::Listen(MB_PORT, 0);
+  EthernetServer _panels(MB_PORT);
+  _panels.begin();
+  MgsModbus _server;
+  EthernetClient _socket;
+  ModbusTCPClient _client(_socket);
+
+  HostNet::Listen(8888, 0);
+  EthernetUDP _iotUdp;
+  IOT _iot(_iotUdp, IPAddress(192, 168, 1, 99), 8888, 8889);
+  _iot.begin("");
+  _iot.SetTrace(&_recorder);
+  _live.RecordTrace(&_recorder);
+
+  EthernetClient _panel;
+  CHECK(_panel.connect(IPAddress(127, 0, 0, 1), _panels.hostPort()));
+  EthernetUDP _phone;
+  _phone.begin(0);
+
+  for (int i = 0; i < 40; i++) {
+    if (i == 10) {
+      _gateway.SetDiscrete(1, 1, true);
+      _gateway.SetInput(1, 20, 1234);
+    }
+    if (i == 20) {
+      SendPanelWrite(_panel, AREA_CMD, 7);
+      const char _packet[] = "updateProximity::1";
+      _phone.beginPacket(IPAddress(127, 0, 0, 1), _iotUdp.hostPort());
+      _phone.write((const uint8_t *)_packet, sizeof(_packet));
+      _phone.endPacket();
+    }
+    _iot.Update();
+    _live.Update(_panels, _server, _client);
+    HostClock::AdvanceMillis(50);
+  }
+  _live.RecordTrace(nullptr);
+  _iot.SetTrace(nullptr);
+
+  CHECK(_gateway.GetCoil(1, 1));
+  CHECK_EQ(FieldValue(_live, AREA_AI), 1234);
+  CHECK_EQ(FieldValue(_live, AREA_CMD), 7);
+  TraceCounts _recorded = Count(_trace);
+  CHECK(_recorded.field > 0);
+  CHECK_EQ(_recorded.panel, 1);
+  CHECK_EQ(_recorded.udp, 1);
+  CHECK(_recorded.cycle > 0);
+  _panel.stop();
+
+  // ---- Riproduzione su un secondo impianto, senza il gateway originale ----
+  // Clock fermo come in registrazione (HostReplay lo porta ai tempi della traccia): stesse scadenze e
+  // stesso budget di lettura, quindi la stessa sequenza di letture. Le latenze si misurano in bench_replay
+  _gateway.Stop();
+  HostTraceBuffer _again;
+  TraceRecorder _replayRecorder(_again);
+
+  DomoManager _dm(20, InitDevices, InitBuffer, 2, 3, 4, 5);
+  _dm.Begin(SomethingChanged, Route, Activity);
+  _dm.EnableDirectServer(true);
+  HostNet::Listen(MB_PORT, 0);
+  EthernetServer _replayPanels(MB_PORT);
+  _replayPanels.begin();
+  MgsModbus _replayServer;
+  EthernetClient _replaySocket;
+  ModbusTCPClient _replayClient(_replaySocket);
+
+  HostNet::Listen(8888, 0);
+  EthernetUDP _replayIotUdp;
+  IOT _replayIot(_replayIotUdp, IPAddress(192, 168, 1, 99), 8888, 8889);
+  _replayIot.begin("");
+  _replayIot.SetTrace(&_replayRecorder);
+  _dm.RecordTrace(&_replayRecorder);
+
+  HostReplay _replay(_dm.GetDevices(), _replayPanels.hostPort(), _replayIotUdp.hostPort());
+  TraceStats _stats;
+  TraceReplay _reader(_trace);
+  unsigned long _cycles = _replay.Run(_reader, _stats,
+    [&]() { _replayIot.Update(); _dm.Update(_replayPanels, _replayServer, _replayClient); },
+    [&]() { return _dm.GetTimings().cycles; });
+  _dm.RecordTrace(nullptr);
+
+  CHECK_EQ(_cycles, _recorded.cycle);
+  CHECK_EQ(_replay.Skipped(), 0);
+  CHECK_EQ(_stats.Count(TraceStageCycle), _recorded.cycle);
+  CHECK(_stats.Count(TraceStageUpdate) >= _recorded.cycle);
+
+  // Stesso stato finale, raggiunto attraverso letture Modbus, server dei pannelli e IOT::Update
+  CHECK(_replay.Gateway(GATEWAY) != nullptr);
+  CHECK(_replay.Gateway(GATEWAY)->GetCoil(1, 1));
+  CHECK_EQ(FieldValue(_dm, AREA_AI), 1234);
+  CHECK_EQ(FieldValue(_dm, AREA_CMD), 7);
+  CHECK(_replayIot.GetStatus().onProximity.preserveGet());
+
+  TraceCounts _replayed = Count(_again);
+  CHECK_EQ(_replayed.field, _recorded.field);
+  CHECK_EQ(_replayed.panel, _recorded.panel);
+  CHECK_EQ(_replayed.udp, _recorded.udp);
+  CHECK_EQ(_replayed.cycle, _recorded.cycle);
+}
+
+// Canali con piu di 255 item: channel e index a 16 bit nel formato DTR2, ogni lettura registrata
+static void TestRecordFormat() {
+  HostClock::Simulate(0);
+  HostTraceBuffer _trace;
+  TraceRecorder _recorder(_trace);
+  _recorder.Begin();
+  _recorder.Field(3, 300, 1999, GenericPrgDevice::DI, 1);
+  _recorder.Field(3, 300, 1999, GenericPrgDevice::DI, 1);
+  HostClock::AdvanceMillis(70000);
+  _recorder.Panel(700, -5);
+  _recorder.End();
+  CHECK_EQ(_recorder.Records(), 4); // due letture, il salto oltre 65535 ms e il pannello
+  CHECK_EQ(_trace.Size(), sizeof(TRACE_MAGIC) + 4 * TRACE_RECORD_SIZE);
+
+  TraceReplay _replay(_trace);
+  TraceEvent _event;
+  for (int i = 0; i < 2; i++) {
+    CHECK(_replay.Next(_event));
+    CHECK_EQ(_event.kind, TraceField);
+    CHECK_EQ(_event.id, 3);
+    CHECK_EQ(_event.channel, 300);
+    CHECK_EQ(_event.index, 1999);
+    CHECK_EQ(_event.value, 1);
+  }
+  CHECK(_replay.Next(_event));
+  CHECK_EQ(_event.kind, TracePanel);
+  CHECK_EQ(_event.id, 700);
+  CHECK_EQ(_event.value, -5);
+  CHECK_EQ(_event.time, 70000);
+  CHECK(!_replay.Next(_event));
+}
+
+int main() {
+  HostSerial::Mute(true);
+  RUN_TEST(TestRecordFormat);
+  RUN_TEST(TestRecordAndReplay);
+  return HostTestResult();
+}
@@ -0,0 +1,122 @@
+// Indirizzo delle scritture: startingAddr + indice dell'item per Coil e Hold, con FC5/FC6 e FC15/FC16,
+// sia con il client sincrono (GenericPrgDevice::Write/WriteMultiple) sia con il client asincrono
+#include "HostTest.h"
+#include "HostModbusServer.h"
+#include <Arduino.h>
+#include "Domo.h"
+#include <chrono>
+#include <thread>
+
+static const IPAddress GATEWAY(192, 168, 1, 40);
+
+static GenericPrgDevice::GenericPrgDeviceChannel channels[] = {
+  {GenericPrgDevice::DI, GenericPrgDevice::Discrete, 0, 3, 1},
+  {GenericPrgDevice::DO, GenericPrgDevice::Coil, 100, 3, 1},
+  {GenericPrgDevice::DO, GenericPrgDevice::Hold, 200, 3, 1},
+};
+
+static void InitDevices(DomoManager &dm) {
+  dm.addDevice("io", GATEWAY, 1, channels, ARRAY_SIZE(channels), {10, 11, 12, 13, 14, 15, 16, 17, 18}, 3, High);
+}
+
+// Ogni ingresso comanda la coil con lo stesso indice
+static void InitBuffer(DomoManager &dm) {
+  ModbusBuffer &_buffer = dm.GetBuffer();
+  for (int i = 0; i < 3; i++)
+    _buffer.SetElement(10 + i, 13 + i, true, false, false, (char *)"in");
+  for (int i = 0; i < 6; i++)
+    _buffer.SetElement(13 + i, 0, false, false, false, (char *)"out");
+  _buffer.Init();
+}
+
+static void SomethingChanged(ModbusBuffer &) {}
+static void Route(BufferSourceInfo, int, ModbusBuffer &) {}
+static void Activity(ModbusBuffer &) {}
+
+static void TestDeviceWrites() {
+  HostNet::Reset();
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, MB_PORT, _gateway.Port());
+
+  GenericPrgDevice _device("io", GATEWAY, 1, channels, ARRAY_SIZE(channels), {10, 11, 12, 13, 14, 15, 16, 17, 18}, 3, High);
+  EthernetClient _socket;
+  ModbusTCPClient _client(_socket);
+  CHECK(_client.begin(GATEWAY, MB_PORT));
+  CHECK_EQ(_device.GetWriteAddress(1, 2), 102);
+  CHECK_EQ(_device.GetWriteAddress(2, 1), 201);
+
+  CHECK(_device.Write(_client, 1, 1, 1));
+  CHECK(_device.Write(_client, 2, 1, 42));
+  long _bits[2] = {1, 1};
+  long _values[2] = {7, 8};
+  CHECK(_device.WriteMultiple(_client, 1, 1, _bits, 2));
+  CHECK(_device.WriteMultiple(_client, 2, 0, _values, 2));
+
+  CHECK(_gateway.GetCoil(1, 101));
+  CHECK(_gateway.GetCoil(1, 102));
+  CHECK(!_gateway.GetCoil(1, 1));
+  CHECK(!_gateway.GetCoil(1, 100));
+  CHECK_EQ(_gateway.GetHolding(1, 200), 7);
+  CHECK_EQ(_gateway.GetHolding(1, 201), 8);
+  CHECK_EQ(_gateway.GetHolding(1, 1), 0);
+}
+
+// Con il client asincrono le risposte arrivano in tempo reale mentre il clock simulato resta fermo
+static void Step(DomoManager &dm, EthernetServer &panels, MgsModbus &server, ModbusTCPClient &client, bool async) {
+  dm.Update(panels, server, client);
+  if (async)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  HostClock::AdvanceMillis(50);
+}
+
+// Un ingresso (FC5), poi due ingressi contigui (FC15) attraverso DomoManager::Update
+static void RunUpdate(bool async) {
+  HostNet::Reset();
+  HostClock::Simulate(1000);
+  HostModbusServer _gateway;
+  CHECK(_gateway.Start());
+  HostNet::Route(GATEWAY, MB_PORT, _gateway.Port());
+
+  DomoManager _dm(20, InitDevices, InitBuffer, 2, 3, 4, 5);
+  _dm.Begin(SomethingChanged, Route, Activity);
+  if (async)
+    _dm.EnableAsyncClient(2, 1000);
+  EthernetClient _socket;
+  ModbusTCPClient _client(_socket);
+  HostNet::Listen(MB_PORT, 0);
+  EthernetServer _panels(MB_PORT);
+  _panels.begin();
+  MgsModbus _server;
+
+  _gateway.SetDiscrete(1, 0, true);
+  for (int i = 0; i < 20; i++)
+    Step(_dm, _panels, _server, _client, async);
+  CHECK(_gateway.GetCoil(1, 100));
+  CHECK(!_gateway.GetCoil(1, 0));
+
+  _gateway.SetDiscrete(1, 1, true);
+  _gateway.SetDiscrete(1, 2, true);
+  for (int i = 0; i < 20; i++)
+    Step(_dm, _panels, _server, _client, async);
+  CHECK(_gateway.GetCoil(1, 101));
+  CHECK(_gateway.GetCoil(1, 102));
+  CHECK(!_gateway.GetCoil(1, 1));
+  CHECK(!_gateway.GetCoil(1, 2));
+}
+
+static void TestUpdateSync() {
+  RunUpdate(false);
+}
+
+static void TestUpdateAsync() {
+  RunUpdate(true);
+}
+
+int main() {
+  HostSerial::Mute(true);
+  RUN_TEST(TestDeviceWrites);
+  RUN_TEST(TestUpdateSync);
+  RUN_TEST(TestUpdateAsync);
+  return HostTestResult();
+}
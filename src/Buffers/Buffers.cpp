@@ -2,10 +2,101 @@
 
 #include "Buffers.h"
 
+///////////////// ModbusBufferJournal
+ModbusBufferJournal::ModbusBufferJournal(unsigned int capacity): _head(0) {
+  unsigned int _size=2;
+  while(_size<capacity)
+    _size<<=1;
+
+  this->_mask=_size-1;
+  this->_entries=new ModbusBufferJournalEntry [_size];
+}
+
+void ModbusBufferJournal::Push(int modbusArea, ModbusBufferFlagType type, long prevValue, long value, unsigned long time) {
+  unsigned long _seq=this->_head.load(std::memory_order_relaxed);
+  ModbusBufferJournalEntry &_entry=this->_entries[_seq & this->_mask];
+
+  _entry.seq=_seq;
+  _entry.time=time;
+  _entry.value=value;
+  _entry.prevValue=prevValue;
+  _entry.modbusArea=modbusArea;
+  _entry.bufferType=type;
+
+  //Pubblico la voce solo dopo averla scritta completamente
+  this->_head.store(_seq+1, std::memory_order_release);
+}
+
+ModbusBufferJournalCursor ModbusBufferJournal::Subscribe() {
+  ModbusBufferJournalCursor _cursor;
+  _cursor.seq=this->_head.load(std::memory_order_acquire);
+  _cursor.synced=true;
+  return _cursor;
+}
+
+ModbusBufferJournalResult ModbusBufferJournal::Read(ModbusBufferJournalCursor &cursor, ModbusBufferJournalEntry &entry) {
+  unsigned long _head=this->_head.load(std::memory_order_acquire);
+
+  //Con lag==capacity lo slot del cursore e' quello in scrittura: lo considero gia perso
+  if(!cursor.synced || _head - cursor.seq >= this->capacity()) {
+    cursor.seq=_head;
+    cursor.synced=true;
+    return JournalResync;
+  }
+
+  if(_head==cursor.seq)
+    return JournalEmpty;
+
+  entry=this->_entries[cursor.seq & this->_mask];
+
+  //Lo scrittore puo aver sovrascritto la voce durante la copia
+  std::atomic_thread_fence(std::memory_order_acquire);
+  _head=this->_head.load(std::memory_order_relaxed);
+  if(entry.seq!=cursor.seq || _head - cursor.seq >= this->capacity()) {
+    cursor.seq=_head;
+    return JournalResync;
+  }
+
+  cursor.seq++;
+  return JournalEntry;
+}
+
+///////////////// ModbusBuffer
 
 ModbusBuffer::ModbusBuffer(unsigned int items): tracker(items) {
   this->_items=items;
+  for(int t=0; t<BUFFER_FLAG_TYPES; t++)
+    this->_journals[t]=nullptr;
+  this->_routeMask=nullptr;
+  this->_dirtyWords=(items + BUFFER_DIRTY_BITS - 1) / BUFFER_DIRTY_BITS;
   this->_buffer=new ModbusBufferInfo [items];
+
+  for(int i=0; i<this->_items; i++) {
+    this->_buffer[i].Reverse=false;
+    this->_buffer[i].ReadFromPanel=false;
+    this->_buffer[i].WriteToPanel=false;
+    this->_buffer[i].FromPanelToField=false;
+    this->_buffer[i].modbusAreaToWrite=0;
+    this->_buffer[i].name=NULL;
+  }
+
+  for(int t=0; t<BUFFER_FLAG_TYPES; t++) {
+    this->_slots[t].value=new long [items];
+    this->_slots[t].prevValue=new long [items];
+    this->_slots[t].time=new unsigned long [items];
+    this->_slots[t].dirty=new uint32_t [this->_dirtyWords];
+    this->_slots[t].exist=new bool [items];
+
+    for(int w=0; w<this->_dirtyWords; w++)
+      this->_slots[t].dirty[w]=0;
+
+    for(int i=0; i<this->_items; i++) {
+      this->_slots[t].value[i]=0;
+      this->_slots[t].prevValue[i]=0;
+      this->_slots[t].time[i]=0;
+      this->_slots[t].exist[i]=false;
+    }
+  }
 }
 
 void ModbusBuffer::SetElement(int modbusArea, int modbusAreaToWrite, bool WriteToPanel, bool ReadFromPanel, bool Reverse, char* name) {
@@ -19,14 +110,15 @@ void ModbusBuffer::SetElement(int modbusArea, int modbusAreaToWrite, bool WriteT
 }
 
 void ModbusBuffer::AddType(int modbusArea, long initialValue, ModbusBufferFlagType type) {
-  BufferSourceInfo data;
-  data.value=initialValue;
-  data.prevValue=0;
-  data.time=millis();
-  data.bufferType=type;
-  data.changed=true;
-   
-  this->_buffer[modbusArea].Data.add(data);
+  if(!IsValidArea(modbusArea))
+    return;
+
+  ModbusBufferSlots &_slot=this->_slots[type];
+  _slot.value[modbusArea]=initialValue;
+  _slot.prevValue[modbusArea]=0;
+  _slot.time[modbusArea]=millis();
+  SetDirty(type, modbusArea, true);
+  _slot.exist[modbusArea]=true;
 }
 
 void ModbusBuffer::Init() {
@@ -46,35 +138,37 @@ void ModbusBuffer::Init() {
       idxPnl++;
     }
   }
+
+  //Tabella di routing: bitset delle aree sorgente, il routing viene guidato dal dirty set di Field
+  if(this->_routeMask==nullptr)
+    this->_routeMask=new uint32_t [this->_dirtyWords];
+  for(int w=0; w<this->_dirtyWords; w++)
+    this->_routeMask[w]=0;
+
+  std::vector<int> _targets(this->_items, 0);
+  for(int i=0; i<this->_items; i++) {
+    _targets[i]=this->_buffer[i].modbusAreaToWrite;
+    if(_targets[i]!=0)
+      this->_routeMask[i / BUFFER_DIRTY_BITS] |= 1UL << (i % BUFFER_DIRTY_BITS);
+  }
+
+  routeTracker.build(_targets.data(), this->_items, DUMMY_AREA);
 }
 
 int ModbusBuffer::Compare(int modbusArea, ModbusBufferFlagType type, long value) {
-  if(modbusArea>this->_items) {
+  if(!IsValidArea(modbusArea)) {
     Serial.print("Compare ERROR ");
     Serial.println(modbusArea);
     return -1; //Error
   }
-  else {
-    if(this->_buffer[modbusArea].Data.getSize()==0) {
-      return 0; //Not Found
-    }
-    else {
-      int _size=this->_buffer[modbusArea].Data.getSize()-1;
-      for (int j=_size; j!=-1; j--) {
-        BufferSourceInfo _data=this->_buffer[modbusArea].Data.get(j);
-        if (_data.bufferType==type) {
-          if( _data.value!=value) { 
-            return 1; // Different
-          }
-          else return 2; //Equal
-        }
-      }
-
-      return 0; //Not found
-    }
-  }
-  
-  return -1; //Error
+
+  if(!this->_slots[type].exist[modbusArea])
+    return 0; //Not found
+
+  if(this->_slots[type].value[modbusArea]!=value)
+    return 1; // Different
+
+  return 2; //Equal
 }
 
 bool ModbusBuffer::WriteElement(int modbusArea, ModbusBufferFlagType type, long value) {
@@ -82,157 +176,84 @@ bool ModbusBuffer::WriteElement(int modbusArea, ModbusBufferFlagType type, long
 }
 
 bool ModbusBuffer::WriteElement(int modbusArea, ModbusBufferFlagType type, long value, bool silent) {
-  if(modbusArea!=DUMMY_AREA) {
-    if(modbusArea>this->_items) {
-      Serial.print("WriteElement ERROR ");
-      Serial.println(modbusArea);
-      return false;
-    }
-    else {
-      if(this->_buffer[modbusArea].Data.getSize()==0) {
-        BufferSourceInfo data;
-        data.prevValue=0; //Essendo creato da zero, il valore precedente è zero
-        data.value=value;
-        data.time=millis();
-        data.bufferType=type;
-        data.changed=(silent==true?false:true);
-        
-        this->_buffer[modbusArea].Data.add(data);
-
-        #ifdef DEBUG_TEST   
-        Serial.print("Buffer write area (1st time) ");
-        if(silent)
-          Serial.print("-SILENT- ");
-        Serial.print(modbusArea);
-        Serial.print(" value ");
-        Serial.print(value); 
-        Serial.print(" copy ");
-        Serial.print(data.prevValue); 
-        Serial.print(" data ");
-        Serial.print(data.value); 
-        Serial.print(" type ");
-        Serial.println(data.bufferType); 
-        #endif
-      }
-      else {
-        bool exist=false;
-        int _size=this->_buffer[modbusArea].Data.getSize()-1;
-        for (int j=_size; j!=-1; j--) {
-          BufferSourceInfo _data=this->_buffer[modbusArea].Data.get(j);
-          if (_data.bufferType==type) {
-            exist=true;
-            if( _data.value!=value) { 
-              #ifdef DEBUG_TEST 
-              if(modbusArea<210) { 
-                Serial.print("Buffer write area ");
-                if(silent)
-                  Serial.print("-SILENT- ");
-                Serial.print(modbusArea);
-                Serial.print(" value ");
-                Serial.print(value); 
-                Serial.print(" copy ");
-                Serial.print(_data.prevValue); 
-                Serial.print(" data ");
-                Serial.print(_data.value); 
-                Serial.print(" type ");
-                Serial.println(_data.bufferType); 
-              }
-              #endif
-
-              this->_buffer[modbusArea].Data.remove(j);
-              _data.prevValue=_data.value;
-              _data.value=value;
-              _data.time=millis();
-              _data.changed=(silent==true?false:true);
-              this->_buffer[modbusArea].Data.add(_data); 
-            }
-            else { 
-              #ifdef DEBUG_TEST 
-              if(modbusArea<210) { 
-                Serial.print("Buffer write area NOT UPDATED ");
-                if(silent)
-                  Serial.print("-SILENT- ");
-                Serial.print(modbusArea);
-                Serial.print(" value ");
-                Serial.print(value); 
-                Serial.print(" copy ");
-                Serial.print(_data.prevValue); 
-                Serial.print(" data ");
-                Serial.print(_data.value); 
-                Serial.print(" type ");
-                Serial.println(_data.bufferType); 
-              }
-              #endif
-            }
-            break; 
-          }
-        }
-
-        if(!exist) {
-          BufferSourceInfo _data;
-          _data.prevValue=0;
-          _data.value=value;
-          _data.time=millis();
-          _data.bufferType=type;
-          _data.changed=(silent==true?false:true);
-          
-          this->_buffer[modbusArea].Data.add(_data);
-
-          #ifdef DEBUG_TEST
-          Serial.print("Buffer write area NOT EXIST ");
-          if(silent)
-            Serial.print("-SILENT- ");
-          Serial.print(modbusArea);
-          Serial.print(" value ");
-          Serial.print(value); 
-          Serial.print(" copy ");
-          Serial.print(_data.prevValue); 
-          Serial.print(" data ");
-          Serial.print(_data.value); 
-          Serial.print(" type ");
-          Serial.println(_data.bufferType); 
-          #endif
-        }
-      }
+  //Routing verso DUMMY_AREA: il valore viene scartato
+  if(modbusArea==DUMMY_AREA)
+    return true;
+
+  if(!IsValidArea(modbusArea)) {
+    Serial.print("WriteElement ERROR ");
+    Serial.println(modbusArea);
+    return false;
+  }
+
+  ModbusBufferSlots &_slot=this->_slots[type];
+
+  if(!_slot.exist[modbusArea]) {
+    //Essendo creato da zero, il valore precedente è zero
+    _slot.prevValue[modbusArea]=0;
+    _slot.exist[modbusArea]=true;
+  }
+  else if(_slot.value[modbusArea]!=value) 
+    _slot.prevValue[modbusArea]=_slot.value[modbusArea];
+  else {
+    #ifdef DEBUG_TEST 
+    if(modbusArea<210) { 
+      Serial.print("Buffer write area NOT UPDATED ");
+      if(silent)
+        Serial.print("-SILENT- ");
+      Serial.print(modbusArea);
+      Serial.print(" value ");
+      Serial.print(value); 
+      Serial.print(" type ");
+      Serial.println(type); 
     }
+    #endif
+    return true;
+  }
+
+  _slot.value[modbusArea]=value;
+  _slot.time[modbusArea]=millis();
+  SetDirty(type, modbusArea, silent==true?false:true);
+
+  if(this->_journals[type]!=nullptr && !silent)
+    this->_journals[type]->Push(modbusArea, type, _slot.prevValue[modbusArea], value, _slot.time[modbusArea]);
+
+  #ifdef DEBUG_TEST 
+  if(modbusArea<210) { 
+    Serial.print("Buffer write area ");
+    if(silent)
+      Serial.print("-SILENT- ");
+    Serial.print(modbusArea);
+    Serial.print(" value ");
+    Serial.print(value); 
+    Serial.print(" copy ");
+    Serial.print(_slot.prevValue[modbusArea]); 
+    Serial.print(" type ");
+    Serial.println(type); 
   }
+  #endif
+
   return true;
 }
 
-
 bool ModbusBuffer::GetChangeFlag(int modbusArea, ModbusBufferFlagType type) {
-  
-  if(this->_buffer[modbusArea].Data.getSize()!=0) {
-    for (int j=0; j<this->_buffer[modbusArea].Data.getSize(); j++) {
-      if(this->_buffer[modbusArea].Data.get(j).bufferType==type) {
-        if(this->_buffer[modbusArea].Data.get(j).changed ) { 
-          return true;
-        }
-        break;
-      }
-    }
-  }
+  if(!IsValidArea(modbusArea))
+    return false;
 
-  return false;
+  return IsDirty(type, modbusArea);
 }
 
 void ModbusBuffer::SetChangeFlag(int modbusArea, ModbusBufferFlagType type, bool value) {
-    if(this->_buffer[modbusArea].Data.getSize()!=0) {
-      for (int j=0; j<this->_buffer[modbusArea].Data.getSize(); j++) {
-        if(this->_buffer[modbusArea].Data.get(j).bufferType==type) {
-          BufferSourceInfo _data=this->_buffer[modbusArea].Data.get(j);
-          this->_buffer[modbusArea].Data.remove(j);
-          _data.changed=value;
-          this->_buffer[modbusArea].Data.add(_data);
-          break;
-        }
-      }
-    }
+  if(!IsValidArea(modbusArea))
+    return;
+
+  if(this->_slots[type].exist[modbusArea])
+    SetDirty(type, modbusArea, value);
 }
 
 char* ModbusBuffer::GetName(int modbusArea)
 { 
-  if(modbusArea<=this->_items) {
+  if(IsValidArea(modbusArea)) {
     if(this->_buffer[modbusArea].name!=NULL) {
       return this->_buffer[modbusArea].name;
     }
@@ -242,19 +263,20 @@ char* ModbusBuffer::GetName(int modbusArea)
 }
 
 bool ModbusBuffer::GetData(int modbusArea, ModbusBufferFlagType type, BufferSourceInfo &dataOut) {
-  if(this->_buffer[modbusArea].Data.getSize()!=0) {
-    for (int j=0; j<this->_buffer[modbusArea].Data.getSize(); j++) {
-      if(this->_buffer[modbusArea].Data.get(j).bufferType==type) {
-        dataOut= this->_buffer[modbusArea].Data.get(j);
-        return true;
-      }
-    }
+  dataOut.bufferType=type;
+
+  if(IsValidArea(modbusArea) && this->_slots[type].exist[modbusArea]) {
+    ModbusBufferSlots &_slot=this->_slots[type];
+    dataOut.value=_slot.value[modbusArea];
+    dataOut.prevValue=_slot.prevValue[modbusArea];
+    dataOut.changed=IsDirty(type, modbusArea);
+    dataOut.time=_slot.time[modbusArea];
+    return true;
   }
 
   //Ritorno valori fittizi
   dataOut.value=0;
   dataOut.prevValue=0;
-  dataOut.bufferType=type;
   dataOut.changed=false;
   dataOut.time=0;
   return false;
@@ -264,8 +286,20 @@ void ModbusBuffer::ResetElement(int modbusArea, ModbusBufferFlagType type) {
     SetChangeFlag(modbusArea, type, false);
 }
 
+void ModbusBuffer::RestoreElement(int modbusArea, ModbusBufferFlagType type) {
+  if(!IsValidArea(modbusArea) || !this->_slots[type].exist[modbusArea] || IsDirty(type, modbusArea))
+    return;
+
+  SetDirty(type, modbusArea, true);
+
+  //Area di nuovo variata con lo stesso valore: i lettori del journal la rivisitano (prevValue==value)
+  ModbusBufferSlots &_slot=this->_slots[type];
+  if(this->_journals[type]!=nullptr)
+    this->_journals[type]->Push(modbusArea, type, _slot.value[modbusArea], _slot.value[modbusArea], _slot.time[modbusArea]);
+}
+
 int ModbusBuffer::GetAreaToWrite(int modbusArea) {
-  if(modbusArea>this->_items)
+  if(!IsValidArea(modbusArea))
     return 0;
   else return this->_buffer[modbusArea].modbusAreaToWrite;
 }
@@ -293,46 +327,81 @@ ModbusBufferArrayInfo ModbusBuffer::GetToReadFromPanel() {
 int ModbusBuffer::getChanged(ModbusBufferItemInfo2* items, ModbusBufferFlagType type, bool preserveChanges=false) {
   int _foundR=0;
 
-  for (int i=0; i<this->_items; i++) {
-    if(this->_buffer[i].Data.getSize()!=0) {
-      for (int j = this->_buffer[i].Data.getSize() - 1; j >= 0; j--) {
-          auto data = this->_buffer[i].Data.get(j);
-          if (data.changed && data.bufferType == type) {
-              items[_foundR].Item = data;
-              items[_foundR].modbusArea = i;
-              _foundR++;
-
-              if (!preserveChanges) {
-                  this->_buffer[i].Data.remove(j);
-                  data.changed = false;
-                  this->_buffer[i].Data.add(data);
-              }
-          }
-      }
-
-      /* old versionfor (int j=0; j<this->_buffer[i].Data.getSize(); j++) {
-        if(this->_buffer[i].Data.get(j).changed && this->_buffer[i].Data.get(j).bufferType==type) {
-          items[_foundR].Item=this->_buffer[i].Data.get(j);
-          items[_foundR].modbusArea=i;
-          
-          _foundR++;
-
-          if(!preserveChanges) {
-            BufferSourceInfo data=this->_buffer[i].Data.get(j);
-            if(data.changed) {
-              this->_buffer[i].Data.remove(j);
-              data.changed=false;
-              this->_buffer[i].Data.add(data);
-            }
-          }
-        }
-      }*/
-    }
+  for (int i=FirstChanged(type); i!=-1; i=NextChanged(type, i)) {
+    items[_foundR].modbusArea=i;
+    GetData(i, type, items[_foundR].Item);
+    _foundR++;
+
+    if (!preserveChanges)
+      SetDirty(type, i, false);
   }
 
   return _foundR;
 }
 
+int ModbusBuffer::FirstChanged(ModbusBufferFlagType type) {
+  return NextChanged(type, -1);
+}
+
+int ModbusBuffer::NextChanged(ModbusBufferFlagType type, int modbusArea) {
+  int _from=modbusArea+1;
+  if(_from<0)
+    _from=0;
+  if(_from>=this->_items)
+    return -1;
+
+  int _word=_from / BUFFER_DIRTY_BITS;
+  //Maschero i bit delle aree gia visitate nella prima parola
+  uint32_t _bits=this->_slots[type].dirty[_word] & (0xFFFFFFFFUL << (_from % BUFFER_DIRTY_BITS));
+
+  while(true) {
+    if(_bits!=0)
+      return _word * BUFFER_DIRTY_BITS + __builtin_ctz(_bits);
+
+    _word++;
+    if(_word>=this->_dirtyWords)
+      return -1;
+    _bits=this->_slots[type].dirty[_word];
+  }
+}
+
+int ModbusBuffer::NextChangedRoute(int modbusArea) {
+  if(this->_routeMask==nullptr)
+    return NextChanged(Field, modbusArea); //Init() non ancora chiamato
+
+  int _from=modbusArea+1;
+  if(_from<0)
+    _from=0;
+  if(_from>=this->_items)
+    return -1;
+
+  int _word=_from / BUFFER_DIRTY_BITS;
+  uint32_t _bits=this->_slots[Field].dirty[_word] & this->_routeMask[_word] & (0xFFFFFFFFUL << (_from % BUFFER_DIRTY_BITS));
+
+  while(true) {
+    if(_bits!=0)
+      return _word * BUFFER_DIRTY_BITS + __builtin_ctz(_bits);
+
+    _word++;
+    if(_word>=this->_dirtyWords)
+      return -1;
+    _bits=this->_slots[Field].dirty[_word] & this->_routeMask[_word];
+  }
+}
+
+int ModbusBuffer::CountChanged(ModbusBufferFlagType type) {
+  int _count=0;
+  for(int w=0; w<this->_dirtyWords; w++)
+    _count+=__builtin_popcount(this->_slots[type].dirty[w]);
+
+  return _count;
+}
+
+void ModbusBuffer::EnableJournal(unsigned int capacity, ModbusBufferFlagType type) {
+  if(this->_journals[type]==nullptr)
+    this->_journals[type]=new ModbusBufferJournal(capacity);
+}
+
 std::vector<int> ModbusBuffer::getNeverInitialized() {
   return tracker.getNeverInitialized();
 }
@@ -340,3 +409,15 @@ std::vector<int> ModbusBuffer::getNeverInitialized() {
 std::vector<int> ModbusBuffer::getInitializedMultipleTimes() {
   return tracker.getInitializedMultipleTimes();
 }
+
+std::vector<int> ModbusBuffer::getRoutingCycles() {
+  return routeTracker.getCycles();
+}
+
+std::vector<int> ModbusBuffer::getRoutingChains() {
+  return routeTracker.getChains();
+}
+
+std::vector<int> ModbusBuffer::getRoutingInvalidTargets() {
+  return routeTracker.getInvalidTargets();
+}
\ No newline at end of file
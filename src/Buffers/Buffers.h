@@ -4,8 +4,10 @@
 #include <List.hpp>
 #include "Arduino.h"
 #include <vector>
+#include <atomic>
 
-const int DUMMY_AREA=999;
+// Destinazione di routing che scarta il valore: fuori dal range delle aree, qualunque sia la dimensione del buffer
+const int DUMMY_AREA=-1;
 // number of items in an array
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -43,6 +45,85 @@ public:
     }
 };
 
+//Diagnostica del grafo di routing (modbusArea -> modbusAreaToWrite), costruita una volta in Init()
+class RouteTracker {
+private:
+    std::vector<int> cycles;         // aree che fanno parte di un ciclo di routing
+    std::vector<int> chains;         // aree che ricevono un routing e lo inoltrano a loro volta
+    std::vector<int> invalidTargets; // aree con destinazione fuori range
+
+public:
+    // targets[i]=area di destinazione di i, 0 se non instradata, dummyArea se scartata
+    void build(const int *targets, int totalAreas, int dummyArea) {
+        cycles.clear();
+        chains.clear();
+        invalidTargets.clear();
+
+        // 0=non visitato, 1=nel percorso corrente, 2=concluso
+        std::vector<char> state(totalAreas, 0);
+        std::vector<char> inChain(totalAreas, 0); // una sola voce per area anche con piu sorgenti
+
+        for (int i = 0; i < totalAreas; i++) {
+            int t = targets[i];
+            if (t == 0 || t == dummyArea)
+                continue;
+
+            if (t < 0 || t >= totalAreas) {
+                invalidTargets.push_back(i);
+                continue;
+            }
+
+            if (targets[t] != 0 && targets[t] != dummyArea && !inChain[t]) {
+                inChain[t] = 1;
+                chains.push_back(t);
+            }
+        }
+
+        // Ogni area ha al piu una destinazione: basta seguire la catena da ogni area
+        for (int i = 0; i < totalAreas; i++) {
+            int area = i;
+            while (area >= 0 && area < totalAreas && state[area] == 0) {
+                state[area] = 1;
+                int t = targets[area];
+                if (t == 0 || t == dummyArea || t < 0 || t >= totalAreas)
+                    break;
+
+                if (state[t] == 1) {
+                    // Ciclo trovato: lo registro partendo da t
+                    int c = t;
+                    do {
+                        cycles.push_back(c);
+                        c = targets[c];
+                    } while (c != t);
+                    break;
+                }
+                area = t;
+            }
+
+            // Chiudo il percorso corrente, fermandomi dove finisce il routing (0 o dummyArea)
+            area = i;
+            while (area >= 0 && area < totalAreas && state[area] == 1) {
+                state[area] = 2;
+                area = targets[area];
+                if (area == 0 || area == dummyArea)
+                    break;
+            }
+        }
+    }
+
+    std::vector<int> getCycles() const {
+        return cycles;
+    }
+
+    std::vector<int> getChains() const {
+        return chains;
+    }
+
+    std::vector<int> getInvalidTargets() const {
+        return invalidTargets;
+    }
+};
+
 enum ModbusBufferFlagType 
 {
   Field=0,
@@ -59,7 +140,6 @@ typedef struct {
   }BufferSourceInfo;
 
 typedef struct {
-  List<BufferSourceInfo> Data; // Piu BufferSourceInfo in base al tipo
   bool Reverse;
   bool ReadFromPanel;
   bool WriteToPanel;
@@ -88,6 +168,61 @@ typedef struct {
     int size;
   }ModbusBufferArrayInfo;
 
+// Numero di tipi in ModbusBufferFlagType
+const int BUFFER_FLAG_TYPES=3;
+const int BUFFER_DIRTY_BITS=32;
+
+//Storage piatto per un tipo di flag: un array contiguo per campo, indicizzato direttamente per area.
+//Allocato tutto nel costruttore, nessuna allocazione durante il ciclo di update
+typedef struct {
+    long *value;
+    long *prevValue;
+    unsigned long *time;
+    uint32_t *dirty; // bitset dei flag changed, 1 bit per area (BUFFER_DIRTY_BITS aree per parola)
+    bool *exist; // false finche il tipo non viene scritto per la prima volta (AddType o WriteElement)
+  }ModbusBufferSlots;
+
+//Journal delle variazioni di un tipo: ring buffer a dimensione fissa alimentato da WriteElement e RestoreElement.
+//Un solo scrittore (il buffer) e N lettori, ognuno con il proprio cursore: il lettore non blocca mai lo scrittore.
+//Se un lettore resta indietro di piu di capacity voci riceve JournalResync e deve rileggere lo stato completo.
+typedef struct {
+    unsigned long seq;  // numero progressivo della voce
+    unsigned long time; // millis() della scrittura
+    long value;
+    long prevValue;
+    int modbusArea;
+    ModbusBufferFlagType bufferType;
+  }ModbusBufferJournalEntry;
+
+typedef struct {
+    unsigned long seq;  // prossima voce da leggere
+    bool synced;        // false alla creazione: la prima Read ritorna JournalResync
+  }ModbusBufferJournalCursor;
+
+enum ModbusBufferJournalResult
+{
+  JournalResync=-1,
+  JournalEmpty=0,
+  JournalEntry=1
+};
+
+class ModbusBufferJournal
+{
+  public:
+    ModbusBufferJournal(unsigned int capacity); // arrotondata alla potenza di 2 superiore
+    void Push(int modbusArea, ModbusBufferFlagType type, long prevValue, long value, unsigned long time);
+    ModbusBufferJournalResult Read(ModbusBufferJournalCursor &cursor, ModbusBufferJournalEntry &entry);
+    ModbusBufferJournalCursor Subscribe();
+
+    unsigned int capacity() const {
+        return _mask + 1;
+    }
+  private:
+    ModbusBufferJournalEntry *_entries;
+    unsigned int _mask;
+    std::atomic<unsigned long> _head; // prossima voce da scrivere, pubblicata dopo la scrittura della voce
+};
+
 class ModbusBuffer
 {
   public:             
@@ -107,11 +242,29 @@ class ModbusBuffer
     bool GetData(int modbusArea, ModbusBufferFlagType type, BufferSourceInfo &data);
     ModbusBufferReadElementInfo ReadElement(int modbusArea, bool preserve, ModbusBufferFlagType type);
     void ResetElement(int modbusArea, ModbusBufferFlagType type);
+    // Rialza il flag changed senza toccare il valore (es. scrittura asincrona fallita dopo ResetElement)
+    void RestoreElement(int modbusArea, ModbusBufferFlagType type);
     int getChanged(ModbusBufferItemInfo2* items, ModbusBufferFlagType type, bool preserveChanges);
     char* GetName(int modbusArea);
     int Compare(int modbusArea, ModbusBufferFlagType type, long value);
+    // Iterazione sulle sole aree variate (find-first-set sul bitset, costo proporzionale alle variazioni)
+    // for(int area=buffer.FirstChanged(ToPanel); area!=-1; area=buffer.NextChanged(ToPanel, area)) ...
+    int FirstChanged(ModbusBufferFlagType type);
+    int NextChanged(ModbusBufferFlagType type, int modbusArea);
+    int CountChanged(ModbusBufferFlagType type);
+    // Come NextChanged(Field, ...) ma limitato alle aree con modbusAreaToWrite (tabella costruita in Init)
+    int NextChangedRoute(int modbusArea);
     std::vector<int> getNeverInitialized();
     std::vector<int> getInitializedMultipleTimes();
+    std::vector<int> getRoutingCycles();
+    std::vector<int> getRoutingChains();
+    std::vector<int> getRoutingInvalidTargets();
+    // Journal opzionale delle variazioni di un tipo, da abilitare in fase di setup (alloca capacity voci).
+    // Un journal per tipo: chi legge Field non scorre le voci dei pannelli. nullptr se non abilitato
+    void EnableJournal(unsigned int capacity, ModbusBufferFlagType type = Field);
+    ModbusBufferJournal* GetJournal(ModbusBufferFlagType type = Field) {
+        return _journals[type];
+    }
 
     size_t size() const {
         return _items;
@@ -119,10 +272,28 @@ class ModbusBuffer
   private: 
     void SetChangeFlag(int modbusArea, ModbusBufferFlagType type, bool value); 
     bool GetChangeFlag(int modbusArea, ModbusBufferFlagType type); 
+    bool IsValidArea(int modbusArea) const {
+        return modbusArea >= 0 && modbusArea < _items;
+    }
+    inline bool IsDirty(ModbusBufferFlagType type, int modbusArea) const {
+        return (_slots[type].dirty[modbusArea / BUFFER_DIRTY_BITS] >> (modbusArea % BUFFER_DIRTY_BITS)) & 1UL;
+    }
+    inline void SetDirty(ModbusBufferFlagType type, int modbusArea, bool value) {
+        uint32_t _mask = 1UL << (modbusArea % BUFFER_DIRTY_BITS);
+        if (value)
+            _slots[type].dirty[modbusArea / BUFFER_DIRTY_BITS] |= _mask;
+        else
+            _slots[type].dirty[modbusArea / BUFFER_DIRTY_BITS] &= ~_mask;
+    }
+    int _dirtyWords;
+    uint32_t *_routeMask; // bitset delle aree con modbusAreaToWrite!=0, nullptr prima di Init()
     AreaTracker tracker;
+    RouteTracker routeTracker;
     int _items;
     ModbusBufferInfo *_buffer;
+    ModbusBufferSlots _slots[BUFFER_FLAG_TYPES];
     ModbusBufferArrayInfo _toPanelRead;
+    ModbusBufferJournal *_journals[BUFFER_FLAG_TYPES];
 };
 
 #endif
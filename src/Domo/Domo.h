@@ -5,6 +5,7 @@
 #include <Arduino.h>
 #include "Fncs.h"
 #include <vector>
+#include <algorithm>
 
 // ************ IO BUFFER *******************************
 //RESERVED
@@ -14,6 +15,15 @@ const int AREA_SYSTEM_FLAGS=2; //Bit flags
 
 // END RESERVED
 
+// Riavvio della scheda quando tutti i gateway restano in errore. Definirla prima di includere Domo.h
+// per le schede senza NVIC (es. ESP32: ESP.restart()) o per una build di test sul PC
+#ifndef DOMO_SYSTEM_RESET
+#define DOMO_SYSTEM_RESET() NVIC_SystemReset()
+#endif
+
+// Sotto questa durata (ms) un'esecuzione non e' mai uno spike: e' jitter di interrupt e rete
+const unsigned long SPIKE_MIN_MS=1;
+
 //System status manager
 class SystemManager {
 public:
@@ -28,6 +38,7 @@ public:
         Cell<bool> mancanzaTensione;
         Cell<bool> interventoProtezioneCasa;
         Cell<bool> devicesInAllarme;
+        Cell<bool> loadShedding;
     } SystemInfo;
 
     enum SystemField {
@@ -40,7 +51,8 @@ public:
         ALLARME_VIDEOSORVEGLIANZA,
         MANCANZA_TENSIONE,
         INTERVENTO_PROTEZIONE_CASA,
-        DEVICES_IN_ALLARME
+        DEVICES_IN_ALLARME,
+        LOAD_SHEDDING          // DomoManager in load shedding (vedi EnableLoadShedding)
     };
 
     SystemManager() {
@@ -55,6 +67,7 @@ public:
         info.mancanzaTensione.set(false);
         info.interventoProtezioneCasa.set(false);
         info.devicesInAllarme.set(false);
+        info.loadShedding.set(false);
     }
 
     int getBitmask() {
@@ -70,6 +83,7 @@ public:
         if (info.mancanzaTensione.get())            mask |= (1 << MANCANZA_TENSIONE);
         if (info.interventoProtezioneCasa.get())    mask |= (1 << INTERVENTO_PROTEZIONE_CASA);
         if (info.devicesInAllarme.get())        mask |= (1 << DEVICES_IN_ALLARME);
+        if (info.loadShedding.get())            mask |= (1 << LOAD_SHEDDING);
 
         return mask;
     }
@@ -84,7 +98,8 @@ public:
             info.allarmeVideosorveglianza.hasChanged() ||
             info.mancanzaTensione.hasChanged() ||
             info.interventoProtezioneCasa.hasChanged() ||
-            info.devicesInAllarme.hasChanged();
+            info.devicesInAllarme.hasChanged() ||
+            info.loadShedding.hasChanged();
         }
 
     void set(SystemField field, bool value) {
@@ -99,6 +114,7 @@ public:
             case MANCANZA_TENSIONE: info.mancanzaTensione.setIfDiff(value); break;
             case INTERVENTO_PROTEZIONE_CASA: info.interventoProtezioneCasa.setIfDiff(value); break;
             case DEVICES_IN_ALLARME: info.devicesInAllarme.setIfDiff(value); break;
+            case LOAD_SHEDDING: info.loadShedding.setIfDiff(value); break;
         }
     }
 
@@ -111,11 +127,49 @@ private:
 };
 
 
+// Livelli di escalation del watchdog, in ordine di gravita
+enum WatchdogLevel {
+    WatchdogOk = 0,
+    WatchdogLog = 1,     // solo segnalazione: Serial e watchdogCallback
+    WatchdogDegrade = 2, // polling dei device Low rallentato di WATCHDOG_DEGRADE_STRETCH
+    WatchdogShed = 3,    // Low rallentati di WATCHDOG_SHED_STRETCH e Normal di WATCHDOG_SHED_NORMAL_STRETCH,
+                         // e load shedding forzato (vedi EnableLoadShedding)
+    WatchdogReset = 4    // DOMO_SYSTEM_RESET
+};
+
+enum WatchdogRuleType {
+    WatchdogRuleLast = 0,   // ultima esecuzione oltre limit (ms)
+    WatchdogRuleAvg = 1,    // media mobile oltre limit (ms)
+    WatchdogRuleSpikes = 2, // piu di limit spike nella finestra WATCHDOG_SPIKE_WINDOW
+    WatchdogRuleP99 = 3     // p99 del profiler oltre limit (ms), solo con DOMO_PROFILER
+};
+
+// Regola del watchdog su un ExecTiming, indicato dalla sua zona del profiler:
+// ProfileSomethingChanged, ProfileRoute, ProfileActivity o ProfileCycle
+struct WatchdogRule {
+    ProfileZone zone;
+    WatchdogRuleType type;
+    float limit;
+    WatchdogLevel level; // livello massimo a cui porta la regola se resta violata
+    const char* reason;
+};
+
+const unsigned long WATCHDOG_SPIKE_WINDOW=60000;
+const uint8_t WATCHDOG_DEGRADE_STRETCH=4;
+const uint8_t WATCHDOG_SHED_STRETCH=8;
+const uint8_t WATCHDOG_SHED_NORMAL_STRETCH=2;
+
+// Load shedding (vedi DomoManager::EnableLoadShedding)
+const uint8_t LOAD_SHED_LOW_STRETCH=16; // device Low rimandati: periodi x16
+const int LOAD_SHED_PNL_FACTOR=3;       // PNL_POLL allungato
+
 struct WatchdogStatus {
+    WatchdogLevel level = WatchdogOk; // livello dopo questo controllo
     bool overload = false;        // true se i tempi sono troppo alti
     bool blocked = false;         // callback bloccato
     bool unstable = false;        // troppi spike
     bool inactive = false;        // callback non chiamato
+    bool panelErrors = false;     // richieste dei pannelli rifiutate con eccezioni Modbus
     const char* reason = nullptr; // testo descrittivo
 };
 
@@ -129,6 +183,7 @@ struct ExecTiming {
 
     // Per Watchdog 
     unsigned int spikeCount = 0; unsigned long lastSpikeTime = 0;
+    unsigned int spikeMark = 0; unsigned long spikeMarkTime = 0; // spikeCount all'inizio della finestra WATCHDOG_SPIKE_WINDOW
 };
 
 /*
@@ -136,6 +191,31 @@ struct ExecTiming {
 4.0-6.0	media (default)	buon equilibrio
 7.0–10.0	bassa	rileva solo spike seri
 */
+// Latenze di una unit (device) dietro il proprio gateway
+struct UnitTiming {
+    const char* name = nullptr;
+    arduino::IPAddress ip;
+    unsigned int unitId = 0;
+    GenericPrgDevice::GenericPrgDeviceUnitStats stats;
+};
+
+// Somma delle unit dietro lo stesso gateway
+struct GatewayTiming {
+    arduino::IPAddress ip;
+    unsigned long requests = 0;
+    unsigned long failures = 0;
+    unsigned long timeouts = 0;
+    unsigned long responses = 0;
+    float avgLatency = 0;          // media delle unit pesata sulle risposte
+    unsigned long maxLatency = 0;
+    unsigned long lastSuccess = 0; // significativo solo con responses>0
+};
+
+// Aree di telemetria per device e per gateway (vedi DomoManager::DefineTelemetryAreas), nell'ordine:
+// richieste, errori, timeout, latenza media (ms), latenza massima (ms), secondi dall'ultima risposta
+const int TELEMETRY_AREAS_PER_ITEM=6;
+const long TELEMETRY_NEVER=0xFFFF; // eta dell'ultima risposta se non ha mai risposto
+
 struct CallbackTimings {
     ExecTiming somethingChanged;
     ExecTiming route;
@@ -143,6 +223,17 @@ struct CallbackTimings {
     ExecTiming updateCycle;
 
     float spikeThresholdFactor = 11.5; // configurable multiplier
+
+    unsigned long readTransactions = 0; // transazioni di lettura Modbus nell'ultimo giro completo degli IP
+    unsigned long writeTransactions = 0; // transazioni di scrittura Modbus nell'ultimo giro completo degli IP
+    unsigned long writeFramesSaved = 0;  // totale scritture singole evitate grazie a FC15/FC16
+    unsigned long cycles = 0;            // giri completi degli IP dall'avvio
+
+    unsigned long panelRequests = 0; // richieste dei pannelli al server nell'ultimo secondo
+    unsigned long panelErrors = 0;   // di cui rifiutate con una risposta di eccezione (dettaglio per FC in MgsModbus::MbsGetStats)
+
+    std::vector<UnitTiming> units; // istogramma latenze, timeout e quarantene per unit, aggiornato ad ogni giro completo degli IP
+    std::vector<GatewayTiming> gateways; // stesse statistiche sommate per gateway (ordine di IPs)
 };
 
 class DomoManager {
@@ -156,9 +247,14 @@ private:
 
     std::vector<GenericPrgDevice> PrgDevices;
     List<structIP> IPs;
+    DeviceRegistry Registry; // indici dei device per IP e priorita, costruito in Begin
     ModbusBuffer Buffer;
     ToggleManager Toggles;
 
+    // Registri del server serviti direttamente dal Buffer (vedi EnableDirectServer)
+    ModbusBufferServerHandler serverHandler;
+    bool directServer = false;
+
     InitDevicesFn initDevicesFn;
     InitBufferFn initBufferFn;
 
@@ -168,27 +264,71 @@ private:
 
     pin_size_t ledR, ledW, ledPnl, ledErr;
     int areaErrors, areaRunningT;
+    int areaProfile = -1; // prima area delle statistiche del profiler (vedi DefineProfileAreas), -1 = non pubblicate
+    int areaTelemetry = -1; // prima area della telemetria di device e gateway (vedi DefineTelemetryAreas)
+    int telemetryItems = 0; // device + gateway riservati in DefineTelemetryAreas
 
     // NEW: timing struct
     CallbackTimings timings;
 
+    unsigned long totalReadTransactions = 0;
+    unsigned long totalWriteTransactions = 0;
+
+    // Server dei pannelli dell'ultimo Update, per i contatori di richieste ed eccezioni del watchdog
+    MgsModbus *panelServer = nullptr;
+    unsigned long totalPanelRequests = 0;
+    unsigned long totalPanelErrors = 0;
+
+    // Pool di connessioni verso i gateway (opzionale, vedi EnableClientPool)
+    ModbusClientPool *clientPool = nullptr;
+
+    // Client asincrono con richieste in pipeline su tutti i gateway (opzionale, vedi EnableAsyncClient)
+    ModbusAsyncEngine *asyncEngine = nullptr;
+
+    // Registrazione del traffico di campo e pannelli (vedi RecordTrace)
+    TraceRecorder *traceRecorder = nullptr;
+
+    // Cursore di ManageMdbCli sul journal del buffer (usato solo se il journal e' abilitato)
+    ModbusBufferJournalCursor routeCursor;
+
     // Static instance for wrappers 
     static DomoManager* instance;
 
     //Watchdog
     using WatchdogFn = void (*)(const WatchdogStatus&);
     WatchdogFn watchdogCallback = nullptr;
+    std::vector<WatchdogRule> watchdogRules;
+    WatchdogLevel watchdogLevel = WatchdogOk;
+    unsigned int watchdogEscalateChecks = 3; // controlli (1 al secondo) per salire di un livello
+    unsigned int watchdogRecoverChecks = 10; // controlli per scendere di un livello
+    unsigned int watchdogStreak = 0, watchdogCalm = 0;
+    bool gatewaysDown = false; // tutti i gateway in errore nell'ultimo Update
+
+    // Load shedding: entra con updateCycle.avg oltre shedBudget (o watchdog a livello Shed),
+    // esce dopo shedRecoverChecks controlli consecutivi sotto shedBudget * shedExitRatio
+    bool shedding = false;
+    float shedBudget = 0; // ms, 0 = solo dal watchdog
+    float shedExitRatio = 0.7;
+    unsigned int shedRecoverChecks = 5;
+    unsigned int shedCalm = 0;
+    ActivityLoopFn optionalActivity = nullptr;
     
     // ---------- Timing Helpers ----------
+    // Durata in us di f, registrata anche nella zona del profiler
     template<typename Fn>
-    unsigned long Measure(Fn f) {
-        unsigned long t0 = millis();
+    unsigned long Measure(ProfileZone zone, Fn f) {
+        unsigned long t0 = micros();
         f();
-        return millis() - t0;
+        unsigned long us = micros() - t0;
+        PROFILE_ADD(zone, us);
+        return us;
     }
 
-    void UpdateTiming(ExecTiming &t, unsigned long exec, float threshold) {
-        t.last = exec;
+    // execUs in microsecondi: last resta in ms per il watchdog, avg e' in ms con i decimali
+    // cosi anche i callback sotto il millisecondo hanno una media significativa
+    void UpdateTiming(ExecTiming &t, unsigned long execUs, float threshold) {
+        float exec = execUs / 1000.0f;
+        t.last = execUs / 1000;
 
         if (t.avg == 0) {
             t.avg = exec;
@@ -199,11 +339,11 @@ private:
         t.avg = t.avg * (1.0f - alpha) + exec * alpha;
 
         bool wasSpike = t.spike;
-        t.spike = exec > t.avg * threshold;
+        t.spike = exec > t.avg * threshold && t.last >= SPIKE_MIN_MS;
 
         if (t.spike) {
-            if (exec > t.maxSpike)
-                t.maxSpike = exec;
+            if (t.last > t.maxSpike)
+                t.maxSpike = t.last;
 
             //Aggiorna i contatori per il Watchdog
             t.spikeCount++; t.lastSpikeTime = millis();
@@ -216,7 +356,7 @@ private:
                     Serial.print(" "); 
                 } 
                 Serial.print("exec=");
-                Serial.print(exec);
+                Serial.print(exec, 3);
                 Serial.print("ms avg=");
                 Serial.print(t.avg);
                 Serial.print(" threshold=");
@@ -226,7 +366,52 @@ private:
     }
 
 
-    int DeviceHasErrors(std::vector<GenericPrgDevice> prgDevices) {
+    void UpdateTransactions() {
+        unsigned long _total = 0, _totalWrite = 0, _saved = 0;
+        timings.units.resize(PrgDevices.size());
+        for (int i = 0; i < PrgDevices.size(); i++) {
+            GenericPrgDevice &prgDevice = PrgDevices[i];
+            _total += prgDevice.GetReadTransactions();
+            _totalWrite += prgDevice.GetWriteTransactions();
+            _saved += prgDevice.GetWriteFramesSaved();
+
+            UnitTiming &_unit = timings.units[i];
+            _unit.name = prgDevice.GetName();
+            _unit.ip = prgDevice.GetIp();
+            _unit.unitId = prgDevice.GetDeviceAddress();
+            _unit.stats = prgDevice.GetUnitStats();
+        }
+
+        timings.gateways.resize(IPs.getSize());
+        for (int i = 0; i < IPs.getSize(); i++) {
+            GatewayTiming &_gateway = timings.gateways[i];
+            _gateway = GatewayTiming();
+            _gateway.ip = IPs.get(i).IP;
+
+            float _latencySum = 0;
+            for (int d : Registry.GetDevicesByIp(i)) {
+                const GenericPrgDevice::GenericPrgDeviceUnitStats &_stats = timings.units[d].stats;
+                _gateway.requests += _stats.requests;
+                _gateway.failures += _stats.failures;
+                _gateway.timeouts += _stats.timeouts;
+                _gateway.responses += _stats.responses;
+                _latencySum += _stats.avgLatency * _stats.responses;
+                _gateway.maxLatency = max(_gateway.maxLatency, _stats.maxLatency);
+                if (_stats.responses > 0 && (_gateway.lastSuccess == 0 || (long)(_stats.lastSuccess - _gateway.lastSuccess) > 0))
+                    _gateway.lastSuccess = _stats.lastSuccess;
+            }
+            if (_gateway.responses > 0)
+                _gateway.avgLatency = _latencySum / _gateway.responses;
+        }
+
+        timings.readTransactions = _total - totalReadTransactions;
+        totalReadTransactions = _total;
+        timings.writeTransactions = _totalWrite - totalWriteTransactions;
+        totalWriteTransactions = _totalWrite;
+        timings.writeFramesSaved = _saved;
+    }
+
+    int DeviceHasErrors(const std::vector<GenericPrgDevice> &prgDevices) {
         static unsigned long Mask = 0;
         short _errors = 0;
 
@@ -256,7 +441,7 @@ private:
     //Invece di passare i callback originali direttamente a ManageMdbCli, passi dei wrapper che misurano il tempo e poi chiamano il callback vero.
     static void SomethingChangedWrapper(ModbusBuffer &buf) { 
         if (instance && instance->somethingChanged) { 
-            unsigned long exec = instance->Measure([&]() { 
+            unsigned long exec = instance->Measure(ProfileSomethingChanged, [&]() { 
                 instance->somethingChanged(buf); 
             }); 
             instance->UpdateTiming(instance->timings.somethingChanged, exec, instance->timings.spikeThresholdFactor); 
@@ -265,63 +450,177 @@ private:
     
     static void RouteWrapper(BufferSourceInfo in, int area, ModbusBuffer &buf) { 
         if (instance && instance->route) { 
-            unsigned long exec = instance->Measure([&]() { 
+            unsigned long exec = instance->Measure(ProfileRoute, [&]() { 
                 instance->route(in, area, buf); 
             }); 
             instance->UpdateTiming(instance->timings.route, exec, instance->timings.spikeThresholdFactor); 
         } 
     }
 
-    void CheckWatchdog() {
-        WatchdogStatus st;
-        unsigned long now = millis();
+    void WriteTelemetryItem(int item, unsigned long requests, unsigned long failures, unsigned long timeouts,
+                            float avgLatency, unsigned long maxLatency, unsigned long responses, unsigned long lastSuccess) {
+        if (item >= telemetryItems) return;
+
+        long _age = responses > 0 ? min((millis() - lastSuccess) / 1000, (unsigned long)TELEMETRY_NEVER) : TELEMETRY_NEVER;
+        long _values[TELEMETRY_AREAS_PER_ITEM] = {
+            (long)(requests & 0xFFFF), (long)(failures & 0xFFFF), (long)(timeouts & 0xFFFF), // contatori a 16 bit che ripartono da 0
+            (long)min((unsigned long)(avgLatency + 0.5f), 0xFFFFUL), (long)min(maxLatency, 0xFFFFUL), _age
+        };
+        int _area = this->areaTelemetry + item * TELEMETRY_AREAS_PER_ITEM;
+        for (int i = 0; i < TELEMETRY_AREAS_PER_ITEM; i++)
+            Buffer.WriteElement(_area + i, ToPanel, _values[i]);
+    }
 
-        //Analizza timing di activityLoop
-        ExecTiming &t = timings.activityLoop;
-        // 1. Blocco
-        if (t.last > 120) {
-            st.blocked = true;
-            st.reason = "activityLoop blocked (>120ms)";
+    // Prima i device in ordine di registrazione, poi i gateway in ordine di IPs
+    void WriteTelemetry() {
+        int _item = 0;
+        for (auto& _unit : timings.units) {
+            const GenericPrgDevice::GenericPrgDeviceUnitStats &_stats = _unit.stats;
+            WriteTelemetryItem(_item++, _stats.requests, _stats.failures, _stats.timeouts,
+                               _stats.avgLatency, _stats.maxLatency, _stats.responses, _stats.lastSuccess);
+        }
+        for (auto& _gateway : timings.gateways) {
+            WriteTelemetryItem(_item++, _gateway.requests, _gateway.failures, _gateway.timeouts,
+                               _gateway.avgLatency, _gateway.maxLatency, _gateway.responses, _gateway.lastSuccess);
         }
+    }
+
+    ExecTiming* TimingOf(ProfileZone zone) {
+        switch (zone) {
+            case ProfileSomethingChanged: return &timings.somethingChanged;
+            case ProfileRoute:            return &timings.route;
+            case ProfileActivity:         return &timings.activityLoop;
+            case ProfileCycle:            return &timings.updateCycle;
+            default:                      return nullptr;
+        }
+    }
 
-        // 2. Media troppo alta
-        else if (t.avg > 70) {
-            st.overload = true;
-            st.reason = "activityLoop avg too high (>70ms)";
+    bool IsViolated(const WatchdogRule &rule, ExecTiming &t) {
+        switch (rule.type) {
+            case WatchdogRuleLast:   return t.last > rule.limit;
+            case WatchdogRuleAvg:    return t.avg > rule.limit;
+            case WatchdogRuleSpikes: return (t.spikeCount - t.spikeMark) > rule.limit;
+            case WatchdogRuleP99:
+                #ifdef DOMO_PROFILER
+                return profiler.Count(rule.zone) > 0 && profiler.Percentile(rule.zone, 99) / 1000.0f > rule.limit;
+                #else
+                return false;
+                #endif
         }
+        return false;
+    }
 
-        // 3. Troppi spike
-        else if (t.spikeCount > 10 &&
-                (now - t.lastSpikeTime) < 60000) {
-            st.unstable = true;
-            st.reason = "too many spikes in 60s";
+    // Rallentamento del polling per priorita secondo il livello del watchdog
+    void ApplyPollStretch() {
+        uint8_t _low = watchdogLevel >= WatchdogShed ? WATCHDOG_SHED_STRETCH : (watchdogLevel >= WatchdogDegrade ? WATCHDOG_DEGRADE_STRETCH : 1);
+        if (shedding) _low = max(_low, LOAD_SHED_LOW_STRETCH);
+        uint8_t _normal = watchdogLevel >= WatchdogShed ? WATCHDOG_SHED_NORMAL_STRETCH : 1;
+        for (auto& prgDevice : PrgDevices) {
+            if (prgDevice.GetPriority() == Low)
+                prgDevice.SetPollStretch(_low);
+            else if (prgDevice.GetPriority() == Normal)
+                prgDevice.SetPollStretch(_normal);
         }
+    }
 
-        /*
-        // 4. Nessuna attività
-        static unsigned long lastExec = 0;
-        if (t.last > 0)
-            lastExec = now;
+    void SetWatchdogLevel(WatchdogLevel level, const char* reason) {
+        Serial.print("[WATCHDOG] livello ");
+        Serial.print(watchdogLevel);
+        Serial.print(" -> ");
+        Serial.print(level);
+        if (reason) {
+            Serial.print(" ");
+            Serial.print(reason);
+        }
+        Serial.println();
 
-        if (!st.reason && (now - lastExec > 60000)) {
-            st.inactive = true;
-            st.reason = "no activityLoop execution for 60s";
-        } */
+        watchdogLevel = level;
+        ApplyPollStretch();
 
-        //Analizza timing di updateCycle
-        ExecTiming &u = timings.updateCycle;
+        if (level == WatchdogReset)
+            DOMO_SYSTEM_RESET();
+    }
 
-        // Ciclo troppo lento → congestione o blocco
-        if (u.last > 150) {
-            st.overload = true;
-            st.reason = "Update cycle too slow (>150ms)";
+    // Un livello alla volta: sale dopo watchdogEscalateChecks controlli consecutivi sopra il livello corrente,
+    // scende dopo watchdogRecoverChecks controlli consecutivi sotto. Il primo passo (Log) e' immediato
+    void Escalate(WatchdogLevel target, const char* reason) {
+        if (target > watchdogLevel) {
+            watchdogCalm = 0;
+            if (watchdogLevel == WatchdogOk || ++watchdogStreak >= watchdogEscalateChecks) {
+                watchdogStreak = 0;
+                SetWatchdogLevel((WatchdogLevel)(watchdogLevel + 1), reason);
+            }
+        }
+        else if (target < watchdogLevel) {
+            watchdogStreak = 0;
+            if (++watchdogCalm >= watchdogRecoverChecks) {
+                watchdogCalm = 0;
+                SetWatchdogLevel((WatchdogLevel)(watchdogLevel - 1), nullptr);
+            }
+        }
+        else {
+            watchdogStreak = 0;
+            watchdogCalm = 0;
         }
+    }
 
-        if (u.avg > 120) {
-            st.overload = true;
-            st.reason = "Update cycle avg too high (>120ms)";
+    void CheckWatchdog() {
+        WatchdogStatus st;
+        WatchdogLevel _target = WatchdogOk;
+        unsigned long now = millis();
+
+        //Finestra fissa per il conteggio degli spike
+        for (ExecTiming *t : {&timings.somethingChanged, &timings.route, &timings.activityLoop, &timings.updateCycle}) {
+            if (now - t->spikeMarkTime >= WATCHDOG_SPIKE_WINDOW) {
+                t->spikeMark = t->spikeCount;
+                t->spikeMarkTime = now;
+            }
         }
 
+        //Regole per ExecTiming: vince il motivo della regola violata di livello piu alto
+        for (auto& rule : watchdogRules) {
+            ExecTiming *t = TimingOf(rule.zone);
+            if (!t || !IsViolated(rule, *t))
+                continue;
+
+            switch (rule.type) {
+                case WatchdogRuleLast:   st.blocked = true; break;
+                case WatchdogRuleSpikes: st.unstable = true; break;
+                default:                 st.overload = true; break;
+            }
+            if (!st.reason || rule.level > _target)
+                st.reason = rule.reason;
+            if (rule.level > _target)
+                _target = rule.level;
+        }
+
+        //Richieste dei pannelli rifiutate (indirizzi fuori mappa, FC non supportati...)
+        if (panelServer) {
+            unsigned long _requests = panelServer->MbsRequests();
+            unsigned long _errors = panelServer->MbsErrors();
+            timings.panelRequests = _requests - totalPanelRequests;
+            timings.panelErrors = _errors - totalPanelErrors;
+            totalPanelRequests = _requests;
+            totalPanelErrors = _errors;
+
+            if (timings.panelErrors > 10 && timings.panelErrors * 2 > timings.panelRequests) {
+                st.panelErrors = true;
+                if (!st.reason)
+                    st.reason = "panel requests rejected (>50% exceptions)";
+                if (_target < WatchdogLog)
+                    _target = WatchdogLog;
+            }
+        }
+
+        //Nessun gateway risponde: reset della scheda, ma solo dopo la salita di tutti i livelli
+        if (gatewaysDown) {
+            st.blocked = true;
+            st.reason = "all gateways in error";
+            _target = WatchdogReset;
+        }
+
+        Escalate(_target, st.reason);
+        st.level = watchdogLevel;
 
         //Per tutti i flag settati
         // Se c’è un problema, chiama la callback esterna
@@ -331,11 +630,173 @@ private:
     }
 
     SystemManager system;
+
+    void SetShedding(bool state) {
+        Serial.print("[LOAD SHEDDING] ");
+        Serial.print(state ? "ON updateCycle avg=" : "OFF updateCycle avg=");
+        Serial.println(timings.updateCycle.avg);
+
+        shedding = state;
+        shedCalm = 0;
+        ApplyPollStretch();
+        this->system.set(SystemManager::LOAD_SHEDDING, state);
+    }
+
+    // Controllato ogni secondo dopo il watchdog, con isteresi sull'uscita
+    void CheckLoadShedding() {
+        float _avg = timings.updateCycle.avg;
+        bool _forced = watchdogLevel >= WatchdogShed;
+
+        if (!shedding) {
+            if (_forced || (shedBudget > 0 && _avg > shedBudget))
+                SetShedding(true);
+        }
+        else if (!_forced && (shedBudget == 0 || _avg < shedBudget * shedExitRatio)) {
+            if (++shedCalm >= shedRecoverChecks)
+                SetShedding(false);
+        }
+        else
+            shedCalm = 0;
+    }
+
+    // Durante il load shedding i pannelli vengono allineati meno spesso
+    unsigned long PnlPoll() {
+        return shedding ? PNL_POLL * LOAD_SHED_PNL_FACTOR : PNL_POLL;
+    }
+
+    // client: unico client servito ogni PNL_POLL (Update storico), server: tutte le connessioni ad ogni ciclo
+    void UpdateCycle(EthernetClient *client, EthernetServer *server, MgsModbus &modbusTCPServer, ModbusTCPClient &modbusTCPClient)
+    {
+        unsigned long _runningT = micros();
+        static unsigned long _lastPnlPoll = millis();
+        static short ipIdx = 0;
+        static bool _rw = false;             
+
+        panelServer = &modbusTCPServer;
+
+        if (directServer) {
+            // Richieste dei pannelli servite dal Buffer ad ogni ciclo: nessuna copia a PNL_POLL
+            modbusTCPServer.MbsSetHandler(&serverHandler);
+            if (client) {
+                PROFILE_ZONE(ProfilePanel);
+                modbusTCPServer.MbsRun(*client);
+            }
+        } else {
+            modbusTCPServer.MbsSetHandler(nullptr);
+
+            // Mappa del server dimensionata sulle aree del buffer, una zona per tipo con indirizzo = area
+            if (modbusTCPServer.GetSpaceLen(MB_SPACE_HOLDING) != Buffer.size())
+                modbusTCPServer.MbsBegin(Buffer.size(), Buffer.size(), Buffer.size(), Buffer.size());
+        }
+
+        // Richieste dei pannelli servite subito, indipendentemente dal giro degli IP
+        if (server) {
+            PROFILE_ZONE(ProfilePanel);
+            modbusTCPServer.MbsRun(*server);
+        }
+
+        if (asyncEngine) {
+            // Tutti i gateway ad ogni chiamata: ogni Update e' un giro completo degli IP
+            ManageMdbCli(this->ledR, this->ledW, *asyncEngine, &IPs, Buffer, PrgDevices, Toggles,
+                         &DomoManager::SomethingChangedWrapper, 
+                         &DomoManager::RouteWrapper, &routeCursor);
+            ipIdx = IPs.getSize() - 1;
+        }
+        else if (ExistDevicesByIp(ipIdx)) {
+           // ManageMdbCli(this->ledR, this->ledW, modbusTCPClient, &IPs, ipIdx,
+           //              Buffer, PrgDevices, Toggles, this->somethingChanged, this->route);
+           if (clientPool) {
+               ManageMdbCli(this->ledR, this->ledW, *clientPool, &IPs, ipIdx, Buffer, PrgDevices, Registry, Toggles,
+                             &DomoManager::SomethingChangedWrapper, 
+                             &DomoManager::RouteWrapper, &routeCursor);
+           } else {
+               ManageMdbCli(this->ledR, this->ledW, modbusTCPClient, &IPs, ipIdx, Buffer, PrgDevices, Registry, Toggles,
+                             &DomoManager::SomethingChangedWrapper, 
+                             &DomoManager::RouteWrapper, &routeCursor);
+           }
+        }
+
+        if (clientPool) clientPool->Loop();
+
+        bool restartIP = true;
+        for (short i = 0; i < IPs.getSize(); i++) {
+            if (!(IPs.get(i).InError && IPs.get(i).Errors > 5)) {
+                restartIP = false;
+                break;
+            }
+        }
+
+        // Tutti i gateway in errore: il reset passa dall'escalation del watchdog (CheckWatchdog)
+        gatewaysDown = restartIP && IPs.getSize() > 0;
+
+        if (ipIdx < IPs.getSize() - 1){
+            ipIdx++;
+        }
+        else {
+            ipIdx = 0;
+            UpdateTransactions();
+            timings.cycles++;
+            if (traceRecorder) traceRecorder->Cycle();
+        
+            if (!directServer && (millis() - _lastPnlPoll >= PnlPoll())) {
+                if (client)
+                    ManageMdbSvr(this->ledPnl, *client, modbusTCPServer, Buffer, Toggles, "Server 01", _rw);
+                else
+                    ManageMdbSvr(this->ledPnl, modbusTCPServer, Buffer, Toggles, "Server 01", _rw);
+                _rw = !_rw;
+                _lastPnlPoll = millis();
+            } else {
+                // Server diretto: nessun giro di copia, activityLoop ad ogni giro completo degli IP
+                if (directServer && (millis() - _lastPnlPoll >= PnlPoll())) {
+                    digitalWrite(this->ledPnl, !digitalRead(this->ledPnl));
+                    _lastPnlPoll = millis();
+                }
+
+                // ---- TIMED CALLBACKS ----
+                unsigned long _activityUs = Measure(ProfileActivity, [&]() {
+                    this->activityLoop(Buffer);
+                    // Lavoro non critico: saltato durante il load shedding
+                    if (this->optionalActivity && !this->shedding) this->optionalActivity(Buffer);
+                });
+                UpdateTiming(timings.activityLoop, _activityUs, timings.spikeThresholdFactor);
+
+                //Se sono variati
+                if(this->system.hasChanged()) {
+                    Buffer.WriteElement(AREA_SYSTEM_FLAGS, ToPanel, this->system.getBitmask());
+                } 
+            }
+        }
+
+        int _errors = DeviceHasErrors(PrgDevices);
+        digitalWrite(this->ledErr, _errors > 0);
+        Buffer.WriteElement(this->areaErrors, ToPanel, _errors);
+        this->system.set(SystemManager::DEVICES_IN_ALLARME, _errors > 0);
+
+        static unsigned long lastWatchdogCheck = 0;
+        if (millis() - lastWatchdogCheck >= 1000) {   // controlla ogni 1s
+            CheckWatchdog();
+            CheckLoadShedding();
+            lastWatchdogCheck = millis();
+
+            Buffer.WriteElement(this->areaRunningT, ToPanel,timings.updateCycle.last);
+            #ifdef DOMO_PROFILER
+            if (this->areaProfile >= 0) profiler.WriteAreas(Buffer, this->areaProfile);
+            #endif
+            if (this->areaTelemetry >= 0) WriteTelemetry();
+        }
+        else {
+            //Aggiorna i dati del watchdog di loop
+            unsigned long _exec = micros() - _runningT; 
+            PROFILE_ADD(ProfileCycle, _exec);
+            UpdateTiming(timings.updateCycle, _exec, timings.spikeThresholdFactor);
+        }
+    }
+
 public:
 
     DomoManager(int areas, InitDevicesFn initDevices, InitBufferFn initBuffer,
                 pin_size_t ledR, pin_size_t ledW, pin_size_t ledPnl, pin_size_t ledErr)
-        : Buffer(areas), initDevicesFn(initDevices), initBufferFn(initBuffer)
+        : Buffer(areas), serverHandler(Buffer), initDevicesFn(initDevices), initBufferFn(initBuffer)
     {
         this->ledR = ledR;
         this->ledW = ledW;
@@ -345,11 +806,16 @@ public:
         this->areaErrors = AREA_SYSTEM_ERRORS;
         this->areaRunningT = AREA_SYSTEM_RUNNING_T;
 
+        this->routeCursor.seq = 0;
+        this->routeCursor.synced = false;
+
         //Battezza nomi dei timings del watchdog
         timings.somethingChanged.name = "somethingChanged";
         timings.route.name = "route";
         timings.activityLoop.name = "activityLoop";
         timings.updateCycle.name = "updateCycle";
+
+        ResetWatchdogRules();
     }
 
     void Begin(SomethingChangedFn somethingChanged, RouteFn route, ActivityLoopFn activityLoop) {
@@ -364,104 +830,358 @@ public:
         if (initBufferFn) initBufferFn(*this);
 
         BuildIps(PrgDevices, &IPs);
+        Registry.Build(PrgDevices);
+
+        if (clientPool) clientPool->Begin(&IPs);
+        if (asyncEngine) asyncEngine->Begin(&IPs, Registry);
 
         Serial.print("Hw items to query: ");
         Serial.println(PrgDevices.size());
     }
 
+    // Mantiene aperta una connessione per gateway tra un ciclo e l'altro invece di connect/stop ad ogni passata.
+    // Il ModbusTCPClient passato a Update non viene piu usato.
+    void EnableClientPool(unsigned long idleTimeout = 30000, unsigned long maxBackoff = 30000) {
+        if (clientPool == nullptr) {
+            clientPool = new ModbusClientPool(idleTimeout, maxBackoff);
+            if (IPs.getSize() > 0) clientPool->Begin(&IPs);
+        }
+    }
+
+    // Update non attende piu le risposte: ad ogni chiamata raccoglie quelle arrivate da tutti i gateway
+    // e accoda nuove richieste, fino a maxInFlight aperte per gateway. Ha precedenza sul pool.
+    void EnableAsyncClient(uint8_t maxInFlight = 2, unsigned long timeout = 300) {
+        if (asyncEngine == nullptr) {
+            asyncEngine = new ModbusAsyncEngine(maxInFlight, timeout);
+            if (IPs.getSize() > 0) asyncEngine->Begin(&IPs, Registry);
+        }
+    }
+
+    // Richieste aperte verso il gateway ipIndex (0 senza client asincrono)
+    uint8_t GetInFlight(short ipIndex) {
+        return asyncEngine ? asyncEngine->InFlight(ipIndex) : 0;
+    }
+
     void SetWatchdogCallback(WatchdogFn fn) {
         watchdogCallback = fn;
     }
 
+    // Regole di default: i limiti storici di activityLoop e updateCycle, piu route e somethingChanged.
+    // Nessuna porta al reset: va aggiunta esplicitamente con AddWatchdogRule(..., WatchdogReset, ...)
+    void ResetWatchdogRules() {
+        watchdogRules.clear();
+        AddWatchdogRule(ProfileActivity, WatchdogRuleLast, 120, WatchdogLog, "activityLoop blocked (>120ms)");
+        AddWatchdogRule(ProfileActivity, WatchdogRuleAvg, 70, WatchdogDegrade, "activityLoop avg too high (>70ms)");
+        AddWatchdogRule(ProfileActivity, WatchdogRuleSpikes, 10, WatchdogLog, "too many spikes in 60s");
+        AddWatchdogRule(ProfileCycle, WatchdogRuleLast, 150, WatchdogDegrade, "Update cycle too slow (>150ms)");
+        AddWatchdogRule(ProfileCycle, WatchdogRuleAvg, 120, WatchdogShed, "Update cycle avg too high (>120ms)");
+        AddWatchdogRule(ProfileRoute, WatchdogRuleLast, 50, WatchdogLog, "route too slow (>50ms)");
+        AddWatchdogRule(ProfileSomethingChanged, WatchdogRuleLast, 50, WatchdogLog, "somethingChanged too slow (>50ms)");
+    }
+
+    void ClearWatchdogRules() {
+        watchdogRules.clear();
+    }
+
+    void AddWatchdogRule(ProfileZone zone, WatchdogRuleType type, float limit, WatchdogLevel level, const char* reason) {
+        watchdogRules.push_back({zone, type, limit, level, reason});
+    }
+
+    void SetWatchdogEscalation(unsigned int escalateChecks, unsigned int recoverChecks) {
+        watchdogEscalateChecks = max(escalateChecks, 1U);
+        watchdogRecoverChecks = max(recoverChecks, 1U);
+    }
+
+    WatchdogLevel GetWatchdogLevel() {
+        return watchdogLevel;
+    }
+
+    // Load shedding automatico quando la media di updateCycle supera cycleBudget (ms): device Low rimandati
+    // (LOAD_SHED_LOW_STRETCH), PNL_POLL allungato (LOAD_SHED_PNL_FACTOR) e activity opzionale saltata.
+    // Torna normale dopo recoverChecks secondi consecutivi sotto cycleBudget * exitRatio.
+    // Senza budget entra solo con il watchdog a livello Shed. Lo stato e' nel flag SystemManager::LOAD_SHEDDING
+    void EnableLoadShedding(float cycleBudget, float exitRatio = 0.7, unsigned int recoverChecks = 5) {
+        shedBudget = cycleBudget;
+        shedExitRatio = constrain(exitRatio, 0.1f, 1.0f);
+        shedRecoverChecks = max(recoverChecks, 1U);
+    }
+
+    // Lavoro non critico dell'activityLoop (statistiche, medie, log...), chiamato dopo activityLoop
+    // solo quando non c'e' load shedding
+    void SetOptionalActivity(ActivityLoopFn fn) {
+        optionalActivity = fn;
+    }
+
+    bool IsShedding() {
+        return shedding;
+    }
+
+    // Abilita il journal delle variazioni di un tipo. Con quello Field il routing di ManageMdbCli visita solo
+    // le aree scritte invece di scansionare tutto il buffer. Altri moduli possono leggerlo con un proprio cursore:
+    // ModbusBufferJournalCursor c = GetBuffer().GetJournal(FromPanel)->Subscribe();
+    void EnableJournal(unsigned int capacity, ModbusBufferFlagType type = Field) {
+        Buffer.EnableJournal(capacity, type);
+    }
+
+    // Registra su recorder tutte le letture, scritture dei pannelli e fine di ogni giro degli IP
+    // (i comandi UDP con IOT::SetTrace). nullptr ferma la registrazione.
+    // La traccia si riproduce sulla build host con HostReplay (extras/host), attraverso Update
+    void RecordTrace(TraceRecorder *recorder) {
+        if (traceRecorder && traceRecorder != recorder) traceRecorder->End();
+        traceRecorder = recorder;
+        if (recorder && !recorder->IsRecording()) recorder->Begin();
+        DeviceManagement_SetTrace(recorder, recorder ? &PrgDevices : nullptr);
+    }
+
     ModbusBuffer& GetBuffer() {
         return this->Buffer;
     }
 
+    // Device nell'ordine di addDevice (lo stesso indice delle tracce e di timings.units)
+    std::vector<GenericPrgDevice>& GetDevices() {
+        return this->PrgDevices;
+    }
+
     const CallbackTimings& GetTimings() const {
         return timings;
     }
 
-    bool ExistDevicesByIp(int ipIdx) {
-        for (auto& prgDevice : PrgDevices) {
-            if (prgDevice.GetIp() == IPs.get(ipIdx).IP)
+    // Latenze (istogramma), timeout e quarantene di una unit dall'ultimo giro completo degli IP.
+    // false se nessun device usa ip/unitId o se il primo giro non e' ancora finito
+    bool GetUnitTiming(IPAddress ip, unsigned int unitId, UnitTiming &out) const {
+        for (const UnitTiming &_unit : timings.units) {
+            if (_unit.ip == ip && _unit.unitId == unitId) {
+                out = _unit;
                 return true;
+            }
         }
         return false;
     }
 
+    bool ExistDevicesByIp(int ipIdx) {
+        return !Registry.GetDevicesByIp(ipIdx).empty();
+    }
+
     void Update(EthernetClient &client, MgsModbus &modbusTCPServer, ModbusTCPClient &modbusTCPClient)
     {
-        unsigned long _runningT = millis();
-        static unsigned long _lastPnlPoll = millis();
-        static short ipIdx = 0;
-        static bool _rw = false;             
+        UpdateCycle(&client, nullptr, modbusTCPServer, modbusTCPClient);
+    }
 
-        if (ExistDevicesByIp(ipIdx)) {
-           // ManageMdbCli(this->ledR, this->ledW, modbusTCPClient, &IPs, ipIdx,
-           //              Buffer, PrgDevices, Toggles, this->somethingChanged, this->route);
-           ManageMdbCli(this->ledR, this->ledW, modbusTCPClient, &IPs, ipIdx, Buffer, PrgDevices, Toggles,
-                         &DomoManager::SomethingChangedWrapper, 
-                         &DomoManager::RouteWrapper);
+    // Server multi client: accetta piu pannelli e risponde alle richieste ad ogni Update, non solo ogni PNL_POLL
+    void Update(EthernetServer &server, MgsModbus &modbusTCPServer, ModbusTCPClient &modbusTCPClient)
+    {
+        UpdateCycle(nullptr, &server, modbusTCPServer, modbusTCPClient);
+    }
+
+    void addDevice(const char* name, arduino::IPAddress ip, unsigned int deviceAddress,
+                   GenericPrgDevice::GenericPrgDeviceChannel channels[], size_t channelSize,
+                   std::vector<int> ioAreas, short ErrorCnt, GenericPrgDevicePriority priority)
+    {
+        PrgDevices.emplace_back(name, ip, deviceAddress, channels, channelSize, ioAreas, ErrorCnt, priority);
+    }
+
+    // Limita la dimensione delle letture coalescenti per tutti i device dietro un gateway
+    // (per gateway che non tollerano frame grandi)
+    void SetMaxReadItems(arduino::IPAddress ip, int registers, int bits) {
+        for (auto& prgDevice : PrgDevices) {
+            if (prgDevice.GetIp() == ip)
+                prgDevice.SetMaxReadItems(registers, bits);
         }
+    }
 
-        bool restartIP = true;
-        for (short i = 0; i < IPs.getSize(); i++) {
-            if (!(IPs.get(i).InError && IPs.get(i).Errors > 5)) {
-                restartIP = false;
-                break;
-            }
+    // Numero massimo di item per scrittura multipla FC15/FC16 per i device dietro un gateway (1 = solo scritture singole)
+    void SetMaxWriteBatch(arduino::IPAddress ip, int items) {
+        for (auto& prgDevice : PrgDevices) {
+            if (prgDevice.GetIp() == ip)
+                prgDevice.SetMaxWriteBatch(items);
         }
+    }
 
-        if (restartIP) {
-            NVIC_SystemReset();
-        } else {
-            if (ipIdx < IPs.getSize() - 1){
-                ipIdx++;
+    // Periodo di refresh desiderato per un device (channel=-1) o per un suo canale: lo scheduler
+    // legge prima i blocchi piu in ritardo rispetto al proprio periodo (default dalla priorita)
+    void SetRefreshPeriod(arduino::IPAddress ip, unsigned int deviceAddress, unsigned long period, int channel = -1) {
+        for (auto& prgDevice : PrgDevices) {
+            if (prgDevice.GetIp() == ip && prgDevice.GetDeviceAddress() == deviceAddress) {
+                if (channel < 0)
+                    prgDevice.SetRefreshPeriod(period);
+                else
+                    prgDevice.SetChannelRefreshPeriod(channel, period);
             }
-            else {
-                ipIdx = 0;
-            
-                if ((millis() - _lastPnlPoll >= PNL_POLL)) {
-                    ManageMdbSvr(this->ledPnl,client, modbusTCPServer, Buffer, Toggles, "Server 01", _rw);
-                    _rw = !_rw;
-                    _lastPnlPoll = millis();
-                } else {
-                    // ---- TIMED CALLBACKS ----
-                    timings.activityLoop.last     = Measure([&]() { this->activityLoop(Buffer); });
-                    UpdateTiming(timings.activityLoop,     timings.activityLoop.last,     timings.spikeThresholdFactor);
-
-                    //Se sono variati
-                    if(this->system.hasChanged()) {
-                        Buffer.WriteElement(AREA_SYSTEM_FLAGS, ToPanel, this->system.getBitmask());
-                    } 
+        }
+    }
+
+    // true: i pannelli leggono e scrivono direttamente nel Buffer, le scritture arrivano subito come FromPanel.
+    // false (default): registri interni del server allineati al Buffer a giri alterni ogni PNL_POLL (comportamento storico)
+    void EnableDirectServer(bool enable) {
+        directServer = enable;
+    }
+
+    // Polling adattivo su tutti i device (o su quelli di un gateway): i canali che variano salgono fino a minPeriod,
+    // quelli fermi scendono fino a maxPeriod. Chiamare dopo eventuali SetRefreshPeriod, minPeriod=0 disabilita
+    void EnableAdaptivePolling(unsigned long minPeriod = 50, unsigned long maxPeriod = 10000) {
+        for (auto& prgDevice : PrgDevices)
+            prgDevice.SetAdaptiveRefresh(minPeriod, maxPeriod);
+    }
+
+    void EnableAdaptivePolling(arduino::IPAddress ip, unsigned long minPeriod, unsigned long maxPeriod) {
+        for (auto& prgDevice : PrgDevices) {
+            if (prgDevice.GetIp() == ip)
+                prgDevice.SetAdaptiveRefresh(minPeriod, maxPeriod);
+        }
+    }
+
+    // Timeout di risposta di una unit dietro il gateway (default UNIT_TIMEOUT_DEFAULT), separato da quello TCP
+    void SetUnitTimeout(arduino::IPAddress ip, unsigned int deviceAddress, unsigned long timeout) {
+        for (auto& prgDevice : PrgDevices) {
+            if (prgDevice.GetIp() == ip && prgDevice.GetDeviceAddress() == deviceAddress)
+                prgDevice.SetUnitTimeout(timeout);
+        }
+    }
+
+    // Istogramma delle latenze per unit (fasce UNIT_LATENCY_LIMITS), con timeout e quarantene
+    void PrintUnitTimings() {
+        Serial.println(" - Latenze unit (ms) - ");
+        for (auto& _unit : timings.units) {
+            Serial.print(_unit.name);
+            Serial.print(" IP: ");
+            Serial.print(_unit.ip);
+            Serial.print(" Unit: ");
+            Serial.print(_unit.unitId);
+            Serial.print(" richieste: ");
+            Serial.print(_unit.stats.requests);
+            Serial.print(" errori: ");
+            Serial.print(_unit.stats.failures);
+            Serial.print(" avg: ");
+            Serial.print(_unit.stats.avgLatency);
+            Serial.print(" max: ");
+            Serial.print(_unit.stats.maxLatency);
+            Serial.print(" timeout: ");
+            Serial.print(_unit.stats.timeouts);
+            Serial.print(" quarantene: ");
+            Serial.print(_unit.stats.quarantines);
+            if (_unit.stats.quarantined)
+                Serial.print(" IN QUARANTENA");
+            Serial.print(" |");
+            for (int b = 0; b < UNIT_LATENCY_BUCKETS; b++) {
+                Serial.print(" ");
+                if (b < UNIT_LATENCY_BUCKETS - 1) {
+                    Serial.print("<=");
+                    Serial.print(UNIT_LATENCY_LIMITS[b]);
                 }
+                else {
+                    Serial.print(">");
+                    Serial.print(UNIT_LATENCY_LIMITS[b - 1]);
+                }
+                Serial.print(":");
+                Serial.print(_unit.stats.histogram[b]);
             }
+            Serial.println();
+        }
+    }
 
-            int _errors = DeviceHasErrors(PrgDevices);
-            digitalWrite(this->ledErr, _errors > 0);
-            Buffer.WriteElement(this->areaErrors, ToPanel, _errors);
-            this->system.set(SystemManager::DEVICES_IN_ALLARME, _errors > 0);
+    // Tempo massimo (ms) di letture sincrone per gateway ad ogni Update
+    void SetPollBudget(unsigned long budget) {
+        DeviceManagement_SetReadBudget(budget);
+    }
+
+    // min/avg/p99/max in us delle zone del profiler (vuoto con DOMO_NO_PROFILER)
+    void PrintProfile() {
+        #ifdef DOMO_PROFILER
+        profiler.PrintReport(Serial);
+        #endif
+    }
+
+    void ResetProfile() {
+        #ifdef DOMO_PROFILER
+        profiler.Reset();
+        #endif
+    }
+
+    // Pubblica ogni secondo le statistiche del profiler ai pannelli: PROFILE_AREAS_PER_ZONE aree per zona
+    // (min, avg, p99, max in us) da firstArea, nell'ordine di ProfileZone. Da chiamare in InitBufferFn
+    void DefineProfileAreas(int firstArea) {
+        this->areaProfile = firstArea;
+        for (int z = 0; z < PROFILE_ZONES; z++) {
+            for (int i = 0; i < PROFILE_AREAS_PER_ZONE; i++)
+                DefineBufferElement(firstArea + z * PROFILE_AREAS_PER_ZONE + i, 0, true, false, false,
+                                    (char*)Profiler::ZoneName((ProfileZone)z));
         }
+    }
 
-        static unsigned long lastWatchdogCheck = 0;
-        if (millis() - lastWatchdogCheck >= 1000) {   // controlla ogni 1s
-            CheckWatchdog();
-            lastWatchdogCheck = millis();
+    // Telemetria per i pannelli: TELEMETRY_AREAS_PER_ITEM aree per ogni device (ordine di registrazione)
+    // seguite da quelle di ogni gateway (ordine del primo device registrato), aggiornate ogni secondo.
+    // Da chiamare in InitBufferFn, dopo aver registrato i device: ritorna il numero di aree riservate
+    int DefineTelemetryAreas(int firstArea) {
+        // IPs non e' ancora costruita: conto i gateway distinti come BuildIps
+        std::vector<arduino::IPAddress> _ips;
+        for (auto& prgDevice : PrgDevices) {
+            if (std::find(_ips.begin(), _ips.end(), prgDevice.GetIp()) == _ips.end())
+                _ips.push_back(prgDevice.GetIp());
+        }
 
-            Buffer.WriteElement(this->areaRunningT, ToPanel,timings.updateCycle.last);
+        this->areaTelemetry = firstArea;
+        this->telemetryItems = PrgDevices.size() + _ips.size();
+        for (int item = 0; item < this->telemetryItems; item++) {
+            char* _name = item < (int)PrgDevices.size() ? (char*)PrgDevices[item].GetName() : (char*)"Gateway";
+            for (int i = 0; i < TELEMETRY_AREAS_PER_ITEM; i++)
+                DefineBufferElement(firstArea + item * TELEMETRY_AREAS_PER_ITEM + i, 0, true, false, false, _name);
         }
-        else {
-            //Aggiorna i dati del watchdog di loop
-            unsigned long _exec = millis() - _runningT; 
-            UpdateTiming(timings.updateCycle, _exec, timings.spikeThresholdFactor);
+        return this->telemetryItems * TELEMETRY_AREAS_PER_ITEM;
+    }
+
+    // Richieste, errori e latenze sommate per gateway
+    void PrintGatewayTimings() {
+        Serial.println(" - Gateway (ms) - ");
+        unsigned long _now = millis();
+        for (auto& _gateway : timings.gateways) {
+            Serial.print("IP: ");
+            Serial.print(_gateway.ip);
+            Serial.print(" richieste: ");
+            Serial.print(_gateway.requests);
+            Serial.print(" errori: ");
+            Serial.print(_gateway.failures);
+            Serial.print(" timeout: ");
+            Serial.print(_gateway.timeouts);
+            Serial.print(" avg: ");
+            Serial.print(_gateway.avgLatency);
+            Serial.print(" max: ");
+            Serial.print(_gateway.maxLatency);
+            Serial.print(" ultima risposta: ");
+            if (_gateway.responses > 0) {
+                Serial.print((_now - _gateway.lastSuccess) / 1000);
+                Serial.println("s fa");
+            }
+            else
+                Serial.println("mai");
         }
     }
 
-    void addDevice(const char* name, arduino::IPAddress ip, unsigned int deviceAddress,
-                   GenericPrgDevice::GenericPrgDeviceChannel channels[], size_t channelSize,
-                   std::vector<int> ioAreas, short ErrorCnt, GenericPrgDevicePriority priority)
-    {
-        PrgDevices.emplace_back(name, ip, deviceAddress, channels, channelSize, ioAreas, ErrorCnt, priority);
+    // Refresh ottenuto contro quello desiderato per ogni device, per dimensionare il bus
+    void PrintRefreshReport() {
+        Serial.println(" - Refresh devices (target / ottenuto ms) - ");
+        for (auto& prgDevice : PrgDevices) {
+            unsigned long _target = prgDevice.GetTargetPeriod();
+            unsigned long _achieved = prgDevice.GetAchievedPeriod();
+            Serial.print(prgDevice.GetName());
+            Serial.print(" IP: ");
+            Serial.print(prgDevice.GetIp());
+            Serial.print(" Address: ");
+            Serial.print(prgDevice.GetDeviceAddress());
+            Serial.print(" target: ");
+            Serial.print(_target);
+            Serial.print(" ottenuto: ");
+            Serial.print(_achieved);
+            if (_target > 0 && _achieved > _target + _target / 2)
+                Serial.print(" LENTO");
+            if (prgDevice.IsAdaptive()) {
+                Serial.print(" adattivo:");
+                for (int channel = 0; channel < prgDevice.GetChannelsSize(); channel++) {
+                    Serial.print(" ");
+                    Serial.print(prgDevice.GetChannelPeriod(channel));
+                }
+            }
+            Serial.println();
+        }
     }
 
     void DefineBufferElement(int modbusArea, int modbusAreaToWrite, bool WriteToPanel,
@@ -487,6 +1207,15 @@ public:
 
         std::vector<int> multipleInit=Buffer.getInitializedMultipleTimes();
         if (!multipleInit.empty()) { Serial.println(" - ERRORE Trovate Aree inizializzate piu volte - "); for (int area : multipleInit) { Serial.print(" Area: "); Serial.println(area); } }
+
+        std::vector<int> routeCycles=Buffer.getRoutingCycles();
+        if (!routeCycles.empty()) { Serial.println(" - ERRORE Trovati cicli di routing - "); for (int area : routeCycles) { Serial.print(" Area: "); Serial.println(area); } }
+
+        std::vector<int> routeInvalid=Buffer.getRoutingInvalidTargets();
+        if (!routeInvalid.empty()) { Serial.println(" - ERRORE Trovate aree con destinazione non valida - "); for (int area : routeInvalid) { Serial.print(" Area: "); Serial.println(area); } }
+
+        std::vector<int> routeChains=Buffer.getRoutingChains();
+        if (!routeChains.empty()) { Serial.println(" - Trovate aree che inoltrano un routing ricevuto - "); for (int area : routeChains) { Serial.print(" Area: "); Serial.println(area); } }
     }
 
     void systemManagerSet(SystemManager::SystemField field, bool value) {
@@ -8,8 +8,148 @@
 const int ANALOG_TRESHOLD=25;
 const int DELAY_VISUAL=800;
 
+//Span di decodifica delle letture sincrone: statico, nessuna allocazione ad ogni poll
+static uint16_t _mbRead[MODBUS_MAX_READ_BITS];
+
+//Tempo massimo (ms) speso in letture sincrone su un gateway per ciclo, vedi DeviceManagement_SetReadBudget
+static unsigned long readBudget=READ_BUDGET_DEFAULT;
+
+//Registrazione opzionale di letture e scritture dei pannelli, vedi DeviceManagement_SetTrace
+static TraceRecorder *trace=nullptr;
+static std::vector<GenericPrgDevice> *traceDevices=nullptr;
+
+void DeviceManagement_SetReadBudget(unsigned long budget) {
+  readBudget=budget;
+}
+
+void DeviceManagement_SetTrace(TraceRecorder *recorder, std::vector<GenericPrgDevice> *prgDevices) {
+  trace=recorder;
+  traceDevices=prgDevices;
+}
+
+MB_FC DeviceManagement_ReadFC(GenericPrgDevice::GenericPrgDeviceHwEnum hwType) {
+  switch(hwType) {
+    case GenericPrgDevice::Coil:
+      return MB_FC_READ_COILS;
+    case GenericPrgDevice::Discrete:
+      return MB_FC_READ_DISCRETE_INPUT;
+    case GenericPrgDevice::Input:
+      return MB_FC_READ_INPUT_REGISTER;
+    case GenericPrgDevice::Hold:
+      return MB_FC_READ_REGISTERS;
+  }
+
+  return MB_FC_NONE;
+}
+
+//Riverso un'area Field variata sulla sua area di destinazione. Ritorna true se l'area e' stata instradata
+bool ManageMdbCli_Route(ModbusBuffer &buffer, int area, RouteFn route) {
+  BufferSourceInfo _sourceInfo;
+  if(!buffer.GetData(area, Field, _sourceInfo) || !_sourceInfo.changed)
+    return false;
+
+  //Vengono saltati quelli con AreaToWrite=0
+  int areatoWrite=buffer.GetAreaToWrite(area);
+  if(areatoWrite==0)
+    return false;
+
+  buffer.WriteElement(areatoWrite, Field, _sourceInfo.value);
+  buffer.ResetElement(area, Field);
+  /*
+  Serial.print(" Changed ");
+  Serial.print(area);
+  Serial.print(" write area ");
+  Serial.print(areatoWrite,DEC);
+  Serial.print(" value ");
+  Serial.println(_sourceInfo.value,DEC); */
+  route(_sourceInfo, area, buffer);
+  return true;
+}
+
+//Visita solo le aree Field variate che hanno una destinazione (dirty set & tabella di routing)
+bool ManageMdbCli_RouteAll(ModbusBuffer &buffer, RouteFn route) {
+  bool _anyChange=false;
+  for(int area=buffer.NextChangedRoute(-1); area!=-1; area=buffer.NextChangedRoute(area)) {
+    if(ManageMdbCli_Route(buffer, area, route))
+      _anyChange=true;
+  }
+
+  return _anyChange;
+}
+
+//Aggiorna lo stato di errore di un IP (gateway)
+void ManageMdbCli_SetIpError(List<structIP> *IPList, short ipIndex, bool inError) {
+  structIP _tmp=IPList->get(ipIndex);
+  if(inError) {
+    _tmp.Errors+=1;
+    _tmp.InError=true;
+  }
+  else {
+    if(!_tmp.InError)
+      return;
+
+    //Se mi connetto ed ero in errore, resetto la struttura
+    _tmp.Errors=0;
+    _tmp.InError=false;
+  }
+  IPList->remove(ipIndex);
+  IPList->addAtIndex(ipIndex,_tmp);
+}
+
+//Riversa le aree Field variate (journal o dirty set) e notifica somethingChanged
+void ManageMdbCli_RouteChanges(ModbusBuffer &buffer, SomethingChangedFn somethingChanged, RouteFn route, ModbusBufferJournalCursor *journalCursor) {
+  PROFILE_ZONE(ProfileRouting);
+  bool _anyChange=false;
+  ModbusBufferJournal *_journal=buffer.GetJournal(Field);
+  if(_journal!=nullptr && journalCursor!=nullptr) {
+    //Guidato dal journal Field: visito solo le aree scritte (o riportate a variate) dall'ultima passata
+    ModbusBufferJournalEntry _entry;
+    unsigned int _maxEntries=_journal->capacity();
+    ModbusBufferJournalResult _result;
+    while(_maxEntries>0 && (_result=_journal->Read(*journalCursor, _entry))!=JournalEmpty) {
+      if(_result==JournalResync) {
+        //Voci perse (o primo giro): ricostruisco lo stato con la scansione completa
+        if(ManageMdbCli_RouteAll(buffer, route))
+          _anyChange=true;
+      }
+      else if(ManageMdbCli_Route(buffer, _entry.modbusArea, route))
+        _anyChange=true;
+      _maxEntries--;
+    }
+  }
+  else if(ManageMdbCli_RouteAll(buffer, route))
+    _anyChange=true;
+
+  if(_anyChange) {
+    somethingChanged(buffer);
+  }
+}
+
+//Ciclo su un gateway gia connesso: lettura, routing, scrittura. Ritorna true in caso di errore I/O
+bool ManageMdbCli_Cycle(pin_size_t ledR, pin_size_t ledW, ModbusTCPClient &modbusTCPCli, List<structIP> *IPList, short ipIndex,
+  ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route, 
+  ModbusBufferJournalCursor *journalCursor) {
+
+  bool ioError=false;
+  ManageMdbCli_SetIpError(IPList, ipIndex, false);
+
+  // Lettura devices Modbus in ingresso
+  if(!DeviceManagement_Read(ledR, modbusTCPCli, IPList, ipIndex, buffer, prgDevices, registry, toggles))
+    ioError=true;
+
+  //Riverso poi gli I/O
+  ManageMdbCli_RouteChanges(buffer, somethingChanged, route, journalCursor);
+
+  // Scrittura devices Modbus in uscita
+  if(!DeviceManagement_Write(ledW, modbusTCPCli, IPList->get(ipIndex).IP, buffer, prgDevices, registry))
+    ioError=true;
+
+  return ioError;
+}
+
 bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusTCPClient &modbusTCPCli, List<structIP> *IPList, short ipIndex,
-  ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route) {
+  ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route, 
+  ModbusBufferJournalCursor *journalCursor) {
   
   bool _connected=false;
   bool ioError=false;
@@ -27,11 +167,7 @@ bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusTCPClient &modbusTCPCl
       Serial.print(", Last error:");
       Serial.println(modbusTCPCli.lastError());
       
-      structIP tmp=IPList->get(ipIndex);
-      tmp.Errors+=1;
-      tmp.InError=true;
-      IPList->remove(ipIndex);
-      IPList->addAtIndex(ipIndex,tmp);
+      ManageMdbCli_SetIpError(IPList, ipIndex, true);
     }
     else {
       _connected=true; // client connected
@@ -41,128 +177,248 @@ bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusTCPClient &modbusTCPCl
     _connected=true; // client connected
   }
 
-  if(_connected) {
-    if(IPList->get(ipIndex).InError) {
-      //Se mi connetto ed ero in errore, resetto la struttura
-      structIP _tmp=IPList->get(ipIndex);
-      _tmp.Errors=0;
-      _tmp.InError=false;
-      IPList->remove(ipIndex);
-      IPList->addAtIndex(ipIndex,_tmp);
+  if(_connected)
+    ioError=ManageMdbCli_Cycle(ledR, ledW, modbusTCPCli, IPList, ipIndex, buffer, prgDevices, registry, toggles, somethingChanged, route, journalCursor);
+
+  //modbusTCPCli.end();
+  modbusTCPCli.stop(); //Chiudere sempre, non mettere in parentesi prima
+ 
+  return ioError;
+}
+
+//Come sopra, ma con la connessione presa dal pool: il socket resta aperto tra un ciclo e l'altro
+bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusClientPool &pool, List<structIP> *IPList, short ipIndex,
+  ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route, 
+  ModbusBufferJournalCursor *journalCursor) {
+
+  ModbusTCPClient *_client=pool.Acquire(IPList, ipIndex);
+  if(_client==nullptr)
+    return false; //Non connesso o in attesa di backoff, errore gia registrato dal pool
+
+  bool ioError=ManageMdbCli_Cycle(ledR, ledW, *_client, IPList, ipIndex, buffer, prgDevices, registry, toggles, somethingChanged, route, journalCursor);
+  pool.Release(ipIndex);
+
+  return ioError;
+}
+
+//Client asincrono: raccolta risposte di tutti i gateway, routing, poi nuove richieste (scritture prima delle letture)
+bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusAsyncEngine &engine, List<structIP> *IPList,
+  ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route, 
+  ModbusBufferJournalCursor *journalCursor) {
+
+  bool ioError=engine.Collect(ledR, IPList, buffer, prgDevices, toggles);
+
+  ManageMdbCli_RouteChanges(buffer, somethingChanged, route, journalCursor);
+
+  if(engine.Issue(ledW, IPList, buffer, prgDevices))
+    ioError=true;
+
+  return ioError;
+}
+
+///////////////// ModbusClientPool
+ModbusClientPool::ModbusClientPool(unsigned long idleTimeout, unsigned long maxBackoff) {
+  this->_idleTimeout=idleTimeout;
+  this->_maxBackoff=maxBackoff;
+}
+
+void ModbusClientPool::Begin(List<structIP> *IPList) {
+  //Uno slot per gateway, allocato una volta sola
+  for(int i=this->_slots.size(); i<IPList->getSize(); i++) {
+    ModbusPoolSlot _slot;
+    _slot.IP=IPList->get(i).IP;
+    _slot.socket=new EthernetClient();
+    _slot.client=new ModbusTCPClient(*_slot.socket);
+    _slot.error=new Errors(3, POOL_MIN_BACKOFF);
+    _slot.lastUse=0;
+    _slot.nextAttempt=0;
+    _slot.backoff=POOL_MIN_BACKOFF;
+    _slot.open=false;
+    this->_slots.push_back(_slot);
+  }
+}
+
+ModbusTCPClient* ModbusClientPool::Acquire(List<structIP> *IPList, short ipIndex) {
+  if(ipIndex>=this->_slots.size())
+    return nullptr;
+
+  ModbusPoolSlot &_slot=this->_slots[ipIndex];
+  unsigned long _now=millis();
+
+  //Health check: il socket puo essere stato chiuso dal gateway
+  if(_slot.open && _slot.client->connected()==0) {
+    _slot.client->stop();
+    _slot.open=false;
+  }
+
+  if(!_slot.open) {
+    //Gateway escluso dall'Errors o in attesa del backoff
+    if(_slot.error->IsInError()) {
+      _slot.error->Loop(true);
+      if(_slot.error->IsInError())
+        return nullptr;
     }
-        
-    // Lettura devices Modbus in ingresso
-    if(!DeviceManagement_Read(ledR, modbusTCPCli, IPList, ipIndex, buffer, prgDevices, toggles))
-      ioError=true;
-
-    //Riverso poi gli I/O
-    bool _anyChange=false;
-    for(int area=0; area<buffer.size(); area++) {
-      //Serial.print(" >>READ ");
-      //  Serial.println(area);
-      BufferSourceInfo _sourceInfo;
-      if(buffer.GetData(area, Field, _sourceInfo )) {
-        if(_sourceInfo.changed) {
-          int areatoWrite=buffer.GetAreaToWrite(area);
-          if(areatoWrite!=0) {
-            buffer.WriteElement(areatoWrite, Field, _sourceInfo.value);
-            buffer.ResetElement(area, Field);
-                     
-            //Vengono saltati quelli con AreaToWrite=0
-            /*
-            Serial.print(" Changed ");
-            Serial.print(area);
-            Serial.print(" write area ");
-            Serial.print(areatoWrite,DEC);
-            Serial.print(" value ");
-            Serial.println(_sourceInfo.value,DEC); */
-          route(_sourceInfo, area, buffer);
-          _anyChange=true;
-          }
-        }
-      }
+    if((long)(_now - _slot.nextAttempt) < 0)
+      return nullptr;
+
+    if(_slot.client->begin(_slot.IP, MB_PORT)==0) {
+      Serial.print("Modbus TCP Client (pool) failed to connect on ");
+      Serial.print(_slot.IP);
+      Serial.print(", Last error:");
+      Serial.println(_slot.client->lastError());
+
+      _slot.client->stop();
+      _slot.error->Loop(true);
+      _slot.nextAttempt=_now + _slot.backoff;
+      _slot.backoff=min(_slot.backoff*2, this->_maxBackoff);
+
+      ManageMdbCli_SetIpError(IPList, ipIndex, true);
+      return nullptr;
     }
 
-    if(_anyChange) {
-      somethingChanged(buffer);
+    _slot.open=true;
+    _slot.error->Loop(false);
+    _slot.backoff=POOL_MIN_BACKOFF;
+    _slot.nextAttempt=0;
+  }
+
+  _slot.lastUse=_now;
+  return _slot.client;
+}
+
+void ModbusClientPool::Release(short ipIndex) {
+  if(ipIndex>=this->_slots.size())
+    return;
+
+  ModbusPoolSlot &_slot=this->_slots[ipIndex];
+  _slot.lastUse=millis();
+
+  //Se il gateway ha chiuso durante il ciclo, libero subito il socket
+  if(_slot.client->connected()==0) {
+    _slot.client->stop();
+    _slot.open=false;
+  }
+}
+
+void ModbusClientPool::Loop() {
+  unsigned long _now=millis();
+  for(auto& _slot : this->_slots) {
+    if(_slot.open && _now - _slot.lastUse > this->_idleTimeout) {
+      _slot.client->stop();
+      _slot.open=false;
     }
+  }
+}
 
-    // Scrittura devices Modbus in uscita
-    if(!DeviceManagement_Write(ledW, modbusTCPCli, IPList->get(ipIndex).IP, buffer, prgDevices))
-      ioError=true;
+size_t ModbusClientPool::OpenConnections() {
+  size_t _open=0;
+  for(auto& _slot : this->_slots) {
+    if(_slot.open)
+      _open++;
   }
-  //modbusTCPCli.end();
-  modbusTCPCli.stop(); //Chiudere sempre, non mettere in parentesi prima
- 
-  return ioError;
+  return _open;
 }
 
-bool DeviceManagement_Write(pin_size_t led, ModbusTCPClient &modbusTCPCli, arduino::IPAddress ip, ModbusBuffer &buffer, std::vector<GenericPrgDevice> prgDevices)
+bool DeviceManagement_Write(pin_size_t led, ModbusTCPClient &modbusTCPCli, arduino::IPAddress ip, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry)
 {
-  //Get all devices under same IP address (device under Waveshare)
-  std::vector<GenericPrgDevice> _devicesUnderSameIP;
-  int _items=GetDevicesByIp(ip, prgDevices, _devicesUnderSameIP);
-  
   bool inError=false;
 
   if(digitalRead(led))
     digitalWrite(led, !digitalRead(led));
   
-  for (auto& _deviceUnderSameIP : _devicesUnderSameIP) {
-    if(!_deviceUnderSameIP.IsInError()) { 
+  //All devices under same IP address (device under Waveshare), by reference so that errors and counters persist
+  for (int _deviceIndex : registry.GetDevicesByIp(registry.IpIndex(ip))) {
+    GenericPrgDevice &_deviceUnderSameIP=prgDevices[_deviceIndex];
+
+    if(!_deviceUnderSameIP.IsInError() && !_deviceUnderSameIP.IsQuarantined(millis())) { 
       //Se il device è in errore per le precedenti letture, lo salto (ATTENZIONE che non va per i device solo in USCITA, dato che NON ne testo la connessione)
+      //Unit in quarantena: le aree restano variate e vengono scritte all'uscita
+      int _maxBatch=_deviceUnderSameIP.GetMaxWriteBatch();
+      modbusTCPCli.setTimeout(_deviceUnderSameIP.GetUnitTimeout());
 
       //For each Device, poll its channels
       for(int channel=0; channel< _deviceUnderSameIP.GetChannelsSize(); channel++) {
         if(_deviceUnderSameIP.GetChannelInfo(channel).type==GenericPrgDevice::DO || _deviceUnderSameIP.GetChannelInfo(channel).type==GenericPrgDevice::AO) {
           //Type WRITE
-          for(int j=0; j< _deviceUnderSameIP.GetChannelInfo(channel).items; j++) {
-            int _area=_deviceUnderSameIP.GetArea(channel, j);
-            if(buffer.HasChanged(_area, Field)) {
+          int _channelItems=_deviceUnderSameIP.GetChannelInfo(channel).items;
+          int j=0;
+          while(j< _channelItems) {
+            if(!buffer.HasChanged(_deviceUnderSameIP.GetArea(channel, j), Field)) {
+              j++;
+              continue;
+            }
+
+            //Raccolgo gli item variati contigui: un'unica FC15/FC16 invece di una scrittura per item
+            long _values[MODBUS_MAX_WRITE_BATCH];
+            int _count=0;
+            while(j+_count<_channelItems && _count<_maxBatch) {
               BufferSourceInfo _sourceInfo;
-              if(buffer.GetData(_area, Field, _sourceInfo )) {
-                /*
-                Serial.print("BUFFER CHANGED (Field): ");
-                Serial.print(" area ");
-                Serial.print(_area);
-                Serial.print(" value ");
-                Serial.print(_sourceInfo.value);
-                Serial.print(" ( ");
-                Serial.print(buffer.GetName(_area));
-                Serial.println(" ) ");*/
-
-                if(_deviceUnderSameIP.Write(modbusTCPCli, channel, j, _sourceInfo.value)==0) {
-                  inError=true;
-                  
-                  #ifdef DEBUG_ERROR
-                  Serial.print("DeviceManagement_Write - Cannot WRITE: ");
-                  Serial.print(_deviceUnderSameIP.GetName());
-
-                  Serial.print(" IP: ");
-                  Serial.print(_deviceUnderSameIP.GetIp());
-
-                  Serial.print(" Address: ");
-                  Serial.print(_deviceUnderSameIP.GetDeviceAddress());
-
-                  Serial.print(" channel: ");
-                  Serial.print(channel);
-                  Serial.print(" item: ");
-                  Serial.print(j);
-
-                  Serial.print(" area ");
-                  Serial.print(_area);
-
-                  Serial.print(" ( ");
-                  Serial.print(buffer.GetName(_area));
-                  Serial.println(" ) ");
-                  #endif
-                  break;
-                }
-                                
-                //Scritto con successo o fallimento, resetto solo Field
-                buffer.ResetElement(_area, Field);
-              }
+              int _area=_deviceUnderSameIP.GetArea(channel, j+_count);
+              if(!buffer.HasChanged(_area, Field) || !buffer.GetData(_area, Field, _sourceInfo))
+                break;
+
+              /*
+              Serial.print("BUFFER CHANGED (Field): ");
+              Serial.print(" area ");
+              Serial.print(_area);
+              Serial.print(" value ");
+              Serial.print(_sourceInfo.value);
+              Serial.print(" ( ");
+              Serial.print(buffer.GetName(_area));
+              Serial.println(" ) ");*/
+              _values[_count]=_sourceInfo.value;
+              _count++;
+            }
+
+            if(_count==0) {
+              j++;
+              continue;
+            }
+
+            bool _written;
+            unsigned long _sent=millis();
+            if(_count==1)
+              _written=_deviceUnderSameIP.Write(modbusTCPCli, channel, j, _values[0]);
+            else
+              _written=_deviceUnderSameIP.WriteMultiple(modbusTCPCli, channel, j, _values, _count);
+            _deviceUnderSameIP.ReportLatency(millis() - _sent, _written, millis());
+
+            if(!_written) {
+              inError=true;
+              
+              #ifdef DEBUG_ERROR
+              int _area=_deviceUnderSameIP.GetArea(channel, j);
+              Serial.print("DeviceManagement_Write - Cannot WRITE: ");
+              Serial.print(_deviceUnderSameIP.GetName());
+
+              Serial.print(" IP: ");
+              Serial.print(_deviceUnderSameIP.GetIp());
+
+              Serial.print(" Address: ");
+              Serial.print(_deviceUnderSameIP.GetDeviceAddress());
+
+              Serial.print(" channel: ");
+              Serial.print(channel);
+              Serial.print(" item: ");
+              Serial.print(j);
+              Serial.print(" count: ");
+              Serial.print(_count);
+
+              Serial.print(" area ");
+              Serial.print(_area);
+
+              Serial.print(" ( ");
+              Serial.print(buffer.GetName(_area));
+              Serial.println(" ) ");
+              #endif
+              break;
             }
+                            
+            //Scritto con successo, resetto solo Field
+            for(int k=0; k<_count; k++)
+              buffer.ResetElement(_deviceUnderSameIP.GetArea(channel, j+k), Field);
+
+            j+=_count;
           }
         }
       } 
@@ -207,258 +463,287 @@ void DeviceManagement_Read_SetOut(ModbusBuffer &buffer, int area, int value)
     buffer.WriteElement(area, ToPanel, value);
 }
 
-bool DeviceManagement_Read(pin_size_t led, ModbusTCPClient &modbusTCPCli, List<structIP> *iPList, short ipIndex, ModbusBuffer &buffer, 
-  std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles)
+//Elabora un valore letto da campo (toggle, reverse, soglia analogica) e lo scrive nel buffer
+void DeviceManagement_Read_Process(ModbusBuffer &buffer, ToggleManager &toggles, GenericPrgDevice &device, int channel, int _index, GenericPrgDevice::GenericPrgDeviceEnum type, unsigned short value)
 {
-  bool _error=false;
-  
-  PriorityMgmt _actualPriority=iPList->get(ipIndex).Priority.Priorities[iPList->get(ipIndex).Priority.Index];
-  
-  std::vector<int> _devices;
-  int _items=GetDevicesByPriority(_actualPriority.Priority, iPList->get(ipIndex).IP, prgDevices, _devices);  //Get all devices under same IP address (device under Waveshare)
-  if(_items>0) {
-    /* #ifdef DEBUG_TEST
-    Serial.println();
-    Serial.print("Checking ");
-    Serial.print(iPList->get(ipIndex).IP);
-    Serial.print(" - ");
-    Serial.print(iPList->get(ipIndex).Priority.Index);
-    Serial.print(" - ");
-    Serial.println(iPList->get(ipIndex).Priority.PrioritySize);
-    Serial.print("Priority: ");
-    Serial.println(_actualPriority.Priority);
-    #endif */
+  int _area=device.GetArea(channel, _index);
+  if(trace!=nullptr && traceDevices!=nullptr)
+    trace->Field(&device - traceDevices->data(), channel, _index, type, value);
+   
+  bool _process=false; //verifica le variazioni
+  BufferSourceInfo _buffer;
+  buffer.GetData(_area, Field, _buffer);  
+
+  unsigned short _value=value;
+  ToggleSignalItem* _toggle=nullptr;
+ 
+  if(type==GenericPrgDevice::AI) {
+    //Analog check trashold
+    _process=abs(_value-_buffer.value)>ANALOG_TRESHOLD;
+  }
+  else {
+    _toggle=toggles.getToggle(_area);
     
-    int _start=0;
-    int _end=_items;
-    digitalWrite(led, !digitalRead(led));
+    //Digital
+    if(buffer.IsReverse(_area))
+      _value= !_value;     
 
-    if(_actualPriority.DeviceIndex!=-1) {
-      //Passa la prima inizializzazione nella quale faccio polling di tutte le periferiche
-      
-      int _jump=GetJump(_actualPriority.Priority);
-      switch (_actualPriority.Priority)   {
-        case Low:
-          _start=_actualPriority.DeviceIndex;
-          _end=_actualPriority.DeviceIndex+_jump>=_items?_items:_actualPriority.DeviceIndex+_jump;
-          break;
-
-        case Medium:
-          _start=_actualPriority.DeviceIndex;
-          _end=_actualPriority.DeviceIndex+_jump>=_items?_items:_actualPriority.DeviceIndex+_jump;
-        break;
+    if(_toggle==nullptr) 
+      //Senza toggle
+      _process= _value!=_buffer.value;
+    else {
+      if(_toggle->forwardsFromAreas.empty() )
+        //Toggle senza forwards
+        _process= _value!=_buffer.value || _value!=_toggle->Toggle.getOldValue();
+      else {
+        /*
+        Serial.println();
+        Serial.print("Test area -- ");
+        Serial.print(_area);
+        Serial.println();*/
+        //Devo verificare se il toggle ha forward verso di lui, nel caso ne devo testare il valore
+        long _tmp=GetToggleFwdValue(_area, toggles, buffer );
+        if(_tmp==0)
+          _tmp=_value;
+        _process= _tmp!=_buffer.value || _tmp!=_toggle->Toggle.getOldValue();   //Entra se ho toggle normale     
+      }
+    }
+  }
+  
+  if(_process ) {
+    //#ifdef DEBUG_TEST
+    if(_value>0 && _area>=11){ //Prende sia digitali a 1 che analogiche
+      Serial.println();
+      Serial.print("DeviceManagement_Read -- ");
+      Serial.print(device.GetName());
+      Serial.print(" channel ");
+      Serial.print(channel);
+      Serial.print(" item ");
+      Serial.print(_index);
+      Serial.print(" value ");
+      Serial.print(_value,DEC);
+      Serial.print(", Buffer value ");
+      Serial.print(_buffer.value,DEC);
+      Serial.print(", Buffer prev value ");
+      Serial.print(_buffer.prevValue,DEC);
+      Serial.print(", AREA ");
+      Serial.print(_area,DEC); 
+      Serial.println(String(" - ")+buffer.GetName(_area));
+    }
+    //#endif
+    buffer.ResetElement(_area, Field);
+                  
+    if(_toggle!=nullptr) {
+      if(_toggle->forwardsFromAreas.empty()) {
+        // Lo gestisco come nessun toggle associato, scrivo direttamente l'uscita
+        long _toggleOut=_buffer.value;
+        #ifdef DEBUG_TEST
+        Serial.print(" Write buffer std TOGGLE NO FWD ");
+        Serial.print(" Area: "+String(_area));
+        Serial.println(", Value: "+String(_value)); 
+        #endif 
+
+        if(_toggle->Toggle.change(_value, _toggleOut)) {
+          #ifdef DEBUG_TEST
+          Serial.println(", Toggle Value:"+String(_toggleOut));
+          #endif
+          DeviceManagement_Read_SetOut(buffer, _area, _toggleOut);
+        }
+      }
+      else {
+        long _toggleOut=_buffer.value;
+        //Devo verificare se il toggle ha forward verso di lui, nel caso ne devo testare il valore
+        int _signalIn=GetToggleFwdValue(_area, toggles, buffer );
+        if(_signalIn==0)
+          _signalIn=_value;
         
-        case Normal:
-          _start=_actualPriority.DeviceIndex;
-          _end=_actualPriority.DeviceIndex+_jump>=_items?_items:_actualPriority.DeviceIndex+_jump;
-        break;
+        #ifdef DEBUG_TEST
+        Serial.println();
+        Serial.print(" Write buffer toggle ");
+        Serial.print(" Area: "+String(_area));
+        Serial.println(", Value: "+String(_signalIn));
+        #endif
+        if(_toggle->Toggle.change(_signalIn, _toggleOut)) {
+          #ifdef DEBUG_TEST
+          Serial.println(", Toggle Value:"+String(_toggleOut));
+          #endif
+          DeviceManagement_Read_SetOut(buffer, _area, _toggleOut);
+        }
       }
     }
+    else {
+      // Se non ho un toggle associato, scrivo direttamente l'uscita
+      /*
+      #ifdef DEBUG_TEST
+      Serial.print(" Write buffer std ");
+      Serial.print(" Area: "+String(_area));
+      Serial.println(", Value: "+String(_value));
+      #endif */
+      DeviceManagement_Read_SetOut(buffer, _area, _value);
+    }
+  } 
+}
 
-    for (int _deviceIndex=_start; _deviceIndex<_end; _deviceIndex++)
-    {
-      //For each Device, poll its channels
-      for(int channel=0; channel<prgDevices[_devices[_deviceIndex]].GetChannelsSize(); channel++)
-      {
-        if(prgDevices[_devices[_deviceIndex]].GetChannelInfo(channel).type==GenericPrgDevice::DI || prgDevices[_devices[_deviceIndex]].GetChannelInfo(channel).type==GenericPrgDevice::AI)
-        {     
-          List<uint16_t> _mbRead;
-          GenericPrgDevice::structRead _read=prgDevices[_devices[_deviceIndex]].Read(modbusTCPCli, channel, &_mbRead);
-          if(_read.ok) {
-            for(int j=0; j< _read.items; j++) {
-              int _index=_read.startIndex +j;
-              int _area=prgDevices[_devices[_deviceIndex]].GetArea(channel, _index);
-               
-              bool _process=false; //verifica le variazioni
-              BufferSourceInfo _buffer;
-              buffer.GetData(_area, Field, _buffer);  
-
-              unsigned short _value=_mbRead.get(j);
-              ToggleSignalItem* _toggle=nullptr;
-             
-              if(prgDevices[_devices[_deviceIndex]].GetChannelInfo(channel).type==GenericPrgDevice::AI) {
-                //Analog check trashold
-                _process=abs(_value-_buffer.value)>ANALOG_TRESHOLD;
-              }
-              else {
-                _toggle=toggles.getToggle(_area);
-                
-                //Digital
-                if(buffer.IsReverse(_area))
-                  _value= !_value;     
-
-                if(_toggle==nullptr) 
-                  //Senza toggle
-                  _process= _value!=_buffer.value;
-                else {
-                  if(_toggle->forwardsFromAreas.empty() )
-                    //Toggle senza forwards
-                    _process= _value!=_buffer.value || _value!=_toggle->Toggle.getOldValue();
-                  else {
-                    /*
-                    Serial.println();
-                    Serial.print("Test area -- ");
-                    Serial.print(_area);
-                    Serial.println();*/
-                    //Devo verificare se il toggle ha forward verso di lui, nel caso ne devo testare il valore
-                    long _tmp=GetToggleFwdValue(_area, toggles, buffer );
-                    if(_tmp==0)
-                      _tmp=_value;
-                    _process= _tmp!=_buffer.value || _tmp!=_toggle->Toggle.getOldValue();   //Entra se ho toggle normale     
-                  }
-                }
-              }
-              
-              if(_process ) {
-                //#ifdef DEBUG_TEST
-                if(_value>0 && _area>=11){ //Prende sia digitali a 1 che analogiche
-                  Serial.println();
-                  Serial.print("DeviceManagement_Read -- ");
-                  Serial.print(prgDevices[_devices[_deviceIndex]].GetName());
-                  Serial.print(" channel ");
-                  Serial.print(channel);
-                  Serial.print(" item ");
-                  Serial.print(_index);
-                  Serial.print(" value ");
-                  Serial.print(_value,DEC);
-                  Serial.print(", Buffer value ");
-                  Serial.print(_buffer.value,DEC);
-                  Serial.print(", Buffer prev value ");
-                  Serial.print(_buffer.prevValue,DEC);
-                  Serial.print(", AREA ");
-                  Serial.print(_area,DEC); 
-                  Serial.println(String(" - ")+buffer.GetName(_area));
-                }
-                //#endif
-                buffer.ResetElement(_area, Field);
-                              
-                if(_toggle!=nullptr) {
-                  if(_toggle->forwardsFromAreas.empty()) {
-                    // Lo gestisco come nessun toggle associato, scrivo direttamente l'uscita
-                    long _toggleOut=_buffer.value;
-                    #ifdef DEBUG_TEST
-                    Serial.print(" Write buffer std TOGGLE NO FWD ");
-                    Serial.print(" Area: "+String(_area));
-                    Serial.println(", Value: "+String(_value)); 
-                    #endif 
-
-                    if(_toggle->Toggle.change(_value, _toggleOut)) {
-                      #ifdef DEBUG_TEST
-                      Serial.println(", Toggle Value:"+String(_toggleOut));
-                      #endif
-                      DeviceManagement_Read_SetOut(buffer, _area, _toggleOut);
-                    }
-                  }
-                  else {
-                    long _toggleOut=_buffer.value;
-                    //Devo verificare se il toggle ha forward verso di lui, nel caso ne devo testare il valore
-                    int _signalIn=GetToggleFwdValue(_area, toggles, buffer );
-                    if(_signalIn==0)
-                      _signalIn=_value;
-                    
-                    #ifdef DEBUG_TEST
-                    Serial.println();
-                    Serial.print(" Write buffer toggle ");
-                    Serial.print(" Area: "+String(_area));
-                    Serial.println(", Value: "+String(_signalIn));
-                    #endif
-                    if(_toggle->Toggle.change(_signalIn, _toggleOut)) {
-                      #ifdef DEBUG_TEST
-                      Serial.println(", Toggle Value:"+String(_toggleOut));
-                      #endif
-                      DeviceManagement_Read_SetOut(buffer, _area, _toggleOut);
-                    }
-                  }
-                }
-                else {
-                  // Se non ho un toggle associato, scrivo direttamente l'uscita
-                  /*
-                  #ifdef DEBUG_TEST
-                  Serial.print(" Write buffer std ");
-                  Serial.print(" Area: "+String(_area));
-                  Serial.println(", Value: "+String(_value));
-                  #endif */
-                  DeviceManagement_Read_SetOut(buffer, _area, _value);
-                }
-              } 
-            }
-            
-            #ifdef DEBUG_VISUAL
-              delay(DELAY_VISUAL);
-            #endif 
-          }
-          else {
-            /*
-            #ifdef DEBUG_ERROR
-              Serial.print("DeviceManagement_Read - Cannot READ: ");
-              Serial.print(prgDevices[_devices[_deviceIndex]].GetName());
+//Polling adattivo: riporta al device, canale per canale, la variazione piu recente (BufferSourceInfo.time del Field)
+//tra gli item del blocco appena letto e processato
+void DeviceManagement_Read_Activity(ModbusBuffer &buffer, GenericPrgDevice &device, const GenericPrgDevice::GenericPrgDeviceReadBlock &block, unsigned long now)
+{
+  if(!device.IsAdaptive())
+    return;
+
+  int channel=block.channel;
+  int _index=block.startIndex;
+  unsigned long _lastChange=0;
+  for(int j=0; j<block.items; j++) {
+    if(_index>=device.GetChannelInfo(channel).items) {
+      device.UpdateChannelActivity(channel, _lastChange, now);
+      channel++;
+      _index=0;
+      _lastChange=0;
+    }
 
-              Serial.print(", IP: ");
-              Serial.print(prgDevices[_devices[_deviceIndex]].GetIp());
+    BufferSourceInfo _info;
+    if(buffer.GetData(device.GetArea(channel, _index), Field, _info) && (_lastChange==0 || (long)(_info.time - _lastChange)>0))
+      _lastChange=_info.time;
+    _index++;
+  }
+  device.UpdateChannelActivity(channel, _lastChange, now);
+}
 
-              Serial.print(", Address: ");
-              Serial.println(prgDevices[_devices[_deviceIndex]].GetDeviceAddress());
-            #endif  */
-            _error=true;
-            break;
-          }
-        }
-      } 
+//Sceglie tra i device di un gateway il blocco di lettura piu in ritardo rispetto al suo periodo di refresh.
+//Salta le unit in quarantena e, con un client asincrono, quelle con una richiesta ancora aperta: dietro un gateway RTU
+//le richieste alla stessa unit vengono comunque servite in serie, cosi la pipeline si alterna tra unit diverse
+//e una unit lenta non occupa piu di uno slot. Ritorna false (device e block a -1) se nessun blocco e' scaduto
+bool DeviceManagement_PickOverdue(const std::vector<int> &devices, std::vector<GenericPrgDevice> &prgDevices, unsigned long now, ModbusAsyncClient *pending, int &device, int &block)
+{
+  long _worst=-1;
+  device=-1;
+  block=-1;
+  for (int d : devices) {
+    GenericPrgDevice &_device=prgDevices[d];
+    if(_device.GetReadBlocksSize()==0 || !_device.CanPoll())
+      continue;
+
+    if(pending!=nullptr && pending->IsPending(d))
+      continue;
+
+    for(int b=0; b<_device.GetReadBlocksSize(); b++) {
+      long _lateness=_device.GetBlockLateness(b, now);
+      if(_lateness<0 || _lateness<=_worst)
+        continue;
+
+      _worst=_lateness;
+      device=d;
+      block=b;
     }
+  }
 
-    structIP tmp=iPList->get(ipIndex);
-    int _jump=GetJump(tmp.Priority.Priorities[tmp.Priority.Index].Priority );
-    if(tmp.Priority.Priorities[tmp.Priority.Index].DeviceIndex+_jump>=_items || tmp.Priority.Priorities[tmp.Priority.Index].DeviceIndex==-1)
-      tmp.Priority.Priorities[tmp.Priority.Index].DeviceIndex=0;
-    else
-      tmp.Priority.Priorities[tmp.Priority.Index].DeviceIndex+=_jump;
-  
-    if(tmp.Priority.Index>=tmp.Priority.PrioritySize-1)
-      tmp.Priority.Index=0;
-    else
-      tmp.Priority.Index++;
+  return _worst>=0;
+}
 
-    iPList->remove(ipIndex);
-    iPList->addAtIndex(ipIndex,tmp);
-  } 
-  else {
-    #ifdef DEBUG_ERROR
-      Serial.print("Nothing to read with priority: ");
-      Serial.print(_actualPriority.Priority);
+bool DeviceManagement_Read(pin_size_t led, ModbusTCPClient &modbusTCPCli, List<structIP> *iPList, short ipIndex, ModbusBuffer &buffer, 
+  std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry, ToggleManager &toggles)
+{
+  PROFILE_ZONE(ProfileRead);
+  bool _error=false;
+  unsigned long _start=millis();
+
+  //Get all devices under same IP address (device under Waveshare), indice precostruito: nessuna copia ad ogni poll
+  const std::vector<int> &_devices=registry.GetDevicesByIp(registry.IpIndex(iPList->get(ipIndex).IP));
+
+  //Blocchi scaduti, il piu in ritardo per primo, finche resta budget per questo gateway
+  int _reads=0;
+  int d=-1, block=-1;
+  while(DeviceManagement_PickOverdue(_devices, prgDevices, millis(), nullptr, d, block)) {
+    GenericPrgDevice &_device=prgDevices[d];
+    if(_reads==0)
+      digitalWrite(led, !digitalRead(led));
+
+    //Lettura del blocco: canali adiacenti coalescenti in un'unica transazione
+    GenericPrgDevice::GenericPrgDeviceReadBlock _block=_device.GetReadBlock(block);
+    _device.MarkBlockPolled(block, millis());
+    modbusTCPCli.setTimeout(_device.GetUnitTimeout());
+    unsigned long _sent=millis();
+    GenericPrgDevice::structRead _read=_device.ReadBlock(modbusTCPCli, block, _mbRead, ARRAY_SIZE(_mbRead));
+    _device.ReportLatency(millis() - _sent, _read.ok, millis());
+    _reads++;
+    if(_read.ok) {
+      _device.MarkBlockUpdated(block, millis());
+
+      int channel=_block.channel;
+      int _index=_read.startIndex;
+      for(int j=0; j< _read.items; j++) {
+        if(_index>=_device.GetChannelInfo(channel).items) {
+          //Il blocco prosegue sul canale successivo
+          channel++;
+          _index=0;
+        }
 
-      Serial.print(", IP: ");
-      Serial.print(iPList->get(ipIndex).IP);
-    #endif  
+        DeviceManagement_Read_Process(buffer, toggles, _device, channel, _index, _block.type, _mbRead[j]);
+        _index++;
+      }
+      DeviceManagement_Read_Activity(buffer, _device, _block, millis());
+      
+      #ifdef DEBUG_VISUAL
+        delay(DELAY_VISUAL);
+      #endif 
+    }
+    else {
+      //Device che non risponde: rimando tutti i suoi blocchi di un periodo invece di ritentarli subito
+      _device.DeferBlocks(millis());
+      _error=true;
+    }
+
+    if(millis() - _start >= readBudget)
+      break;
   }
 
   return !_error;
 }
 
 void ManageMdbSvr(pin_size_t led, EthernetClient &client, MgsModbus &modbusTCPSvr, ModbusBuffer &buffer, ToggleManager &toggles, char *itemName, bool mode) {
+  ManageMdbSvr(led, modbusTCPSvr, buffer, toggles, itemName, mode);
+
   // poll for Modbus TCP requests, while client connected
+  modbusTCPSvr.MbsRun(client);   
+}
+
+//Stesso indirizzo (= area) in tutte le zone separate della mappa del server, con controllo dei limiti
+void ManageMdbSvr_SetArea(MgsModbus &modbusTCPSvr, int area, long value) {
+  modbusTCPSvr.SetRegister(MB_SPACE_HOLDING, area, value);
+  if(modbusTCPSvr.HasSpace(MB_SPACE_INPUT))
+    modbusTCPSvr.SetRegister(MB_SPACE_INPUT, area, value);
+  if(modbusTCPSvr.HasSpace(MB_SPACE_COILS))
+    modbusTCPSvr.SetBit(MB_SPACE_COILS, area, value!=0);
+  if(modbusTCPSvr.HasSpace(MB_SPACE_DISCRETE))
+    modbusTCPSvr.SetBit(MB_SPACE_DISCRETE, area, value!=0);
+}
+
+//Solo allineamento buffer <-> registri del server: le richieste dei pannelli vengono servite a parte (MgsModbus::MbsRun(EthernetServer &))
+void ManageMdbSvr(pin_size_t led, MgsModbus &modbusTCPSvr, ModbusBuffer &buffer, ToggleManager &toggles, char *itemName, bool mode) {
+  PROFILE_ZONE(ProfilePanel);
   digitalWrite(led, !digitalRead(led));
 
   if (mode) {
     //GET data from BUFFER if any changed and update panel 
-    ModbusBufferItemInfo2 _items[buffer.size()];
-    int _toRead=buffer.getChanged(_items, ToPanel, true); //(preserve changed flag, will be resetted if write NOT fail
-    if(_toRead>0) {
-      for(int i=0; i<_toRead; i++)  {
-        #ifdef DEBUG_TEST_PANEL
-        if(_items[i].modbusArea<210 && _items[i].modbusArea>9) {
-          Serial.print(" BUFFER > PANEL value:");
-          Serial.print(_items[i].Item.value,DEC);
-          Serial.print(" area ");
-          Serial.println(_items[i].modbusArea,DEC);  
-        }
-        #endif
+    //Scorro solo le aree variate (preserve changed flag, will be resetted if write NOT fail)
+    for(int _area=buffer.FirstChanged(ToPanel); _area!=-1; _area=buffer.NextChanged(ToPanel, _area)) {
+      BufferSourceInfo _sourceInfo;
+      buffer.GetData(_area, ToPanel, _sourceInfo);
 
-        //Scrivo sui registri del pannello, azzero il change del buffer
-        modbusTCPSvr.MbData[_items[i].modbusArea]= _items[i].Item.value;
-        buffer.ResetElement(_items[i].modbusArea, ToPanel); //Resetto flag bit xche la lettura dello stato era PRESERVE
-        buffer.WriteElement(_items[i].modbusArea, FromPanel, _items[i].Item.value, true); //Genero un evento fittizio silenzioso per il comando che torna indietro
-      
+      #ifdef DEBUG_TEST_PANEL
+      if(_area<210 && _area>9) {
+        Serial.print(" BUFFER > PANEL value:");
+        Serial.print(_sourceInfo.value,DEC);
+        Serial.print(" area ");
+        Serial.println(_area,DEC);  
       }
+      #endif
+
+      //Scrivo sui registri del pannello, azzero il change del buffer
+      ManageMdbSvr_SetArea(modbusTCPSvr, _area, _sourceInfo.value);
+      buffer.ResetElement(_area, ToPanel); //Resetto flag bit xche la lettura dello stato era PRESERVE
+      buffer.WriteElement(_area, FromPanel, _sourceInfo.value, true); //Genero un evento fittizio silenzioso per il comando che torna indietro
     }
   }
   else {
@@ -467,36 +752,387 @@ void ManageMdbSvr(pin_size_t led, EthernetClient &client, MgsModbus &modbusTCPSv
     if(_toRead.size>0) {    
       int _items=_toRead.size>buffer.size()?buffer.size():_toRead.size;            
       for(int i=0; i<_items; i++)  {            
-        long _valueRead=modbusTCPSvr.MbData[_toRead.itemsPtr[i]]; 
+        word _register;
+        if(!modbusTCPSvr.GetRegister(MB_SPACE_HOLDING, _toRead.itemsPtr[i], _register))
+          continue; //Area oltre la mappa del server
+        long _valueRead=_register; 
 
-        if(buffer.Compare(_toRead.itemsPtr[i], FromPanel, _valueRead)!=2) {
-          #ifdef DEBUG_TEST_PANEL
-          Serial.println();
-          Serial.print(" PANEL > BUFFER value:");
-          Serial.print(_valueRead,DEC); 
-          Serial.print(" area ");
-          Serial.println(_toRead.itemsPtr[i],DEC);
-          #endif
+        //Coil scritto dal pannello (FC5/FC15): non e' piu allineato al registro
+        bool _coil=modbusTCPSvr.GetBit(MB_SPACE_COILS, _toRead.itemsPtr[i]);
+        if(modbusTCPSvr.HasSpace(MB_SPACE_COILS) && buffer.Compare(_toRead.itemsPtr[i], FromPanel, _valueRead)==2 && _coil!=(_valueRead!=0))
+          _valueRead=_coil;
 
-          buffer.WriteElement(_toRead.itemsPtr[i], FromPanel, _valueRead);
-          
-          //Il pannello è variato, riverso il valore come se fosse arrivato da campo
-          if(buffer.WriteElement(_toRead.itemsPtr[i], Field, _valueRead))
-            buffer.ResetElement (_toRead.itemsPtr[i], FromPanel); //Abbasso il flag di modifica xche è stato processato dal Field
-          
-          if(buffer.CanWriteToPanel(_toRead.itemsPtr[i]))
-              buffer.WriteElement(_toRead.itemsPtr[i], ToPanel, _valueRead, true); //Aggiorno anche il suo eventuale omonimo comando, in maniera silente
-          
-          #ifdef DEBUG_TEST_PANEL
-          Serial.println(" PANEL > BUFFER - END -");
-          #endif
+        if(buffer.Compare(_toRead.itemsPtr[i], FromPanel, _valueRead)!=2) {
+          ManageMdbSvr_SetArea(modbusTCPSvr, _toRead.itemsPtr[i], _valueRead);
+          ManageMdbSvr_FromPanel(buffer, _toRead.itemsPtr[i], _valueRead);
         }
       }
     } 
   } 
+}
 
-  modbusTCPSvr.MbsRun(client);   
+//Comando arrivato dal pannello: lo riverso nel buffer come se fosse arrivato da campo
+void ManageMdbSvr_FromPanel(ModbusBuffer &buffer, int area, long value) {
+  #ifdef DEBUG_TEST_PANEL
+  Serial.println();
+  Serial.print(" PANEL > BUFFER value:");
+  Serial.print(value,DEC); 
+  Serial.print(" area ");
+  Serial.println(area,DEC);
+  #endif
+
+  if(trace!=nullptr)
+    trace->Panel(area, value);
+
+  buffer.WriteElement(area, FromPanel, value);
+  
+  //Il pannello è variato, riverso il valore come se fosse arrivato da campo
+  if(buffer.WriteElement(area, Field, value))
+    buffer.ResetElement (area, FromPanel); //Abbasso il flag di modifica xche è stato processato dal Field
+  
+  if(buffer.CanWriteToPanel(area))
+      buffer.WriteElement(area, ToPanel, value, true); //Aggiorno anche il suo eventuale omonimo comando, in maniera silente
+  
+  #ifdef DEBUG_TEST_PANEL
+  Serial.println(" PANEL > BUFFER - END -");
+  #endif
+}
+
+
+///////////////// ModbusBufferServerHandler
+ModbusBufferServerHandler::ModbusBufferServerHandler(ModbusBuffer &buffer) : _buffer(buffer) {
 }
 
+word ModbusBufferServerHandler::MbsSize(MB_SPACE space) {
+  return this->_buffer.size()>0xFFFF? 0xFFFF: this->_buffer.size();
+}
+
+//Valore servito al pannello: l'ultimo ToPanel, altrimenti l'ultimo comando ricevuto
+bool ModbusBufferServerHandler::Served(int area, long &value) {
+  BufferSourceInfo _sourceInfo;
+  if(this->_buffer.GetData(area, ToPanel, _sourceInfo) || this->_buffer.GetData(area, FromPanel, _sourceInfo)) {
+    value=_sourceInfo.value;
+    return true;
+  }
+  value=0;
+  return false;
+}
+
+boolean ModbusBufferServerHandler::MbsRead(MB_SPACE space, word address, word &value) {
+  long _value;
+  Served(address, _value);
+  if(space==MB_SPACE_COILS || space==MB_SPACE_DISCRETE)
+    value=_value!=0;
+  else
+    value=_value;
+  return true;
+}
+
+boolean ModbusBufferServerHandler::MbsWrite(MB_SPACE space, word address, word value) {
+  Write(address, value);
+  return true;
+}
+
+//FC1/FC2: un'unica passata sulle aree del blocco, byte composti localmente
+boolean ModbusBufferServerHandler::MbsReadBits(MB_SPACE space, word address, word count, uint8_t *dest) {
+  uint8_t _byte=0;
+  for(int i=0; i<count; i++) {
+    long _value;
+    Served(address + i, _value);
+    if(_value!=0)
+      _byte|=1 << (i % 8);
+    if(i % 8==7 || i==count - 1) {
+      dest[i / 8]=_byte;
+      _byte=0;
+    }
+  }
+  return true;
+}
+
+//FC15: ogni coil passa dalle stesse regole di MbsWrite
+boolean ModbusBufferServerHandler::MbsWriteBits(MB_SPACE space, word address, word count, const uint8_t *src) {
+  for(int i=0; i<count; i++)
+    Write(address + i, (src[i / 8] >> (i % 8)) & 1);
+  return true;
+}
+
+void ModbusBufferServerHandler::Write(int area, long value) {
+  //Area non scrivibile dal pannello: confermo la scrittura ma la ignoro, come faceva la copia dai registri
+  if(!this->_buffer.CanReadFromPanel(area))
+    return;
+
+  //Solo le variazioni rispetto al valore mostrato diventano comandi (idem la copia sui registri)
+  long _value;
+  if(!Served(area, _value) || _value!=value)
+    ManageMdbSvr_FromPanel(this->_buffer, area, value);
+}
+
+
 
 
+///////////////// ModbusAsyncEngine
+ModbusAsyncEngine::ModbusAsyncEngine(uint8_t maxInFlight, unsigned long timeout) {
+  this->_maxInFlight=maxInFlight;
+  this->_timeout=timeout;
+  this->_buffer=nullptr;
+  this->_prgDevices=nullptr;
+  this->_toggles=nullptr;
+  this->_ioError=false;
+  this->_readDone=false;
+}
+
+void ModbusAsyncEngine::Begin(List<structIP> *IPList, const DeviceRegistry &registry) {
+  //Un client per gateway (stesso indice di List<structIP>), con l'elenco dei suoi device
+  for(int i=this->_gateways.size(); i<IPList->getSize(); i++) {
+    ModbusAsyncGateway _gateway;
+    _gateway.client=new ModbusAsyncClient();
+    _gateway.client->Begin(IPList->get(i).IP, this->_maxInFlight, this->_timeout, POOL_MIN_BACKOFF);
+    _gateway.devices=registry.GetDevicesByIp(registry.IpIndex(IPList->get(i).IP));
+    this->_gateways.push_back(_gateway);
+  }
+}
+
+bool ModbusAsyncEngine::Collect(pin_size_t ledR, List<structIP> *IPList, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles) {
+  PROFILE_ZONE(ProfileRead);
+  this->_buffer=&buffer;
+  this->_prgDevices=&prgDevices;
+  this->_toggles=&toggles;
+  this->_ioError=false;
+  this->_readDone=false;
+
+  for(int i=0; i<this->_gateways.size(); i++) {
+    ModbusAsyncGateway &_gateway=this->_gateways[i];
+    bool _wasOpen=_gateway.client->Connected();
+    _gateway.client->Poll(&ModbusAsyncEngine::OnResult, this);
+
+    //Connessione persa durante l'attesa delle risposte
+    if(_wasOpen && !_gateway.client->Connected()) {
+      ManageMdbCli_SetIpError(IPList, i, true);
+      this->_ioError=true;
+    }
+  }
+
+  if(this->_readDone)
+    digitalWrite(ledR, !digitalRead(ledR));
+
+  return this->_ioError;
+}
+
+bool ModbusAsyncEngine::Issue(pin_size_t ledW, List<structIP> *IPList, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices) {
+  this->_buffer=&buffer;
+  this->_prgDevices=&prgDevices;
+  bool _ioError=false;
+
+  if(digitalRead(ledW))
+    digitalWrite(ledW, !digitalRead(ledW));
+
+  for(int i=0; i<this->_gateways.size(); i++) {
+    ModbusAsyncGateway &_gateway=this->_gateways[i];
+    unsigned long _failures=_gateway.client->GetConnectFailures();
+
+    QueueWrites(_gateway);
+    QueueReads(_gateway);
+
+    if(_gateway.client->GetConnectFailures()!=_failures) {
+      Serial.print("Modbus TCP Client (async) failed to connect on ");
+      Serial.println(_gateway.client->GetIp());
+
+      ManageMdbCli_SetIpError(IPList, i, true);
+      _ioError=true;
+    }
+    else if(_gateway.client->Connected())
+      ManageMdbCli_SetIpError(IPList, i, false);
+  }
+
+  return _ioError;
+}
+
+uint8_t ModbusAsyncEngine::InFlight(short ipIndex) {
+  if(ipIndex<0 || ipIndex>=this->_gateways.size())
+    return 0;
+
+  return this->_gateways[ipIndex].client->InFlight();
+}
+
+uint8_t ModbusAsyncEngine::MaxInFlight() {
+  return this->_maxInFlight;
+}
+
+void ModbusAsyncEngine::QueueWrites(ModbusAsyncGateway &gateway) {
+  for(int d : gateway.devices) {
+    GenericPrgDevice &_device=(*this->_prgDevices)[d];
+    //Una richiesta aperta per unit (vedi DeviceManagement_PickOverdue): le altre unit non restano in coda dietro a questa
+    if(_device.IsInError() || _device.IsQuarantined(millis()) || gateway.client->IsPending(d))
+      continue;
+
+    int _maxBatch=_device.GetMaxWriteBatch();
+    bool _sent=false;
+    for(int channel=0; channel<_device.GetChannelsSize() && !_sent; channel++) {
+      GenericPrgDevice::GenericPrgDeviceChannel _channel=_device.GetChannelInfo(channel);
+      //Come GenericPrgDevice::Write, solo i canali DO
+      if(_channel.type!=GenericPrgDevice::DO || (_channel.hwType!=GenericPrgDevice::Coil && _channel.hwType!=GenericPrgDevice::Hold))
+        continue;
+
+      int j=0;
+      while(j<_channel.items) {
+        if(!this->_buffer->HasChanged(_device.GetArea(channel, j), Field)) {
+          j++;
+          continue;
+        }
+
+        if(!gateway.client->CanRequest())
+          return; //Pipeline piena: le aree restano variate per il prossimo ciclo
+
+        //Item variati contigui in un'unica FC15/FC16
+        long _values[MODBUS_MAX_WRITE_BATCH];
+        int _count=0;
+        while(j+_count<_channel.items && _count<_maxBatch) {
+          BufferSourceInfo _sourceInfo;
+          int _area=_device.GetArea(channel, j+_count);
+          if(!this->_buffer->HasChanged(_area, Field) || !this->_buffer->GetData(_area, Field, _sourceInfo))
+            break;
+
+          _values[_count]=_sourceInfo.value;
+          _count++;
+        }
+
+        if(_count==0) {
+          j++;
+          continue;
+        }
+
+        MB_FC _fc;
+        if(_channel.hwType==GenericPrgDevice::Coil)
+          _fc=_count==1? MB_FC_WRITE_COIL: MB_FC_WRITE_MULTIPLE_COILS;
+        else
+          _fc=_count==1? MB_FC_WRITE_REGISTER: MB_FC_WRITE_MULTIPLE_REGISTERS;
+        int _address=_device.GetWriteAddress(channel, j);
+
+        ModbusAsyncTag _tag;
+        _tag.id=d;
+        _tag.index=channel;
+        _tag.offset=j;
+        if(!gateway.client->Request(_device.GetDeviceAddress(), _fc, _address, _count, _values, _tag, _device.GetUnitTimeout()))
+          return;
+
+        //Inviata: abbasso il flag subito, viene rialzato se la scrittura fallisce
+        for(int k=0; k<_count; k++)
+          this->_buffer->ResetElement(_device.GetArea(channel, j+k), Field);
+
+        _sent=true;
+        break;
+      }
+    }
+  }
+}
+
+void ModbusAsyncEngine::QueueReads(ModbusAsyncGateway &gateway) {
+  //Stesso criterio delle letture sincrone: il blocco piu in ritardo per primo, finche la pipeline ha posto
+  int d=-1, block=-1;
+  while(gateway.client->CanRequest() && DeviceManagement_PickOverdue(gateway.devices, *this->_prgDevices, millis(), gateway.client, d, block)) {
+    GenericPrgDevice &_device=(*this->_prgDevices)[d];
+    GenericPrgDevice::GenericPrgDeviceReadBlock _block=_device.GetReadBlock(block);
+    MB_FC _fc=DeviceManagement_ReadFC(_block.hwType);
+
+    ModbusAsyncTag _tag;
+    _tag.id=d;
+    _tag.index=block;
+    _tag.offset=0;
+    if(_fc==MB_FC_NONE || !gateway.client->Request(_device.GetDeviceAddress(), _fc, _block.startingAddr, _block.items, nullptr, _tag, _device.GetUnitTimeout()))
+      return; //Non inviata: il blocco resta scaduto e viene ripreso al prossimo ciclo
+
+    _device.MarkBlockPolled(block, millis());
+  }
+}
+
+void ModbusAsyncEngine::OnResult(void *context, const ModbusAsyncResult &result) {
+  ModbusAsyncEngine *_engine=(ModbusAsyncEngine*)context;
+  int d=result.request->tag.id;
+  if(d<0 || d>=_engine->_prgDevices->size())
+    return;
+
+  GenericPrgDevice &_device=(*_engine->_prgDevices)[d];
+  if(result.request->function<=MB_FC_READ_INPUT_REGISTER)
+    _engine->OnRead(_device, result);
+  else
+    _engine->OnWrite(_device, result);
+}
+
+void ModbusAsyncEngine::OnRead(GenericPrgDevice &device, const ModbusAsyncResult &result) {
+  bool _ok=result.status==MB_ASYNC_OK;
+  device.ReportTransaction(false, _ok, result.request->count);
+  device.ReportLatency(millis() - result.request->sentAt, _ok, millis());
+  if(!_ok) {
+    this->_ioError=true;
+    return;
+  }
+
+  //Il piano puo essere stato ricostruito (SetMaxReadItems) mentre la richiesta era aperta
+  int block=result.request->tag.index;
+  if(block>=device.GetReadBlocksSize())
+    return;
+  GenericPrgDevice::GenericPrgDeviceReadBlock _block=device.GetReadBlock(block);
+  if(_block.startingAddr!=result.request->address || _block.items!=result.request->count)
+    return;
+
+  device.MarkBlockUpdated(block, millis());
+
+  bool _bits=result.request->function<=MB_FC_READ_DISCRETE_INPUT;
+  int channel=_block.channel;
+  int _index=_block.startIndex;
+  for(int j=0; j<_block.items; j++) {
+    if(_index>=device.GetChannelInfo(channel).items) {
+      //Il blocco prosegue sul canale successivo
+      channel++;
+      _index=0;
+    }
+
+    unsigned short _value;
+    if(_bits)
+      _value=(result.data[j/8] >> (j%8)) & 1;
+    else
+      _value=(result.data[j*2] << 8) | result.data[(j*2)+1];
+
+    DeviceManagement_Read_Process(*this->_buffer, *this->_toggles, device, channel, _index, _block.type, _value);
+    _index++;
+  }
+  DeviceManagement_Read_Activity(*this->_buffer, device, _block, millis());
+
+  this->_readDone=true;
+}
+
+void ModbusAsyncEngine::OnWrite(GenericPrgDevice &device, const ModbusAsyncResult &result) {
+  bool _ok=result.status==MB_ASYNC_OK;
+  device.ReportTransaction(true, _ok, result.request->count);
+  device.ReportLatency(millis() - result.request->sentAt, _ok, millis());
+  if(_ok)
+    return;
+
+  this->_ioError=true;
+  int channel=result.request->tag.index;
+  int j=result.request->tag.offset;
+
+  //Scrittura non confermata: rialzo i flag, il valore corrente verra riscritto al prossimo ciclo
+  for(int k=0; k<result.request->count; k++)
+    this->_buffer->RestoreElement(device.GetArea(channel, j+k), Field);
+
+  #ifdef DEBUG_ERROR
+  Serial.print("ModbusAsyncEngine - Cannot WRITE: ");
+  Serial.print(device.GetName());
+
+  Serial.print(" IP: ");
+  Serial.print(device.GetIp());
+
+  Serial.print(" Address: ");
+  Serial.print(device.GetDeviceAddress());
+
+  Serial.print(" channel: ");
+  Serial.print(channel);
+  Serial.print(" item: ");
+  Serial.print(j);
+  Serial.print(" count: ");
+  Serial.print(result.request->count);
+  Serial.print(" status: ");
+  Serial.println(result.status, HEX);
+  #endif
+}
@@ -16,13 +16,112 @@
 
 //Modbus Server Pannello, uso libreria MgsModbus
 #include "MgsModbus.h"
+//Modbus Client asincrono (pipeline per gateway)
+#include "ModbusAsync.h"
+#include "Trace.h"
+#include "Profiler.h"
 
 typedef void (*SomethingChangedFn)(ModbusBuffer &); 
 typedef void (*RouteFn)(BufferSourceInfo, int, ModbusBuffer &);
 
+const unsigned long POOL_MIN_BACKOFF=1000; //ms, raddoppia ad ogni connessione fallita
+const unsigned long READ_BUDGET_DEFAULT=40; //ms di letture sincrone per gateway e per ciclo
+
+typedef struct {
+  arduino::IPAddress IP;
+  EthernetClient *socket;
+  ModbusTCPClient *client;
+  Errors *error;              // esclusione del gateway dopo ripetuti fallimenti
+  unsigned long lastUse;
+  unsigned long nextAttempt;  // backoff: nessun tentativo di connessione prima di questo istante
+  unsigned long backoff;
+  bool open;
+}ModbusPoolSlot;
+
+//Pool di connessioni Modbus TCP, una per gateway (stesso indice di List<structIP>), mantenute aperte tra i cicli
+class ModbusClientPool
+{
+  public:
+    ModbusClientPool(unsigned long idleTimeout=30000, unsigned long maxBackoff=30000);
+    void Begin(List<structIP> *IPList);
+    ModbusTCPClient* Acquire(List<structIP> *IPList, short ipIndex); // client connesso o nullptr
+    void Release(short ipIndex);
+    void Loop(); // chiude le connessioni inattive da piu di idleTimeout
+    size_t OpenConnections();
+  private:
+    std::vector<ModbusPoolSlot> _slots;
+    unsigned long _idleTimeout;
+    unsigned long _maxBackoff;
+};
+
+//Stato per gateway del client asincrono
+typedef struct {
+  ModbusAsyncClient *client;
+  std::vector<int> devices; // indici in prgDevices dei device dietro il gateway
+}ModbusAsyncGateway;
+
+//Client Modbus asincrono: tutti i gateway serviti ad ogni ciclo, senza attendere le risposte
+class ModbusAsyncEngine
+{
+  public:
+    ModbusAsyncEngine(uint8_t maxInFlight=2, unsigned long timeout=300);
+    void Begin(List<structIP> *IPList, const DeviceRegistry &registry);
+    // Raccoglie le risposte arrivate su tutti i gateway e le riversa nel buffer. Ritorna true in caso di errore I/O
+    bool Collect(pin_size_t ledR, List<structIP> *IPList, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles);
+    // Accoda le scritture variate e poi le letture fino a riempire la pipeline di ogni gateway. Ritorna true in caso di errore I/O
+    bool Issue(pin_size_t ledW, List<structIP> *IPList, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices);
+    uint8_t InFlight(short ipIndex);
+    uint8_t MaxInFlight();
+  private:
+    static void OnResult(void *context, const ModbusAsyncResult &result);
+    void OnRead(GenericPrgDevice &device, const ModbusAsyncResult &result);
+    void OnWrite(GenericPrgDevice &device, const ModbusAsyncResult &result);
+    void QueueWrites(ModbusAsyncGateway &gateway);
+    void QueueReads(ModbusAsyncGateway &gateway);
+    std::vector<ModbusAsyncGateway> _gateways;
+    uint8_t _maxInFlight;
+    unsigned long _timeout;
+    // Contesto del ciclo in corso, usato dai callback delle risposte
+    ModbusBuffer *_buffer;
+    std::vector<GenericPrgDevice> *_prgDevices;
+    ToggleManager *_toggles;
+    bool _ioError;
+    bool _readDone;
+};
+
+//Registri del server letti e scritti direttamente nel buffer (indirizzo = area), senza copie periodiche:
+//FC3/FC4 servono il ToPanel, le scritture del pannello arrivano subito come variazioni FromPanel
+class ModbusBufferServerHandler : public MbsHandler
+{
+  public:
+    ModbusBufferServerHandler(ModbusBuffer &buffer);
+    word MbsSize(MB_SPACE space) override;
+    boolean MbsRead(MB_SPACE space, word address, word &value) override;
+    boolean MbsWrite(MB_SPACE space, word address, word value) override;
+    boolean MbsReadBits(MB_SPACE space, word address, word count, uint8_t *dest) override;
+    boolean MbsWriteBits(MB_SPACE space, word address, word count, const uint8_t *src) override;
+  private:
+    bool Served(int area, long &value);
+    void Write(int area, long value);
+    ModbusBuffer &_buffer;
+};
+
 void ManageMdbSvr(pin_size_t led, EthernetClient &client, MgsModbus &modbusTCPSvr, ModbusBuffer &buffer, ToggleManager &toggles, char *itemName, bool mode);
-bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusTCPClient &modbusTCPCli, List<structIP> *IPList, short ipIndex, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route);
+void ManageMdbSvr(pin_size_t led, MgsModbus &modbusTCPSvr, ModbusBuffer &buffer, ToggleManager &toggles, char *itemName, bool mode);
+void ManageMdbSvr_FromPanel(ModbusBuffer &buffer, int area, long value);
+bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusTCPClient &modbusTCPCli, List<structIP> *IPList, short ipIndex, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route, ModbusBufferJournalCursor *journalCursor=nullptr);
+
+bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusAsyncEngine &engine, List<structIP> *IPList, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route, ModbusBufferJournalCursor *journalCursor=nullptr);
+
+bool ManageMdbCli(pin_size_t ledR, pin_size_t ledW, ModbusClientPool &pool, List<structIP> *IPList, short ipIndex, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry, ToggleManager &toggles, SomethingChangedFn somethingChanged, RouteFn route, ModbusBufferJournalCursor *journalCursor=nullptr);
 
-bool DeviceManagement_Write(pin_size_t led, ModbusTCPClient &modbusTCPCli, arduino::IPAddress ip, ModbusBuffer &buffer, std::vector<GenericPrgDevice> prgDevices);
-bool DeviceManagement_Read(pin_size_t led, ModbusTCPClient &modbusTCPCli, List<structIP> *iPList, short ipIndex, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, ToggleManager &toggles);
+bool DeviceManagement_Write(pin_size_t led, ModbusTCPClient &modbusTCPCli, arduino::IPAddress ip, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry);
+// Scheduler a scadenza delle letture (periodo di refresh per device/canale, vedi GenericPrgDevice::SetRefreshPeriod)
+bool DeviceManagement_PickOverdue(const std::vector<int> &devices, std::vector<GenericPrgDevice> &prgDevices, unsigned long now, ModbusAsyncClient *pending, int &device, int &block);
+void DeviceManagement_SetReadBudget(unsigned long budget);
+// Registra su recorder le letture (solo item variati) e le scritture dei pannelli, nullptr disattiva
+void DeviceManagement_SetTrace(TraceRecorder *recorder, std::vector<GenericPrgDevice> *prgDevices);
+void DeviceManagement_Read_Process(ModbusBuffer &buffer, ToggleManager &toggles, GenericPrgDevice &device, int channel, int _index, GenericPrgDevice::GenericPrgDeviceEnum type, unsigned short value);
+void ManageMdbCli_RouteChanges(ModbusBuffer &buffer, SomethingChangedFn somethingChanged, RouteFn route, ModbusBufferJournalCursor *journalCursor);
+bool DeviceManagement_Read(pin_size_t led, ModbusTCPClient &modbusTCPCli, List<structIP> *iPList, short ipIndex, ModbusBuffer &buffer, std::vector<GenericPrgDevice> &prgDevices, const DeviceRegistry &registry, ToggleManager &toggles);
 #endif
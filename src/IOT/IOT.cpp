@@ -36,6 +36,7 @@ IOT::IOT(EthernetUDP &udp, IPAddress ip, unsigned int localPort, unsigned int re
   this->_ip=ip;
   this->_localPort=localPort;
   this->_remotePort=remotePort;
+  this->_trace=nullptr;
 }
 
 void IOT::begin(String message) 
@@ -116,43 +117,12 @@ bool IOT::Update() {
     if(_marker!=-1) {
       String _cmd=String(packetBuffer).substring(0, _marker);
       Serial.print("IOT Receive: "+_cmd);
-      String _value="";
-      switch (getCommandIndex(_cmd)) {
-        case CMD_onArrivoACasaChange:
-          _value=String(packetBuffer).substring(_marker+2);
-          Serial.println(", value: "+_value);
-          
-          this->setArrivoACasa("Ho variato lo stato di Casa: ", _value.toInt());
-          return true;
-          break;
-
-        case CMD_onLuciEsterneChange:
-          _value=String(packetBuffer).substring(_marker+2);
-          Serial.println(", value: "+_value);
-          
-          this->setLuciEsterne("Ho variato lo stato delle luci Esterne: ", _value.toInt()==1?true:false);
-          return true;
-          break;
-
-        case CMD_updateProximity:
-          _value=String(packetBuffer).substring(_marker+2);
-          Serial.println(", value: "+_value);
-          
-          this->setProximity("Vedo che stai: ", _value.toInt()==1?true:false);
-          return true;
-          break;
-
-        case CMD_Check:
-          Serial.println();
-          UDPSend(*this->_udp, this->_ip, this->_remotePort, "Check", "Ok");
-          return true;
-          break;
-
-        default:
-          Serial.println("Unknown Command");
-          break;
-        
-      }
+      CommandIndex _command=getCommandIndex(_cmd);
+      long _value=String(packetBuffer).substring(_marker+2).toInt();
+      if(this->_trace!=nullptr && _command!=CMD_UNKNOWN)
+        this->_trace->Udp(_command, _value);
+
+      return Execute(_command, _value);
     }
     else Serial.println("UDP Receive error: "+String(packetBuffer));
   }
@@ -160,6 +130,54 @@ bool IOT::Update() {
   return false;
 }
 
+bool IOT::Execute(int command, long value) {
+  switch (command) {
+    case CMD_onArrivoACasaChange:
+      Serial.println(", value: "+String(value));
+      
+      this->setArrivoACasa("Ho variato lo stato di Casa: ", value);
+      return true;
+      break;
+
+    case CMD_onLuciEsterneChange:
+      Serial.println(", value: "+String(value));
+      
+      this->setLuciEsterne("Ho variato lo stato delle luci Esterne: ", value==1?true:false);
+      return true;
+      break;
+
+    case CMD_updateProximity:
+      Serial.println(", value: "+String(value));
+      
+      this->setProximity("Vedo che stai: ", value==1?true:false);
+      return true;
+      break;
+
+    case CMD_Check:
+      Serial.println();
+      UDPSend(*this->_udp, this->_ip, this->_remotePort, "Check", "Ok");
+      return true;
+      break;
+
+    default:
+      Serial.println("Unknown Command");
+      break;
+    
+  }
+
+  return false;
+}
+
+void IOT::SetTrace(TraceRecorder *recorder) {
+  this->_trace=recorder;
+}
+
+String IOT::CommandName(int command) {
+  if(command<0 || command>=CMD_UNKNOWN)
+    return "";
+  return commands[command];
+}
+
 
 // **************************   UDP
 const int numCommands = sizeof(commands) / sizeof(commands[0]);
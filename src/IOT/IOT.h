@@ -4,6 +4,7 @@
   #include <Arduino.h>
   #include <EthernetUdp.h>
   #include "PLC.h"
+  #include "Trace.h"
 
 /* ============================================================
    IOT — UDP-Based Home Automation Communication Module
@@ -192,8 +193,14 @@
       void setAllarmeIntrusione(bool value);
       void setTemperaturaMediaInterna(String message, float value);
       bool Update();
+      // Registra i comandi ricevuti su recorder, nullptr disattiva
+      void SetTrace(TraceRecorder *recorder);
       SystemCmdInfo& GetStatus();
+      // Nome del comando con questo indice (quello registrato nelle tracce), "" se sconosciuto
+      static String CommandName(int command);
     private:
+      // Esegue un comando gia decodificato (indice in commands[])
+      bool Execute(int command, long value);
       typedef struct {
         bool allarmeIntrusione;
         bool allarmeAllagamento;
@@ -210,6 +217,7 @@
       IPAddress _ip;
       unsigned int _localPort;
       unsigned int _remotePort;
+      TraceRecorder *_trace;
   };
 
 
@@ -6,29 +6,103 @@ EthernetClient MbmClient;
 
 MgsModbus::MgsModbus()
 {
-  
+  for(int s = 0; s < MbSpaces; s++) {
+    MbSpace[s] = nullptr;
+    MbSpaceOwned[s] = false;
+  }
+  MbsSource = nullptr;
+  MbsResetStats();
+  MbsBegin(MbDataLen, 0, 0, 0);
+  for(int i = 0; i < MbsMaxClients; i++) {
+    MbsConn[i].FrameLen = 0;
+    MbsConn[i].Open = false;
+  }
+  MbsLegacy.FrameLen = 0;
+  MbsLegacy.Open = false;
+  for(int i = 0; i < MbmQueueLen; i++) {
+    MbmQueue[i].State = MB_MSTATE_FREE;
+  }
+  MbmNextTid = 1;
+  MbmNextSeq = 0;
+  MbmCounter = 0;
+  MbmNextConnect = 0;
+  MbmOpen = false;
+  MbmBegin(IPAddress(192,168,0,12), MbmTimeoutDefault);
+}
+
+
+//****************** Target for ModBusMaster ****************
+void MgsModbus::MbmBegin(IPAddress Ip, unsigned long Timeout)
+{
+  remSlaveIP = Ip;
+  MbmTimeout = Timeout;
 }
 
 
-//****************** Send data for ModBusMaster ****************
+//****************** Queue a request for ModBusMaster ****************
 void MgsModbus::Req(MB_FC FC, word Ref, word Count, word Pos)
 {
-  MbmFC = FC;
-  byte ServerIp[] = {192,168,0,12};
-  MbmByteArray[0] = 0;  // ID high byte
-  MbmByteArray[1] = 1;  // ID low byte
+  if (Req(remSlaveIP, 1, FC, Ref, Count, Pos) == 0) {
+    Serial.println("modbus master queue full");
+  }
+}
+
+
+word MgsModbus::Req(IPAddress Ip, uint8_t Unit, MB_FC FC, word Ref, word Count, word Pos, MbmCallback Callback, void *Context, unsigned long Timeout)
+{
+  MbmRequest *Slot = nullptr;
+  for (int i = 0; i < MbmQueueLen && Slot == nullptr; i++) {
+    if (MbmQueue[i].State == MB_MSTATE_FREE) {Slot = &MbmQueue[i];}
+  }
+  if (Slot == nullptr) {return 0;}
+
+  if (MbmNextTid == 0) {MbmNextTid = 1;} // 0 = richiesta rifiutata
+  Slot->Tid = MbmNextTid++;
+  Slot->Ip = Ip;
+  Slot->Unit = Unit;
+  Slot->FC = FC;
+  Slot->Ref = Ref;
+  Slot->Count = Count;
+  Slot->Pos = Pos;
+  Slot->Seq = MbmNextSeq++;
+  Slot->Timeout = Timeout != 0 ? Timeout : MbmTimeout;
+  Slot->Callback = Callback;
+  Slot->Context = Context;
+  Slot->State = MB_MSTATE_QUEUED;
+  return Slot->Tid;
+}
+
+
+int MgsModbus::MbmPending()
+{
+  int Count = 0;
+  for (int i = 0; i < MbmQueueLen; i++) {
+    if (MbmQueue[i].State != MB_MSTATE_FREE) Count++;
+  }
+  return Count;
+}
+
+
+//****************** Build the request for ModBusMaster ****************
+int MgsModbus::MbmBuild(MbmRequest &Request)
+{
+  MB_FC FC = Request.FC;
+  word Count = Request.Count;
+  word Pos = Request.Pos;
+  MbmByteArray[0] = highByte(Request.Tid);  // ID high byte
+  MbmByteArray[1] = lowByte(Request.Tid);   // ID low byte
   MbmByteArray[2] = 0;  // protocol high byte
   MbmByteArray[3] = 0;  // protocol low byte
   MbmByteArray[5] = 6;  // Lenght low byte;
   MbmByteArray[4] = 0;  // Lenght high byte
-  MbmByteArray[6] = 1;  // unit ID
+  MbmByteArray[6] = Request.Unit;  // unit ID
   MbmByteArray[7] = FC; // function code
-  MbmByteArray[8] = highByte(Ref);
-  MbmByteArray[9] = lowByte(Ref);
+  MbmByteArray[8] = highByte(Request.Ref);
+  MbmByteArray[9] = lowByte(Request.Ref);
   //****************** Read Coils (1) & Read Input discretes (2) **********************
   if(FC == MB_FC_READ_COILS || FC == MB_FC_READ_DISCRETE_INPUT) {
     if (Count < 1) {Count = 1;}
-    if (Count > 125) {Count = 2000;}
+    if (Count > 2000) {Count = 2000;}
     MbmByteArray[10] = highByte(Count);
     MbmByteArray[11] = lowByte(Count);
   }
@@ -40,18 +114,18 @@ void MgsModbus::Req(MB_FC FC, word Ref, word Count, word Pos)
     MbmByteArray[11] = lowByte(Count);
   }
   //****************** Write Coil (5) **********************
-  if(MbmFC == MB_FC_WRITE_COIL) {
+  if(FC == MB_FC_WRITE_COIL) {
     if (GetBit(Pos)) {MbmByteArray[10] = 0xFF;} else {MbmByteArray[10] = 0;} // 0xFF coil on 0x00 coil off
     MbmByteArray[11] = 0; // always zero
   }
   //****************** Write Register (6) ******************
-  if(MbmFC == MB_FC_WRITE_REGISTER) {
-    MbmByteArray[10] = highByte(MbData[Pos]);
-    MbmByteArray[11] = lowByte(MbData[Pos]);
+  if(FC == MB_FC_WRITE_REGISTER) {
+    word Value = Pos < GetDataLen() ? MbData[Pos] : 0;
+    MbmByteArray[10] = highByte(Value);
+    MbmByteArray[11] = lowByte(Value);
   }
   //****************** Write Multiple Coils (15) **********************
-  // not fuly tested
-  if(MbmFC == MB_FC_WRITE_MULTIPLE_COILS) {
+  if(FC == MB_FC_WRITE_MULTIPLE_COILS) {
     if (Count < 1) {Count = 1;}
     if (Count > 800) {Count = 800;}
     MbmByteArray[10] = highByte(Count);
@@ -59,12 +133,13 @@ void MgsModbus::Req(MB_FC FC, word Ref, word Count, word Pos)
     MbmByteArray[12] = (Count + 7) /8;
     MbmByteArray[4] = highByte(MbmByteArray[12] + 7); // Lenght high byte
     MbmByteArray[5] = lowByte(MbmByteArray[12] + 7); // Lenght low byte;
+    for (int i=0; i<MbmByteArray[12]; i++) {MbmByteArray[13 + i] = 0;}
     for (int i=0; i<Count; i++) {
       bitWrite(MbmByteArray[13+(i/8)],i-((i/8)*8),GetBit(Pos+i));
     }
   }
   //****************** Write Multiple Registers (16) ******************
-  if(MbmFC == MB_FC_WRITE_MULTIPLE_REGISTERS) {
+  if(FC == MB_FC_WRITE_MULTIPLE_REGISTERS) {
     if (Count < 1) {Count = 1;}
     if (Count > 100) {Count = 100;}
     MbmByteArray[10] = highByte(Count);
@@ -73,33 +148,75 @@ void MgsModbus::Req(MB_FC FC, word Ref, word Count, word Pos)
     MbmByteArray[4] = highByte(MbmByteArray[12] + 7); // Lenght high byte
     MbmByteArray[5] = lowByte(MbmByteArray[12] + 7); // Lenght low byte;
     for (int i=0; i<Count;i++) {
-      MbmByteArray[(i*2)+13] = highByte (MbData[Pos + i]);
-      MbmByteArray[(i*2)+14] = lowByte (MbData[Pos + i]);
+      word Value = Pos + i < GetDataLen() ? MbData[Pos + i] : 0;
+      MbmByteArray[(i*2)+13] = highByte (Value);
+      MbmByteArray[(i*2)+14] = lowByte (Value);
     }
   }
-  //****************** ?? ******************
-  if (MbmClient.connect(ServerIp,MB_PORT)) {
+  Request.Count = Count;
+  return MbmByteArray[5] + 6;
+}
+
+
+//****************** Send queued requests for ModBusMaster ****************
+// Una connessione alla volta: le richieste per lo stesso target partono tutte insieme (pipeline),
+// il target cambia solo quando non ci sono piu risposte attese
+void MgsModbus::MbmSend()
+{
+  MbmRequest *Next = nullptr;
+  boolean InFlight = false;
+  for (int i = 0; i < MbmQueueLen; i++) {
+    if (MbmQueue[i].State == MB_MSTATE_SENT) {InFlight = true;}
+    if (MbmQueue[i].State == MB_MSTATE_QUEUED && (Next == nullptr || (long)(MbmQueue[i].Seq - Next->Seq) < 0)) {Next = &MbmQueue[i];}
+  }
+  if (Next == nullptr) {return;}
+
+  if (MbmOpen && !(MbmConnectedIp == Next->Ip)) {
+    if (InFlight) {return;}
+    MbmClient.stop();
+    MbmOpen = false;
+  }
+  if (!MbmOpen) {
+    if ((long)(millis() - MbmNextConnect) < 0) {return;}
+    if (!MbmClient.connect(Next->Ip, MB_PORT)) {
+      Serial.println("connection with modbus slave failed");
+      MbmClient.stop();
+      MbmNextConnect = millis() + MbmReconnectDelay;
+      // Le richieste per il target irraggiungibile falliscono subito, le altre restano in coda
+      IPAddress Ip = Next->Ip;
+      for (int i = 0; i < MbmQueueLen; i++) {
+        if (MbmQueue[i].State == MB_MSTATE_QUEUED && MbmQueue[i].Ip == Ip) {MbmDone(MbmQueue[i], MbmStatusDisconnected);}
+      }
+      return;
+    }
     #ifdef DEBUG
       Serial.println("connected with modbus slave");
+    #endif
+    MbmOpen = true;
+    MbmConnectedIp = Next->Ip;
+    MbmCounter = 0;
+  }
+
+  for (int i = 0; i < MbmQueueLen; i++) {
+    MbmRequest &Request = MbmQueue[i];
+    if (Request.State != MB_MSTATE_QUEUED || !(Request.Ip == MbmConnectedIp)) {continue;}
+    int Length = MbmBuild(Request);
+    #ifdef DEBUG
       Serial.print("Master request: ");
-      for(int i=0;i<MbmByteArray[5]+6;i++) {
+      for(int i=0;i<Length;i++) {
         if(MbmByteArray[i] < 16){Serial.print("0");}
         Serial.print(MbmByteArray[i],HEX);
-        if (i != MbmByteArray[5]+5) {Serial.print(".");} else {Serial.println();}
+        if (i != Length - 1) {Serial.print(".");} else {Serial.println();}
       }
     #endif    
-    for(int i=0;i<MbmByteArray[5]+6;i++) {
-      MbmClient.write(MbmByteArray[i]);
+    if (MbmClient.write(MbmByteArray, Length) != (size_t)Length) {
+      MbmClient.stop();
+      MbmOpen = false;
+      MbmNextConnect = millis() + MbmReconnectDelay;
+      return; // le richieste inviate vengono chiuse dal prossimo MbmRun
     }
-    MbmCounter = 0;
-    MbmByteArray[7] = 0;
-    MbmPos = Pos;
-    MbmBitCount = Count;
-  } else {
-    
-      Serial.println("connection with modbus master failed");
-       
-    MbmClient.stop();
+    Request.SentAt = millis();
+    Request.State = MB_MSTATE_SENT;
   }
 }
 
@@ -107,174 +224,413 @@ void MgsModbus::Req(MB_FC FC, word Ref, word Count, word Pos)
 //****************** Recieve data for ModBusMaster ****************
 void MgsModbus::MbmRun()
 {
+  if (MbmOpen && !MbmClient.connected()) {
+    MbmClient.stop();
+    MbmOpen = false;
+  }
+  if (!MbmOpen) {
+    MbmFail(MbmStatusDisconnected, false);
+  }
+
   //****************** Read from socket ****************
-  while (MbmClient.available()) {
-    MbmByteArray[MbmCounter] = MbmClient.read();
-    if (MbmCounter > 4)  {
-      if (MbmCounter == MbmByteArray[5] + 5) { // the full answer is recieved  
+  // Header MBAP, poi il resto della risposta secondo il campo lunghezza
+  int Available = MbmOpen ? MbmClient.available() : 0;
+  while (Available > 0) {
+    int Need;
+    if (MbmCounter < 6) Need = 6 - MbmCounter;
+    else Need = 6 + word(MbmByteArray[4], MbmByteArray[5]) - MbmCounter;
+
+    int Read = MbmClient.read(MbmByteArray + MbmCounter, min(Need, Available));
+    if (Read <= 0) break;
+    MbmCounter += Read;
+    Available -= Read;
+
+    if (MbmCounter == 6) {
+      word PduLen = word(MbmByteArray[4], MbmByteArray[5]);
+      if (word(MbmByteArray[2], MbmByteArray[3]) != 0 || PduLen < 2 || PduLen > sizeof(MbmByteArray) - 6) {
+        // Stream non piu allineato: chiudo e fallisco le richieste inviate
         MbmClient.stop();
-        MbmProcess();
-        #ifdef DEBUG
-          Serial.println("recieve klaar");
-        #endif    
+        MbmOpen = false;
+        MbmCounter = 0;
+        MbmFail(MbmStatusBadResponse, false);
+        break;
       }
     }
-    MbmCounter++;
+    else if (MbmCounter > 6 && MbmCounter == 6 + word(MbmByteArray[4], MbmByteArray[5])) { // the full answer is recieved  
+      MbmProcess();
+      MbmCounter = 0;
+    }
   }
+
+  //****************** Timeouts ****************
+  unsigned long Now = millis();
+  for (int i = 0; i < MbmQueueLen; i++) {
+    if (MbmQueue[i].State == MB_MSTATE_SENT && Now - MbmQueue[i].SentAt > MbmQueue[i].Timeout) {
+      MbmDone(MbmQueue[i], MbmStatusTimeout);
+    }
+  }
+
+  MbmSend();
 }
 
 void MgsModbus::MbmProcess()
 {
-  MbmFC = SetFC(int (MbmByteArray[7]));
   #ifdef DEBUG
-    for (int i=0;i<MbmByteArray[5]+6;i++) {
+    for (int i=0;i<MbmCounter;i++) {
       if(MbmByteArray[i] < 16) {Serial.print("0");}
       Serial.print(MbmByteArray[i],HEX);
-      if (i != MbmByteArray[5]+5) {Serial.print(".");
+      if (i != MbmCounter - 1) {Serial.print(".");
       } else {Serial.println();}
     }
   #endif    
+  word Tid = word(MbmByteArray[0], MbmByteArray[1]);
+  MbmRequest *Request = nullptr;
+  for (int i = 0; i < MbmQueueLen && Request == nullptr; i++) {
+    if (MbmQueue[i].State == MB_MSTATE_SENT && MbmQueue[i].Tid == Tid) {Request = &MbmQueue[i];}
+  }
+  if (Request == nullptr) {return;} // risposta tardiva ad una richiesta gia scaduta
+
+  int PduLen = MbmCounter - 7;
+  if (MbmByteArray[7] == (Request->FC | 0x80)) {
+    MbmDone(*Request, PduLen >= 2 ? MbmByteArray[8] : MbmStatusBadResponse);
+    return;
+  }
+  MB_FC MbmFC = SetFC(int (MbmByteArray[7]));
+  if (MbmFC != Request->FC || MbmByteArray[6] != Request->Unit) {
+    MbmDone(*Request, MbmStatusBadResponse);
+    return;
+  }
+  word MbmPos = Request->Pos;
   //****************** Read Coils (1) & Read Input discretes (2) **********************
   if(MbmFC == MB_FC_READ_COILS || MbmFC == MB_FC_READ_DISCRETE_INPUT) {
-    word Count = MbmByteArray[8] * 8;
-    if (MbmBitCount < Count) {
-      Count = MbmBitCount;
+    if (PduLen < 2 || MbmByteArray[8] < (Request->Count + 7) / 8 || 2 + MbmByteArray[8] > PduLen) {
+      MbmDone(*Request, MbmStatusBadResponse);
+      return;
     }
+    word Count = Request->Count;
     for (int i=0;i<Count;i++) {
-      if (i + MbmPos < MbDataLen * 16) {
+      if (i + MbmPos < GetDataLen() * 16) {
         SetBit(i + MbmPos,bitRead(MbmByteArray[(i/8)+9],i-((i/8)*8)));
       }
     }
   }
   //****************** Read Registers (3) & Read Input registers (4) ******************
   if(MbmFC == MB_FC_READ_REGISTERS || MbmFC == MB_FC_READ_INPUT_REGISTER) {
+    if (PduLen < 2 || MbmByteArray[8] < Request->Count * 2 || 2 + MbmByteArray[8] > PduLen) {
+      MbmDone(*Request, MbmStatusBadResponse);
+      return;
+    }
     word Pos = MbmPos;
-    for (int i=0;i<MbmByteArray[8];i=i+2) {
-      if (Pos < MbDataLen) {
+    for (int i=0;i<Request->Count * 2;i=i+2) {
+      if (Pos < GetDataLen()) {
         MbData[Pos] = (MbmByteArray[i+9] * 0x100) + MbmByteArray[i+1+9];
         Pos++;
       }
     }
   }
-  //****************** Write Coil (5) **********************
-  if(MbmFC == MB_FC_WRITE_COIL){
+  //****************** Write Coil (5), Register (6), Multiple Coils (15), Multiple Registers (16) **********************
+  // Echo dell'indirizzo: nessun dato da riportare in MbData
+  MbmDone(*Request, MbmStatusOk);
+}
+
+
+// Libera lo slot prima del callback, che puo accodare subito una nuova richiesta
+void MgsModbus::MbmDone(MbmRequest &Request, uint8_t Status)
+{
+  MbmRequest Done = Request;
+  Request.State = MB_MSTATE_FREE;
+  #ifdef DEBUG
+    if (Status != MbmStatusOk) {
+      Serial.print("Master request ");
+      Serial.print(Done.Tid);
+      Serial.print(" failed: ");
+      Serial.println(Status, HEX);
+    }
+  #endif
+  if (Done.Callback != nullptr) {Done.Callback(Done.Context, Done, Status);}
+}
+
+
+// Chiude le richieste inviate (e quelle in coda se Queued) con Status
+void MgsModbus::MbmFail(uint8_t Status, boolean Queued)
+{
+  for (int i = 0; i < MbmQueueLen; i++) {
+    if (MbmQueue[i].State == MB_MSTATE_SENT || (Queued && MbmQueue[i].State == MB_MSTATE_QUEUED)) {
+      MbmDone(MbmQueue[i], Status);
+    }
   }
-  //****************** Write Register (6) ******************
-  if(MbmFC == MB_FC_WRITE_REGISTER){
+}
+
+
+//****************** Recieve data for ModBusSlave ****************
+// Singolo client passato dal chiamante (es. EthernetServer::available()): una richiesta parziale
+// resta nel buffer fino alla chiamata successiva, quelle in coda vengono servite tutte
+void MgsModbus::MbsRun(EthernetClient &client)
+{
+  if(!MbsLegacy.Open || !MbsLegacy.Client.connected()) MbsLegacy.FrameLen = 0;
+  MbsLegacy.Client = client;
+  MbsLegacy.Open = true;
+  if(!MbsReceive(MbsLegacy)) {
+    client.stop();
+    MbsLegacy.Open = false;
   }
-  //****************** Write Multiple Coils (15) **********************
-  if(MbmFC == MB_FC_WRITE_MULTIPLE_COILS){
+}
+
+
+//****************** Multi client ModBusSlave ****************
+// Accetta fino a MbsMaxClients connessioni dei pannelli; ogni richiesta completa riceve
+// risposta nella stessa chiamata in cui arriva
+void MgsModbus::MbsRun(EthernetServer &server)
+{
+  EthernetClient Incoming = server.accept();
+  if(Incoming) {
+    // Slot libero, altrimenti chiudo la connessione ferma da piu tempo (pannello riavviato)
+    int Slot = -1;
+    for(int i = 0; i < MbsMaxClients && Slot == -1; i++) {
+      if(!MbsConn[i].Open) Slot = i;
+    }
+    if(Slot == -1) {
+      Slot = 0;
+      for(int i = 1; i < MbsMaxClients; i++) {
+        if((long)(MbsConn[i].LastActivity - MbsConn[Slot].LastActivity) < 0) Slot = i;
+      }
+      MbsConn[Slot].Client.stop();
+    }
+    MbsConn[Slot].Client = Incoming;
+    MbsConn[Slot].FrameLen = 0;
+    MbsConn[Slot].LastActivity = millis();
+    MbsConn[Slot].Open = true;
   }
-  //****************** Write Multiple Registers (16) ******************
-  if(MbmFC == MB_FC_WRITE_MULTIPLE_REGISTERS){
+
+  for(int i = 0; i < MbsMaxClients; i++) {
+    MbsConnection &Conn = MbsConn[i];
+    if(!Conn.Open) continue;
+
+    boolean Close = !Conn.Client.connected() && !Conn.Client.available();
+    if(!Close) Close = !MbsReceive(Conn) || millis() - Conn.LastActivity > MbsIdleTimeout;
+    if(Close) {
+      Conn.Client.stop();
+      Conn.Open = false;
+    }
   }
 }
 
 
-//****************** Recieve data for ModBusSlave ****************
-void MgsModbus::MbsRun(EthernetClient &client)
-{  
-  if(client.available())
-  {    
-    int i = 0;
-    while(client.available())
-    {
-      MbsByteArray[i] = client.read();
-      i++;
-      //Serial.println(MbsByteArray[i]);
+int MgsModbus::MbsConnections()
+{
+  int Count = 0;
+  for(int i = 0; i < MbsMaxClients; i++) {
+    if(MbsConn[i].Open) Count++;
+  }
+  return Count;
+}
+
+
+//****************** Framing on MBAP length for ModBusSlave ****************
+// Legge solo i byte disponibili: header MBAP, poi il resto della ADU secondo il campo lunghezza.
+// Ritorna false se lo stream non e' piu allineato e la connessione va chiusa
+boolean MgsModbus::MbsReceive(MbsConnection &conn)
+{
+  int Available = conn.Client.available();
+  while(Available > 0) {
+    int Need;
+    if(conn.FrameLen < 6) Need = 6 - conn.FrameLen;
+    else Need = 6 + word(conn.Frame[4], conn.Frame[5]) - conn.FrameLen;
+
+    int Read = conn.Client.read(conn.Frame + conn.FrameLen, min(Need, Available));
+    if(Read <= 0) break;
+    conn.FrameLen += Read;
+    Available -= Read;
+
+    if(conn.FrameLen == 6) {
+      word PduLen = word(conn.Frame[4], conn.Frame[5]);
+      if(word(conn.Frame[2], conn.Frame[3]) != 0 || PduLen < 2 || PduLen > MbsFrameLen - 6) return false;
+    }
+    else if(conn.FrameLen > 6 && conn.FrameLen == 6 + word(conn.Frame[4], conn.Frame[5])) {
+      MbsProcess(conn.Frame, conn.Client);
+      conn.FrameLen = 0;
+      conn.LastActivity = millis();
     }
-    MbsFC = SetFC(MbsByteArray[7]);  //Byte 7 of request is FC
+  }
+  return true;
+}
 
-    //Serial.println("-----------");
-  } 
+
+//****************** Process a complete request for ModBusSlave ****************
+void MgsModbus::MbsProcess(uint8_t *Frame, EthernetClient &client)
+{
+  MB_FC MbsFC = SetFC(Frame[7]);  //Byte 7 of request is FC
   int Start, WordDataLength, ByteDataLength, CoilDataLength, MessageLength;
+  MbsStats[MbsFcSlot(Frame[7])].Requests++;
+  //****************** Request validation ******************
+  // Risposta di eccezione immediata: il pannello non ripete la richiesta fino al timeout
+  MB_SPACE Space;
+  word Count = word(Frame[10],Frame[11]);
+  word MaxCount;
+  switch(MbsFC) {
+    case MB_FC_READ_COILS:               Space = MB_SPACE_COILS;    MaxCount = 2000; break;
+    case MB_FC_READ_DISCRETE_INPUT:      Space = MB_SPACE_DISCRETE; MaxCount = 2000; break;
+    case MB_FC_READ_REGISTERS:           Space = MB_SPACE_HOLDING;  MaxCount = 125;  break;
+    case MB_FC_READ_INPUT_REGISTER:      Space = MB_SPACE_INPUT;    MaxCount = 125;  break;
+    case MB_FC_WRITE_COIL:               Space = MB_SPACE_COILS;    Count = 1; MaxCount = 1; break;
+    case MB_FC_WRITE_REGISTER:           Space = MB_SPACE_HOLDING;  Count = 1; MaxCount = 1; break;
+    case MB_FC_WRITE_MULTIPLE_COILS:     Space = MB_SPACE_COILS;    MaxCount = 1968; break;
+    case MB_FC_WRITE_MULTIPLE_REGISTERS: Space = MB_SPACE_HOLDING;  MaxCount = 123;  break;
+    default: MbsException(Frame, client, MB_EX_ILLEGAL_FUNCTION); return;
+  }
+  MB_EX Exception = MB_EX_NONE;
+  word Length = word(Frame[4],Frame[5]); // unit id + PDU
+  if(Length < 6 || Count < 1 || Count > MaxCount) Exception = MB_EX_ILLEGAL_DATA_VALUE;
+  else if(MbsFC == MB_FC_WRITE_COIL && word(Frame[10],Frame[11]) != 0xFF00 && word(Frame[10],Frame[11]) != 0x0000) Exception = MB_EX_ILLEGAL_DATA_VALUE;
+  else if(!MbsInRange(Space, word(Frame[8],Frame[9]), Count)) Exception = MB_EX_ILLEGAL_DATA_ADDRESS;
+  else if(MbsFC == MB_FC_WRITE_MULTIPLE_COILS || MbsFC == MB_FC_WRITE_MULTIPLE_REGISTERS) {
+    // Byte count coerente con la quantita e con la lunghezza MBAP
+    word DataBytes = MbsFC == MB_FC_WRITE_MULTIPLE_COILS ? (Count + 7) / 8 : Count * 2;
+    if(Length < 7 || Frame[12] != DataBytes || Length < 7 + DataBytes) Exception = MB_EX_ILLEGAL_DATA_VALUE;
+  }
+  if(Exception != MB_EX_NONE) {
+    #ifdef DEBUG
+      Serial.print("Slave request rejected, FC ");
+      Serial.print(Frame[7]);
+      Serial.print(" exception ");
+      Serial.println(Exception);
+    #endif
+    MbsException(Frame, client, Exception);
+    return;
+  }
   //****************** Read Coils (1 & 2) **********************
   if(MbsFC == MB_FC_READ_COILS || MbsFC == MB_FC_READ_DISCRETE_INPUT) {
-    Start = word(MbsByteArray[8],MbsByteArray[9]);
-    CoilDataLength = word(MbsByteArray[10],MbsByteArray[11]);
+    Start = word(Frame[8],Frame[9]);
+    CoilDataLength = word(Frame[10],Frame[11]);
     ByteDataLength = CoilDataLength / 8;
     if(ByteDataLength * 8 < CoilDataLength) ByteDataLength++;      
-    CoilDataLength = ByteDataLength * 8;
-    MbsByteArray[5] = ByteDataLength + 3; //Number of bytes after this one.
-    MbsByteArray[8] = ByteDataLength;     //Number of bytes after this one (or number of bytes of data).
-    for(int i = 0; i < ByteDataLength ; i++)
-    {
-      MbsByteArray[9 + i] = 0; // To get all remaining not written bits zero
-      for(int j = 0; j < 8; j++)
-      {
-        bitWrite(MbsByteArray[9 + i], j, GetBit(Start + i * 8 + j));
-      }
-    }
+    Frame[5] = ByteDataLength + 3; //Number of bytes after this one.
+    Frame[8] = ByteDataLength;     //Number of bytes after this one (or number of bytes of data).
+    GetBits(Space, Start, CoilDataLength, &Frame[9]); // remaining not written bits zero
     MessageLength = ByteDataLength + 9;
-    client.write(MbsByteArray, MessageLength);
+    client.write(Frame, MessageLength);
     MbsFC = MB_FC_NONE;
   }
   //****************** Read Registers (3 & 4) ******************
   if(MbsFC == MB_FC_READ_REGISTERS || MbsFC == MB_FC_READ_INPUT_REGISTER) {
-    Start = word(MbsByteArray[8],MbsByteArray[9]);
-    WordDataLength = word(MbsByteArray[10],MbsByteArray[11]);
+    Start = word(Frame[8],Frame[9]);
+    WordDataLength = word(Frame[10],Frame[11]);
     ByteDataLength = WordDataLength * 2;
-    MbsByteArray[5] = ByteDataLength + 3; //Number of bytes after this one.
-    MbsByteArray[8] = ByteDataLength;     //Number of bytes after this one (or number of bytes of data).
+    Frame[5] = ByteDataLength + 3; //Number of bytes after this one.
+    Frame[8] = ByteDataLength;     //Number of bytes after this one (or number of bytes of data).
     for(int i = 0; i < WordDataLength; i++)
     {
-      MbsByteArray[ 9 + i * 2] = highByte(MbData[Start + i]);
-      MbsByteArray[10 + i * 2] =  lowByte(MbData[Start + i]);
+      word Value = 0;
+      GetRegister(Space, Start + i, Value);
+      Frame[ 9 + i * 2] = highByte(Value);
+      Frame[10 + i * 2] =  lowByte(Value);
     }
     MessageLength = ByteDataLength + 9;
-    client.write(MbsByteArray, MessageLength);
+    client.write(Frame, MessageLength);
     MbsFC = MB_FC_NONE;
   }
   //****************** Write Coil (5) **********************
   if(MbsFC == MB_FC_WRITE_COIL) {
-    Start = word(MbsByteArray[8],MbsByteArray[9]);
-    if (word(MbsByteArray[10],MbsByteArray[11]) == 0xFF00){SetBit(Start,true);}
-    if (word(MbsByteArray[10],MbsByteArray[11]) == 0x0000){SetBit(Start,false);}
-    MbsByteArray[5] = 2; //Number of bytes after this one.
-    MessageLength = 8;
-    client.write(MbsByteArray, MessageLength);
+    Start = word(Frame[8],Frame[9]);
+    if (word(Frame[10],Frame[11]) == 0xFF00){SetBit(Space,Start,true);}
+    if (word(Frame[10],Frame[11]) == 0x0000){SetBit(Space,Start,false);}
+    Frame[5] = 6; //Number of bytes after this one (echo of the request).
+    MessageLength = 12;
+    client.write(Frame, MessageLength);
     MbsFC = MB_FC_NONE;
   } 
   //****************** Write Register (6) ******************
   if(MbsFC == MB_FC_WRITE_REGISTER) {
-    Start = word(MbsByteArray[8],MbsByteArray[9]);
-    MbData[Start] = word(MbsByteArray[10],MbsByteArray[11]);
-    MbsByteArray[5] = 6; //Number of bytes after this one.
+    Start = word(Frame[8],Frame[9]);
+    SetRegister(Space, Start, word(Frame[10],Frame[11]));
+    Frame[5] = 6; //Number of bytes after this one.
     MessageLength = 12;
-    client.write(MbsByteArray, MessageLength);
+    client.write(Frame, MessageLength);
     MbsFC = MB_FC_NONE;
   }
   //****************** Write Multiple Coils (15) **********************
   if(MbsFC == MB_FC_WRITE_MULTIPLE_COILS) {
-    Start = word(MbsByteArray[8],MbsByteArray[9]);
-    CoilDataLength = word(MbsByteArray[10],MbsByteArray[11]);
-    MbsByteArray[5] = 6;
-    for(int i = 0; i < CoilDataLength; i++)
-    {
-      SetBit(Start + i,bitRead(MbsByteArray[13 + (i/8)],i-((i/8)*8)));
-    }
+    Start = word(Frame[8],Frame[9]);
+    CoilDataLength = word(Frame[10],Frame[11]);
+    Frame[5] = 6;
+    SetBits(Space, Start, CoilDataLength, &Frame[13]);
     MessageLength = 12;
-    client.write(MbsByteArray, MessageLength);
+    client.write(Frame, MessageLength);
     MbsFC = MB_FC_NONE;
   }  
   //****************** Write Multiple Registers (16) ******************
   if(MbsFC == MB_FC_WRITE_MULTIPLE_REGISTERS) {
-    Start = word(MbsByteArray[8],MbsByteArray[9]);
-    WordDataLength = word(MbsByteArray[10],MbsByteArray[11]);
+    Start = word(Frame[8],Frame[9]);
+    WordDataLength = word(Frame[10],Frame[11]);
     ByteDataLength = WordDataLength * 2;
-    MbsByteArray[5] = 6;
+    Frame[5] = 6;
     for(int i = 0; i < WordDataLength; i++)
     {
-      MbData[Start + i] =  word(MbsByteArray[ 13 + i * 2],MbsByteArray[14 + i * 2]);
+      SetRegister(Space, Start + i, word(Frame[ 13 + i * 2],Frame[14 + i * 2]));
     }
     MessageLength = 12;
-    client.write(MbsByteArray, MessageLength);
+    client.write(Frame, MessageLength);
     MbsFC = MB_FC_NONE;
   }
 }
 
 
 //****************** ?? ******************
+//****************** Exception response for ModBusSlave ****************
+void MgsModbus::MbsException(uint8_t *Frame, EthernetClient &client, MB_EX Code)
+{
+  MbsStats[MbsFcSlot(Frame[7])].Errors++;
+  Frame[5] = 3;             //Number of bytes after this one.
+  Frame[7] |= 0x80;         //Function code with error bit
+  Frame[8] = Code;
+  client.write(Frame, 9);
+}
+
+
+int MgsModbus::MbsFcSlot(uint8_t Fc)
+{
+  switch(Fc) {
+    case MB_FC_READ_COILS:               return 0;
+    case MB_FC_READ_DISCRETE_INPUT:      return 1;
+    case MB_FC_READ_REGISTERS:           return 2;
+    case MB_FC_READ_INPUT_REGISTER:      return 3;
+    case MB_FC_WRITE_COIL:               return 4;
+    case MB_FC_WRITE_REGISTER:           return 5;
+    case MB_FC_WRITE_MULTIPLE_COILS:     return 6;
+    case MB_FC_WRITE_MULTIPLE_REGISTERS: return 7;
+    default:                             return MbsFcSlots - 1;
+  }
+}
+
+
+MbsFcStats MgsModbus::MbsGetStats(uint8_t Fc)
+{
+  return MbsStats[MbsFcSlot(Fc)];
+}
+
+
+unsigned long MgsModbus::MbsRequests()
+{
+  unsigned long Total = 0;
+  for(int i = 0; i < MbsFcSlots; i++) Total += MbsStats[i].Requests;
+  return Total;
+}
+
+
+unsigned long MgsModbus::MbsErrors()
+{
+  unsigned long Total = 0;
+  for(int i = 0; i < MbsFcSlots; i++) Total += MbsStats[i].Errors;
+  return Total;
+}
+
+
+void MgsModbus::MbsResetStats()
+{
+  memset(MbsStats, 0, sizeof(MbsStats));
+}
+
+
 MB_FC MgsModbus::SetFC(int fc)
 {
   MB_FC FC=MB_FC_NONE;
@@ -294,25 +650,201 @@ MB_FC MgsModbus::SetFC(int fc)
  
 word MgsModbus::GetDataLen()
 {
-  return MbDataLen;
+  return MbSpaceLen[MB_SPACE_HOLDING];
 }
  
  
+// Bit dei registri holding interni (MbData), anche con un handler impostato
 boolean MgsModbus::GetBit(word Number)
 {
-  int ArrayPos = Number / 16;
-  int BitPos = Number - ArrayPos * 16;  
-  return bitRead(MbData[ArrayPos],BitPos);
+  if (Number >= (unsigned long)MbSpaceLen[MB_SPACE_HOLDING] * 16) {return false;}
+  return bitRead(MbData[Number / 16], Number % 16);
 }
 
 
 boolean MgsModbus::SetBit(word Number,boolean Data)
 {
-  int ArrayPos = Number / 16;
-  int BitPos = Number - ArrayPos * 16;
-  boolean Overrun = ArrayPos > MbDataLen * 16; // check for data overrun
+  boolean Overrun = Number >= (unsigned long)MbSpaceLen[MB_SPACE_HOLDING] * 16; // check for data overrun
   if (!Overrun){                 
-    bitWrite(MbData[ArrayPos],BitPos,Data);
+    bitWrite(MbData[Number / 16], Number % 16, Data);
   } 
   return Overrun;
 }
+
+
+//****************** Register map ******************
+void MgsModbus::MbsBegin(word Holding, word Input, word Coils, word Discrete)
+{
+  word Len[MbSpaces] = {Holding, Input, Coils, Discrete};
+  if (Len[MB_SPACE_HOLDING] == 0) {Len[MB_SPACE_HOLDING] = MbDataLen;}
+
+  for (int s = 0; s < MbSpaces; s++) {
+    if (MbSpaceOwned[s]) {delete[] MbSpace[s];}
+    MbSpaceOwned[s] = false;
+  }
+
+  for (int s = 0; s < MbSpaces; s++) {
+    boolean Bits = s == MB_SPACE_COILS || s == MB_SPACE_DISCRETE;
+    if (s != MB_SPACE_HOLDING && Len[s] == 0) {
+      // Zona non dimensionata: condivide i registri holding, come l'unico blocco MbData originale
+      MbSpace[s] = MbSpace[MB_SPACE_HOLDING];
+      MbSpaceLen[s] = Bits ? MbSpaceLen[MB_SPACE_HOLDING] * 16 : MbSpaceLen[MB_SPACE_HOLDING];
+      continue;
+    }
+    word Words = Bits ? (Len[s] + 15) / 16 : Len[s];
+    MbSpace[s] = new word[Words];
+    memset(MbSpace[s], 0, Words * sizeof(word));
+    MbSpaceLen[s] = Len[s];
+    MbSpaceOwned[s] = true;
+  }
+  MbData = MbSpace[MB_SPACE_HOLDING];
+}
+
+
+boolean MbsHandler::MbsReadBits(MB_SPACE Space, word Address, word Count, uint8_t *Dest)
+{
+  for (int i = 0; i < (Count + 7) / 8; i++) {Dest[i] = 0;}
+  for (int i = 0; i < Count; i++) {
+    word Value = 0;
+    if (!MbsRead(Space, Address + i, Value)) {return false;}
+    if (Value != 0) {bitSet(Dest[i / 8], i % 8);}
+  }
+  return true;
+}
+
+
+boolean MbsHandler::MbsWriteBits(MB_SPACE Space, word Address, word Count, const uint8_t *Src)
+{
+  for (int i = 0; i < Count; i++) {
+    if (!MbsWrite(Space, Address + i, bitRead(Src[i / 8], i % 8))) {return false;}
+  }
+  return true;
+}
+
+
+word MgsModbus::GetSpaceLen(MB_SPACE Space)
+{
+  if (MbsSource != nullptr) {return MbsSource->MbsSize(Space);}
+  return MbSpaceLen[Space];
+}
+
+
+void MgsModbus::MbsSetHandler(MbsHandler *Handler)
+{
+  MbsSource = Handler;
+}
+
+
+boolean MgsModbus::HasSpace(MB_SPACE Space)
+{
+  return Space == MB_SPACE_HOLDING || MbSpaceOwned[Space] || MbsSource != nullptr;
+}
+
+
+boolean MgsModbus::MbsInRange(MB_SPACE Space, word Address, word Count)
+{
+  return (unsigned long)Address + Count <= GetSpaceLen(Space);
+}
+
+
+boolean MgsModbus::GetRegister(MB_SPACE Space, word Address, word &Value)
+{
+  if (!MbsInRange(Space, Address, 1)) {return false;}
+  if (MbsSource != nullptr) {return MbsSource->MbsRead(Space, Address, Value);}
+  Value = MbSpace[Space][Address];
+  return true;
+}
+
+
+boolean MgsModbus::SetRegister(MB_SPACE Space, word Address, word Value)
+{
+  if (!MbsInRange(Space, Address, 1)) {return false;}
+  if (MbsSource != nullptr) {return MbsSource->MbsWrite(Space, Address, Value);}
+  MbSpace[Space][Address] = Value;
+  return true;
+}
+
+
+boolean MgsModbus::GetBit(MB_SPACE Space, word Address)
+{
+  if (!MbsInRange(Space, Address, 1)) {return false;}
+  if (MbsSource != nullptr) {
+    word Value = 0;
+    return MbsSource->MbsRead(Space, Address, Value) && Value != 0;
+  }
+  return bitRead(MbSpace[Space][Address / 16], Address % 16);
+}
+
+
+boolean MgsModbus::SetBit(MB_SPACE Space, word Address, boolean Data)
+{
+  if (!MbsInRange(Space, Address, 1)) {return false;}
+  if (MbsSource != nullptr) {return MbsSource->MbsWrite(Space, Address, Data ? 1 : 0);}
+  bitWrite(MbSpace[Space][Address / 16], Address % 16, Data);
+  return true;
+}
+
+
+word MgsModbus::MbsWords(MB_SPACE Space)
+{
+  if (Space == MB_SPACE_COILS || Space == MB_SPACE_DISCRETE) {return (MbSpaceLen[Space] + 15) / 16;}
+  return MbSpaceLen[Space];
+}
+
+
+// Il bit n della zona sta nel bit n % 16 della parola n / 16: i byte della PDU
+// (bit 0 = primo indirizzo) sono il byte basso e alto di ogni parola, spostati di Address % 16
+boolean MgsModbus::GetBits(MB_SPACE Space, word Address, word Count, uint8_t *Dest)
+{
+  if (!MbsInRange(Space, Address, Count)) {return false;}
+  int Bytes = (Count + 7) / 8;
+  if (MbsSource != nullptr) {return MbsSource->MbsReadBits(Space, Address, Count, Dest);}
+  word *Data = MbSpace[Space];
+  if (Address % 8 == 0) {
+    // Allineato al byte: copia diretta dei byte delle parole
+    word First = Address / 8;
+    for (int i = 0; i < Bytes; i++) {
+      word W = Data[(First + i) / 2];
+      Dest[i] = (First + i) % 2 ? highByte(W) : lowByte(W);
+    }
+  }
+  else {
+    word Words = MbsWords(Space);
+    for (int i = 0; i < Bytes; i++) {
+      unsigned long Bit = (unsigned long)Address + i * 8;
+      word W = Bit / 16;
+      uint32_t Chunk = Data[W];
+      if (W + 1 < Words) {Chunk |= (uint32_t)Data[W + 1] << 16;}
+      Dest[i] = Chunk >> (Bit % 16);
+    }
+  }
+  if (Count % 8) {Dest[Bytes - 1] &= (1 << (Count % 8)) - 1;}
+  return true;
+}
+
+
+boolean MgsModbus::SetBits(MB_SPACE Space, word Address, word Count, const uint8_t *Src)
+{
+  if (!MbsInRange(Space, Address, Count)) {return false;}
+  if (MbsSource != nullptr) {return MbsSource->MbsWriteBits(Space, Address, Count, Src);}
+  word *Data = MbSpace[Space];
+  int Bytes = (Count + 7) / 8;
+  for (int i = 0; i < Bytes; i++) {
+    int Bits = (i == Bytes - 1 && Count % 8) ? Count % 8 : 8;
+    uint8_t Mask = (1 << Bits) - 1;
+    unsigned long Bit = (unsigned long)Address + i * 8;
+    word W = Bit / 16;
+    int Shift = Bit % 16;
+    if (Shift + Bits <= 16) {
+      // Byte dentro una parola (sempre nel caso allineato al byte)
+      Data[W] = (Data[W] & ~((word)Mask << Shift)) | ((word)(Src[i] & Mask) << Shift);
+    }
+    else {
+      uint32_t Chunk = Data[W] | ((uint32_t)Data[W + 1] << 16);
+      Chunk = (Chunk & ~((uint32_t)Mask << Shift)) | ((uint32_t)(Src[i] & Mask) << Shift);
+      Data[W] = Chunk;
+      Data[W + 1] = Chunk >> 16;
+    }
+  }
+  return true;
+}
@@ -39,8 +39,13 @@
   This library use a single block of memory for all modbus data (mbData[] array). The
   same data can be reached via several modbus functions, either via a 16 bit access
   or via an access bit. The length of MbData must at least 1.
+  MbsBegin() sizes the slave map at runtime and can give input registers, coils and
+  discrete inputs their own space. Invalid slave requests get an exception response
+  (01 illegal function, 02 illegal data address, 03 illegal data value).
   
   For the master the following modbus functions are implemented: 1, 2, 3, 4, 5, 6, 15, 16
+  The master queues up to MbmQueueLen requests, each with its own target, unit id and
+  transaction id; MbmRun() sends them and matches the answers without waiting.
   For the slave the following modbus functions are implemented: 1, 2, 3, 4, 5, 6, 15, 16
   
   The internal and external addresses are 0 (zero) based
@@ -57,6 +62,9 @@
 
 #define MbDataLen 232 // length of the MdData array
 #define MB_PORT 502
+#define MbsMaxClients 4      // slave: connessioni contemporanee (pannelli)
+#define MbsIdleTimeout 30000 // slave: ms senza richieste prima di chiudere una connessione
+#define MbsFrameLen 260      // ADU Modbus TCP massima (MBAP + PDU)
 
 enum MB_FC {
   MB_FC_NONE                     = 0,
@@ -70,34 +78,161 @@ enum MB_FC {
   MB_FC_WRITE_MULTIPLE_REGISTERS = 16
 };
 
+// Zone della mappa slave, indirizzate 0 based
+enum MB_SPACE {
+  MB_SPACE_HOLDING  = 0, // FC3, FC6, FC16 (MbData)
+  MB_SPACE_INPUT    = 1, // FC4
+  MB_SPACE_COILS    = 2, // FC1, FC5, FC15
+  MB_SPACE_DISCRETE = 3  // FC2
+};
+#define MbSpaces 4
+
+// Codici di eccezione restituiti dallo slave
+enum MB_EX {
+  MB_EX_NONE                  = 0,
+  MB_EX_ILLEGAL_FUNCTION      = 1,
+  MB_EX_ILLEGAL_DATA_ADDRESS  = 2,
+  MB_EX_ILLEGAL_DATA_VALUE    = 3
+};
+
+// Contatori slave per function code: richieste ricevute e risposte di eccezione
+struct MbsFcStats {
+  unsigned long Requests;
+  unsigned long Errors;
+};
+#define MbsFcSlots 9 // FC 1, 2, 3, 4, 5, 6, 15, 16 + function code non supportati
+
+// Dati slave forniti dall'applicazione (es. direttamente dal suo buffer) al posto della mappa interna.
+// Le coil/discrete valgono 0 o 1; ogni metodo ritorna false se l'indirizzo non esiste
+class MbsHandler
+{
+public:
+  virtual word MbsSize(MB_SPACE Space) = 0; // registri o bit della zona, per il controllo dei limiti
+  virtual boolean MbsRead(MB_SPACE Space, word Address, word &Value) = 0;
+  virtual boolean MbsWrite(MB_SPACE Space, word Address, word Value) = 0;
+  // Blocchi di Count coil/discrete impacchettati come nella PDU (FC1/2/15), limiti gia controllati.
+  // Di default un MbsRead/MbsWrite per bit: da ridefinire per servire il blocco in un'unica passata
+  virtual boolean MbsReadBits(MB_SPACE Space, word Address, word Count, uint8_t *Dest);
+  virtual boolean MbsWriteBits(MB_SPACE Space, word Address, word Count, const uint8_t *Src);
+};
+
+// Esito di una richiesta master: MbmStatusOk, codice di eccezione Modbus (MB_EX) o uno dei codici sotto
+#define MbmStatusOk           0x00
+#define MbmStatusBadResponse  0xFD
+#define MbmStatusDisconnected 0xFE
+#define MbmStatusTimeout      0xFF
+#define MbmQueueLen 8             // master: richieste in coda o in attesa di risposta
+#define MbmTimeoutDefault 1000    // master: ms di attesa della risposta
+#define MbmReconnectDelay 1000    // master: ms prima di ritentare una connessione fallita
+
+struct MbmRequest;
+typedef void (*MbmCallback)(void *Context, const MbmRequest &Request, uint8_t Status);
+
+enum MB_MSTATE {
+  MB_MSTATE_FREE   = 0,
+  MB_MSTATE_QUEUED = 1,
+  MB_MSTATE_SENT   = 2
+};
+
+// Richiesta master: i dati letti vanno in MbData da Pos, quelli da scrivere vengono presi da MbData all'invio
+struct MbmRequest {
+  word Tid;
+  IPAddress Ip;
+  uint8_t Unit;
+  MB_FC FC;
+  word Ref;
+  word Count;
+  word Pos;              // registro (FC3/4/6/16) o bit (FC1/2/5/15) di MbData
+  unsigned long Seq;     // ordine di accodamento
+  unsigned long SentAt;
+  unsigned long Timeout;
+  MbmCallback Callback;
+  void *Context;
+  MB_MSTATE State;
+};
+
+// Connessione lato slave con la richiesta in ricezione
+struct MbsConnection {
+  EthernetClient Client;
+  uint8_t Frame[MbsFrameLen];
+  int FrameLen;
+  unsigned long LastActivity;
+  boolean Open;
+};
+
 class MgsModbus
 {
 public:
   // general
   MgsModbus();
-  word MbData[MbDataLen]; // memory block that holds all the modbus user data
+  word *MbData; // holding registers, MbDataLen words until MbsBegin
   boolean GetBit(word Number);
-  boolean SetBit(word Number,boolean Data); // returns true when the number is in the MbData range
+  boolean SetBit(word Number,boolean Data); // returns true on data overrun
+  // Mappa dei registri dimensionata a runtime (es. sul numero di aree del buffer): dimensioni in registri
+  // per holding/input, in bit per coils/discrete. 0 = la zona condivide i registri holding (unico blocco originale)
+  void MbsBegin(word Holding, word Input, word Coils, word Discrete);
+  word GetSpaceLen(MB_SPACE Space);
+  boolean HasSpace(MB_SPACE Space); // zona con registri propri (non condivisi con holding)
+  // Con un handler tutte le richieste slave (e gli accessi sotto) passano da lui; nullptr torna alla mappa interna
+  void MbsSetHandler(MbsHandler *Handler);
+  // Accesso con controllo dei limiti: false se l'indirizzo e' fuori dalla zona
+  boolean GetRegister(MB_SPACE Space, word Address, word &Value);
+  boolean SetRegister(MB_SPACE Space, word Address, word Value);
+  boolean GetBit(MB_SPACE Space, word Address);
+  boolean SetBit(MB_SPACE Space, word Address, boolean Data);
+  // Count bit da Address impacchettati come nella PDU (bit 0 del primo byte = Address), copiati a byte/parole
+  boolean GetBits(MB_SPACE Space, word Address, word Count, uint8_t *Dest); // bit oltre Count azzerati
+  boolean SetBits(MB_SPACE Space, word Address, word Count, const uint8_t *Src);
   // modbus master
-  void Req(MB_FC FC, word Ref, word Count, word Pos);
+  void MbmBegin(IPAddress Ip, unsigned long Timeout = MbmTimeoutDefault); // target di Req(FC, Ref, Count, Pos)
+  void Req(MB_FC FC, word Ref, word Count, word Pos); // unit 1 su remSlaveIP
+  // Accoda una richiesta, ritorna il transaction id o 0 se la coda e' piena. Timeout 0 = quello di MbmBegin
+  word Req(IPAddress Ip, uint8_t Unit, MB_FC FC, word Ref, word Count, word Pos, MbmCallback Callback = nullptr, void *Context = nullptr, unsigned long Timeout = 0);
+  // Non bloccante (tranne EthernetClient::connect): invia le richieste in coda, raccoglie le risposte e scade quelle senza risposta
   void MbmRun();
+  int MbmPending(); // richieste in coda o in attesa di risposta
   IPAddress remSlaveIP;
   // modbus slave
   void MbsRun(EthernetClient &client);  
+  void MbsRun(EthernetServer &server); // piu pannelli contemporaneamente, da chiamare ad ogni loop
+  int MbsConnections();
+  MbsFcStats MbsGetStats(uint8_t Fc); // i function code non supportati condividono un contatore
+  unsigned long MbsRequests();
+  unsigned long MbsErrors();
+  void MbsResetStats();
   word GetDataLen();
 private: 
   // general
   MB_FC SetFC(int fc);
+  word *MbSpace[MbSpaces];
+  word MbSpaceLen[MbSpaces]; // registri o bit
+  boolean MbSpaceOwned[MbSpaces];
+  MbsHandler *MbsSource;
+  boolean MbsInRange(MB_SPACE Space, word Address, word Count);
+  MbsFcStats MbsStats[MbsFcSlots];
+  int MbsFcSlot(uint8_t Fc);
+  void MbsException(uint8_t *Frame, EthernetClient &client, MB_EX Code);
+  word MbsWords(MB_SPACE Space); // parole allocate per la zona
   // modbus master
   uint8_t MbmByteArray[260]; // send and recieve buffer
-  MB_FC MbmFC;
   int MbmCounter;
+  int MbmBuild(MbmRequest &Request); // ADU in MbmByteArray, ritorna la lunghezza
+  void MbmSend();
   void MbmProcess();
-  word MbmPos;
-  word MbmBitCount;
+  void MbmDone(MbmRequest &Request, uint8_t Status);
+  void MbmFail(uint8_t Status, boolean Queued);
+  MbmRequest MbmQueue[MbmQueueLen];
+  word MbmNextTid;
+  unsigned long MbmNextSeq;
+  unsigned long MbmTimeout;
+  unsigned long MbmNextConnect;
+  IPAddress MbmConnectedIp;
+  boolean MbmOpen;
   //modbus slave
-  uint8_t MbsByteArray[260]; // send and recieve buffer
-  MB_FC MbsFC;
+  boolean MbsReceive(MbsConnection &conn);
+  void MbsProcess(uint8_t *Frame, EthernetClient &client);
+  MbsConnection MbsConn[MbsMaxClients];
+  MbsConnection MbsLegacy; // MbsRun(EthernetClient &)
 };
 
 #endif
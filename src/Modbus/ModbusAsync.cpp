@@ -0,0 +1,364 @@
+#include "ModbusAsync.h"
+
+// #define DEBUG
+
+ModbusAsyncClient::ModbusAsyncClient()
+{
+  this->_maxInFlight=1;
+  this->_inFlightCount=0;
+  this->_nextTid=1;
+  this->_timeout=300;
+  this->_reconnectDelay=1000;
+  this->_nextConnect=0;
+  this->_timeouts=0;
+  this->_connectFailures=0;
+  this->_open=false;
+  this->_rxLen=0;
+  for(int i=0; i<MB_ASYNC_MAX_INFLIGHT; i++)
+    this->_inFlight[i].inUse=false;
+}
+
+void ModbusAsyncClient::Begin(IPAddress ip, uint8_t maxInFlight, unsigned long timeout, unsigned long reconnectDelay)
+{
+  this->_ip=ip;
+  this->_maxInFlight=constrain(maxInFlight, 1, MB_ASYNC_MAX_INFLIGHT);
+  this->_timeout=timeout;
+  this->_reconnectDelay=reconnectDelay;
+}
+
+bool ModbusAsyncClient::Connect()
+{
+  if(this->_open)
+    return true;
+
+  //Riconnessione solo a pipeline vuota e fuori dal backoff
+  if(this->_inFlightCount>0 || (long)(millis() - this->_nextConnect) < 0)
+    return false;
+
+  if(this->_socket.connect(this->_ip, MB_PORT)==0) {
+    this->_socket.stop();
+    this->_nextConnect=millis() + this->_reconnectDelay;
+    this->_connectFailures++;
+    #ifdef DEBUG
+    Serial.print("ModbusAsync connect failed: ");
+    Serial.println(this->_ip);
+    #endif
+    return false;
+  }
+
+  this->_open=true;
+  this->_rxLen=0;
+  return true;
+}
+
+bool ModbusAsyncClient::Request(uint8_t unitId, MB_FC function, uint16_t address, uint16_t count, const long *values, ModbusAsyncTag tag, unsigned long timeout)
+{
+  if(this->_inFlightCount>=this->_maxInFlight || !Connect())
+    return false;
+
+  ModbusAsyncTransaction *_slot=nullptr;
+  for(int i=0; i<this->_maxInFlight; i++) {
+    if(!this->_inFlight[i].inUse) {
+      _slot=&this->_inFlight[i];
+      break;
+    }
+  }
+  if(_slot==nullptr)
+    return false;
+
+  int _len=12;
+  uint16_t _value=0;
+  this->_tx[6]=unitId;
+  this->_tx[7]=function;
+  this->_tx[8]=highByte(address);
+  this->_tx[9]=lowByte(address);
+  switch(function) {
+    case MB_FC_READ_COILS:
+    case MB_FC_READ_DISCRETE_INPUT:
+      if(count<1 || count>2000) return false;
+      this->_tx[10]=highByte(count);
+      this->_tx[11]=lowByte(count);
+    break;
+
+    case MB_FC_READ_REGISTERS:
+    case MB_FC_READ_INPUT_REGISTER:
+      if(count<1 || count>125) return false;
+      this->_tx[10]=highByte(count);
+      this->_tx[11]=lowByte(count);
+    break;
+
+    case MB_FC_WRITE_COIL:
+      count=1;
+      _value=values[0]!=0? 0xFF00: 0x0000; // 0xFF coil on 0x00 coil off
+      this->_tx[10]=highByte(_value);
+      this->_tx[11]=lowByte(_value);
+    break;
+
+    case MB_FC_WRITE_REGISTER:
+      count=1;
+      _value=(word)values[0];
+      this->_tx[10]=highByte(_value);
+      this->_tx[11]=lowByte(_value);
+    break;
+
+    case MB_FC_WRITE_MULTIPLE_COILS:
+      if(count<1 || count>1968) return false;
+      this->_tx[10]=highByte(count);
+      this->_tx[11]=lowByte(count);
+      this->_tx[12]=(count + 7) / 8;
+      for(int i=0; i<this->_tx[12]; i++)
+        this->_tx[13+i]=0;
+      for(int i=0; i<count; i++) {
+        if(values[i]!=0)
+          bitSet(this->_tx[13+(i/8)], i%8);
+      }
+      _len=13 + this->_tx[12];
+    break;
+
+    case MB_FC_WRITE_MULTIPLE_REGISTERS:
+      if(count<1 || count>123) return false;
+      this->_tx[10]=highByte(count);
+      this->_tx[11]=lowByte(count);
+      this->_tx[12]=count*2;
+      for(int i=0; i<count; i++) {
+        this->_tx[13+(i*2)]=highByte((word)values[i]);
+        this->_tx[14+(i*2)]=lowByte((word)values[i]);
+      }
+      _len=13 + this->_tx[12];
+    break;
+
+    default:
+      return false;
+  }
+
+  uint16_t _tid=this->_nextTid++;
+  this->_tx[0]=highByte(_tid);  // ID high byte
+  this->_tx[1]=lowByte(_tid);   // ID low byte
+  this->_tx[2]=0;               // protocol high byte
+  this->_tx[3]=0;               // protocol low byte
+  this->_tx[4]=highByte(_len - 6); // Lenght high byte
+  this->_tx[5]=lowByte(_len - 6);  // Lenght low byte
+
+  if(this->_socket.write(this->_tx, _len)!=(size_t)_len) {
+    //Socket caduto: le richieste aperte vengono chiuse dal prossimo Poll
+    this->_socket.stop();
+    this->_open=false;
+    this->_nextConnect=millis() + this->_reconnectDelay;
+    return false;
+  }
+
+  _slot->transactionId=_tid;
+  _slot->unitId=unitId;
+  _slot->function=function;
+  _slot->address=address;
+  _slot->count=count;
+  _slot->value=_value;
+  _slot->sentAt=millis();
+  _slot->timeout=timeout!=0? timeout: this->_timeout;
+  _slot->tag=tag;
+  _slot->inUse=true;
+  this->_inFlightCount++;
+
+  return true;
+}
+
+void ModbusAsyncClient::Poll(ModbusAsyncCallback callback, void *context)
+{
+  if(this->_open && this->_socket.connected()==0) {
+    this->_socket.stop();
+    this->_open=false;
+    this->_nextConnect=millis() + this->_reconnectDelay;
+  }
+
+  if(!this->_open) {
+    FailAll(MB_ASYNC_DISCONNECTED, callback, context);
+    return;
+  }
+
+  //Leggo solo i byte gia arrivati, una ADU alla volta (header MBAP, poi il resto secondo il campo lunghezza)
+  int _available=this->_socket.available();
+  while(_available>0) {
+    int _need;
+    if(this->_rxLen<6)
+      _need=6 - this->_rxLen;
+    else
+      _need=6 + ((this->_rx[4] << 8) | this->_rx[5]) - this->_rxLen;
+
+    int _read=this->_socket.read(this->_rx + this->_rxLen, min(_need, _available));
+    if(_read<=0)
+      break;
+    this->_rxLen+=_read;
+    _available-=_read;
+
+    if(this->_rxLen==6) {
+      int _pduLen=(this->_rx[4] << 8) | this->_rx[5];
+      if(this->_rx[2]!=0 || this->_rx[3]!=0 || _pduLen<2 || _pduLen>MB_ASYNC_FRAME - 6) {
+        //Stream non piu allineato: non posso ritrovare l'inizio della prossima ADU, chiudo
+        this->_socket.stop();
+        this->_open=false;
+        this->_rxLen=0;
+        FailAll(MB_ASYNC_BAD_RESPONSE, callback, context);
+        return;
+      }
+    }
+    else if(this->_rxLen>6 && this->_rxLen==6 + ((this->_rx[4] << 8) | this->_rx[5])) {
+      Dispatch(callback, context);
+      this->_rxLen=0;
+    }
+  }
+
+  //Richieste scadute
+  unsigned long _now=millis();
+  for(int i=0; i<this->_maxInFlight; i++) {
+    ModbusAsyncTransaction &_t=this->_inFlight[i];
+    if(_t.inUse && _now - _t.sentAt > _t.timeout) {
+      ModbusAsyncTransaction _request=_t;
+      _t.inUse=false;
+      this->_inFlightCount--;
+      this->_timeouts++;
+
+      ModbusAsyncResult _result;
+      _result.request=&_request;
+      _result.status=MB_ASYNC_TIMEOUT;
+      _result.data=nullptr;
+      _result.byteCount=0;
+      callback(context, _result);
+    }
+  }
+}
+
+void ModbusAsyncClient::Dispatch(ModbusAsyncCallback callback, void *context)
+{
+  ModbusAsyncTransaction *_t=Find((this->_rx[0] << 8) | this->_rx[1]);
+  if(_t==nullptr) {
+    //Risposta tardiva ad una richiesta gia scaduta
+    #ifdef DEBUG
+    Serial.print("ModbusAsync unknown TID from ");
+    Serial.println(this->_ip);
+    #endif
+    return;
+  }
+
+  //Libero lo slot prima del callback, che puo accodare subito una nuova richiesta
+  ModbusAsyncTransaction _request=*_t;
+  _t->inUse=false;
+  this->_inFlightCount--;
+
+  ModbusAsyncResult _result;
+  _result.request=&_request;
+  _result.status=MB_ASYNC_OK;
+  _result.data=nullptr;
+  _result.byteCount=0;
+
+  uint8_t _fc=this->_rx[7];
+  int _pduLen=this->_rxLen - 7;
+  if(_fc==(_request.function | 0x80)) {
+    //Eccezione: lo stato non deve mai valere MB_ASYNC_OK, anche con codice 0x00 o PDU troncato
+    _result.status=_pduLen>=2 && this->_rx[8]!=MB_ASYNC_OK? this->_rx[8]: MB_ASYNC_BAD_RESPONSE;
+  }
+  else if(_fc!=_request.function || this->_rx[6]!=_request.unitId)
+    _result.status=MB_ASYNC_BAD_RESPONSE;
+  else if(_fc<=MB_FC_READ_INPUT_REGISTER) {
+    int _expected=(_fc<=MB_FC_READ_DISCRETE_INPUT)? (_request.count + 7) / 8: _request.count * 2;
+    if(_pduLen<2 || this->_rx[8]<_expected || 2 + this->_rx[8]>_pduLen)
+      _result.status=MB_ASYNC_BAD_RESPONSE;
+    else {
+      _result.byteCount=this->_rx[8];
+      _result.data=this->_rx + 9;
+    }
+  }
+  else {
+    //Scritture: la risposta deve ripetere indirizzo e valore (FC5/6) o indirizzo e quantita (FC15/16)
+    uint16_t _echo=(_fc==MB_FC_WRITE_COIL || _fc==MB_FC_WRITE_REGISTER)? _request.value: _request.count;
+    if(_pduLen<5 || ((this->_rx[8] << 8) | this->_rx[9])!=_request.address || ((this->_rx[10] << 8) | this->_rx[11])!=_echo)
+      _result.status=MB_ASYNC_BAD_RESPONSE;
+  }
+
+  callback(context, _result);
+}
+
+void ModbusAsyncClient::FailAll(uint8_t status, ModbusAsyncCallback callback, void *context)
+{
+  for(int i=0; i<MB_ASYNC_MAX_INFLIGHT && this->_inFlightCount>0; i++) {
+    ModbusAsyncTransaction &_t=this->_inFlight[i];
+    if(!_t.inUse)
+      continue;
+
+    ModbusAsyncTransaction _request=_t;
+    _t.inUse=false;
+    this->_inFlightCount--;
+
+    ModbusAsyncResult _result;
+    _result.request=&_request;
+    _result.status=status;
+    _result.data=nullptr;
+    _result.byteCount=0;
+    callback(context, _result);
+  }
+}
+
+ModbusAsyncTransaction* ModbusAsyncClient::Find(uint16_t transactionId)
+{
+  for(int i=0; i<MB_ASYNC_MAX_INFLIGHT; i++) {
+    if(this->_inFlight[i].inUse && this->_inFlight[i].transactionId==transactionId)
+      return &this->_inFlight[i];
+  }
+  return nullptr;
+}
+
+bool ModbusAsyncClient::CanRequest()
+{
+  if(this->_inFlightCount>=this->_maxInFlight)
+    return false;
+
+  return this->_open || (this->_inFlightCount==0 && (long)(millis() - this->_nextConnect) >= 0);
+}
+
+bool ModbusAsyncClient::IsPending(MB_FC function, int id, int index)
+{
+  for(int i=0; i<MB_ASYNC_MAX_INFLIGHT; i++) {
+    ModbusAsyncTransaction &_t=this->_inFlight[i];
+    if(_t.inUse && _t.function==function && _t.tag.id==id && _t.tag.index==index)
+      return true;
+  }
+  return false;
+}
+
+bool ModbusAsyncClient::IsPending(int id)
+{
+  for(int i=0; i<MB_ASYNC_MAX_INFLIGHT; i++) {
+    if(this->_inFlight[i].inUse && this->_inFlight[i].tag.id==id)
+      return true;
+  }
+  return false;
+}
+
+uint8_t ModbusAsyncClient::InFlight()
+{
+  return this->_inFlightCount;
+}
+
+uint8_t ModbusAsyncClient::MaxInFlight()
+{
+  return this->_maxInFlight;
+}
+
+bool ModbusAsyncClient::Connected()
+{
+  return this->_open;
+}
+
+IPAddress ModbusAsyncClient::GetIp()
+{
+  return this->_ip;
+}
+
+unsigned long ModbusAsyncClient::GetTimeouts()
+{
+  return this->_timeouts;
+}
+
+unsigned long ModbusAsyncClient::GetConnectFailures()
+{
+  return this->_connectFailures;
+}
@@ -0,0 +1,100 @@
+/*
+  ModbusAsync.h - client Modbus TCP non bloccante con richieste in pipeline.
+
+  Una istanza per gateway: le richieste partono con un transaction ID proprio e le risposte
+  vengono raccolte in Poll() man mano che arrivano (framing sulla lunghezza MBAP), senza attese.
+  Ogni gateway tiene al piu maxInFlight richieste aperte; quelle senza risposta entro timeout
+  vengono chiuse con MB_ASYNC_TIMEOUT e un'eventuale risposta tardiva viene scartata (TID sconosciuto).
+
+  La connessione (EthernetClient::connect) resta l'unico punto bloccante: viene tentata solo
+  senza richieste aperte e con backoff dopo un fallimento.
+*/
+
+#include "Arduino.h"
+#include "Ethernet.h"
+#include "MgsModbus.h"
+
+#ifndef ModbusAsync_h
+#define ModbusAsync_h
+
+#define MB_ASYNC_MAX_INFLIGHT 8 // profondita massima della pipeline per gateway
+#define MB_ASYNC_FRAME 260      // ADU Modbus TCP massima (MBAP + PDU)
+
+// Codici di esito non Modbus (le eccezioni Modbus vanno da 0x01 a 0x0B)
+const uint8_t MB_ASYNC_OK=0x00;
+const uint8_t MB_ASYNC_BAD_RESPONSE=0xFD;
+const uint8_t MB_ASYNC_DISCONNECTED=0xFE;
+const uint8_t MB_ASYNC_TIMEOUT=0xFF;
+
+// Riferimento libero del chiamante, restituito con la risposta (es. device, blocco, item)
+typedef struct {
+  int id;
+  int index;
+  int offset;
+}ModbusAsyncTag;
+
+typedef struct {
+  uint16_t transactionId;
+  uint8_t unitId;
+  MB_FC function;
+  uint16_t address;
+  uint16_t count;
+  uint16_t value;      // FC5/6: valore inviato (0xFF00/0x0000 per i coil), atteso nell'eco
+  unsigned long sentAt;
+  unsigned long timeout;
+  ModbusAsyncTag tag;
+  bool inUse;
+}ModbusAsyncTransaction;
+
+typedef struct {
+  const ModbusAsyncTransaction *request;
+  uint8_t status;      // MB_ASYNC_OK, codice di eccezione Modbus o uno dei codici MB_ASYNC_* (mai OK se data non e' valido)
+  const uint8_t *data; // letture: dati dopo il byte count, nullptr negli altri casi
+  uint8_t byteCount;
+}ModbusAsyncResult;
+
+typedef void (*ModbusAsyncCallback)(void *context, const ModbusAsyncResult &result);
+
+class ModbusAsyncClient
+{
+public:
+  ModbusAsyncClient();
+  void Begin(IPAddress ip, uint8_t maxInFlight, unsigned long timeout, unsigned long reconnectDelay=1000);
+  // Accoda una richiesta: FC1-4 letture (values ignorato), FC5/6 un valore, FC15/16 count valori.
+  // Ritorna false se la pipeline e' piena o il gateway non e' raggiungibile.
+  // timeout: scadenza della singola richiesta (es. per unit ID dietro un gateway RTU), 0 = quella del client
+  bool Request(uint8_t unitId, MB_FC function, uint16_t address, uint16_t count, const long *values, ModbusAsyncTag tag, unsigned long timeout=0);
+  // Raccoglie le risposte disponibili e scade le richieste oltre il timeout, senza attese
+  void Poll(ModbusAsyncCallback callback, void *context);
+  bool CanRequest();
+  bool IsPending(MB_FC function, int id, int index); // richiesta con lo stesso tag (id, index) ancora aperta
+  bool IsPending(int id); // qualsiasi richiesta aperta con tag.id
+  uint8_t InFlight();
+  uint8_t MaxInFlight();
+  bool Connected();
+  IPAddress GetIp();
+  unsigned long GetTimeouts();
+  unsigned long GetConnectFailures();
+private:
+  bool Connect();
+  void Dispatch(ModbusAsyncCallback callback, void *context);
+  void FailAll(uint8_t status, ModbusAsyncCallback callback, void *context);
+  ModbusAsyncTransaction* Find(uint16_t transactionId);
+  EthernetClient _socket;
+  IPAddress _ip;
+  ModbusAsyncTransaction _inFlight[MB_ASYNC_MAX_INFLIGHT];
+  uint8_t _maxInFlight;
+  uint8_t _inFlightCount;
+  uint16_t _nextTid;
+  unsigned long _timeout;
+  unsigned long _reconnectDelay;
+  unsigned long _nextConnect;
+  unsigned long _timeouts;
+  unsigned long _connectFailures;
+  bool _open;
+  uint8_t _rx[MB_ASYNC_FRAME]; // risposta parziale in ricezione
+  int _rxLen;
+  uint8_t _tx[MB_ASYNC_FRAME];
+};
+
+#endif
@@ -26,7 +26,7 @@ bool Errors::Loop(bool inError){
   return false;
 }
 
-bool Errors::IsInError(){  
+bool Errors::IsInError() const {  
   return this->_error;
 }
 
@@ -96,7 +96,332 @@ GenericPrgDevice::GenericPrgDevice(const char* name, arduino::IPAddress ip, unsi
   
   this->_ip=ip;
   this->_priority=priority;
-  this->bank=0; // nel caso di calls ripetute
+
+  this->_refreshPeriod=GetDefaultRefreshPeriod(priority);
+  this->_pollStretch=1;
+  this->_channelPeriod.resize(channelSize, 0);
+  this->_adaptive=false;
+  this->_minTier=0;
+  this->_maxTier=ADAPTIVE_TIER_COUNT - 1;
+  this->_unitTimeout=UNIT_TIMEOUT_DEFAULT;
+  memset(&this->_unitStats, 0, sizeof(this->_unitStats));
+
+  this->_maxReadRegisters=MODBUS_MAX_READ_REGISTERS;
+  this->_maxReadBits=MODBUS_MAX_READ_BITS;
+  this->_readTransactions=0;
+  BuildReadPlan();
+
+  this->_maxWriteBatch=MODBUS_MAX_WRITE_BATCH;
+  this->_writeTransactions=0;
+  this->_writeFramesSaved=0;
+}
+
+void GenericPrgDevice::SetMaxWriteBatch(int items)
+{
+  this->_maxWriteBatch=constrain(items, 1, MODBUS_MAX_WRITE_BATCH);
+}
+
+int GenericPrgDevice::GetMaxWriteBatch()
+{
+  return this->_maxWriteBatch;
+}
+
+unsigned long GenericPrgDevice::GetWriteTransactions()
+{
+  return this->_writeTransactions;
+}
+
+unsigned long GenericPrgDevice::GetWriteFramesSaved()
+{
+  return this->_writeFramesSaved;
+}
+
+void GenericPrgDevice::SetMaxReadItems(int registers, int bits)
+{
+  this->_maxReadRegisters=constrain(registers, 1, MODBUS_MAX_READ_REGISTERS);
+  this->_maxReadBits=constrain(bits, 1, MODBUS_MAX_READ_BITS);
+  BuildReadPlan();
+}
+
+void GenericPrgDevice::SetRefreshPeriod(unsigned long period)
+{
+  this->_refreshPeriod=max(period, 1UL);
+  BuildReadPlan();
+}
+
+void GenericPrgDevice::SetChannelRefreshPeriod(int channel, unsigned long period)
+{
+  if(channel<0 || channel>=this->_channelSize)
+    return;
+
+  this->_channelPeriod[channel]=period;
+  BuildReadPlan();
+}
+
+unsigned long GenericPrgDevice::GetRefreshPeriod()
+{
+  return this->_refreshPeriod;
+}
+
+unsigned long GenericPrgDevice::GetBasePeriod(int channel)
+{
+  return this->_channelPeriod[channel]!=0? this->_channelPeriod[channel]: this->_refreshPeriod;
+}
+
+//Livello piu lento non oltre period (il primo se period e' sotto tutti i livelli)
+static uint8_t GetAdaptiveTier(unsigned long period)
+{
+  uint8_t _tier=0;
+  while(_tier<ADAPTIVE_TIER_COUNT - 1 && ADAPTIVE_TIERS[_tier + 1]<=period)
+    _tier++;
+  return _tier;
+}
+
+void GenericPrgDevice::SetAdaptiveRefresh(unsigned long minPeriod, unsigned long maxPeriod)
+{
+  this->_adaptive=minPeriod!=0;
+  if(this->_adaptive) {
+    this->_minTier=GetAdaptiveTier(minPeriod);
+    this->_maxTier=max(GetAdaptiveTier(maxPeriod), this->_minTier);
+
+    //Si parte dal livello del periodo statico, riportato nei limiti
+    GenericPrgDeviceChannelActivity _activity;
+    _activity.lastChange=0;
+    _activity.tierSince=millis();
+    _activity.seen=false;
+    this->_activity.assign(this->_channelSize, _activity);
+    for(int channel=0; channel<this->_channelSize; channel++)
+      this->_activity[channel].tier=constrain(GetAdaptiveTier(GetBasePeriod(channel)), this->_minTier, this->_maxTier);
+  }
+  else
+    this->_activity.clear();
+
+  ApplyAdaptivePeriods();
+}
+
+bool GenericPrgDevice::IsAdaptive() const
+{
+  return this->_adaptive;
+}
+
+void GenericPrgDevice::UpdateChannelActivity(int channel, unsigned long lastChange, unsigned long now)
+{
+  if(!this->_adaptive || channel<0 || channel>=this->_channelSize)
+    return;
+
+  GenericPrgDeviceChannelActivity &_activity=this->_activity[channel];
+  uint8_t _tier=_activity.tier;
+
+  if(!_activity.seen) {
+    //Prima lettura: i valori iniziali non sono variazioni
+    _activity.lastChange=lastChange;
+    _activity.seen=true;
+    return;
+  }
+
+  if(lastChange!=_activity.lastChange) {
+    //Variazione: subito al livello piu veloce, il prossimo tasto viene letto con la latenza minima
+    _activity.lastChange=lastChange;
+    _tier=this->_minTier;
+  }
+  else if(_tier<this->_maxTier) {
+    //Canale fermo: si scende di un livello dopo ADAPTIVE_DEMOTE_PERIODS periodi senza variazioni
+    unsigned long _quietFrom=_activity.tierSince;
+    if(lastChange!=0 && (long)(lastChange - _quietFrom)>0)
+      _quietFrom=lastChange;
+    if(now - _quietFrom >= ADAPTIVE_TIERS[_tier] * ADAPTIVE_DEMOTE_PERIODS)
+      _tier++;
+  }
+
+  if(_tier==_activity.tier)
+    return;
+
+  #ifdef DEBUG_ADAPTIVE
+  Serial.print("Adaptive ");
+  Serial.print(this->_name);
+  Serial.print(" channel ");
+  Serial.print(channel);
+  Serial.print(" ");
+  Serial.print(ADAPTIVE_TIERS[_activity.tier]);
+  Serial.print(" -> ");
+  Serial.println(ADAPTIVE_TIERS[_tier]);
+  #endif
+
+  _activity.tier=_tier;
+  _activity.tierSince=now;
+  ApplyAdaptivePeriods();
+}
+
+unsigned long GenericPrgDevice::GetChannelPeriod(int channel)
+{
+  if(channel<0 || channel>=this->_channelSize)
+    return 0;
+
+  if(this->_adaptive)
+    return ADAPTIVE_TIERS[this->_activity[channel].tier];
+  return GetBasePeriod(channel);
+}
+
+//Periodo effettivo dei blocchi: in modalita adattiva decide il canale piu veloce del blocco (una sola transazione per tutti)
+void GenericPrgDevice::ApplyAdaptivePeriods()
+{
+  for(int block=0; block<this->_readPlan.size(); block++) {
+    GenericPrgDeviceReadBlock &_block=this->_readPlan[block];
+    unsigned long _period=_block.period;
+    if(this->_adaptive) {
+      _period=ADAPTIVE_TIERS[this->_activity[_block.channel].tier];
+      for(int channel=_block.channel + 1; channel<=_block.lastChannel; channel++)
+        _period=min(_period, ADAPTIVE_TIERS[this->_activity[channel].tier]);
+    }
+    this->_blockState[block].period=_period;
+  }
+}
+
+long GenericPrgDevice::GetBlockLateness(int block, unsigned long now)
+{
+  GenericPrgDeviceBlockState &_state=this->_blockState[block];
+  if(!_state.polled)
+    return 0x3FFFFFFF; //Mai letto: prima di tutto il resto
+
+  unsigned long _period=_state.period * this->_pollStretch;
+  long _overdue=(long)(now - _state.lastPoll) - (long)_period;
+  if(_overdue<0)
+    return _overdue;
+
+  //Pesato sul periodo: 100ms di ritardo contano piu su un pulsante a 50ms che su un contatore a 10s
+  return (long)(((long long)_overdue * 1000) / _period);
+}
+
+void GenericPrgDevice::SetPollStretch(uint8_t factor)
+{
+  this->_pollStretch=max(factor, (uint8_t)1);
+}
+
+uint8_t GenericPrgDevice::GetPollStretch() const
+{
+  return this->_pollStretch;
+}
+
+void GenericPrgDevice::MarkBlockPolled(int block, unsigned long now)
+{
+  this->_blockState[block].lastPoll=now;
+  this->_blockState[block].polled=true;
+}
+
+void GenericPrgDevice::MarkBlockUpdated(int block, unsigned long now)
+{
+  GenericPrgDeviceBlockState &_state=this->_blockState[block];
+  if(_state.lastUpdate!=0) {
+    _state.lastPeriod=now - _state.lastUpdate;
+    if(_state.avgPeriod==0)
+      _state.avgPeriod=_state.lastPeriod;
+    else
+      _state.avgPeriod=_state.avgPeriod * 0.9f + _state.lastPeriod * 0.1f;
+  }
+  _state.lastUpdate=now;
+}
+
+void GenericPrgDevice::DeferBlocks(unsigned long now)
+{
+  for(int block=0; block<this->_blockState.size(); block++)
+    MarkBlockPolled(block, now);
+}
+
+GenericPrgDevice::GenericPrgDeviceBlockState GenericPrgDevice::GetBlockState(int block)
+{
+  return this->_blockState[block];
+}
+
+unsigned long GenericPrgDevice::GetTargetPeriod()
+{
+  unsigned long _target=0;
+  for(auto& _state : this->_blockState) {
+    if(_target==0 || _state.period<_target)
+      _target=_state.period;
+  }
+  return _target;
+}
+
+unsigned long GenericPrgDevice::GetAchievedPeriod()
+{
+  float _achieved=0;
+  for(auto& _state : this->_blockState) {
+    if(_state.avgPeriod>_achieved)
+      _achieved=_state.avgPeriod;
+  }
+  return (unsigned long)_achieved;
+}
+
+void GenericPrgDevice::BuildReadPlan()
+{
+  this->_readPlan.clear();
+  int _lastChannel=-1; //canale dell'ultimo item pianificato
+
+  for(int channel=0; channel<this->_channelSize; channel++) {
+    GenericPrgDeviceChannel &_ch=this->_channels[channel];
+    if(_ch.type!=DI && _ch.type!=AI)
+      continue;
+
+    int _max=(_ch.hwType==Coil || _ch.hwType==Discrete)? this->_maxReadBits: this->_maxReadRegisters;
+    unsigned long _period=GetBasePeriod(channel);
+
+    for(int index=0; index<_ch.items; ) {
+      int _addr=_ch.startingAddr + index;
+      int _room=_ch.items - index;
+
+      //Accodo all'ultimo blocco se contiguo (anche come indice canale), stesso tipo e periodo e c'e' ancora spazio nella PDU
+      if(!this->_readPlan.empty() && _lastChannel>=channel-1) {
+        GenericPrgDeviceReadBlock &_last=this->_readPlan.back();
+        if(_last.type==_ch.type && _last.hwType==_ch.hwType && _last.period==_period && _last.startingAddr + _last.items==_addr && _last.items<_max) {
+          int _add=min(_room, _max - _last.items);
+          _last.items+=_add;
+          index+=_add;
+          _last.lastChannel=channel;
+          _lastChannel=channel;
+          continue;
+        }
+      }
+
+      GenericPrgDeviceReadBlock _block;
+      _block.type=_ch.type;
+      _block.hwType=_ch.hwType;
+      _block.startingAddr=_addr;
+      _block.items=min(_room, _max);
+      _block.channel=channel;
+      _block.startIndex=index;
+      _block.lastChannel=channel;
+      _block.period=_period;
+      this->_readPlan.push_back(_block);
+      index+=_block.items;
+      _lastChannel=channel;
+    }
+  }
+
+  //Piano nuovo: i blocchi ripartono come mai letti
+  GenericPrgDeviceBlockState _state;
+  _state.lastPoll=0;
+  _state.lastUpdate=0;
+  _state.lastPeriod=0;
+  _state.avgPeriod=0;
+  _state.period=0;
+  _state.polled=false;
+  this->_blockState.assign(this->_readPlan.size(), _state);
+  ApplyAdaptivePeriods();
+}
+
+size_t GenericPrgDevice::GetReadBlocksSize() const
+{
+  return this->_readPlan.size();
+}
+
+GenericPrgDevice::GenericPrgDeviceReadBlock GenericPrgDevice::GetReadBlock(int block)
+{
+  return this->_readPlan[block];
+}
+
+unsigned long GenericPrgDevice::GetReadTransactions()
+{
+  return this->_readTransactions;
 }
 
 int GenericPrgDevice::GetArea(int channel, int address)
@@ -120,32 +445,32 @@ GenericPrgDevice::GenericPrgDeviceChannel GenericPrgDevice::GetChannelInfo(int c
   }
 }
 
-bool GenericPrgDevice::IsInError()
+bool GenericPrgDevice::IsInError() const
 { 
   return this->Error.IsInError(); //this->_inError;
 }
 
-size_t GenericPrgDevice::GetChannelsSize()
+size_t GenericPrgDevice::GetChannelsSize() const
 { 
   return this->_channelSize;
 }
 
-GenericPrgDevicePriority GenericPrgDevice::GetPriority()
+GenericPrgDevicePriority GenericPrgDevice::GetPriority() const
 { 
   return this->_priority;
 }
 
-arduino::IPAddress GenericPrgDevice::GetIp()
+arduino::IPAddress GenericPrgDevice::GetIp() const
 { 
   return this->_ip;
 }
 
-unsigned int GenericPrgDevice::GetDeviceAddress()
+unsigned int GenericPrgDevice::GetDeviceAddress() const
 { 
   return this->_deviceAddress;
 }
 
-const char* GenericPrgDevice::GetName()
+const char* GenericPrgDevice::GetName() const
 { 
   return this->_name;
 }
@@ -257,12 +582,12 @@ bool GenericPrgDevice::Read(ModbusClient &mb, int channel, float *value)
   }
 }
 
-GenericPrgDevice::structRead GenericPrgDevice::Read(ModbusClient &mb, int channel, List<uint16_t> *items)
+GenericPrgDevice::structRead GenericPrgDevice::Read(ModbusClient &mb, int channel, uint16_t *values, int capacity)
 {
-  structRead retVal;
-  retVal.ok=false;
-
   if(channel>=this->_channelSize) {
+    structRead retVal;
+    retVal.ok=false;
+
     Serial.print("Generic Device READ ERROR, size<channel ");
     Serial.print(this->_name);
 
@@ -282,148 +607,50 @@ GenericPrgDevice::structRead GenericPrgDevice::Read(ModbusClient &mb, int channe
     return retVal;
   }
 
-  int startingAddr=this->_channels[channel].startingAddr;         //Inizializza default come indirizzo di partenza
-  retVal.startIndex=0;
-
-  if(this->_channels[channel].items< this->MAX_CALLS) 
-    retVal.items= this->_channels[channel].items;   //Inizializza default come numero items
-  else {
-    //Se il numero di items è maggiore di quanto ne posso leggere ogni volta
-    if(this->bank==0) {
-      retVal.items=this->MAX_CALLS;
-      this->bank+=1;
-    } 
-    else {
-      int jump=this->bank * this->MAX_CALLS;
-      retVal.startIndex=jump;
-
-      startingAddr+= jump;
-      retVal.items= this->MAX_CALLS;
-
-      if(jump + retVal.items > this->_channels[channel].items) {
-        int _items=abs(jump -this->_channels[channel].items);
-        //Serial.print("items: "+String(_items)+", jump: "+String(jump));
-        //Serial.println();
-
-        if(_items==0) {
-          retVal.startIndex=0;
-          startingAddr=this->_channels[channel].startingAddr;  
-        }
-        else
-          retVal.items=_items;
+  int _max=(this->_channels[channel].hwType==Coil || this->_channels[channel].hwType==Discrete)? this->_maxReadBits: this->_maxReadRegisters;
+  return ReadItems(mb, this->_channels[channel].hwType, this->_channels[channel].startingAddr, min(this->_channels[channel].items, _max), values, capacity);
+}
 
-        this->bank=0;
-      }
-      else
-        this->bank+=1;
-    }
+GenericPrgDevice::structRead GenericPrgDevice::ReadBlock(ModbusClient &mb, int block, uint16_t *values, int capacity)
+{
+  if(block>=this->_readPlan.size()) {
+    structRead retVal;
+    retVal.ok=false;
+    this->Error.Loop(true);
+    return retVal;
   }
 
-  /*
-  Serial.println();
-  Serial.print("Generic Device READ::  ");
-  Serial.print(this->_name);
-
-  Serial.print(", Bank:");
-  Serial.print(this->bank);
-
-  Serial.print(", StartIndex:");
-  Serial.print(retVal.startIndex);
-
-  Serial.print(", startingAddr: ");
-  Serial.print(startingAddr);
-
-  Serial.print(", Items: ");
-  Serial.print(retVal.items);
+  GenericPrgDeviceReadBlock &_block=this->_readPlan[block];
+  structRead retVal=ReadItems(mb, _block.hwType, _block.startingAddr, _block.items, values, capacity);
+  retVal.startIndex=_block.startIndex;
+  return retVal;
+}
 
-  Serial.print(", Channel Items: ");
-  Serial.print(this->_channels[channel].items);
-  Serial.println(); */
+//Decodifica dal buffer di ricezione del client direttamente in values (al piu capacity item), senza allocazioni
+GenericPrgDevice::structRead GenericPrgDevice::ReadItems(ModbusClient &mb, GenericPrgDeviceHwEnum hwType, int startingAddr, int count, uint16_t *values, int capacity)
+{
+  structRead retVal;
+  retVal.ok=false;
+  retVal.startIndex=0;
+  retVal.items=count;
 
-  switch(this->_channels[channel].hwType)
+  int _type;
+  const char* _desc;
+  switch(hwType)
   {
     case Hold: //Hold
-      if(!this->Error.IsInError()) {
-        int tmpRead=mb.requestFrom(this->_deviceAddress, HOLDING_REGISTERS, startingAddr, retVal.items);
-        if(tmpRead!=0) { 
-          for (int i=0; i<tmpRead; i++)
-            items->add(mb.read());
-                      
-          this->Error.Loop(false);
-          retVal.ok=true;
-        }
-        else if(!this->Error.Loop(true)) {
-          #ifdef DEBUG_ERRORS
-          Serial.print("Generic Device ERROR (Hold): ");
-          Serial.print(this->_name);
-
-          Serial.print(" IP: ");
-          Serial.print(this->_ip);
-
-          Serial.print(" Address: ");
-          Serial.println(this->GetDeviceAddress());
-          #endif
-        }
-      }
-      else this->Error.Loop(true);
-
+      _type=HOLDING_REGISTERS;
+      _desc="Hold";
     break;
 
-  case Input: //Input Register
-      if(!this->Error.IsInError()) {
-        int tmpRead=mb.requestFrom(this->_deviceAddress, INPUT_REGISTERS, startingAddr, retVal.items);
-        if(tmpRead!=0) { 
-          for (int i=0; i<tmpRead; i++)
-            items->add(mb.read());
-
-          //Serial.print("GenericPrgDevice read input register: ");
-          //Serial.println(value[0]);
-          this->Error.Loop(false);
-          retVal.ok=true;
-        }
-        else if(!this->Error.Loop(true)) {
-          #ifdef DEBUG_ERRORS
-          Serial.print("Generic Device ERROR (Input): ");
-          Serial.print(this->_name);
-
-          Serial.print(" IP: ");
-          Serial.print(this->_ip);
-
-          Serial.print(" Address: ");
-          Serial.println(this->GetDeviceAddress());
-          #endif
-        }
-      }
-      else this->Error.Loop(true);
-      
+    case Input: //Input Register
+      _type=INPUT_REGISTERS;
+      _desc="Input";
     break;
 
     case Discrete: //Discrete input
-      if(!this->Error.IsInError()) {
-        int tmpRead=mb.requestFrom(this->_deviceAddress, DISCRETE_INPUTS, startingAddr, retVal.items);
-        if(tmpRead!=0){ 
-          //Ok per una letturo di botto
-          for (int i=0; i<tmpRead; i++)
-            items->add(mb.read());
-          
-          this->Error.Loop(false);
-          retVal.ok=true;
-        }
-        else if(!this->Error.Loop(true)) {
-          #ifdef DEBUG_ERRORS
-          Serial.print("Generic Device ERROR (Discrete): ");
-          Serial.print(this->_name);
-
-          Serial.print(" IP: ");
-          Serial.print(this->_ip);
-
-          Serial.print(" Address: ");
-          Serial.println(this->GetDeviceAddress());
-          #endif
-        }
-      }
-      else this->Error.Loop(true);
-      
+      _type=DISCRETE_INPUTS;
+      _desc="Discrete";
     break;
 
     default:
@@ -438,15 +665,40 @@ GenericPrgDevice::structRead GenericPrgDevice::Read(ModbusClient &mb, int channe
       Serial.print(this->GetDeviceAddress());
 
       Serial.print(" Type: ");
-      Serial.print(this->_channels[channel].hwType);
-
-      Serial.print(" Channel: ");
-      Serial.println(channel);
+      Serial.println(hwType);
       #endif
       
       this->Error.Loop(true);
-    break;
+      return retVal;
+  }
+
+  if(!this->Error.IsInError()) {
+    this->_readTransactions++;
+    int tmpRead=mb.requestFrom(this->_deviceAddress, _type, startingAddr, count);
+    if(tmpRead!=0) { 
+      retVal.items=min(tmpRead, capacity);
+      for (int i=0; i<retVal.items; i++)
+        values[i]=mb.read();
+                  
+      this->Error.Loop(false);
+      retVal.ok=true;
+    }
+    else if(!this->Error.Loop(true)) {
+      #ifdef DEBUG_ERRORS
+      Serial.print("Generic Device ERROR (");
+      Serial.print(_desc);
+      Serial.print("): ");
+      Serial.print(this->_name);
+
+      Serial.print(" IP: ");
+      Serial.print(this->_ip);
+
+      Serial.print(" Address: ");
+      Serial.println(this->GetDeviceAddress());
+      #endif
+    }
   }
+  else this->Error.Loop(true);
 
   return retVal;
 }
@@ -455,10 +707,11 @@ bool GenericPrgDevice::Write(ModbusClient &mb, int channel, int address, int val
 {
   if(this->_channels[channel].type==DO) {
     int tmpResult=0;
+    this->_writeTransactions++;
 
     switch(this->_channels[channel].hwType) {
       case Hold: //Hold
-        tmpResult=mb.holdingRegisterWrite(this->_deviceAddress, this->_channels[channel].startingAddr, value);
+        tmpResult=mb.holdingRegisterWrite(this->_deviceAddress, GetWriteAddress(channel, address), value);
         
         if(!this->Error.Loop(tmpResult==0)) {
           Serial.print("Generic Device ERROR (Write Holding register): ");
@@ -475,7 +728,7 @@ bool GenericPrgDevice::Write(ModbusClient &mb, int channel, int address, int val
       break;
 
       case Coil:
-        tmpResult=mb.coilWrite(this->_deviceAddress, address, value);
+        tmpResult=mb.coilWrite(this->_deviceAddress, GetWriteAddress(channel, address), value);
         
         if(!this->Error.Loop(tmpResult==0)) {
           Serial.print("Generic Device ERROR (Write coil): ");
@@ -514,40 +767,270 @@ bool GenericPrgDevice::Write(ModbusClient &mb, int channel, int address, int val
   }
 }
 
-int GetDevicesByIp(arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices, std::vector<GenericPrgDevice> &items)
+//Scrittura multipla di count item contigui da GetWriteAddress: FC15 per Coil, FC16 per Hold
+bool GenericPrgDevice::WriteMultiple(ModbusClient &mb, int channel, int address, const long *values, int count)
+{
+  if(this->_channels[channel].type!=DO) {
+    Serial.print("GenericPrgDevice write definition error: ");
+    Serial.println(this->_deviceAddress);
+    Serial.println(this->_channels[channel].startingAddr);
+
+    return false;
+  }
+
+  int _type;
+  switch(this->_channels[channel].hwType) {
+    case Hold: //Hold
+      _type=HOLDING_REGISTERS;
+    break;
+
+    case Coil:
+      _type=COILS;
+    break;
+
+    default:
+      Serial.print("GenericPrgDevice ERROR (Unknown Write function): ");
+      Serial.println(this->_name);
+
+      Serial.print(" IP: ");
+      Serial.print(this->_ip);
+
+      Serial.print(" Address: ");
+      Serial.println(this->GetDeviceAddress());
+      return false;
+  }
+
+  this->_writeTransactions++;
+
+  int tmpResult=mb.beginTransmission(this->_deviceAddress, _type, GetWriteAddress(channel, address), count);
+  for(int i=0; i<count && tmpResult!=0; i++)
+    tmpResult=mb.write(values[i]);
+  if(tmpResult!=0)
+    tmpResult=mb.endTransmission();
+
+  if(!this->Error.Loop(tmpResult==0)) {
+    Serial.print("Generic Device ERROR (Write multiple): ");
+    Serial.println(this->_name);
+    return false;
+  }
+
+  if(tmpResult!=0)
+    this->_writeFramesSaved+=count-1;
+
+  return tmpResult!=0;
+}
+
+int GenericPrgDevice::GetWriteAddress(int channel, int address)
+{
+  return this->_channels[channel].startingAddr + address;
+}
+
+bool GenericPrgDevice::CanPoll()
+{
+  if(this->Error.IsInError())
+    this->Error.Loop(true); //Wait some time
+
+  return !this->Error.IsInError() && !IsQuarantined(millis());
+}
+
+void GenericPrgDevice::ReportTransaction(bool write, bool ok, int items)
+{
+  if(write) {
+    this->_writeTransactions++;
+    if(ok && items>1)
+      this->_writeFramesSaved+=items-1;
+  }
+  else
+    this->_readTransactions++;
+
+  if(!this->Error.Loop(!ok)) {
+    #ifdef DEBUG_ERRORS
+    Serial.print("Generic Device ERROR (");
+    Serial.print(write? "Async write": "Async read");
+    Serial.print("): ");
+    Serial.print(this->_name);
+
+    Serial.print(" IP: ");
+    Serial.print(this->_ip);
+
+    Serial.print(" Address: ");
+    Serial.println(this->GetDeviceAddress());
+    #endif
+  }
+}
+
+void GenericPrgDevice::SetUnitTimeout(unsigned long timeout)
+{
+  this->_unitTimeout=max(timeout, 1UL);
+}
+
+unsigned long GenericPrgDevice::GetUnitTimeout() const
+{
+  return this->_unitTimeout;
+}
+
+void GenericPrgDevice::ReportLatency(unsigned long latency, bool ok, unsigned long now)
+{
+  GenericPrgDeviceUnitStats &_stats=this->_unitStats;
+
+  _stats.requests++;
+  if(ok) {
+    int _bucket=0;
+    while(_bucket<UNIT_LATENCY_BUCKETS - 1 && latency>UNIT_LATENCY_LIMITS[_bucket])
+      _bucket++;
+    _stats.histogram[_bucket]++;
+    _stats.responses++;
+    _stats.lastSuccess=now;
+    if(latency>_stats.maxLatency)
+      _stats.maxLatency=latency;
+    _stats.avgLatency=_stats.avgLatency==0? latency: _stats.avgLatency * 0.9f + latency * 0.1f;
+
+    //Risponde: esce dalla quarantena e il backoff riparte dal minimo
+    _stats.consecutiveTimeouts=0;
+    _stats.quarantined=false;
+    _stats.quarantineDelay=0;
+    return;
+  }
+
+  _stats.failures++;
+
+  //Errore veloce (eccezione, socket chiuso): lo gestisce Errors, non e' una unit lenta
+  if(latency<this->_unitTimeout)
+    return;
+
+  _stats.timeouts++;
+  if(_stats.consecutiveTimeouts<255)
+    _stats.consecutiveTimeouts++;
+
+  //In quarantena basta una prova fallita per rientrarci, con il periodo raddoppiato
+  if(!_stats.quarantined && _stats.consecutiveTimeouts<UNIT_QUARANTINE_TIMEOUTS)
+    return;
+
+  _stats.quarantineDelay=_stats.quarantineDelay==0? UNIT_QUARANTINE_MIN: min(_stats.quarantineDelay * 2, UNIT_QUARANTINE_MAX);
+  _stats.quarantineUntil=now + _stats.quarantineDelay;
+  _stats.quarantined=true;
+  _stats.quarantines++;
+
+  #ifdef DEBUG_ERRORS
+  Serial.print("Unit QUARANTINE ");
+  Serial.print(this->_name);
+  Serial.print(" IP: ");
+  Serial.print(this->_ip);
+  Serial.print(" Address: ");
+  Serial.print(this->_deviceAddress);
+  Serial.print(" for ms ");
+  Serial.println(_stats.quarantineDelay);
+  #endif
+}
+
+bool GenericPrgDevice::IsQuarantined(unsigned long now) const
+{
+  return this->_unitStats.quarantined && (long)(now - this->_unitStats.quarantineUntil)<0;
+}
+
+const GenericPrgDevice::GenericPrgDeviceUnitStats& GenericPrgDevice::GetUnitStats() const
+{
+  return this->_unitStats;
+}
+
+int GetDevicesByIp(arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices, std::vector<int> &items)
 { 
   int foundId=0;
-  for (auto& prgDevice : prgDevices) {
-    if(prgDevice.GetIp()==ip) { 
-      items.push_back(prgDevice);
+  for (int i=0; i<prgDevices.size(); i++) {
+    if(prgDevices[i].GetIp()==ip) { 
+      items.push_back(i);
       foundId++;
     }
   }
   return foundId;
 }
 
-int GetJump(GenericPrgDevicePriority priority) {
+bool ExistDevicesByIp(arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices)
+{ 
+  for (auto& prgDevice : prgDevices) {       
+    if(prgDevice.GetIp()==ip) 
+      return true;
+  }
+
+  return false;
+}
+
+///////////////// DeviceRegistry
+void DeviceRegistry::Build(const std::vector<GenericPrgDevice> &prgDevices)
+{
+  this->_ips.clear();
+
+  //Stesso ordine di BuildIps (prima occorrenza dell'IP), cosi l'indice coincide con quello di List<structIP>
+  for (int i=0; i<prgDevices.size(); i++) {
+    int _ip=IpIndex(prgDevices[i].GetIp());
+    if(_ip==-1) {
+      DeviceRegistryIp _item;
+      _item.IP=prgDevices[i].GetIp();
+      this->_ips.push_back(_item);
+      _ip=this->_ips.size()-1;
+    }
+
+    this->_ips[_ip].devices.push_back(i);
+    int _priority=prgDevices[i].GetPriority();
+    if(_priority>=0 && _priority<DEVICE_PRIORITIES)
+      this->_ips[_ip].byPriority[_priority].push_back(i);
+  }
+}
+
+int DeviceRegistry::IpIndex(arduino::IPAddress ip) const
+{
+  for (int i=0; i<this->_ips.size(); i++) {
+    if(this->_ips[i].IP==ip)
+      return i;
+  }
+  return -1;
+}
+
+const std::vector<int>& DeviceRegistry::GetDevicesByIp(int ipIndex) const
+{
+  if(ipIndex<0 || ipIndex>=this->_ips.size())
+    return this->_empty;
+
+  return this->_ips[ipIndex].devices;
+}
+
+const std::vector<int>& DeviceRegistry::GetDevicesByPriority(int ipIndex, GenericPrgDevicePriority priority) const
+{
+  if(ipIndex<0 || ipIndex>=this->_ips.size() || priority<0 || priority>=DEVICE_PRIORITIES)
+    return this->_empty;
+
+  return this->_ips[ipIndex].byPriority[priority];
+}
+
+size_t DeviceRegistry::size() const
+{
+  return this->_ips.size();
+}
+
+//Periodo di refresh (ms) di partenza per priorita, sovrascrivibile con SetRefreshPeriod
+unsigned long GetDefaultRefreshPeriod(GenericPrgDevicePriority priority) {
   switch (priority)   {
-      case Low:
-        return 1;
-        break;
+      case High:
+        return 50;
+      break;
 
       case Medium:
-        return 2;
+        return 250;
       break;
       
       case Normal:
-        return 3;
+        return 1000;
       break;
 
-      default:
-        return 0;
+      case Low:
+        return 5000;
+      break;
     }
 
-    return 0;
+    return 1000;
 }
 
-int BuildIps(std::vector<GenericPrgDevice> prgDevices, List<structIP> *items)
+int BuildIps(const std::vector<GenericPrgDevice> &prgDevices, List<structIP> *items)
 { 
   int foundId=0;
   for (auto& prgDevice : prgDevices) {
@@ -606,7 +1089,7 @@ int BuildIps(std::vector<GenericPrgDevice> prgDevices, List<structIP> *items)
   return items->getSize();
 }
 
-bool ExistDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices)
+bool ExistDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices)
 { 
   for (auto& prgDevice : prgDevices) {       
     if(prgDevice.GetPriority()==priority && prgDevice.GetIp()==ip) 
@@ -616,7 +1099,7 @@ bool ExistDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddres
   return false;
 }
 
-int GetDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices, std::vector<int> &items)
+int GetDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices, std::vector<int> &items)
 { 
   int foundId=0;
   for (auto& prgDevice : prgDevices) {           
@@ -629,7 +1112,7 @@ int GetDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress i
    return items.size();
 }
 
-int GetUsedPriorities(arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices, List<PriorityMgmt> *items)
+int GetUsedPriorities(arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices, List<PriorityMgmt> *items)
 { 
   int foundId=0;
   for (auto& prgDevice : prgDevices) {
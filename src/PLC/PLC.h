@@ -10,6 +10,23 @@
 // number of items in an array
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
+// Limiti PDU Modbus per una singola richiesta di lettura
+const int MODBUS_MAX_READ_REGISTERS=125; // FC3/FC4
+const int MODBUS_MAX_READ_BITS=2000;     // FC1/FC2
+// Item massimi per una scrittura multipla FC15/FC16 (buffer locale in DeviceManagement_Write)
+const int MODBUS_MAX_WRITE_BATCH=64;
+// Polling adattivo: livelli di refresh (ms) tra cui i canali vengono promossi o retrocessi
+const unsigned long ADAPTIVE_TIERS[]={50, 100, 250, 500, 1000, 2500, 5000, 10000};
+const int ADAPTIVE_TIER_COUNT=ARRAY_SIZE(ADAPTIVE_TIERS);
+const int ADAPTIVE_DEMOTE_PERIODS=20; // periodi del livello senza variazioni prima di scendere al livello piu lento
+// Unit ID dietro un gateway RTU: timeout di risposta per unit, quarantena e istogramma delle latenze
+const unsigned long UNIT_TIMEOUT_DEFAULT=250;     // ms, separato dal timeout TCP del client
+const int UNIT_QUARANTINE_TIMEOUTS=3;             // timeout consecutivi prima della quarantena
+const unsigned long UNIT_QUARANTINE_MIN=1000;     // prima quarantena, raddoppia ad ogni ricaduta
+const unsigned long UNIT_QUARANTINE_MAX=60000;
+const int UNIT_LATENCY_BUCKETS=8;
+const unsigned long UNIT_LATENCY_LIMITS[UNIT_LATENCY_BUCKETS - 1]={10, 20, 50, 100, 200, 500, 1000}; // ms, l'ultimo bucket raccoglie il resto
+
 //Cell, classe che implementa un valore con controllo sullo stato variato
 template<typename T>
 class Cell {
@@ -116,7 +133,7 @@ class Errors
   public:            
     Errors(short count, unsigned long time=60000);   
     bool Loop(bool inError);
-    bool IsInError();   
+    bool IsInError() const;   
     void IncrementError();
   
   protected:
@@ -193,22 +210,150 @@ class GenericPrgDevice
     bool ok;
   }structRead; 
 
+  //Blocco del piano di lettura: canali adiacenti dello stesso tipo letti con un'unica transazione
+  typedef struct {
+    GenericPrgDeviceEnum type;
+    GenericPrgDeviceHwEnum hwType;
+    int startingAddr;
+    int items;      // registri/bit letti nella transazione
+    int channel;    // canale del primo item
+    int startIndex; // indice del primo item nel canale
+    int lastChannel; // canale dell'ultimo item
+    unsigned long period; // periodo di refresh desiderato (ms), uguale per tutti i canali del blocco
+  }GenericPrgDeviceReadBlock;
+
+  //Stato dello scheduler per blocco di lettura
+  typedef struct {
+    unsigned long lastPoll;   // ultima richiesta (base per la prossima scadenza)
+    unsigned long lastUpdate; // ultima lettura riuscita
+    unsigned long lastPeriod; // intervallo tra le ultime due letture riuscite
+    float avgPeriod;          // media mobile dell'intervallo tra letture riuscite
+    unsigned long period;     // periodo effettivo: quello del piano o, in modalita adattiva, il canale piu veloce del blocco
+    bool polled;
+  }GenericPrgDeviceBlockState;
+
+  //Attivita del canale per il polling adattivo
+  typedef struct {
+    unsigned long lastChange; // ultima variazione vista (BufferSourceInfo.time del Field)
+    unsigned long tierSince;  // ingresso nel livello corrente
+    uint8_t tier;             // indice in ADAPTIVE_TIERS
+    bool seen;                // false fino alla prima lettura: lastChange non ancora valido
+  }GenericPrgDeviceChannelActivity;
+
+  //Statistiche della unit (device) verso il gateway
+  typedef struct {
+    unsigned long histogram[UNIT_LATENCY_BUCKETS]; // risposte per fascia di latenza (UNIT_LATENCY_LIMITS)
+    unsigned long requests;          // transazioni concluse, riuscite o no
+    unsigned long failures;          // transazioni fallite, timeout compresi
+    unsigned long lastSuccess;       // millis dell'ultima risposta valida (significativo solo con responses>0)
+    unsigned long responses;
+    unsigned long timeouts;
+    unsigned long maxLatency;
+    float avgLatency;                // media mobile delle risposte arrivate
+    unsigned long quarantines;       // ingressi in quarantena
+    unsigned long quarantineUntil;
+    unsigned long quarantineDelay;   // durata dell'ultima quarantena, 0 se la unit risponde
+    uint8_t consecutiveTimeouts;
+    bool quarantined;
+  }GenericPrgDeviceUnitStats;
+
     GenericPrgDevice(const char* name, arduino::IPAddress ip, unsigned int deviceAddress, GenericPrgDeviceChannel channels[], size_t channelSize, std::vector<int> ioAreas, short ErrorCnt, GenericPrgDevicePriority priority);     
     bool Run();
-    structRead Read(ModbusClient &mb, int channel, List<uint16_t> *value);
+    // Letture su span del chiamante (capacity item): structRead.items riporta gli item decodificati
+    structRead Read(ModbusClient &mb, int channel, uint16_t *values, int capacity);
+    structRead ReadBlock(ModbusClient &mb, int block, uint16_t *values, int capacity);
     bool Read(ModbusClient &mb, int channel, float *value);
+    // Scritture: address e' l'indice dell'item nel canale, l'indirizzo Modbus e' sempre GetWriteAddress
     bool Write(ModbusClient &mb, int channel, int address, int value);
+    bool WriteMultiple(ModbusClient &mb, int channel, int address, const long *values, int count);
+    // Indirizzo Modbus dell'item: startingAddr + address per Coil e Hold, come per le letture.
+    // Unica regola per Write (FC5/FC6), WriteMultiple (FC15/FC16) e il client asincrono
+    int GetWriteAddress(int channel, int address);
     int GetArea(int channel, int address);
     
     GenericPrgDeviceChannel GetChannelInfo(int channel);
-    arduino::IPAddress GetIp();
-    GenericPrgDevicePriority GetPriority();
-    size_t GetChannelsSize();
-    const char* GetName();
-    unsigned int GetDeviceAddress();
-    bool IsInError();
+    arduino::IPAddress GetIp() const;
+    GenericPrgDevicePriority GetPriority() const;
+    size_t GetChannelsSize() const;
+    const char* GetName() const;
+    unsigned int GetDeviceAddress() const;
+    bool IsInError() const;
+
+    // Piano di lettura: costruito alla registrazione, ricostruito se cambiano i limiti
+    // (gateway che non tollerano frame grandi)
+    void SetMaxReadItems(int registers, int bits);
+    size_t GetReadBlocksSize() const;
+    GenericPrgDeviceReadBlock GetReadBlock(int block);
+    unsigned long GetReadTransactions();
+
+    // Scritture multiple (FC15/FC16): 1 disabilita il batching
+    void SetMaxWriteBatch(int items);
+    int GetMaxWriteBatch();
+    unsigned long GetWriteTransactions();
+    unsigned long GetWriteFramesSaved();
+
+    // Scheduler a scadenza: periodo di refresh per device (default dalla priorita) o per singolo canale (0 = quello del device)
+    void SetRefreshPeriod(unsigned long period);
+    void SetChannelRefreshPeriod(int channel, unsigned long period);
+    unsigned long GetRefreshPeriod();
+    // Ritardo pesato sul periodo (millesimi di periodo oltre la scadenza), negativo se il blocco non e' ancora scaduto
+    long GetBlockLateness(int block, unsigned long now);
+    void MarkBlockPolled(int block, unsigned long now);
+    void MarkBlockUpdated(int block, unsigned long now);
+    void DeferBlocks(unsigned long now); // tutti i blocchi rimandati di un periodo (device che non risponde)
+    // Moltiplicatore temporaneo dei periodi (1 = normale), usato dal watchdog per alleggerire il bus senza toccare il piano
+    void SetPollStretch(uint8_t factor);
+    uint8_t GetPollStretch() const;
+    GenericPrgDeviceBlockState GetBlockState(int block);
+    // Refresh ottenuto: peggiore media tra i blocchi, da confrontare con il periodo desiderato piu stretto
+    unsigned long GetTargetPeriod();
+    unsigned long GetAchievedPeriod();
+
+    // Polling adattivo: ogni canale si sposta tra i livelli ADAPTIVE_TIERS compresi tra minPeriod e maxPeriod.
+    // Una variazione porta il canale al livello piu veloce, ADAPTIVE_DEMOTE_PERIODS periodi senza variazioni lo rallentano di un livello.
+    // Il periodo statico (SetRefreshPeriod/SetChannelRefreshPeriod) resta il livello di partenza. minPeriod=0 disabilita
+    void SetAdaptiveRefresh(unsigned long minPeriod, unsigned long maxPeriod);
+    bool IsAdaptive() const;
+    // Dopo ogni lettura riuscita: lastChange=variazione piu recente tra gli item letti del canale (0 se mai scritto)
+    void UpdateChannelActivity(int channel, unsigned long lastChange, unsigned long now);
+    unsigned long GetChannelPeriod(int channel);
+
+    // Per le transazioni gestite fuori da Read/Write (client asincrono):
+    // CanPoll attende il retry se il device e' escluso, ReportTransaction aggiorna contatori ed Errors
+    bool CanPoll();
+    void ReportTransaction(bool write, bool ok, int items);
+
+    // Timeout di risposta della unit (sotto il gateway), usato al posto di quello del client
+    void SetUnitTimeout(unsigned long timeout);
+    unsigned long GetUnitTimeout() const;
+    // Latenza di ogni transazione: un errore oltre il timeout della unit conta come timeout.
+    // UNIT_QUARANTINE_TIMEOUTS timeout consecutivi mettono la unit in quarantena (backoff esponenziale),
+    // alla scadenza passa una sola richiesta di prova
+    void ReportLatency(unsigned long latency, bool ok, unsigned long now);
+    bool IsQuarantined(unsigned long now) const;
+    const GenericPrgDeviceUnitStats& GetUnitStats() const;
   private:  
-    short bank;
+    void BuildReadPlan();
+    structRead ReadItems(ModbusClient &mb, GenericPrgDeviceHwEnum hwType, int startingAddr, int count, uint16_t *values, int capacity);
+    unsigned long GetBasePeriod(int channel);
+    void ApplyAdaptivePeriods();
+    std::vector<GenericPrgDeviceReadBlock> _readPlan;
+    std::vector<GenericPrgDeviceBlockState> _blockState;
+    std::vector<unsigned long> _channelPeriod;
+    unsigned long _refreshPeriod;
+    uint8_t _pollStretch;
+    std::vector<GenericPrgDeviceChannelActivity> _activity;
+    bool _adaptive;
+    uint8_t _minTier;
+    uint8_t _maxTier;
+    unsigned long _unitTimeout;
+    GenericPrgDeviceUnitStats _unitStats;
+    int _maxReadRegisters;
+    int _maxReadBits;
+    unsigned long _readTransactions;
+    int _maxWriteBatch;
+    unsigned long _writeTransactions;
+    unsigned long _writeFramesSaved; // scritture singole evitate grazie a FC15/FC16
     std::vector<int> _ioAreas;
     GenericPrgDevicePriority _priority;
     const char* _name;
@@ -217,16 +362,39 @@ class GenericPrgDevice
     size_t _channelSize;
     GenericPrgDeviceChannel *_channels;
     Errors Error;
-    const short MAX_CALLS=8;
 };
 
-int GetJump(GenericPrgDevicePriority priority);
-int GetDevicesByIp(arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices, std::vector<GenericPrgDevice> &items);
-int GetDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices, std::vector<int> &items);
-bool ExistDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices);
-int GetUsedPriorities(arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices, List<PriorityMgmt> *items);
-bool ExistDevicesByIp(arduino::IPAddress ip, std::vector<GenericPrgDevice> prgDevices);
-int BuildIps(std::vector<GenericPrgDevice> prgDevices, List<structIP> *items);
+unsigned long GetDefaultRefreshPeriod(GenericPrgDevicePriority priority);
+int GetDevicesByIp(arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices, std::vector<int> &items);
+int GetDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices, std::vector<int> &items);
+bool ExistDevicesByPriority(GenericPrgDevicePriority priority, arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices);
+int GetUsedPriorities(arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices, List<PriorityMgmt> *items);
+bool ExistDevicesByIp(arduino::IPAddress ip, const std::vector<GenericPrgDevice> &prgDevices);
+int BuildIps(const std::vector<GenericPrgDevice> &prgDevices, List<structIP> *items);
+
+// Numero di valori in GenericPrgDevicePriority
+const int DEVICE_PRIORITIES=4;
+
+typedef struct {
+  arduino::IPAddress IP;
+  std::vector<int> devices;                       // indici in prgDevices dei device dietro il gateway
+  std::vector<int> byPriority[DEVICE_PRIORITIES]; // gli stessi, divisi per GenericPrgDevicePriority
+}DeviceRegistryIp;
+
+//Indice dei device per gateway e priorita, costruito una volta dopo la registrazione dei device:
+//il ciclo di polling lavora su indici e riferimenti, senza copiare i GenericPrgDevice
+class DeviceRegistry
+{
+  public:
+    void Build(const std::vector<GenericPrgDevice> &prgDevices);
+    int IpIndex(arduino::IPAddress ip) const; // stesso indice di List<structIP> (BuildIps), -1 se assente
+    const std::vector<int>& GetDevicesByIp(int ipIndex) const;
+    const std::vector<int>& GetDevicesByPriority(int ipIndex, GenericPrgDevicePriority priority) const;
+    size_t size() const;
+  private:
+    std::vector<DeviceRegistryIp> _ips;
+    std::vector<int> _empty;
+};
 
 //Calcolatore Medie
 #define NUM_VARIAZIONI 5
@@ -0,0 +1,126 @@
+#include "Profiler.h"
+
+#ifdef DOMO_PROFILER
+Profiler profiler;
+#endif
+
+///////////////// Profiler
+Profiler::Profiler() {
+  Reset();
+}
+
+void Profiler::Reset() {
+  memset(this->_histogram, 0, sizeof(this->_histogram));
+  memset(this->_count, 0, sizeof(this->_count));
+  memset(this->_max, 0, sizeof(this->_max));
+  memset(this->_total, 0, sizeof(this->_total));
+  for(int z=0; z<PROFILE_ZONES; z++)
+    this->_min[z]=0xFFFFFFFF;
+}
+
+void Profiler::Add(ProfileZone zone, unsigned long us) {
+  int _bucket=TraceStats::Bucket(us);
+  if(_bucket>=PROFILE_BUCKETS)
+    _bucket=PROFILE_BUCKETS - 1;
+
+  //Fascia satura: dimezzo tutta la zona, le proporzioni (e quindi i percentili) restano valide
+  uint16_t *_histogram=this->_histogram[zone];
+  if(_histogram[_bucket]==0xFFFF) {
+    for(int b=0; b<PROFILE_BUCKETS; b++)
+      _histogram[b]>>=1;
+  }
+  _histogram[_bucket]++;
+
+  this->_count[zone]++;
+  this->_total[zone]+=us;
+  if(us<this->_min[zone])
+    this->_min[zone]=us;
+  if(us>this->_max[zone])
+    this->_max[zone]=us;
+}
+
+unsigned long Profiler::Count(ProfileZone zone) {
+  return this->_count[zone];
+}
+
+unsigned long Profiler::Min(ProfileZone zone) {
+  return this->_count[zone]>0? this->_min[zone]: 0;
+}
+
+unsigned long Profiler::Avg(ProfileZone zone) {
+  return this->_count[zone]>0? (unsigned long)(this->_total[zone] / this->_count[zone]): 0;
+}
+
+unsigned long Profiler::Max(ProfileZone zone) {
+  return this->_max[zone];
+}
+
+unsigned long Profiler::Percentile(ProfileZone zone, float p) {
+  unsigned long _samples=0;
+  for(int b=0; b<PROFILE_BUCKETS; b++)
+    _samples+=this->_histogram[zone][b];
+  if(_samples==0)
+    return 0;
+
+  unsigned long _target=(unsigned long)ceil(_samples * p / 100.0);
+  if(_target==0)
+    _target=1;
+  unsigned long _sum=0;
+  for(int b=0; b<PROFILE_BUCKETS; b++) {
+    _sum+=this->_histogram[zone][b];
+    if(_sum>=_target)
+      return b<PROFILE_BUCKETS - 1? min(TraceStats::BucketLimit(b), this->_max[zone]): this->_max[zone];
+  }
+  return this->_max[zone];
+}
+
+const char* Profiler::ZoneName(ProfileZone zone) {
+  switch(zone) {
+    case ProfileRead:             return "read";
+    case ProfileRouting:          return "routing";
+    case ProfilePanel:            return "panel";
+    case ProfileSomethingChanged: return "somethingChanged";
+    case ProfileRoute:            return "route";
+    case ProfileActivity:         return "activityLoop";
+    case ProfileCycle:            return "updateCycle";
+  }
+  return "?";
+}
+
+void Profiler::PrintReport(Print &out) {
+  out.println(" - Profiler (us) - ");
+  for(int z=0; z<PROFILE_ZONES; z++) {
+    ProfileZone _zone=(ProfileZone)z;
+    out.print(ZoneName(_zone));
+    out.print(" n: ");
+    out.print(Count(_zone));
+    out.print(" min: ");
+    out.print(Min(_zone));
+    out.print(" avg: ");
+    out.print(Avg(_zone));
+    out.print(" p99: ");
+    out.print(Percentile(_zone, 99));
+    out.print(" max: ");
+    out.println(Max(_zone));
+  }
+}
+
+void Profiler::WriteAreas(ModbusBuffer &buffer, int firstArea) {
+  for(int z=0; z<PROFILE_ZONES; z++) {
+    ProfileZone _zone=(ProfileZone)z;
+    unsigned long _values[PROFILE_AREAS_PER_ZONE]={Min(_zone), Avg(_zone), Percentile(_zone, 99), Max(_zone)};
+    for(int i=0; i<PROFILE_AREAS_PER_ZONE; i++)
+      buffer.WriteElement(firstArea + z*PROFILE_AREAS_PER_ZONE + i, ToPanel, min(_values[i], 0xFFFFUL));
+  }
+}
+
+
+///////////////// ProfileScope
+ProfileScope::ProfileScope(Profiler &profiler, ProfileZone zone) : _profiler(profiler) {
+  this->_zone=zone;
+  this->_start=micros();
+}
+
+ProfileScope::~ProfileScope() {
+  this->_profiler.Add(this->_zone, micros() - this->_start);
+}
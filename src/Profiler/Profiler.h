@@ -0,0 +1,83 @@
+/*
+  Profiler.h - tempi di esecuzione in microsecondi delle zone calde di DomoManager::Update.
+
+  Ogni zona (lettura dei device, routing, allineamento pannelli, callback utente...) accumula
+  min/avg/max e un istogramma a memoria fissa (stesse fasce di TraceStats, 4 per ottava) da cui
+  si ricava il p99. Le misure si prendono con PROFILE_ZONE(zona) all'inizio di un blocco oppure
+  con PROFILE_ADD(zona, us) se la durata e' gia nota.
+  Con DOMO_NO_PROFILER definito le macro diventano vuote e l'istanza globale non esiste.
+*/
+
+#ifndef Profiler_h
+#define Profiler_h
+
+#include "Arduino.h"
+#include "Buffers.h"
+#include "Trace.h"
+
+// #define DOMO_NO_PROFILER
+#ifndef DOMO_NO_PROFILER
+#define DOMO_PROFILER
+#endif
+
+enum ProfileZone
+{
+  ProfileRead=0,             // letture dei device di un gateway (sincrone o risposte asincrone)
+  ProfileRouting=1,          // ManageMdbCli_RouteChanges, callback compresi
+  ProfilePanel=2,            // richieste dei pannelli e allineamento buffer <-> registri del server
+  ProfileSomethingChanged=3, // callback utente somethingChanged
+  ProfileRoute=4,            // callback utente route
+  ProfileActivity=5,         // callback utente activityLoop
+  ProfileCycle=6             // UpdateCycle completo
+};
+const int PROFILE_ZONES=7;
+// Fasce fino a 2^21 us (~2 s), oltre finiscono nell'ultima
+const int PROFILE_BUCKETS=80;
+// Aree del buffer scritte per zona da WriteAreas: min, avg, p99, max (us, saturati a 65535)
+const int PROFILE_AREAS_PER_ZONE=4;
+
+class Profiler
+{
+  public:
+    Profiler();
+    void Reset();
+    void Add(ProfileZone zone, unsigned long us);
+    unsigned long Count(ProfileZone zone);
+    unsigned long Min(ProfileZone zone);
+    unsigned long Avg(ProfileZone zone);
+    unsigned long Max(ProfileZone zone);
+    unsigned long Percentile(ProfileZone zone, float p); // limite superiore della fascia che contiene il percentile p (0..100)
+    void PrintReport(Print &out);
+    // Statistiche nelle aree ToPanel da firstArea, PROFILE_AREAS_PER_ZONE per zona nell'ordine di ProfileZone
+    void WriteAreas(ModbusBuffer &buffer, int firstArea);
+    static const char* ZoneName(ProfileZone zone);
+  private:
+    uint16_t _histogram[PROFILE_ZONES][PROFILE_BUCKETS]; // dimezzato quando una fascia satura
+    unsigned long _count[PROFILE_ZONES];
+    unsigned long _min[PROFILE_ZONES];
+    unsigned long _max[PROFILE_ZONES];
+    uint64_t _total[PROFILE_ZONES];
+};
+
+// Misura la durata del blocco in cui e' dichiarato
+class ProfileScope
+{
+  public:
+    ProfileScope(Profiler &profiler, ProfileZone zone);
+    ~ProfileScope();
+  private:
+    Profiler &_profiler;
+    ProfileZone _zone;
+    unsigned long _start;
+};
+
+#ifdef DOMO_PROFILER
+extern Profiler profiler;
+#define PROFILE_ZONE(zone) ProfileScope _profileScope(profiler, zone)
+#define PROFILE_ADD(zone, us) profiler.Add(zone, us)
+#else
+#define PROFILE_ZONE(zone)
+#define PROFILE_ADD(zone, us)
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+#include "Trace.h"
+
+///////////////// TraceRecorder
+TraceRecorder::TraceRecorder(Print &out) {
+  this->_out=&out;
+  this->_recording=false;
+  this->_start=0;
+  this->_last=0;
+  this->_records=0;
+}
+
+void TraceRecorder::Begin() {
+  this->_out->write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  this->_start=millis();
+  this->_last=this->_start;
+  this->_records=0;
+  this->_recording=true;
+}
+
+void TraceRecorder::End() {
+  this->_recording=false;
+  this->_out->flush();
+}
+
+bool TraceRecorder::IsRecording() {
+  return this->_recording;
+}
+
+unsigned long TraceRecorder::Records() {
+  return this->_records;
+}
+
+//Record fisso little endian: kind, type, delta ms (2), id (2), channel (2), index (2), value (4)
+void TraceRecorder::Write(TraceKind kind, uint16_t id, uint16_t channel, uint16_t index, uint8_t type, long value) {
+  unsigned long _now=millis();
+  unsigned long _delta=_now - this->_last;
+  this->_last=_now;
+  if(_delta>0xFFFF) {
+    Write(TraceGap, 0, 0, 0, 0, _delta);
+    _delta=0;
+  }
+
+  uint8_t _record[TRACE_RECORD_SIZE];
+  _record[0]=kind;
+  _record[1]=type;
+  _record[2]=lowByte(_delta);
+  _record[3]=highByte(_delta);
+  _record[4]=lowByte(id);
+  _record[5]=highByte(id);
+  _record[6]=lowByte(channel);
+  _record[7]=highByte(channel);
+  _record[8]=lowByte(index);
+  _record[9]=highByte(index);
+  for(int i=0; i<4; i++)
+    _record[10+i]=(uint8_t)((unsigned long)value >> (8*i));
+
+  this->_out->write(_record, TRACE_RECORD_SIZE);
+  this->_records++;
+}
+
+//Anche le letture che ripetono il valore: il carico riprodotto deve essere quello reale
+void TraceRecorder::Field(int device, int channel, int index, uint8_t type, long value) {
+  if(this->_recording)
+    Write(TraceField, device, channel, index, type, value);
+}
+
+void TraceRecorder::Panel(int area, long value) {
+  if(this->_recording)
+    Write(TracePanel, area, 0, 0, 0, value);
+}
+
+void TraceRecorder::Udp(int command, long value) {
+  if(this->_recording)
+    Write(TraceUdp, command, 0, 0, 0, value);
+}
+
+void TraceRecorder::Cycle() {
+  if(this->_recording)
+    Write(TraceCycle, 0, 0, 0, 0, 0);
+}
+
+
+///////////////// TraceReplay
+TraceReplay::TraceReplay(Stream &in) {
+  this->_in=&in;
+  this->_header=false;
+  this->_valid=false;
+  this->_time=0;
+}
+
+bool TraceReplay::Read(uint8_t *data, int size) {
+  return this->_in->readBytes((char*)data, size)==(size_t)size;
+}
+
+bool TraceReplay::Next(TraceEvent &event) {
+  if(!this->_header) {
+    uint8_t _magic[sizeof(TRACE_MAGIC)];
+    this->_header=true;
+    this->_valid=Read(_magic, sizeof(_magic)) && memcmp(_magic, TRACE_MAGIC, sizeof(_magic))==0;
+    if(!this->_valid)
+      Serial.println("Trace: intestazione non valida");
+  }
+
+  uint8_t _record[TRACE_RECORD_SIZE];
+  while(this->_valid && Read(_record, TRACE_RECORD_SIZE)) {
+    unsigned long _value=0;
+    for(int i=0; i<4; i++)
+      _value|=(unsigned long)_record[10+i] << (8*i);
+
+    this->_time+=word(_record[3], _record[2]);
+    if(_record[0]==TraceGap) {
+      this->_time+=_value;
+      continue;
+    }
+
+    event.kind=(TraceKind)_record[0];
+    event.type=_record[1];
+    event.time=this->_time;
+    event.id=word(_record[5], _record[4]);
+    event.channel=word(_record[7], _record[6]);
+    event.index=word(_record[9], _record[8]);
+    event.value=(int32_t)_value;
+    return true;
+  }
+
+  return false;
+}
+
+
+///////////////// TraceStats
+TraceStats::TraceStats() {
+  Reset();
+}
+
+void TraceStats::Reset() {
+  memset(this->_histogram, 0, sizeof(this->_histogram));
+  memset(this->_count, 0, sizeof(this->_count));
+  memset(this->_max, 0, sizeof(this->_max));
+}
+
+//Fasce 0..3 esatte, poi 4 fasce per ogni potenza di 2
+int TraceStats::Bucket(unsigned long us) {
+  if(us<4)
+    return us;
+
+  int _octave=2;
+  while((us >> (_octave + 1))!=0)
+    _octave++;
+  int _bucket=(_octave - 1)*4 + ((us >> (_octave - 2)) & 3);
+  return _bucket<TRACE_BUCKETS? _bucket: TRACE_BUCKETS - 1;
+}
+
+unsigned long TraceStats::BucketLimit(int bucket) {
+  if(bucket<4)
+    return bucket;
+
+  int _octave=bucket/4 + 1;
+  return ((4UL + bucket%4 + 1) << (_octave - 2)) - 1;
+}
+
+void TraceStats::Add(TraceStage stage, unsigned long us) {
+  this->_histogram[stage][Bucket(us)]++;
+  this->_count[stage]++;
+  if(us>this->_max[stage])
+    this->_max[stage]=us;
+}
+
+unsigned long TraceStats::Percentile(TraceStage stage, float p) {
+  if(this->_count[stage]==0)
+    return 0;
+
+  unsigned long _target=(unsigned long)ceil(this->_count[stage] * p / 100.0);
+  if(_target==0)
+    _target=1;
+  unsigned long _sum=0;
+  for(int b=0; b<TRACE_BUCKETS; b++) {
+    _sum+=this->_histogram[stage][b];
+    if(_sum>=_target)
+      return min(BucketLimit(b), this->_max[stage]);
+  }
+  return this->_max[stage];
+}
+
+unsigned long TraceStats::Count(TraceStage stage) {
+  return this->_count[stage];
+}
+
+unsigned long TraceStats::Max(TraceStage stage) {
+  return this->_max[stage];
+}
+
+const char* TraceStats::StageName(TraceStage stage) {
+  switch(stage) {
+    case TraceStageUpdate: return "update";
+    case TraceStageCycle:  return "cycle";
+  }
+  return "?";
+}
+
+void TraceStats::PrintReport(Print &out) {
+  out.println(" - Latenze per stadio (us) - ");
+  for(int s=0; s<TRACE_STAGES; s++) {
+    TraceStage _stage=(TraceStage)s;
+    out.print(StageName(_stage));
+    out.print(" n: ");
+    out.print(Count(_stage));
+    out.print(" p50: ");
+    out.print(Percentile(_stage, 50));
+    out.print(" p90: ");
+    out.print(Percentile(_stage, 90));
+    out.print(" p99: ");
+    out.print(Percentile(_stage, 99));
+    out.print(" max: ");
+    out.println(Max(_stage));
+  }
+}
@@ -0,0 +1,106 @@
+/*
+  Trace.h - registrazione e riproduzione del traffico di campo, pannelli e UDP.
+
+  TraceRecorder scrive su un Print (Serial, file su SD...) una traccia binaria compatta a record fissi:
+  tutte le letture grezze dei device, scritture dei pannelli, comandi UDP e la fine di ogni giro
+  completo degli IP.
+  TraceReplay la rilegge da uno Stream. La riproduzione passa dal vero DomoManager::Update con gateway,
+  pannelli e UDP simulati (HostReplay della build host, extras/host): le latenze finiscono in
+  TraceStats (percentili) e nel Profiler, per confrontare build diverse sullo stesso carico.
+*/
+
+#ifndef Trace_h
+#define Trace_h
+
+#include "Arduino.h"
+
+// DTR2: channel e index a 16 bit (blocchi fino a 2000 bit), ogni lettura registrata
+const uint8_t TRACE_MAGIC[4]={'D','T','R','2'};
+const int TRACE_RECORD_SIZE=14;
+
+enum TraceKind
+{
+  TraceField=1, // lettura da campo: id=device, channel/index/type, value=valore grezzo
+  TracePanel=2, // scrittura del pannello: id=area
+  TraceUdp=3,   // comando UDP: id=indice del comando (IOT)
+  TraceCycle=4, // fine di un giro completo degli IP
+  TraceGap=5    // pausa oltre 65535 ms: value=ms
+};
+
+typedef struct {
+  TraceKind kind;
+  unsigned long time; // ms dall'inizio della registrazione
+  uint16_t id;
+  uint16_t channel;
+  uint16_t index;
+  uint8_t type;
+  long value;
+}TraceEvent;
+
+class TraceRecorder
+{
+  public:
+    TraceRecorder(Print &out);
+    // Scrive l'intestazione e azzera il tempo della traccia
+    void Begin();
+    void End();
+    bool IsRecording();
+    void Field(int device, int channel, int index, uint8_t type, long value);
+    void Panel(int area, long value);
+    void Udp(int command, long value);
+    void Cycle();
+    unsigned long Records();
+  private:
+    void Write(TraceKind kind, uint16_t id, uint16_t channel, uint16_t index, uint8_t type, long value);
+    Print *_out;
+    bool _recording;
+    unsigned long _start;
+    unsigned long _last;
+    unsigned long _records;
+};
+
+class TraceReplay
+{
+  public:
+    TraceReplay(Stream &in);
+    // Ritorna false a fine traccia o se l'intestazione non e' valida
+    bool Next(TraceEvent &event);
+  private:
+    bool Read(uint8_t *data, int size);
+    Stream *_in;
+    bool _header;
+    bool _valid;
+    unsigned long _time;
+};
+
+// Il dettaglio per zona (letture, routing, pannelli, callback) e' nel Profiler
+enum TraceStage
+{
+  TraceStageUpdate=0, // una chiamata a Update (piu IOT::Update) durante la riproduzione
+  TraceStageCycle=1   // giro completo degli IP, fino al marcatore TraceCycle della traccia
+};
+const int TRACE_STAGES=2;
+// 4 fasce per ottava (errore massimo 25%) fino a 2^24 us
+const int TRACE_BUCKETS=96;
+
+//Istogramma a memoria fissa delle latenze (us) per stadio
+class TraceStats
+{
+  public:
+    TraceStats();
+    void Reset();
+    void Add(TraceStage stage, unsigned long us);
+    unsigned long Percentile(TraceStage stage, float p); // limite superiore della fascia che contiene il percentile p (0..100)
+    unsigned long Count(TraceStage stage);
+    unsigned long Max(TraceStage stage);
+    void PrintReport(Print &out);
+    static const char* StageName(TraceStage stage);
+    static int Bucket(unsigned long us);
+    static unsigned long BucketLimit(int bucket);
+  private:
+    unsigned long _histogram[TRACE_STAGES][TRACE_BUCKETS];
+    unsigned long _count[TRACE_STAGES];
+    unsigned long _max[TRACE_STAGES];
+};
+
+#endif